@@ -6,22 +6,79 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include <mutex>
+
 #include "prelude.h"
 
-void allocate_arena_chain_link(struct qxc_memory_pool* pool)
+// Released arenas are kept around for the next pool instead of going back to the
+// system, so later translation units (and compile server jobs) start with warm,
+// already faulted-in memory. Arenas are handed out zeroed, like fresh calloc memory.
+#define QXC_MAX_RETAINED_ARENA_BYTES (64 << 20)
+
+static std::mutex s_retained_arenas_lock;
+static struct qxc_memory_arena_chain* s_retained_arenas = nullptr;
+static size_t s_retained_arena_bytes = 0;
+
+static size_t arena_size(const struct qxc_memory_arena_chain* arena)
+{
+    return (size_t)(arena->end - arena->start);
+}
+
+static struct qxc_memory_arena_chain* take_retained_arena(size_t size)
+{
+    std::lock_guard<std::mutex> guard(s_retained_arenas_lock);
+
+    struct qxc_memory_arena_chain** link = &s_retained_arenas;
+    while (*link && arena_size(*link) != size) {
+        link = &(*link)->prev_link;
+    }
+
+    struct qxc_memory_arena_chain* arena = *link;
+    if (arena) {
+        *link = arena->prev_link;
+        s_retained_arena_bytes -= size;
+    }
+    return arena;
+}
+
+// false if the arena should be freed instead
+static bool retain_arena(struct qxc_memory_arena_chain* arena)
+{
+    std::lock_guard<std::mutex> guard(s_retained_arenas_lock);
+
+    if (s_retained_arena_bytes + arena_size(arena) > QXC_MAX_RETAINED_ARENA_BYTES) {
+        return false;
+    }
+
+    memset(arena->start, 0, (size_t)(arena->bump_ptr - arena->start));
+    arena->prev_link = s_retained_arenas;
+    s_retained_arenas = arena;
+    s_retained_arena_bytes += arena_size(arena);
+    return true;
+}
+
+static void allocate_arena_of_size(struct qxc_memory_pool* pool, size_t size)
 {
     struct qxc_memory_arena_chain* old_tip = pool->chain_tip;
 
-    auto new_tip = static_cast<struct qxc_memory_arena_chain*>(
-        malloc(sizeof(struct qxc_memory_arena_chain)));
-    new_tip->start = static_cast<uint8_t*>(calloc(pool->arena_size, 1));
-    new_tip->end = new_tip->start + pool->arena_size;
+    struct qxc_memory_arena_chain* new_tip = take_retained_arena(size);
+    if (new_tip == nullptr) {
+        new_tip = static_cast<struct qxc_memory_arena_chain*>(
+            malloc(sizeof(struct qxc_memory_arena_chain)));
+        new_tip->start = static_cast<uint8_t*>(calloc(size, 1));
+        new_tip->end = new_tip->start + size;
+    }
     new_tip->bump_ptr = new_tip->start;
     new_tip->prev_link = old_tip;
 
     pool->chain_tip = new_tip;
 }
 
+void allocate_arena_chain_link(struct qxc_memory_pool* pool)
+{
+    allocate_arena_of_size(pool, pool->arena_size);
+}
+
 struct qxc_memory_pool* qxc_memory_pool_init(size_t arena_size_bytes)
 {
     struct qxc_memory_pool* new_pool =
@@ -34,6 +91,11 @@ struct qxc_memory_pool* qxc_memory_pool_init(size_t arena_size_bytes)
 
 char* qxc_malloc_str(struct qxc_memory_pool* pool, size_t bytes)
 {
+    // too big for any regular arena, so it gets one of its own
+    if (bytes >= pool->arena_size) {
+        allocate_arena_of_size(pool, bytes + 1);
+    }
+
     struct qxc_memory_arena_chain* tip = pool->chain_tip;
 
     // TODO: exit condition for failure
@@ -56,8 +118,10 @@ void qxc_memory_pool_release(struct qxc_memory_pool* pool)
     while (tip) {
         struct qxc_memory_arena_chain* old_tip = tip;
         tip = tip->prev_link;
-        free(old_tip->start);
-        free(old_tip);
+        if (!retain_arena(old_tip)) {
+            free(old_tip->start);
+            free(old_tip);
+        }
     }
 
     free(pool);
@@ -41,3 +41,13 @@ T* qxc_malloc(struct qxc_memory_pool* pool, Args&&... args)
     }
 }
 
+// count value initialized elements, of any total size
+template <typename T>
+T* qxc_malloc_array(struct qxc_memory_pool* pool, size_t count)
+{
+    T* array = (T*)qxc_malloc_str(pool, count * sizeof(T));
+    for (size_t i = 0; i < count; i++) {
+        new (&array[i]) T();
+    }
+    return array;
+}
@@ -55,6 +55,16 @@ DynArray<T, N> array_create(void)
     return arr;
 }
 
+// initialize an array in place. Unlike array_create, this is safe for arrays living
+// inside other objects, since the data pointer refers to this array's own stack storage
+template <typename T, size_t N>
+void array_init(DynArray<T, N>* arr)
+{
+    arr->data = arr->stack_data;
+    arr->length = 0;
+    arr->capacity = N;
+}
+
 template <typename T>
 DynArray<T, 0> heap_array_create(size_t initial_capacity = 0)
 {
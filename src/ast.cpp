@@ -9,14 +9,24 @@
 #include "prelude.h"
 #include "pretty_print_ast.h"
 #include "token.h"
+#include "trace.h"
 
-// <program> ::= <function>
-// <function> ::= "int" <id> "(" ")" "{" { <block-item> } "}"
+// <program> ::= { <function> | <declaration> }
+// <function> ::= "int" <id> "(" [ "int" <id> { "," "int" <id> } ] ")"
+//                ( "{" { <block-item> } "}" | ";" )
 // <block-item> ::= <statement> | <declaration>
 // <declaration> ::= "int" <id> [ = <exp> ] ";"
 // <statement> ::= "return" <exp> ";"
 //               | <exp> ";"
 //               | "if" "(" <exp> ")" <statement> [ "else" <statement> ]
+//               | "{" { <block-item> } "}"
+//               | "for" "(" [ <exp> ] ";" [ <exp> ] ";" [ <exp> ] ")" <statement>
+//               | "for" "(" <declaration> [ <exp> ] ";" [ <exp> ] ")" <statement>
+//               | "while" "(" <exp> ")" <statement>
+//               | "do" <statement> "while" "(" <exp> ")" ";"
+//               | "break" ";"
+//               | "continue" ";"
+//               | ";"
 //
 // <exp> ::= <id> "=" <exp> | <conditional-exp>
 // <conditional-exp> ::= <logical-or-exp> [ "?" <exp> ":" <conditional-exp> ]
@@ -26,21 +36,26 @@
 // <relational-exp> ::= <additive-exp> { ("<" | ">" | "<=" | ">=") <additive-exp> }
 // <additive-exp> ::= <term> { ("+" | "-") <term> }
 // <term> ::= <factor> { ("*" | "/") <factor> }
-// <factor> ::= "(" <exp> ")" | <unary_op> <factor> | <int> | <id>
+// <factor> ::= <function-call> | "(" <exp> ")" | <unary_op> <factor> | <int> | <id>
+// <function-call> ::= <id> "(" [ <exp> { "," <exp> } ] ")"
 // <unary_op> ::= "!" | "~" | "-"
 
 struct Parser {
     DynHeapArray<Token> token_buffer;
     struct qxc_memory_pool* pool;
     size_t itoken;
+    const char* filepath;
+    int max_nesting_depth;
 };
 
-static Parser parser_create(void)
+static Parser parser_create(const char* filepath, const CompileOptions* options)
 {
     Parser parser;
     parser.pool = qxc_memory_pool_init(10e3);
     parser.token_buffer = heap_array_create<Token>(0);
     parser.itoken = 0;
+    parser.filepath = filepath;
+    parser.max_nesting_depth = options->max_nesting_depth;
     return parser;
 }
 
@@ -98,6 +113,19 @@ static Token* expect_token_type(Parser* parser, TokenType expected_token_type)
     return next_token;
 }
 
+static bool next_token_is(Parser* parser, TokenType token_type)
+{
+    Token* next_token = peek_next_token(parser);
+    return next_token && next_token->type == token_type;
+}
+
+static bool next_token_is_keyword(Parser* parser, Keyword keyword)
+{
+    Token* next_token = peek_next_token(parser);
+    return next_token && next_token->type == TokenType::KeyWord &&
+           next_token->keyword == keyword;
+}
+
 static Token* expect_keyword(Parser* parser, Keyword expected_keyword)
 {
     Token* next_token = pop_next_token(parser);
@@ -110,17 +138,6 @@ static Token* expect_keyword(Parser* parser, Keyword expected_keyword)
     return next_token;
 }
 
-static Token* expect_identifier(Parser* parser, const char* expected_identifier)
-{
-    Token* next_token = pop_next_token(parser);
-
-    EXPECT(next_token && next_token->type == TokenType::Identifier &&
-               strs_are_equal(next_token->name, expected_identifier),
-           "Expected identifier");
-
-    return next_token;
-}
-
 // static Token* expect_operator(Parser* parser,
 //                                                     Operator expected_op)
 // {
@@ -133,213 +150,371 @@ static Token* expect_identifier(Parser* parser, const char* expected_identifier)
 //     return next_token;
 // }
 
-static struct ExprNode* parse_expression(Parser*);
-
-static struct ExprNode* parse_factor(Parser* parser)
+// Nesting only costs heap memory, the limit is there to turn runaway generated input
+// into a diagnostic. depth counts the groups and statements open at token.
+static bool nesting_within_limit(Parser* parser, const Token* token, size_t depth)
 {
-    auto factor = qxc_malloc<struct ExprNode>(parser->pool);
+    if (depth <= (size_t)parser->max_nesting_depth) return true;
 
-    Token* next_token = pop_next_token(parser);
-    EXPECT_(next_token);
-
-    switch (next_token->type) {
-        case TokenType::IntLiteral:
-            debug_print("parsed integer literal factor: %ld",
-                        next_token->int_literal_value);
-            factor->type = ExprType::IntLiteral;
-            factor->literal = next_token->int_literal_value;
-            break;
+    fprintf(stderr, "%s:%d:%d: nesting deeper than %d levels, see --max-nesting-depth\n",
+            parser->filepath, token->line, token->column, parser->max_nesting_depth);
+    return false;
+}
 
-        case TokenType::Operator:
-            EXPECT(operator_can_be_unary(next_token->op),
-                   "non-unary operator in unary operator context: %s",
-                   operator_to_str(next_token->op));
-            factor->type = ExprType::UnaryOp;
-            factor->unop_expr.op = next_token->op;
-            factor->unop_expr.child_expr = parse_factor(parser);
-            EXPECT(factor->unop_expr.child_expr,
-                   "Failed to parse child expression of unary operator");
-            break;
+// the token buffer doesn't outlive the parser, so names are copied into the pool
+static const char* copy_identifier(Parser* parser, const Token* token)
+{
+    const size_t id_len = strlen(token->name) + 1;  // includes \0 terminator
+    char* name = qxc_malloc_str(parser->pool, id_len);
+    memcpy(name, token->name, id_len);
+    return name;
+}
 
-        case TokenType::OpenParen:
-            debug_print("attempting to parse paren closed expression...");
-            factor = parse_expression(parser);
+// --------------------------------------------------------------------------------
+// expressions
+//
+// Operator precedence parsing driven by the table below, with an explicit stack in
+// place of recursion: nesting depth of generated code only costs heap memory. The
+// parser alternates between expecting an operand and expecting an operator. Pending
+// prefix and infix operators wait on the stack until an operator binding less tightly
+// (or a closing token) shows up, at which point they are reduced into nodes. Groups
+// that are closed by a token, parentheses, call arguments and the middle of ?:, sit
+// on the stack as markers that only their closing token removes.
+
+enum class Associativity { Left, Right };
+
+enum class InfixKind { None, Binary, Assignment, Conditional };
+
+struct OperatorInfo {
+    bool prefix;
+    InfixKind infix;
+    int precedence;  // of the infix form, higher binds tighter
+    Associativity associativity;
+};
 
-            EXPECT(factor, "failed to parse paren-closed expression");
+// binds tighter than every infix operator
+#define QXC_PREFIX_PRECEDENCE 14
+
+// indexed by Operator. Colon and Comma only ever close a group, so they are not infix.
+static constexpr OperatorInfo s_operator_table[] = {
+    /* Minus */ {true, InfixKind::Binary, 12, Associativity::Left},
+    /* Plus */ {false, InfixKind::Binary, 12, Associativity::Left},
+    /* Divide */ {false, InfixKind::Binary, 13, Associativity::Left},
+    /* Multiply */ {false, InfixKind::Binary, 13, Associativity::Left},
+    /* LogicalNegation */ {true, InfixKind::None, 0, Associativity::Left},
+    /* Complement */ {true, InfixKind::None, 0, Associativity::Left},
+    /* LogicalAND */ {false, InfixKind::Binary, 5, Associativity::Left},
+    /* LogicalOR */ {false, InfixKind::Binary, 4, Associativity::Left},
+    /* EqualTo */ {false, InfixKind::Binary, 9, Associativity::Left},
+    /* NotEqualTo */ {false, InfixKind::Binary, 9, Associativity::Left},
+    /* Colon */ {false, InfixKind::None, 0, Associativity::Left},
+    /* QuestionMark */ {false, InfixKind::Conditional, 3, Associativity::Right},
+    /* LessThan */ {false, InfixKind::Binary, 10, Associativity::Left},
+    /* LessThanOrEqualTo */ {false, InfixKind::Binary, 10, Associativity::Left},
+    /* GreaterThan */ {false, InfixKind::Binary, 10, Associativity::Left},
+    /* GreaterThanOrEqualTo */ {false, InfixKind::Binary, 10, Associativity::Left},
+    /* Assignment */ {false, InfixKind::Assignment, 2, Associativity::Right},
+    /* Comma */ {false, InfixKind::None, 0, Associativity::Left},
+    /* BitwiseOR */ {false, InfixKind::Binary, 6, Associativity::Left},
+    /* BitwiseAND */ {false, InfixKind::Binary, 8, Associativity::Left},
+    /* BitwiseXOR */ {false, InfixKind::Binary, 7, Associativity::Left},
+    /* BitShiftLeft */ {false, InfixKind::Binary, 11, Associativity::Left},
+    /* BitShiftRight */ {false, InfixKind::Binary, 11, Associativity::Left},
+    /* Percent */ {false, InfixKind::Binary, 13, Associativity::Left},
+    /* AddAssign */ {false, InfixKind::Assignment, 2, Associativity::Right},
+    /* SubtractAssign */ {false, InfixKind::Assignment, 2, Associativity::Right},
+    /* MultiplyAssign */ {false, InfixKind::Assignment, 2, Associativity::Right},
+    /* DivideAssign */ {false, InfixKind::Assignment, 2, Associativity::Right},
+    /* ModuloAssign */ {false, InfixKind::Assignment, 2, Associativity::Right},
+    /* ShiftLeftAssign */ {false, InfixKind::Assignment, 2, Associativity::Right},
+    /* ShiftRightAssign */ {false, InfixKind::Assignment, 2, Associativity::Right},
+    /* AndAssign */ {false, InfixKind::Assignment, 2, Associativity::Right},
+    /* OrAssign */ {false, InfixKind::Assignment, 2, Associativity::Right},
+    /* XorAssign */ {false, InfixKind::Assignment, 2, Associativity::Right},
+    /* Increment */ {true, InfixKind::None, 0, Associativity::Left},  // also postfix
+    /* Decrement */ {true, InfixKind::None, 0, Associativity::Left},
+    /* Invalid */ {false, InfixKind::None, 0, Associativity::Left},
+};
+static_assert(sizeof(s_operator_table) / sizeof(s_operator_table[0]) ==
+                  (size_t)Operator::Invalid + 1,
+              "operator table out of sync with Operator");
+
+static const OperatorInfo& operator_info(Operator op) { return s_operator_table[(int)op]; }
+
+enum class PendingType {
+    Prefix,         // op waiting for its operand
+    Infix,          // left op waiting for the right operand
+    ConditionElse,  // cond ? then : waiting for the else operand
+    Paren,          // ( waiting for )
+    CallArgs,       // name( arg, ... waiting for , or )
+    ConditionThen   // cond ? waiting for :
+};
 
-            EXPECT(expect_token_type(parser, TokenType::CloseParen),
-                   "Missing close parenthesis after enclosed factor");
+struct PendingOperator {
+    PendingType type;
+    Operator op;
+    int precedence;    // 0 for groups, which only their closing token reduces
+    ExprNode* left;    // left operand, or the condition of ?:
+    ExprNode* middle;  // then operand of ?:
+    CallExpr* call;
+};
 
-            debug_print("found close paren for enclosed expression");
+static PendingOperator pending(PendingType type, Operator op, int precedence,
+                               ExprNode* left)
+{
+    PendingOperator entry;
+    entry.type = type;
+    entry.op = op;
+    entry.precedence = precedence;
+    entry.left = left;
+    entry.middle = nullptr;
+    entry.call = nullptr;
+    return entry;
+}
 
+// folds the operator on top of the stack and its operands into one node
+static ExprNode* reduce(Parser* parser, const PendingOperator& top, ExprNode* operand)
+{
+    ExprNode* node = qxc_malloc<ExprNode>(parser->pool);
+
+    switch (top.type) {
+        case PendingType::Prefix:
+            node->type = ExprType::UnaryOp;
+            node->branches = operand->branches;
+            node->unop_expr.op = top.op;
+            node->unop_expr.child_expr = operand;
+            node->unop_expr.postfix = false;
             break;
-
-        case TokenType::Identifier:
-            factor->type = ExprType::VariableRef;
-            factor->referenced_var_name = next_token->name;
+        case PendingType::Infix:
+            node->type = ExprType::BinaryOp;
+            node->branches = top.op == Operator::LogicalOR || top.op == Operator::LogicalAND ||
+                             top.left->branches || operand->branches;
+            node->binop_expr.op = top.op;
+            node->binop_expr.left_expr = top.left;
+            node->binop_expr.right_expr = operand;
+            break;
+        case PendingType::ConditionElse:
+            node->type = ExprType::Conditional;
+            node->branches = true;
+            node->cond_expr.conditional_expr = top.left;
+            node->cond_expr.if_expr = top.middle;
+            node->cond_expr.else_expr = operand;
             break;
-
         default:
-            return nullptr;
+            QXC_UNREACHABLE();
     }
 
-    return factor;
+    return node;
 }
 
-// TODO: clean this up and handle all errors with informative print statements
-static int binop_precedence(Operator op)
+static bool is_increment_or_decrement(Operator op)
 {
-    switch (op) {
-        case Operator::Minus:
-            return 12;
-        case Operator::Plus:
-            return 12;
-        case Operator::Divide:
-            return 13;
-        case Operator::Multiply:
-            return 13;
-        case Operator::LogicalAND:
-            return 5;
-        case Operator::LogicalOR:
-            return 4;
-        case Operator::EqualTo:
-            return 9;
-        case Operator::NotEqualTo:
-            return 9;
-        case Operator::Colon:
-            return 3;
-        case Operator::QuestionMark:
-            return 3;
-        case Operator::LessThan:
-            return 10;
-        case Operator::LessThanOrEqualTo:
-            return 10;
-        case Operator::GreaterThan:
-            return 10;
-        case Operator::GreaterThanOrEqualTo:
-            return 10;
-        case Operator::Assignment:
-            return 2;
-        case Operator::Comma:
-            return 1;
-        case Operator::BitwiseOR:
-            return 6;
-        case Operator::BitwiseAND:
-            return 8;
-        case Operator::BitwiseXOR:
-            return 7;
-        case Operator::BitShiftLeft:
-            return 11;
-        case Operator::BitShiftRight:
-            return 11;
-        case Operator::Percent:
-            return 13;
-        case Operator::Invalid:
-            return -999;
-        default:
-            QXC_UNREACHABLE();
-    }
+    return op == Operator::Increment || op == Operator::Decrement;
 }
 
-static bool binop_valid_for_logical_or_expr_or_below(Operator op)
+static bool push_pending(Parser* parser, DynHeapArray<PendingOperator>* stack,
+                         const PendingOperator& entry, const Token* token)
 {
-    return binop_precedence(op) > 3;
+    array_append(stack, entry);
+    return nesting_within_limit(parser, token, stack->length);
 }
 
-// remember, if things get wonky you can re-write the parser explicitely for each
-// production rule in the grammar
-static struct ExprNode* parse_logical_or_expr_(Parser* parser, ExprNode* left_factor,
-                                               int min_precedence)
+// an operand, leaving the stack with whatever prefix operators and groups precede it
+static ExprNode* parse_operand(Parser* parser, DynHeapArray<PendingOperator>* stack)
 {
-    Token* next_token = peek_next_token(parser);
-    EXPECT_(next_token);
-
-    while (next_token->type == TokenType::Operator &&
-           binop_valid_for_logical_or_expr_or_below(next_token->op)) {
-        EXPECT(next_token->op != Operator::Assignment,
-               "assignment operator in invalid place!");
-        const int next_op_precedence = binop_precedence(next_token->op);
-
-        if (next_op_precedence <= min_precedence) {
-            break;
+    while (true) {
+        Token* next_token = pop_next_token(parser);
+        EXPECT(next_token, "Unexpected end of input in expression");
+
+        switch (next_token->type) {
+            case TokenType::IntLiteral: {
+                TRACE_DEBUG(TraceCategory::Parser, "parsed integer literal factor: %ld",
+                            next_token->int_literal_value);
+                ExprNode* literal = qxc_malloc<ExprNode>(parser->pool);
+                literal->type = ExprType::IntLiteral;
+                literal->literal = next_token->int_literal_value;
+                return literal;
+            }
+
+            case TokenType::Operator:
+                EXPECT(operator_info(next_token->op).prefix,
+                       "non-unary operator in unary operator context: %s",
+                       operator_to_str(next_token->op));
+                EXPECT_(push_pending(parser, stack,
+                                     pending(PendingType::Prefix, next_token->op,
+                                             QXC_PREFIX_PRECEDENCE, nullptr),
+                                     next_token));
+                break;
+
+            case TokenType::OpenParen:
+                EXPECT_(push_pending(parser, stack,
+                                     pending(PendingType::Paren, Operator::Invalid, 0, nullptr),
+                                     next_token));
+                break;
+
+            case TokenType::Identifier: {
+                const char* name = copy_identifier(parser, next_token);
+
+                if (!next_token_is(parser, TokenType::OpenParen)) {
+                    ExprNode* var_ref = qxc_malloc<ExprNode>(parser->pool);
+                    var_ref->type = ExprType::VariableRef;
+                    var_ref->referenced_var_name = name;
+                    return var_ref;
+                }
+
+                (void)pop_next_token(parser);
+                CallExpr* call = qxc_malloc<CallExpr>(parser->pool);
+                call->function_name = name;
+                array_init(&call->args);
+
+                if (next_token_is(parser, TokenType::CloseParen)) {
+                    (void)pop_next_token(parser);
+                    ExprNode* call_node = qxc_malloc<ExprNode>(parser->pool);
+                    call_node->type = ExprType::FunctionCall;
+                    call_node->call_expr = call;
+                    return call_node;
+                }
+
+                PendingOperator args = pending(PendingType::CallArgs, Operator::Invalid, 0,
+                                               nullptr);
+                args.call = call;
+                EXPECT_(push_pending(parser, stack, args, next_token));
+                break;
+            }
+
+            default:
+                EXPECT(false, "Expected an expression");
         }
-
-        next_token = pop_next_token(parser);
-        struct ExprNode* right_expr =
-            parse_logical_or_expr_(parser, parse_factor(parser), next_op_precedence);
-        EXPECT_(right_expr);
-
-        ExprNode* new_expr = qxc_malloc<ExprNode>(parser->pool);
-        new_expr->type = ExprType::BinaryOp;
-        new_expr->binop_expr.op = next_token->op;
-        new_expr->binop_expr.left_expr = left_factor;
-        new_expr->binop_expr.right_expr = right_expr;
-
-        left_factor = new_expr;
-
-        next_token = peek_next_token(parser);
-        EXPECT_(next_token);
     }
-
-    return left_factor;
 }
 
-static struct ExprNode* parse_logical_or_expr(Parser* parser,
-                                              struct ExprNode* left_factor)
+static bool is_operator_token(const Token* token, Operator op)
 {
-    return parse_logical_or_expr_(parser, left_factor, -1);
+    return token && token->type == TokenType::Operator && token->op == op;
 }
 
-static struct ExprNode* parse_conditional_expression(Parser* parser,
-                                                     struct ExprNode* left_factor)
+// an assignment expression, which is everything but the comma operator
+static struct ExprNode* parse_expression(Parser* parser)
 {
-    struct ExprNode* lor_expr = parse_logical_or_expr(parser, left_factor);
+    DynHeapArray<PendingOperator> stack = heap_array_create<PendingOperator>(16);
+    defer { array_free(&stack); };
 
-    Token* next_token = peek_next_token(parser);
-    EXPECT_(next_token);
+    ExprNode* operand = parse_operand(parser, &stack);
+    EXPECT_(operand);
 
-    if (next_token->op == Operator::QuestionMark) {
-        (void)pop_next_token(parser);
+    while (true) {
+        Token* next_token = peek_next_token(parser);
 
-        struct ExprNode* ternary_expr = qxc_malloc<ExprNode>(parser->pool);
-        ternary_expr->type = ExprType::Conditional;
-        ternary_expr->cond_expr.conditional_expr = lor_expr;
-        ternary_expr->cond_expr.if_expr = parse_expression(parser);
-        (void)pop_next_token(parser);
-        ternary_expr->cond_expr.else_expr =
-            parse_conditional_expression(parser, parse_factor(parser));
+        // postfix ++ and -- bind tighter than anything pending
+        if (next_token && next_token->type == TokenType::Operator &&
+            is_increment_or_decrement(next_token->op)) {
+            (void)pop_next_token(parser);
+            EXPECT(operand->type == ExprType::VariableRef,
+                   "operand of postfix %s must be a variable reference",
+                   operator_to_str(next_token->op));
 
-        return ternary_expr;
-    }
-    else {
-        return lor_expr;
-    }
-}
+            ExprNode* node = qxc_malloc<ExprNode>(parser->pool);
+            node->type = ExprType::UnaryOp;
+            node->unop_expr.op = next_token->op;
+            node->unop_expr.child_expr = operand;
+            node->unop_expr.postfix = true;
+            operand = node;
+            continue;
+        }
 
-static struct ExprNode* parse_expression(Parser* parser)
-{
-    struct ExprNode* left_factor = parse_factor(parser);
-    EXPECT_(left_factor);
+        const bool is_infix = next_token && next_token->type == TokenType::Operator &&
+                              operator_info(next_token->op).infix != InfixKind::None;
 
-    Token* next_token = peek_next_token(parser);
-    EXPECT_(next_token);
+        // everything binding tighter than what comes next is complete. Tokens that
+        // aren't infix operators end an operand, reducing down to the innermost group.
+        int precedence = 0;
+        Associativity associativity = Associativity::Left;
+        if (is_infix) {
+            precedence = operator_info(next_token->op).precedence;
+            associativity = operator_info(next_token->op).associativity;
+        }
 
-    // assignment operator is right-associative, so special treatment here
-    if (next_token->op == Operator::Assignment) {
-        EXPECT(left_factor->type == ExprType::VariableRef,
-               "left hand side of assignment operator must be a variable reference!");
-        (void)pop_next_token(parser);
+        while (stack.length > 0) {
+            const PendingOperator& top = stack[stack.length - 1];
+            const bool binds_tighter =
+                top.precedence > precedence ||
+                (top.precedence == precedence && associativity == Associativity::Left);
+            if (top.precedence == 0 || !binds_tighter) break;
+
+            EXPECT(top.type != PendingType::Prefix || !is_increment_or_decrement(top.op) ||
+                       operand->type == ExprType::VariableRef,
+                   "operand of %s must be a variable reference", operator_to_str(top.op));
+            operand = reduce(parser, top, operand);
+            stack.length--;
+        }
 
-        struct ExprNode* assign_expr = qxc_malloc<ExprNode>(parser->pool);
-        assign_expr->type = ExprType::BinaryOp;
-        assign_expr->binop_expr.op = Operator::Assignment;
-        assign_expr->binop_expr.left_expr = left_factor;
-        assign_expr->binop_expr.right_expr = parse_expression(parser);
+        PendingOperator* group = stack.length > 0 ? &stack[stack.length - 1] : nullptr;
+
+        if (is_infix) {
+            (void)pop_next_token(parser);
+            const Operator op = next_token->op;
+
+            PendingOperator entry;
+            switch (operator_info(op).infix) {
+                case InfixKind::Assignment:
+                    EXPECT(operand->type == ExprType::VariableRef,
+                           "left hand side of assignment operator must be a variable "
+                           "reference!");
+                    entry = pending(PendingType::Infix, op, precedence, operand);
+                    break;
+                case InfixKind::Conditional:
+                    entry = pending(PendingType::ConditionThen, op, 0, operand);
+                    break;
+                case InfixKind::Binary:
+                    entry = pending(PendingType::Infix, op, precedence, operand);
+                    break;
+                default:
+                    QXC_UNREACHABLE();
+            }
+            EXPECT_(push_pending(parser, &stack, entry, next_token));
+        }
+        else if (group && group->type == PendingType::ConditionThen &&
+                 is_operator_token(next_token, Operator::Colon)) {
+            (void)pop_next_token(parser);
+            group->type = PendingType::ConditionElse;
+            group->precedence = operator_info(Operator::QuestionMark).precedence;
+            group->middle = operand;
+        }
+        else if (group && group->type == PendingType::Paren &&
+                 next_token_is(parser, TokenType::CloseParen)) {
+            (void)pop_next_token(parser);
+            stack.length--;
+            continue;  // the parenthesized expression is an operand of its own
+        }
+        else if (group && group->type == PendingType::CallArgs &&
+                 (next_token_is(parser, TokenType::Comma) ||
+                  next_token_is(parser, TokenType::CloseParen))) {
+            array_append(&group->call->args, operand);
+
+            if (pop_next_token(parser)->type == TokenType::CloseParen) {
+                operand = qxc_malloc<ExprNode>(parser->pool);
+                operand->type = ExprType::FunctionCall;
+                operand->call_expr = group->call;
+                for (ExprNode* arg : group->call->args) {
+                    operand->branches |= arg->branches;
+                }
+                stack.length--;
+                continue;
+            }
+        }
+        else {
+            // whatever follows belongs to the enclosing statement
+            EXPECT(group == nullptr || group->type != PendingType::Paren,
+                   "Missing close parenthesis after enclosed expression");
+            EXPECT(group == nullptr || group->type != PendingType::CallArgs,
+                   "Missing close parenthesis after arguments of call to: %s",
+                   group->call->function_name);
+            EXPECT(group == nullptr, "Missing ':' in conditional expression");
+            return operand;
+        }
 
-        return assign_expr;
-    }
-    else {
-        return parse_conditional_expression(parser, left_factor);
+        operand = parse_operand(parser, &stack);
+        EXPECT_(operand);
     }
 }
 
@@ -354,7 +529,8 @@ static Declaration* parse_declaration(Parser* parser)
     EXPECT(next_token && next_token->type == TokenType::Identifier,
            "Invalid identifier found for variable declaration name");
 
-    debug_print("parsing declaration of int var: %s", next_token->name);
+    TRACE_DEBUG(TraceCategory::Parser, "parsing declaration of int var: %s",
+                next_token->name);
 
     const size_t id_len = strlen(next_token->name) + 1;  // includes \0 terminator
     new_declaration->var_name = qxc_malloc_str(parser->pool, id_len);
@@ -377,11 +553,64 @@ static Declaration* parse_declaration(Parser* parser)
 
 static BlockItemNode* parse_block_item(Parser* parser);
 
-static StatementNode* parse_statement(Parser* parser)
+// parses an expression up to, and including, the terminator token. The expression
+// is optional, *expr is left nullptr if it's missing.
+static Token* parse_optional_expression(Parser* parser, ExprNode** expr, TokenType terminator)
+{
+    if (!next_token_is(parser, terminator)) {
+        *expr = parse_expression(parser);
+        EXPECT(*expr, "Failed to parse expression");
+    }
+
+    return expect_token_type(parser, terminator);
+}
+
+// everything up to the body, which is left to parse_statement
+static ForStatement* parse_for_header(Parser* parser)
+{
+    ForStatement* for_stmt = qxc_malloc<ForStatement>(parser->pool);
+
+    EXPECT(expect_token_type(parser, TokenType::OpenParen),
+           "Missing open parenthesis after for");
+
+    if (next_token_is_keyword(parser, Keyword::Int)) {
+        for_stmt->init_decl = parse_declaration(parser);
+        EXPECT_(for_stmt->init_decl);
+    }
+    else {
+        EXPECT(parse_optional_expression(parser, &for_stmt->init_expr, TokenType::SemiColon),
+               "Invalid initial clause in for loop");
+    }
+
+    EXPECT(parse_optional_expression(parser, &for_stmt->condition_expr, TokenType::SemiColon),
+           "Invalid condition in for loop");
+    EXPECT(parse_optional_expression(parser, &for_stmt->post_expr, TokenType::CloseParen),
+           "Invalid post expression in for loop");
+
+    return for_stmt;
+}
+
+static ExprNode* parse_loop_condition(Parser* parser)
+{
+    EXPECT(expect_token_type(parser, TokenType::OpenParen),
+           "Missing open parenthesis before loop condition");
+    ExprNode* condition_expr = parse_expression(parser);
+    EXPECT(condition_expr, "Failed to parse loop condition");
+    EXPECT(expect_token_type(parser, TokenType::CloseParen),
+           "Missing close parenthesis after loop condition");
+    return condition_expr;
+}
+
+// A whole statement, or only the opening part of one containing further statements:
+// the header of if/for/while/switch, a case label, "do" or "{". Those come back with *is_open set, their
+// nested statements are then parsed by parse_statement.
+static StatementNode* parse_statement_head(Parser* parser, bool* is_open)
 {
     Token* next_token = peek_next_token(parser);
+    EXPECT(next_token, "Expected statement");
 
     auto statement = qxc_malloc<StatementNode>(parser->pool);
+    *is_open = false;
 
     if (next_token->type == TokenType::KeyWord &&
         next_token->keyword == Keyword::Return) {
@@ -401,40 +630,91 @@ static StatementNode* parse_statement(Parser* parser)
         IfElseStatement* ifelse_stmt = qxc_malloc<IfElseStatement>(parser->pool);
         ifelse_stmt->conditional_expr = parse_expression(parser);
         EXPECT_(ifelse_stmt->conditional_expr);
-        ifelse_stmt->if_branch_statement = parse_statement(parser);
-        EXPECT_(ifelse_stmt->if_branch_statement);
         statement->ifelse_statement = ifelse_stmt;
-
-        next_token = peek_next_token(parser);
-
-        if (next_token && next_token->type == TokenType::KeyWord &&
-            next_token->keyword == Keyword::Else) {
-            (void)pop_next_token(parser);  // pop off 'else' keyword
-            ifelse_stmt->else_branch_statement = parse_statement(parser);
-            EXPECT_(ifelse_stmt->else_branch_statement);
+        *is_open = true;
+    }
+    else if (next_token->type == TokenType::KeyWord &&
+             next_token->keyword == Keyword::For) {
+        (void)pop_next_token(parser);  // pop off 'for' keyword
+        statement->type = StatementType::For;
+        statement->for_statement = parse_for_header(parser);
+        EXPECT_(statement->for_statement);
+        *is_open = true;
+    }
+    else if (next_token->type == TokenType::KeyWord &&
+             next_token->keyword == Keyword::While) {
+        (void)pop_next_token(parser);  // pop off 'while' keyword
+        statement->type = StatementType::While;
+
+        WhileStatement* while_stmt = qxc_malloc<WhileStatement>(parser->pool);
+        while_stmt->condition_expr = parse_loop_condition(parser);
+        EXPECT_(while_stmt->condition_expr);
+        statement->while_statement = while_stmt;
+        *is_open = true;
+    }
+    else if (next_token->type == TokenType::KeyWord &&
+             next_token->keyword == Keyword::Do) {
+        (void)pop_next_token(parser);  // pop off 'do' keyword
+        statement->type = StatementType::DoWhile;
+        statement->while_statement = qxc_malloc<WhileStatement>(parser->pool);
+        *is_open = true;
+    }
+    else if (next_token->type == TokenType::KeyWord &&
+             next_token->keyword == Keyword::Switch) {
+        (void)pop_next_token(parser);  // pop off 'switch' keyword
+        statement->type = StatementType::Switch;
+
+        SwitchStatement* switch_stmt = qxc_malloc<SwitchStatement>(parser->pool);
+        EXPECT(expect_token_type(parser, TokenType::OpenParen),
+               "Missing open parenthesis before switch expression");
+        switch_stmt->controlling_expr = parse_expression(parser);
+        EXPECT(switch_stmt->controlling_expr, "Failed to parse switch expression");
+        EXPECT(expect_token_type(parser, TokenType::CloseParen),
+               "Missing close parenthesis after switch expression");
+        statement->switch_statement = switch_stmt;
+        *is_open = true;
+    }
+    else if (next_token->type == TokenType::KeyWord &&
+             (next_token->keyword == Keyword::Case ||
+              next_token->keyword == Keyword::Default)) {
+        (void)pop_next_token(parser);  // pop off 'case'/'default' keyword
+        statement->type = StatementType::Case;
+
+        CaseStatement* case_stmt = qxc_malloc<CaseStatement>(parser->pool);
+        if (next_token->keyword == Keyword::Case) {
+            case_stmt->value_expr = parse_expression(parser);
+            EXPECT(case_stmt->value_expr, "Failed to parse case value");
         }
+        EXPECT(is_operator_token(pop_next_token(parser), Operator::Colon),
+               "Missing colon after %s label", keyword_to_str(next_token->keyword));
+        statement->case_statement = case_stmt;
+        *is_open = true;
+    }
+    else if (next_token->type == TokenType::KeyWord &&
+             (next_token->keyword == Keyword::Break ||
+              next_token->keyword == Keyword::Continue)) {
+        (void)pop_next_token(parser);  // pop off 'break'/'continue' keyword
+        statement->type = next_token->keyword == Keyword::Break ? StatementType::Break
+                                                                : StatementType::Continue;
+
+        EXPECT(expect_token_type(parser, TokenType::SemiColon),
+               "Missing semicolon at end of statement");
+    }
+    else if (next_token->type == TokenType::SemiColon) {
+        (void)pop_next_token(parser);  // pop off ';'
+        statement->type = StatementType::Null;
     }
     else if (next_token->type == TokenType::OpenBrace) {
-        (void)pop_next_token(parser);  // pop off 'if' keyword
+        (void)pop_next_token(parser);  // pop off '{'
         statement->type = StatementType::Compound;
-
-        // TODO: abstract out to parse_block_item_list
-        statement->block_items = array_create<BlockItemNode*, 8>();
-        while (peek_next_token(parser)->type != TokenType::CloseBrace) {
-            BlockItemNode* next_block_item = parse_block_item(parser);
-            EXPECT(next_block_item, "Failed to parse block item in function: main");
-            array_append(&statement->block_items, next_block_item);
-            debug_print("successfully parsed block item");
-        }
-
-        EXPECT(expect_token_type(parser, TokenType::CloseBrace),
-               "Missing closing brace at end of compound statement");
+        array_init(&statement->block_items);
+        *is_open = true;
     }
     else {
         // fallthrough, so attempt to parse standalone expression statement
         // for now the only meaningful stand-alone expression is variable assignment
         // i.e. a = 2;
-        debug_print("attempting to parse standalone expression");
+        TRACE_DEBUG(TraceCategory::Parser, "attempting to parse standalone expression");
         struct ExprNode* standalone_expression = parse_expression(parser);
 
         EXPECT(standalone_expression, "Failed to parse standalone expression");
@@ -449,6 +729,130 @@ static StatementNode* parse_statement(Parser* parser)
     return statement;
 }
 
+// a statement waiting for the statements nested in it
+struct OpenStatement {
+    StatementNode* statement;
+    bool in_else_branch;  // if statements get a second nested statement
+};
+
+// Statements nesting statements are kept on an explicit stack while their contents
+// are parsed, so generated decision trees nest as deep as memory (and the nesting
+// limit) allows. Whenever a statement is complete it is handed to the innermost open
+// statement, which then either completes too or asks for its next nested statement.
+static StatementNode* parse_statement(Parser* parser)
+{
+    DynHeapArray<OpenStatement> stack = heap_array_create<OpenStatement>(16);
+    defer { array_free(&stack); };
+
+    while (true) {
+        StatementNode* complete = nullptr;
+        OpenStatement* open = stack.length > 0 ? &stack[stack.length - 1] : nullptr;
+
+        if (open && open->statement->type == StatementType::Compound &&
+            !next_token_is_keyword(parser, Keyword::Int)) {
+            EXPECT(peek_next_token(parser),
+                   "Missing closing brace at end of compound statement");
+
+            if (next_token_is(parser, TokenType::CloseBrace)) {
+                (void)pop_next_token(parser);
+                complete = open->statement;
+                stack.length--;
+            }
+        }
+        else if (open && open->statement->type == StatementType::Compound) {
+            BlockItemNode* declaration_item = parse_block_item(parser);
+            EXPECT(declaration_item, "Failed to parse block item in compound statement");
+            array_append(&open->statement->block_items, declaration_item);
+            continue;
+        }
+
+        if (complete == nullptr) {
+            Token* head_token = peek_next_token(parser);
+            bool is_open = false;
+            StatementNode* statement = parse_statement_head(parser, &is_open);
+            EXPECT_(statement);
+
+            if (is_open) {
+                OpenStatement entry;
+                entry.statement = statement;
+                entry.in_else_branch = false;
+                array_append(&stack, entry);
+                EXPECT_(nesting_within_limit(parser, head_token, stack.length));
+                continue;
+            }
+            complete = statement;
+        }
+
+        // hand the complete statement to the statements it is nested in, completing
+        // them in turn where it was their last nested statement
+        while (complete != nullptr) {
+            if (stack.length == 0) return complete;
+
+            open = &stack[stack.length - 1];
+            StatementNode* parent = open->statement;
+
+            switch (parent->type) {
+                case StatementType::Compound: {
+                    BlockItemNode* item = qxc_malloc<BlockItemNode>(parser->pool);
+                    item->type = BlockItemType::Statement;
+                    item->statement = complete;
+                    array_append(&parent->block_items, item);
+                    TRACE_DEBUG(TraceCategory::Parser, "successfully parsed block item");
+                    complete = nullptr;
+                    continue;
+                }
+
+                case StatementType::IfElse:
+                    if (!open->in_else_branch) {
+                        parent->ifelse_statement->if_branch_statement = complete;
+                        if (next_token_is_keyword(parser, Keyword::Else)) {
+                            (void)pop_next_token(parser);  // pop off 'else' keyword
+                            open->in_else_branch = true;
+                            complete = nullptr;
+                            continue;
+                        }
+                    }
+                    else {
+                        parent->ifelse_statement->else_branch_statement = complete;
+                    }
+                    break;
+
+                case StatementType::For:
+                    parent->for_statement->body_statement = complete;
+                    break;
+
+                case StatementType::While:
+                    parent->while_statement->body_statement = complete;
+                    break;
+
+                case StatementType::Switch:
+                    parent->switch_statement->body_statement = complete;
+                    break;
+
+                case StatementType::Case:
+                    parent->case_statement->statement = complete;
+                    break;
+
+                case StatementType::DoWhile:
+                    parent->while_statement->body_statement = complete;
+                    EXPECT(expect_keyword(parser, Keyword::While),
+                           "Missing while after do body");
+                    parent->while_statement->condition_expr = parse_loop_condition(parser);
+                    EXPECT_(parent->while_statement->condition_expr);
+                    EXPECT(expect_token_type(parser, TokenType::SemiColon),
+                           "Missing semicolon at end of do-while statement");
+                    break;
+
+                default:
+                    QXC_UNREACHABLE();
+            }
+
+            complete = parent;
+            stack.length--;
+        }
+    }
+}
+
 static BlockItemNode* parse_block_item(Parser* parser)
 {
     Token* next_token = peek_next_token(parser);
@@ -473,50 +877,97 @@ static BlockItemNode* parse_block_item(Parser* parser)
 static FunctionDecl* parse_function_decl(Parser* parser)
 {
     EXPECT(expect_keyword(parser, Keyword::Int),
-           "Invalid main type signature, must return int.");
+           "Invalid function type signature, must return int.");
 
-    EXPECT(expect_identifier(parser, "main"), "Invalid main function name");
+    Token* name_token = pop_next_token(parser);
+    EXPECT(name_token && name_token->type == TokenType::Identifier,
+           "Invalid identifier found for function name");
+
+    FunctionDecl* decl = qxc_malloc<FunctionDecl>(parser->pool);
+    decl->name = copy_identifier(parser, name_token);
+    array_init(&decl->param_names);
+    array_init(&decl->block_items);
 
     EXPECT(expect_token_type(parser, TokenType::OpenParen), "Missing open parenthesis");
 
-    // arg parsing would go here, if we allowed function arguments yet
+    if (!next_token_is(parser, TokenType::CloseParen)) {
+        do {
+            EXPECT(expect_keyword(parser, Keyword::Int), "Parameters must be of type int");
+            Token* param_token = pop_next_token(parser);
+            EXPECT(param_token && param_token->type == TokenType::Identifier,
+                   "Invalid identifier found for parameter of function: %s", decl->name);
+            array_append(&decl->param_names, copy_identifier(parser, param_token));
+        } while (next_token_is(parser, TokenType::Comma) && pop_next_token(parser));
+    }
 
     EXPECT(expect_token_type(parser, TokenType::CloseParen), "Missing close parenthesis");
 
-    EXPECT(expect_token_type(parser, TokenType::OpenBrace), "Missing open brace token");
+    if (next_token_is(parser, TokenType::SemiColon)) {
+        (void)pop_next_token(parser);  // forward declaration, no body
+        return decl;
+    }
 
-    FunctionDecl* decl = qxc_malloc<FunctionDecl>(parser->pool);
-    decl->name = "main";
+    EXPECT(expect_token_type(parser, TokenType::OpenBrace), "Missing open brace token");
+    decl->is_definition = true;
 
-    while (peek_next_token(parser)->type != TokenType::CloseBrace) {
+    while (peek_next_token(parser) && !next_token_is(parser, TokenType::CloseBrace)) {
         BlockItemNode* next_block_item = parse_block_item(parser);
-        EXPECT(next_block_item, "Failed to parse block item in function: main");
+        EXPECT(next_block_item, "Failed to parse block item in function: %s", decl->name);
         array_append(&decl->block_items, next_block_item);
-        debug_print("successfully parsed block item");
+        TRACE_DEBUG(TraceCategory::Parser, "successfully parsed block item");
     }
 
     EXPECT(expect_token_type(parser, TokenType::CloseBrace),
-           "Missing close brace token at end of function: main");
+           "Missing close brace token at end of function: %s", decl->name);
 
     return decl;
 }
 
-Program* parse_program(const char* filepath)
+// both start with "int" <id>, a function is followed by its parameter list
+static TopLevelItem* parse_top_level_item(Parser* parser)
 {
-    Parser parser = parser_create();
+    TopLevelItem* item = qxc_malloc<TopLevelItem>(parser->pool);
+
+    const size_t paren_index = parser->itoken + 2;
+    const bool is_function = paren_index < parser->token_buffer.length &&
+                             parser->token_buffer[paren_index].type == TokenType::OpenParen;
+
+    if (is_function) {
+        item->type = TopLevelType::Function;
+        item->function_decl = parse_function_decl(parser);
+        EXPECT_(item->function_decl);
+    }
+    else {
+        EXPECT(next_token_is_keyword(parser, Keyword::Int),
+               "Invalid type for global variable, must be int.");
+        item->type = TopLevelType::Variable;
+        item->var_decl = parse_declaration(parser);
+        EXPECT_(item->var_decl);
+    }
+
+    return item;
+}
+
+Program* parse_program(const char* filepath, const CompileOptions* options)
+{
+    TRACE_SPAN(TraceCategory::Parser, "parse");
+
+    Parser parser = parser_create(filepath, options);
     defer { parser_destroy(&parser); };
 
     if (tokenize(&parser.token_buffer, filepath) != 0) {
         return nullptr;
     }
 
-    FunctionDecl* main_decl = parse_function_decl(&parser);
-
-    EXPECT(main_decl, "Failed to parse main function declaration");
-
     auto program = qxc_malloc<Program>(parser.pool);
-    program->main_decl = main_decl;
+    array_init(&program->items);
     program->pool = parser.pool;
 
+    while (peek_next_token(&parser) != nullptr) {
+        TopLevelItem* item = parse_top_level_item(&parser);
+        EXPECT(item, "Failed to parse function or global variable declaration");
+        array_append(&program->items, item);
+    }
+
     return program;
 }
@@ -2,16 +2,26 @@
 
 #include "allocator.h"
 #include "array.h"
+#include "options.h"
 #include "prelude.h"
 #include "token.h"
 
 // --------------------------------------------------------------------------------
 
-enum class ExprType { IntLiteral, UnaryOp, BinaryOp, VariableRef, Conditional, Invalid };
+enum class ExprType {
+    IntLiteral,
+    UnaryOp,
+    BinaryOp,
+    VariableRef,
+    Conditional,
+    FunctionCall,
+    Invalid
+};
 
 struct UnopExpr {
     Operator op = Operator::Invalid;
     struct ExprNode* child_expr = nullptr;
+    bool postfix = false;  // x++ rather than ++x
 };
 
 struct BinopExpr {
@@ -26,14 +36,21 @@ struct CondExpr {
     struct ExprNode* else_expr = nullptr;
 };
 
+struct CallExpr {
+    const char* function_name = nullptr;
+    DynArray<struct ExprNode*, 6> args;
+};
+
 struct ExprNode {
     ExprType type = ExprType::Invalid;
+    bool branches = false;  // contains &&, || or ?:, so evaluating it takes branches
 
     union {
         long literal;
         struct UnopExpr unop_expr;
         struct BinopExpr binop_expr;
         struct CondExpr cond_expr;
+        struct CallExpr* call_expr;
         const char* referenced_var_name;
     };
 
@@ -42,9 +59,24 @@ struct ExprNode {
 
 // --------------------------------------------------------------------------------
 
-enum class StatementType { Return, StandAloneExpr, IfElse, Compound, Invalid };
+enum class StatementType {
+    Return,
+    StandAloneExpr,
+    Null,
+    IfElse,
+    Compound,
+    For,
+    While,
+    DoWhile,
+    Break,
+    Continue,
+    Switch,
+    Case,  // also default, which has no value_expr
+    Invalid
+};
 
 struct StatementNode;
+struct Declaration;
 
 struct IfElseStatement {
     ExprNode* conditional_expr = nullptr;
@@ -52,6 +84,33 @@ struct IfElseStatement {
     StatementNode* else_branch_statement = nullptr;  // optional, may be nullptr
 };
 
+// for (init; condition; post) body, any of the three clauses may be missing
+struct ForStatement {
+    Declaration* init_decl = nullptr;  // at most one of init_decl and init_expr is set
+    ExprNode* init_expr = nullptr;
+    ExprNode* condition_expr = nullptr;  // nullptr means loop forever
+    ExprNode* post_expr = nullptr;
+    StatementNode* body_statement = nullptr;
+};
+
+// while (condition) body, or do body while (condition);
+struct WhileStatement {
+    ExprNode* condition_expr = nullptr;
+    StatementNode* body_statement = nullptr;
+};
+
+// switch (controlling) body, with the case labels somewhere inside body
+struct SwitchStatement {
+    ExprNode* controlling_expr = nullptr;
+    StatementNode* body_statement = nullptr;
+};
+
+// case value: statement, or default: statement
+struct CaseStatement {
+    ExprNode* value_expr = nullptr;  // nullptr for default
+    StatementNode* statement = nullptr;
+};
+
 struct BlockItemNode;
 
 struct StatementNode {
@@ -60,6 +119,10 @@ struct StatementNode {
     union {
         ExprNode* return_expr;
         IfElseStatement* ifelse_statement;
+        ForStatement* for_statement;
+        WhileStatement* while_statement;
+        SwitchStatement* switch_statement;
+        CaseStatement* case_statement;
         DynArray<BlockItemNode*, 8> block_items;
         ExprNode* standalone_expr;
     };
@@ -91,15 +154,28 @@ struct BlockItemNode {
 
 struct FunctionDecl {
     const char* name = nullptr;
+    DynArray<const char*, 6> param_names;
+    bool is_definition = false;  // false for a forward declaration without a body
     DynArray<BlockItemNode*, 16> block_items;
 };
 
 // --------------------------------------------------------------------------------
 
+enum class TopLevelType { Function, Variable, Invalid };
+
+struct TopLevelItem {
+    TopLevelType type = TopLevelType::Invalid;
+
+    union {
+        FunctionDecl* function_decl;
+        Declaration* var_decl;  // file-scope variable
+    };
+};
+
 struct Program {  // program
-    FunctionDecl* main_decl = nullptr;
+    DynArray<TopLevelItem*, 8> items;  // in source order
     struct qxc_memory_pool* pool = nullptr;
 };
 
-Program* parse_program(const char* filepath);
+Program* parse_program(const char* filepath, const CompileOptions* options);
 
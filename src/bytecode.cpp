@@ -0,0 +1,1000 @@
+#include "bytecode.h"
+
+#include <dlfcn.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "prelude.h"
+#include "trace.h"
+
+// frames beyond this many registers in total count as a stack overflow, the native
+// stack would have run out long before
+#define QXC_BYTECODE_MAX_REGISTERS (1L << 24)
+
+// external functions get all System V argument registers, whatever they expect
+#define QXC_BYTECODE_MAX_EXTERNAL_ARGS 6
+
+static const char* const s_op_names[] = {
+    "imm",         "move",         "neg",         "not",          "lnot",
+    "add",         "sub",          "mul",         "div",          "mod",
+    "and",         "or",           "xor",         "shl",          "shr",
+    "eq",
+    "ne",          "lt",           "le",          "gt",           "ge",
+    "select",
+    "load_global", "store_global", "call",        "call_external", "jump",
+    "branch",      "branch_eq",    "branch_ne",   "branch_lt",    "branch_le",
+    "branch_gt",   "branch_ge",    "jump_table",  "switch",       "return"};
+
+static_assert(sizeof(s_op_names) / sizeof(s_op_names[0]) == (size_t)BytecodeOp::Count,
+              "every bytecode op needs a name");
+
+// --------------------------------------------------------------------------------
+// lowering from IR
+
+// functions and globals of all units, sorted by name for lookups
+struct BytecodeSymbol {
+    const char* name;
+    bool is_global;
+    long index;
+};
+
+struct BytecodeLowering {
+    BytecodeProgram* program;
+    DynHeapArray<BytecodeSymbol> symbols;
+
+    // per function
+    IRFunction* fn;
+    long global_base;                   // of the unit fn belongs to
+    DynHeapArray<int> use_counts;       // indexed by vreg
+    DynHeapArray<size_t> block_offsets;  // indexed by block id
+    DynHeapArray<size_t> target_refs;   // code words holding a block id for now
+    DynHeapArray<int32_t> args;         // registers of the pending call's arguments
+};
+
+static int compare_symbols(const void* a, const void* b)
+{
+    return strcmp(((const BytecodeSymbol*)a)->name, ((const BytecodeSymbol*)b)->name);
+}
+
+static const BytecodeSymbol* find_symbol(BytecodeLowering* lowering, const char* name)
+{
+    BytecodeSymbol key;
+    key.name = name;
+    return (const BytecodeSymbol*)bsearch(&key, lowering->symbols.begin(),
+                                          lowering->symbols.length, sizeof(BytecodeSymbol),
+                                          compare_symbols);
+}
+
+static void put(BytecodeLowering* lowering, long word)
+{
+    array_append(&lowering->program->code, (int32_t)word);
+}
+
+static void put_op(BytecodeLowering* lowering, BytecodeOp op) { put(lowering, (long)op); }
+
+// 64 bit values take two words, low half first
+static void put_long(BytecodeLowering* lowering, long value)
+{
+    put(lowering, (long)(uint32_t)((unsigned long)value & 0xffffffff));
+    put(lowering, (long)(uint32_t)((unsigned long)value >> 32));
+}
+
+static long long_operand(const int32_t* words)
+{
+    return (long)(((unsigned long)(uint32_t)words[1] << 32) | (uint32_t)words[0]);
+}
+
+static void put_target(BytecodeLowering* lowering, IRBlock* block)
+{
+    array_append(&lowering->target_refs, lowering->program->code.length);
+    put(lowering, block->id);
+}
+
+static long param_register(long index) { return index; }
+
+static long vreg_register(BytecodeLowering* lowering, int vreg)
+{
+    assert(vreg >= 0);
+    return lowering->fn->param_count + vreg;
+}
+
+static long slot_register(BytecodeLowering* lowering, long slot)
+{
+    return lowering->fn->param_count + lowering->fn->vreg_count + slot;
+}
+
+static BytecodeOp unary_op(IROpcode opcode)
+{
+    switch (opcode) {
+        case IROpcode::Neg:
+            return BytecodeOp::Neg;
+        case IROpcode::Not:
+            return BytecodeOp::Not;
+        case IROpcode::LogicalNot:
+            return BytecodeOp::LogicalNot;
+        default:
+            QXC_UNREACHABLE();
+            return BytecodeOp::Count;
+    }
+}
+
+static BytecodeOp binary_op(IROpcode opcode)
+{
+    switch (opcode) {
+        case IROpcode::Add:
+            return BytecodeOp::Add;
+        case IROpcode::Sub:
+            return BytecodeOp::Sub;
+        case IROpcode::Mul:
+            return BytecodeOp::Mul;
+        case IROpcode::Div:
+            return BytecodeOp::Div;
+        case IROpcode::Mod:
+            return BytecodeOp::Mod;
+        case IROpcode::And:
+            return BytecodeOp::And;
+        case IROpcode::Or:
+            return BytecodeOp::Or;
+        case IROpcode::Xor:
+            return BytecodeOp::Xor;
+        case IROpcode::Shl:
+            return BytecodeOp::ShiftLeft;
+        case IROpcode::Shr:
+            return BytecodeOp::ShiftRight;
+        case IROpcode::Equal:
+            return BytecodeOp::Equal;
+        case IROpcode::NotEqual:
+            return BytecodeOp::NotEqual;
+        case IROpcode::LessThan:
+            return BytecodeOp::LessThan;
+        case IROpcode::LessEqual:
+            return BytecodeOp::LessEqual;
+        case IROpcode::GreaterThan:
+            return BytecodeOp::GreaterThan;
+        case IROpcode::GreaterEqual:
+            return BytecodeOp::GreaterEqual;
+        default:
+            QXC_UNREACHABLE();
+            return BytecodeOp::Count;
+    }
+}
+
+static bool is_comparison(IROpcode opcode)
+{
+    return opcode >= IROpcode::Equal && opcode <= IROpcode::GreaterEqual;
+}
+
+// the fused compare-and-branch op for a comparison, laid out in the same order
+static BytecodeOp compare_branch_op(IROpcode opcode)
+{
+    return (BytecodeOp)((int)BytecodeOp::BranchEqual + ((int)opcode - (int)IROpcode::Equal));
+}
+
+// a comparison only feeding the branch right after it, which then tests the operands
+// itself, like the x86 backend fuses cmp and jcc
+static bool fuses_with_branch(BytecodeLowering* lowering, IRInstr* instr, IRInstr* next)
+{
+    return next && is_comparison(instr->opcode) && next->opcode == IROpcode::Branch &&
+           next->args[0] == instr->dst && lowering->use_counts[(size_t)instr->dst] == 1;
+}
+
+static long external_index(BytecodeLowering* lowering, const char* name)
+{
+    BytecodeProgram* program = lowering->program;
+    for (size_t i = 0; i < program->externals.length; i++) {
+        if (strs_are_equal(program->externals[i].name, name)) return (long)i;
+    }
+
+    void* address = dlsym(RTLD_DEFAULT, name);
+    if (address == nullptr) {
+        fprintf(stderr, "undefined reference to `%s'\n", name);
+        return -1;
+    }
+
+    BytecodeExternal external;
+    external.name = name;
+    external.address = address;
+    array_append(&program->externals, external);
+    return (long)program->externals.length - 1;
+}
+
+static int lower_call(BytecodeLowering* lowering, IRInstr* instr)
+{
+    const BytecodeSymbol* symbol = find_symbol(lowering, instr->callee);
+    long callee = 0;
+
+    if (symbol && !symbol->is_global) {
+        put_op(lowering, BytecodeOp::Call);
+        callee = symbol->index;
+    }
+    else {
+        if (instr->imm > QXC_BYTECODE_MAX_EXTERNAL_ARGS) {
+            fprintf(stderr, "%s: external functions take at most %d arguments when interpreted\n",
+                    instr->callee, QXC_BYTECODE_MAX_EXTERNAL_ARGS);
+            return -1;
+        }
+        callee = external_index(lowering, instr->callee);
+        if (callee < 0) return -1;
+        put_op(lowering, BytecodeOp::CallExternal);
+    }
+
+    put(lowering, vreg_register(lowering, instr->dst));
+    put(lowering, callee);
+    put(lowering, instr->imm);
+    for (long i = 0; i < instr->imm; i++) {
+        put(lowering, lowering->args[(size_t)i]);
+    }
+    return 0;
+}
+
+// a table lookup where the cases are dense enough, like the x86 backend, else a
+// binary search
+static void lower_switch(BytecodeLowering* lowering, IRInstr* instr)
+{
+    const IRSwitchCase* cases = instr->cases;
+    const size_t count = (size_t)instr->imm;
+
+    if (ir_switch_cases_are_dense(cases, count)) {
+        const unsigned long min = (unsigned long)cases[0].value;
+        const unsigned long entries = (unsigned long)cases[count - 1].value - min + 1;
+
+        put_op(lowering, BytecodeOp::JumpTable);
+        put(lowering, vreg_register(lowering, instr->args[0]));
+        put_long(lowering, cases[0].value);
+        put(lowering, (long)entries);
+        put_target(lowering, instr->targets[0]);
+
+        size_t next_case = 0;
+        for (unsigned long entry = 0; entry < entries; entry++) {
+            IRBlock* target = instr->targets[0];
+            if ((unsigned long)cases[next_case].value - min == entry) {
+                target = cases[next_case++].target;
+            }
+            put_target(lowering, target);
+        }
+        return;
+    }
+
+    put_op(lowering, BytecodeOp::Switch);
+    put(lowering, vreg_register(lowering, instr->args[0]));
+    put(lowering, (long)count);
+    put_target(lowering, instr->targets[0]);
+    for (size_t i = 0; i < count; i++) {
+        put_long(lowering, cases[i].value);
+        put_target(lowering, cases[i].target);
+    }
+}
+
+static int lower_instr(BytecodeLowering* lowering, IRInstr* instr)
+{
+    switch (instr->opcode) {
+        case IROpcode::Const:
+            put_op(lowering, BytecodeOp::Imm);
+            put(lowering, vreg_register(lowering, instr->dst));
+            put_long(lowering, instr->imm);
+            break;
+
+        case IROpcode::Neg:
+        case IROpcode::Not:
+        case IROpcode::LogicalNot:
+            put_op(lowering, unary_op(instr->opcode));
+            put(lowering, vreg_register(lowering, instr->dst));
+            put(lowering, vreg_register(lowering, instr->args[0]));
+            break;
+
+        case IROpcode::Add:
+        case IROpcode::Sub:
+        case IROpcode::Mul:
+        case IROpcode::Div:
+        case IROpcode::Mod:
+        case IROpcode::And:
+        case IROpcode::Or:
+        case IROpcode::Xor:
+        case IROpcode::Shl:
+        case IROpcode::Shr:
+        case IROpcode::Equal:
+        case IROpcode::NotEqual:
+        case IROpcode::LessThan:
+        case IROpcode::LessEqual:
+        case IROpcode::GreaterThan:
+        case IROpcode::GreaterEqual:
+            put_op(lowering, binary_op(instr->opcode));
+            put(lowering, vreg_register(lowering, instr->dst));
+            put(lowering, vreg_register(lowering, instr->args[0]));
+            put(lowering, vreg_register(lowering, instr->args[1]));
+            break;
+
+        case IROpcode::Select:
+            put_op(lowering, BytecodeOp::Select);
+            put(lowering, vreg_register(lowering, instr->dst));
+            for (int arg : instr->args) {
+                put(lowering, vreg_register(lowering, arg));
+            }
+            break;
+
+        case IROpcode::Load:
+            put_op(lowering, BytecodeOp::Move);
+            put(lowering, vreg_register(lowering, instr->dst));
+            put(lowering, slot_register(lowering, instr->imm));
+            break;
+
+        case IROpcode::Store:
+            put_op(lowering, BytecodeOp::Move);
+            put(lowering, slot_register(lowering, instr->imm));
+            put(lowering, vreg_register(lowering, instr->args[0]));
+            break;
+
+        case IROpcode::LoadGlobal:
+            put_op(lowering, BytecodeOp::LoadGlobal);
+            put(lowering, vreg_register(lowering, instr->dst));
+            put(lowering, lowering->global_base + instr->imm);
+            break;
+
+        case IROpcode::StoreGlobal:
+            put_op(lowering, BytecodeOp::StoreGlobal);
+            put(lowering, lowering->global_base + instr->imm);
+            put(lowering, vreg_register(lowering, instr->args[0]));
+            break;
+
+        case IROpcode::Param:
+            put_op(lowering, BytecodeOp::Move);
+            put(lowering, vreg_register(lowering, instr->dst));
+            put(lowering, param_register(instr->imm));
+            break;
+
+        // Args run right before their Call, which takes the registers as operands
+        case IROpcode::Arg:
+            while (lowering->args.length <= (size_t)instr->imm) {
+                array_append(&lowering->args, 0);
+            }
+            lowering->args[(size_t)instr->imm] =
+                (int32_t)vreg_register(lowering, instr->args[0]);
+            break;
+
+        case IROpcode::Call:
+            return lower_call(lowering, instr);
+
+        case IROpcode::Jump:
+            put_op(lowering, BytecodeOp::Jump);
+            put_target(lowering, instr->targets[0]);
+            break;
+
+        case IROpcode::Branch:
+            put_op(lowering, BytecodeOp::Branch);
+            put(lowering, vreg_register(lowering, instr->args[0]));
+            put_target(lowering, instr->targets[0]);
+            put_target(lowering, instr->targets[1]);
+            break;
+
+        case IROpcode::Switch:
+            lower_switch(lowering, instr);
+            break;
+
+        case IROpcode::Return:
+            put_op(lowering, BytecodeOp::Return);
+            put(lowering, vreg_register(lowering, instr->args[0]));
+            break;
+
+        default:
+            QXC_UNREACHABLE();
+            break;
+    }
+
+    return 0;
+}
+
+static int lower_function(BytecodeLowering* lowering, IRFunction* fn, BytecodeFunction* out)
+{
+    BytecodeProgram* program = lowering->program;
+    lowering->fn = fn;
+
+    array_clear(&lowering->use_counts);
+    for (int i = 0; i < fn->vreg_count; i++) {
+        array_append(&lowering->use_counts, 0);
+    }
+    for (IRBlock* block : fn->blocks) {
+        for (const IRInstr& instr : block->instrs) {
+            for (int arg : instr.args) {
+                if (arg >= 0) lowering->use_counts[(size_t)arg]++;
+            }
+        }
+    }
+
+    out->entry = program->code.length;
+    array_clear(&lowering->block_offsets);
+    array_clear(&lowering->target_refs);
+
+    for (IRBlock* block : fn->blocks) {
+        while (lowering->block_offsets.length <= (size_t)block->id) {
+            array_append(&lowering->block_offsets, (size_t)0);
+        }
+        lowering->block_offsets[(size_t)block->id] = program->code.length;
+
+        for (size_t i = 0; i < block->instrs.length; i++) {
+            IRInstr* instr = &block->instrs[i];
+            IRInstr* next = i + 1 < block->instrs.length ? &block->instrs[i + 1] : nullptr;
+
+            if (fuses_with_branch(lowering, instr, next)) {
+                put_op(lowering, compare_branch_op(instr->opcode));
+                put(lowering, vreg_register(lowering, instr->args[0]));
+                put(lowering, vreg_register(lowering, instr->args[1]));
+                put_target(lowering, next->targets[0]);
+                put_target(lowering, next->targets[1]);
+                break;
+            }
+
+            if (lower_instr(lowering, instr) != 0) return -1;
+        }
+    }
+
+    for (size_t ref : lowering->target_refs) {
+        const size_t block_id = (size_t)program->code[ref];
+        program->code[ref] = (int32_t)lowering->block_offsets[block_id];
+    }
+
+    return 0;
+}
+
+BytecodeProgram* bytecode_compile(IRProgram* const* programs, size_t program_count)
+{
+    TRACE_SPAN(TraceCategory::Codegen, "bytecode");
+
+    BytecodeProgram* program = (BytecodeProgram*)malloc(sizeof(BytecodeProgram));
+    program->code = heap_array_create<int32_t>(0);
+    program->functions = heap_array_create<BytecodeFunction>(0);
+    program->externals = heap_array_create<BytecodeExternal>(0);
+    program->globals = heap_array_create<long>(0);
+    program->main_function = -1;
+
+    BytecodeLowering lowering;
+    lowering.program = program;
+    lowering.symbols = heap_array_create<BytecodeSymbol>(0);
+    lowering.fn = nullptr;
+    lowering.global_base = 0;
+    lowering.use_counts = heap_array_create<int>(0);
+    lowering.block_offsets = heap_array_create<size_t>(0);
+    lowering.target_refs = heap_array_create<size_t>(0);
+    lowering.args = heap_array_create<int32_t>(0);
+    defer {
+        array_free(&lowering.symbols);
+        array_free(&lowering.use_counts);
+        array_free(&lowering.block_offsets);
+        array_free(&lowering.target_refs);
+        array_free(&lowering.args);
+    };
+
+    for (size_t p = 0; p < program_count; p++) {
+        for (IRFunction* fn : programs[p]->functions) {
+            BytecodeSymbol symbol;
+            symbol.name = fn->name;
+            symbol.is_global = false;
+            symbol.index = (long)program->functions.length;
+            array_append(&lowering.symbols, symbol);
+
+            BytecodeFunction function;
+            function.name = fn->name;
+            function.param_count = fn->param_count;
+            function.register_count = fn->param_count + fn->vreg_count + fn->slot_count;
+            function.entry = 0;
+            array_append(&program->functions, function);
+        }
+        for (const IRGlobal& global : programs[p]->globals) {
+            BytecodeSymbol symbol;
+            symbol.name = global.name;
+            symbol.is_global = true;
+            symbol.index = (long)program->globals.length;
+            array_append(&lowering.symbols, symbol);
+            array_append(&program->globals, global.value);
+        }
+    }
+
+    qsort(lowering.symbols.begin(), lowering.symbols.length, sizeof(BytecodeSymbol),
+          compare_symbols);
+    for (size_t i = 1; i < lowering.symbols.length; i++) {
+        if (strs_are_equal(lowering.symbols[i - 1].name, lowering.symbols[i].name)) {
+            fprintf(stderr, "multiple definition of `%s'\n", lowering.symbols[i].name);
+            bytecode_program_free(program);
+            return nullptr;
+        }
+    }
+
+    const BytecodeSymbol* main_symbol = find_symbol(&lowering, "main");
+    if (main_symbol == nullptr || main_symbol->is_global) {
+        fprintf(stderr, "undefined reference to `main'\n");
+        bytecode_program_free(program);
+        return nullptr;
+    }
+    program->main_function = main_symbol->index;
+
+    size_t function_index = 0;
+    for (size_t p = 0; p < program_count; p++) {
+        for (IRFunction* fn : programs[p]->functions) {
+            if (lower_function(&lowering, fn, &program->functions[function_index++]) != 0) {
+                bytecode_program_free(program);
+                return nullptr;
+            }
+        }
+        lowering.global_base += (long)programs[p]->globals.length;
+    }
+
+    return program;
+}
+
+void bytecode_program_free(BytecodeProgram* program)
+{
+    array_free(&program->code);
+    array_free(&program->functions);
+    array_free(&program->externals);
+    array_free(&program->globals);
+    free(program);
+}
+
+// --------------------------------------------------------------------------------
+// printing
+
+// words taken by the instruction at code[pc], operands included
+static size_t instr_length(const int32_t* code, size_t pc)
+{
+    switch ((BytecodeOp)code[pc]) {
+        case BytecodeOp::Jump:
+        case BytecodeOp::Return:
+            return 2;
+        case BytecodeOp::Move:
+        case BytecodeOp::Neg:
+        case BytecodeOp::Not:
+        case BytecodeOp::LogicalNot:
+        case BytecodeOp::LoadGlobal:
+        case BytecodeOp::StoreGlobal:
+            return 3;
+        case BytecodeOp::Imm:
+        case BytecodeOp::Add:
+        case BytecodeOp::Sub:
+        case BytecodeOp::Mul:
+        case BytecodeOp::Div:
+        case BytecodeOp::Mod:
+        case BytecodeOp::And:
+        case BytecodeOp::Or:
+        case BytecodeOp::Xor:
+        case BytecodeOp::ShiftLeft:
+        case BytecodeOp::ShiftRight:
+        case BytecodeOp::Equal:
+        case BytecodeOp::NotEqual:
+        case BytecodeOp::LessThan:
+        case BytecodeOp::LessEqual:
+        case BytecodeOp::GreaterThan:
+        case BytecodeOp::GreaterEqual:
+        case BytecodeOp::Branch:
+            return 4;
+        case BytecodeOp::BranchEqual:
+        case BytecodeOp::BranchNotEqual:
+        case BytecodeOp::BranchLessThan:
+        case BytecodeOp::BranchLessEqual:
+        case BytecodeOp::BranchGreaterThan:
+        case BytecodeOp::BranchGreaterEqual:
+        case BytecodeOp::Select:
+            return 5;
+        case BytecodeOp::Call:
+        case BytecodeOp::CallExternal:
+            return 4 + (size_t)code[pc + 3];
+        case BytecodeOp::JumpTable:
+            return 6 + (size_t)code[pc + 4];
+        case BytecodeOp::Switch:
+            return 4 + 3 * (size_t)code[pc + 2];
+        default:
+            QXC_UNREACHABLE();
+            return 0;
+    }
+}
+
+static void print_instr(BytecodeProgram* program, size_t pc)
+{
+    const int32_t* code = program->code.begin();
+    const BytecodeOp op = (BytecodeOp)code[pc];
+    printf("  %5zu: %-13s ", pc, s_op_names[(int)op]);
+
+    switch (op) {
+        case BytecodeOp::Imm:
+            printf("r%d, %ld\n", code[pc + 1], long_operand(code + pc + 2));
+            return;
+        case BytecodeOp::LoadGlobal:
+            printf("r%d, @%d\n", code[pc + 1], code[pc + 2]);
+            return;
+        case BytecodeOp::StoreGlobal:
+            printf("@%d, r%d\n", code[pc + 1], code[pc + 2]);
+            return;
+        case BytecodeOp::Call:
+        case BytecodeOp::CallExternal: {
+            const char* callee = op == BytecodeOp::Call
+                                     ? program->functions[(size_t)code[pc + 2]].name
+                                     : program->externals[(size_t)code[pc + 2]].name;
+            printf("r%d, %s(", code[pc + 1], callee);
+            for (int32_t i = 0; i < code[pc + 3]; i++) {
+                printf(i == 0 ? "r%d" : ", r%d", code[pc + 4 + (size_t)i]);
+            }
+            printf(")\n");
+            return;
+        }
+        case BytecodeOp::Jump:
+            printf("%d\n", code[pc + 1]);
+            return;
+        case BytecodeOp::Branch:
+            printf("r%d, %d, %d\n", code[pc + 1], code[pc + 2], code[pc + 3]);
+            return;
+        case BytecodeOp::BranchEqual:
+        case BytecodeOp::BranchNotEqual:
+        case BytecodeOp::BranchLessThan:
+        case BytecodeOp::BranchLessEqual:
+        case BytecodeOp::BranchGreaterThan:
+        case BytecodeOp::BranchGreaterEqual:
+            printf("r%d, r%d, %d, %d\n", code[pc + 1], code[pc + 2], code[pc + 3],
+                   code[pc + 4]);
+            return;
+        case BytecodeOp::JumpTable:
+            printf("r%d, %ld, default %d, [", code[pc + 1], long_operand(code + pc + 2),
+                   code[pc + 5]);
+            for (int32_t i = 0; i < code[pc + 4]; i++) {
+                printf(i == 0 ? "%d" : ", %d", code[pc + 6 + (size_t)i]);
+            }
+            printf("]\n");
+            return;
+        case BytecodeOp::Switch:
+            printf("r%d, default %d, [", code[pc + 1], code[pc + 3]);
+            for (int32_t i = 0; i < code[pc + 2]; i++) {
+                const int32_t* entry = code + pc + 4 + 3 * (size_t)i;
+                printf(i == 0 ? "%ld: %d" : ", %ld: %d", long_operand(entry), entry[2]);
+            }
+            printf("]\n");
+            return;
+        default:
+            break;
+    }
+
+    // everything else only has register operands
+    const size_t length = instr_length(code, pc);
+    for (size_t i = 1; i < length; i++) {
+        printf(i == 1 ? "r%d" : ", r%d", code[pc + i]);
+    }
+    printf("\n");
+}
+
+void bytecode_print_program(BytecodeProgram* program)
+{
+    for (size_t i = 0; i < program->globals.length; i++) {
+        printf("global @%zu = %ld\n", i, program->globals[i]);
+    }
+    if (program->globals.length > 0) printf("\n");
+
+    for (size_t f = 0; f < program->functions.length; f++) {
+        const BytecodeFunction& fn = program->functions[f];
+        const size_t end = f + 1 < program->functions.length ? program->functions[f + 1].entry
+                                                              : program->code.length;
+
+        printf("function %s (params: %d, registers: %d)\n", fn.name, fn.param_count,
+               fn.register_count);
+        for (size_t pc = fn.entry; pc < end; pc += instr_length(program->code.begin(), pc)) {
+            print_instr(program, pc);
+        }
+        printf("\n");
+    }
+}
+
+// --------------------------------------------------------------------------------
+// interpreter
+//
+// Threaded: every handler ends by jumping straight to the handler of the next
+// instruction through a table of label addresses (GCC's computed goto), instead of
+// going back to a central switch. That gives each handler its own indirect branch,
+// which the branch predictor learns far better than one shared jump.
+
+struct BytecodeFrame {
+    const int32_t* return_pc;
+    size_t base;  // first register of the caller's frame
+    size_t top;   // one past its last register
+    int32_t dst;  // caller's register receiving the result
+};
+
+typedef long (*BytecodeExternalFn)(long, long, long, long, long, long);
+
+// makes room for registers up to top, false if that's more than we allow
+static bool reserve_registers(long** stack, size_t* capacity, size_t top)
+{
+    if (top <= *capacity) return true;
+    if (top > (size_t)QXC_BYTECODE_MAX_REGISTERS) return false;
+
+    size_t new_capacity = *capacity;
+    while (new_capacity < top) new_capacity *= 2;
+    *stack = (long*)realloc(*stack, new_capacity * sizeof(long));
+    *capacity = new_capacity;
+    return true;
+}
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpedantic"
+
+int bytecode_run(BytecodeProgram* program, int* exit_code)
+{
+    TRACE_SPAN(TraceCategory::Driver, "interpret");
+
+    static void* const dispatch[] = {
+        &&op_imm,           &&op_move,
+        &&op_neg,           &&op_not,
+        &&op_logical_not,   &&op_add,
+        &&op_sub,           &&op_mul,
+        &&op_div,           &&op_mod,
+        &&op_and,           &&op_or,
+        &&op_xor,           &&op_shift_left,
+        &&op_shift_right,   &&op_equal,
+        &&op_not_equal,     &&op_less_than,
+        &&op_less_equal,    &&op_greater_than,
+        &&op_greater_equal, &&op_select,
+        &&op_load_global,   &&op_store_global,
+        &&op_call,          &&op_call_external,
+        &&op_jump,          &&op_branch,
+        &&op_branch_equal,  &&op_branch_not_equal,
+        &&op_branch_less_than, &&op_branch_less_equal,
+        &&op_branch_greater_than, &&op_branch_greater_equal,
+        &&op_jump_table,    &&op_switch,
+        &&op_return,
+    };
+    static_assert(sizeof(dispatch) / sizeof(dispatch[0]) == (size_t)BytecodeOp::Count,
+                  "every bytecode op needs a handler");
+
+    const BytecodeFunction* functions = program->functions.begin();
+    const BytecodeFunction& main_function = functions[program->main_function];
+
+    DynHeapArray<long> globals = heap_array_create<long>(program->globals.length);
+    DynHeapArray<BytecodeFrame> frames = heap_array_create<BytecodeFrame>(64);
+    size_t capacity = 1 << 12;
+    long* stack = (long*)malloc(capacity * sizeof(long));
+    defer {
+        array_free(&globals);
+        array_free(&frames);
+        free(stack);
+    };
+
+    for (long value : program->globals) {
+        array_append(&globals, value);
+    }
+
+    size_t base = 0;
+    size_t top = (size_t)main_function.register_count;
+    if (!reserve_registers(&stack, &capacity, top)) {
+        fprintf(stderr, "runtime error: stack overflow\n");
+        return -1;
+    }
+
+    const int32_t* const code = program->code.begin();
+    const int32_t* pc = code + main_function.entry;
+    long* regs = stack;
+    long* const global_values = globals.begin();
+    long result = 0;
+
+#define DISPATCH() goto* dispatch[*pc]
+
+    // wrap around on overflow like the generated code does, rather than invoking UB
+#define BINARY_OP(label, expr)              \
+    label : {                               \
+        const long a = regs[pc[2]];         \
+        const long b = regs[pc[3]];         \
+        (void)a;                            \
+        (void)b;                            \
+        regs[pc[1]] = (expr);               \
+        pc += 4;                            \
+        DISPATCH();                         \
+    }
+
+#define COMPARE_BRANCH_OP(label, op)                                      \
+    label : {                                                             \
+        pc = code + (regs[pc[1]] op regs[pc[2]] ? pc[3] : pc[4]);         \
+        DISPATCH();                                                       \
+    }
+
+    DISPATCH();
+
+op_imm:
+    regs[pc[1]] = long_operand(pc + 2);
+    pc += 4;
+    DISPATCH();
+
+op_move:
+    regs[pc[1]] = regs[pc[2]];
+    pc += 3;
+    DISPATCH();
+
+op_neg:
+    regs[pc[1]] = ir_wrap_int(0UL - (unsigned long)regs[pc[2]]);
+    pc += 3;
+    DISPATCH();
+
+op_not:
+    regs[pc[1]] = ~regs[pc[2]];
+    pc += 3;
+    DISPATCH();
+
+op_logical_not:
+    regs[pc[1]] = regs[pc[2]] == 0;
+    pc += 3;
+    DISPATCH();
+
+    // registers hold ints, results wrap around to 32 bits like the native code's
+    BINARY_OP(op_add, ir_wrap_int((unsigned long)a + (unsigned long)b))
+    BINARY_OP(op_sub, ir_wrap_int((unsigned long)a - (unsigned long)b))
+    BINARY_OP(op_mul, ir_wrap_int((unsigned long)a * (unsigned long)b))
+
+op_div: {
+    const long a = regs[pc[2]];
+    const long b = regs[pc[3]];
+    if (b == 0 || (a == INT_MIN && b == -1)) {
+        fprintf(stderr, "runtime error: %s\n", b == 0 ? "division by zero" : "division overflow");
+        return -1;
+    }
+    regs[pc[1]] = a / b;
+    pc += 4;
+    DISPATCH();
+}
+
+op_mod: {
+    const long a = regs[pc[2]];
+    const long b = regs[pc[3]];
+    if (b == 0 || (a == INT_MIN && b == -1)) {
+        fprintf(stderr, "runtime error: %s\n", b == 0 ? "division by zero" : "division overflow");
+        return -1;
+    }
+    regs[pc[1]] = a % b;
+    pc += 4;
+    DISPATCH();
+}
+
+    BINARY_OP(op_and, a & b)
+    BINARY_OP(op_or, a | b)
+    BINARY_OP(op_xor, a ^ b)
+    // the shift count is masked like x86 does
+    BINARY_OP(op_shift_left, ir_wrap_int((unsigned long)a << (b & 31)))
+    BINARY_OP(op_shift_right, a >> (b & 31))
+
+    BINARY_OP(op_equal, a == b)
+    BINARY_OP(op_not_equal, a != b)
+    BINARY_OP(op_less_than, a < b)
+    BINARY_OP(op_less_equal, a <= b)
+    BINARY_OP(op_greater_than, a > b)
+    BINARY_OP(op_greater_equal, a >= b)
+
+op_select:
+    regs[pc[1]] = regs[pc[2]] != 0 ? regs[pc[3]] : regs[pc[4]];
+    pc += 5;
+    DISPATCH();
+
+op_load_global:
+    regs[pc[1]] = global_values[pc[2]];
+    pc += 3;
+    DISPATCH();
+
+op_store_global:
+    global_values[pc[1]] = regs[pc[2]];
+    pc += 3;
+    DISPATCH();
+
+op_call: {
+    const BytecodeFunction& callee = functions[pc[2]];
+    const int32_t argc = pc[3];
+
+    BytecodeFrame frame;
+    frame.return_pc = pc + 4 + argc;
+    frame.base = base;
+    frame.top = top;
+    frame.dst = pc[1];
+    array_append(&frames, frame);
+
+    if (!reserve_registers(&stack, &capacity, top + (size_t)callee.register_count)) {
+        fprintf(stderr, "runtime error: stack overflow\n");
+        return -1;
+    }
+
+    long* const caller_regs = stack + base;
+    long* const callee_regs = stack + top;
+    for (int32_t i = 0; i < argc && i < callee.param_count; i++) {
+        callee_regs[i] = caller_regs[pc[4 + i]];
+    }
+
+    base = top;
+    top += (size_t)callee.register_count;
+    regs = callee_regs;
+    pc = code + callee.entry;
+    DISPATCH();
+}
+
+op_call_external: {
+    long args[QXC_BYTECODE_MAX_EXTERNAL_ARGS] = {0};
+    for (int32_t i = 0; i < pc[3]; i++) {
+        args[i] = regs[pc[4 + i]];
+    }
+
+    const BytecodeExternalFn fn =
+        reinterpret_cast<BytecodeExternalFn>(program->externals[(size_t)pc[2]].address);
+    regs[pc[1]] = ir_wrap_int((unsigned long)fn(args[0], args[1], args[2], args[3], args[4],
+                                                args[5]));
+    pc += 4 + pc[3];
+    DISPATCH();
+}
+
+op_jump:
+    pc = code + pc[1];
+    DISPATCH();
+
+op_branch:
+    pc = code + (regs[pc[1]] != 0 ? pc[2] : pc[3]);
+    DISPATCH();
+
+    COMPARE_BRANCH_OP(op_branch_equal, ==)
+    COMPARE_BRANCH_OP(op_branch_not_equal, !=)
+    COMPARE_BRANCH_OP(op_branch_less_than, <)
+    COMPARE_BRANCH_OP(op_branch_less_equal, <=)
+    COMPARE_BRANCH_OP(op_branch_greater_than, >)
+    COMPARE_BRANCH_OP(op_branch_greater_equal, >=)
+
+op_jump_table: {
+    // below min wraps around to a huge unsigned index
+    const unsigned long index =
+        (unsigned long)regs[pc[1]] - (unsigned long)long_operand(pc + 2);
+    pc = code + (index < (unsigned long)pc[4] ? pc[6 + index] : pc[5]);
+    DISPATCH();
+}
+
+op_switch: {
+    const long value = regs[pc[1]];
+    const int32_t* const cases = pc + 4;
+    int32_t target = pc[3];
+
+    size_t low = 0;
+    size_t high = (size_t)pc[2];
+    while (low < high) {
+        const size_t middle = (low + high) / 2;
+        const long case_value = long_operand(cases + 3 * middle);
+        if (case_value == value) {
+            target = cases[3 * middle + 2];
+            break;
+        }
+        if (case_value < value) {
+            low = middle + 1;
+        }
+        else {
+            high = middle;
+        }
+    }
+
+    pc = code + target;
+    DISPATCH();
+}
+
+op_return: {
+    const long value = regs[pc[1]];
+    if (frames.length == 0) {
+        result = value;
+        goto done;
+    }
+
+    const BytecodeFrame frame = frames[frames.length - 1];
+    frames.length--;
+    base = frame.base;
+    top = frame.top;
+    regs = stack + base;
+    regs[frame.dst] = value;
+    pc = frame.return_pc;
+    DISPATCH();
+}
+
+#undef DISPATCH
+#undef BINARY_OP
+#undef COMPARE_BRANCH_OP
+
+done:
+    // whatever the program printed through libc is still buffered in our stdout
+    fflush(stdout);
+
+    *exit_code = (int)(result & 0xff);
+    return 0;
+}
+
+#pragma GCC diagnostic pop
@@ -0,0 +1,107 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "array.h"
+#include "ir.h"
+
+// Register-based bytecode, an alternative backend to x86 for running programs right
+// away (qxc --interpret). It is lowered from the optimized IR, so it shares the whole
+// front end with the native path, and is executed by a threaded interpreter.
+//
+// Code is a flat array of 32 bit words, an opcode followed by its operands. Every
+// function gets a frame of registers: its parameters first, then one register per
+// vreg, then one per stack slot, so Load/Store/Param all become plain moves. Jump
+// targets are absolute word offsets into the code.
+//
+//   Imm          dst lo hi           dst = (hi << 32) | lo
+//   Move         dst a
+//   Neg, ...     dst a               unary operators
+//   Add, ...     dst a b             binary operators and comparisons
+//   Select       dst c a b           dst = c ? a : b
+//   LoadGlobal   dst global
+//   StoreGlobal  global a
+//   Call         dst function argc arg0 arg1 ...
+//   CallExternal dst external argc arg0 arg1 ...
+//   Jump         target
+//   Branch       a target_true target_false
+//   BranchEqual  a b target_true target_false, and so on for every comparison
+//   JumpTable    a min_lo min_hi count default target0 target1 ...
+//                                    goto target[a - min], default if out of range
+//   Switch       a count default value0_lo value0_hi target0 ...
+//                                    binary search for a among the sorted values
+//   Return       a
+
+enum class BytecodeOp : int32_t {
+    Imm,
+    Move,
+    Neg,
+    Not,
+    LogicalNot,
+    Add,
+    Sub,
+    Mul,
+    Div,
+    Mod,
+    And,
+    Or,
+    Xor,
+    ShiftLeft,
+    ShiftRight,
+    Equal,
+    NotEqual,
+    LessThan,
+    LessEqual,
+    GreaterThan,
+    GreaterEqual,
+    Select,
+    LoadGlobal,
+    StoreGlobal,
+    Call,
+    CallExternal,
+    Jump,
+    Branch,
+    BranchEqual,
+    BranchNotEqual,
+    BranchLessThan,
+    BranchLessEqual,
+    BranchGreaterThan,
+    BranchGreaterEqual,
+    JumpTable,
+    Switch,
+    Return,
+    Count
+};
+
+struct BytecodeFunction {
+    const char* name;
+    int param_count;
+    int register_count;
+    size_t entry;  // word offset of the first instruction
+};
+
+// functions defined outside of the program, called through a pointer found in this
+// process, the way linking against libc would
+struct BytecodeExternal {
+    const char* name;
+    void* address;
+};
+
+struct BytecodeProgram {
+    DynHeapArray<int32_t> code;
+    DynHeapArray<BytecodeFunction> functions;
+    DynHeapArray<BytecodeExternal> externals;
+    DynHeapArray<long> globals;  // initial values, of all units one after another
+    long main_function;
+};
+
+// links the IR of all translation units into one program, nullptr on errors like an
+// undefined function
+BytecodeProgram* bytecode_compile(IRProgram* const* programs, size_t program_count);
+void bytecode_print_program(BytecodeProgram* program);
+void bytecode_program_free(BytecodeProgram* program);
+
+// Runs main. Returns -1 on a runtime error (division by zero, running out of stack),
+// else 0 with main's result truncated to an exit status in *exit_code.
+int bytecode_run(BytecodeProgram* program, int* exit_code);
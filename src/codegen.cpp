@@ -1,462 +1,1324 @@
 #include "codegen.h"
 
 #include <assert.h>
-#include <stdarg.h>
+#include <limits.h>
 #include <stdio.h>
 
-#include "flat_map.h"
-#include "strbuf.h"
-
-#define QXC_STACK_OFFSETS_CAPACITY 64
-struct StackOffsets {
-    DenseHashTable<String, int> m_table;
-    const char* variable_names[QXC_STACK_OFFSETS_CAPACITY] = {0};
-    int variable_offsets[QXC_STACK_OFFSETS_CAPACITY] = {0};
-    size_t count = 0;
-    int stack_index = -8;
-    StackOffsets* parent = nullptr;
+#include "array.h"
+#include "ir.h"
+#include "peephole.h"
+#include "prelude.h"
+#include "trace.h"
+#include "x86.h"
+
+// vregs are handed out to callee-saved registers only, so they survive calls without
+// any caller-side spilling. rax, rcx and rdx are kept free as scratch registers for
+// instruction selection.
+#define QXC_ALLOCATABLE_REGISTER_COUNT 5
+static const X86Reg s_allocatable_regs[QXC_ALLOCATABLE_REGISTER_COUNT] = {
+    X86Reg::RBX, X86Reg::R12, X86Reg::R13, X86Reg::R14, X86Reg::R15};
+
+// System V integer argument registers, any further arguments are passed on the stack
+#define QXC_ARG_REGISTER_COUNT 6
+static const X86Reg s_arg_regs[QXC_ARG_REGISTER_COUNT] = {
+    X86Reg::RDI, X86Reg::RSI, X86Reg::RDX, X86Reg::RCX, X86Reg::R8, X86Reg::R9};
+
+// loop headers start on a fresh 16 byte fetch block
+#define QXC_LOOP_ALIGNMENT 16
+
+enum class LocationType { Register, Stack, Immediate, None };
+
+struct Location {
+    LocationType type = LocationType::None;
+    long value = 0;  // register index, spill slot index or immediate value
 };
 
-static bool stack_offsets_contains(StackOffsets* offsets, const char* name)
+struct CodeGen {
+    FILE* asm_output;
+    const CompileOptions* options;
+    IRProgram* program;
+
+    IRFunction* fn;
+    DynHeapArray<Location> locations;  // indexed by vreg
+    DynHeapArray<int> use_counts;      // indexed by vreg
+    DynHeapArray<IRInstr*> updates_in_memory;  // indexed by vreg, see find_memory_updates
+    int spill_count;
+    int used_register_count;  // registers are handed out in order, so a prefix is in use
+    long call_stack_bytes;    // pushed by the arguments of the call being generated
+    int label_count;          // labels in use, blocks and the epilogue come first
+
+    DynHeapArray<X86Instr> instrs;  // the function currently being generated
+    PeepholeStats* peephole_stats;
+};
+
+static X86Instr* emit(CodeGen* gen, X86Op op, X86Operand a = X86Operand(),
+                      X86Operand b = X86Operand(), X86Operand c = X86Operand())
+{
+    X86Instr* instr = array_extend(&gen->instrs);
+    new (instr) X86Instr();
+    instr->op = op;
+    instr->operands[0] = a;
+    instr->operands[1] = b;
+    instr->operands[2] = c;
+    return instr;
+}
+
+static void emit_cond(CodeGen* gen, X86Op op, X86Cond cond, X86Operand a,
+                      X86Operand b = X86Operand())
 {
-    const size_t count = offsets->count;
-    for (size_t i = 0; i < count; i++) {
-        if (strs_are_equal(name, offsets->variable_names[i])) {
+    emit(gen, op, a, b)->cond = cond;
+}
+
+// --------------------------------------------------------------------------------
+// read-modify-write
+//
+// Updating a variable in place, like x += y or x++ do, is a load, an operation and a
+// store back to the same slot or global. Unless something else reads the loaded or
+// the computed value, the three become a single instruction on memory:
+//
+//     %1 = load $0
+//     %2 = add %1, %0     --->     add dword [rbp - 8], ebx
+//     store $0, %2
+//
+// The operation has to come right before the store, so its other operand is still
+// where it was put when the store gets generated.
+
+static bool can_update_memory(IROpcode opcode)
+{
+    switch (opcode) {
+        case IROpcode::Add:
+        case IROpcode::Sub:
+        case IROpcode::And:
+        case IROpcode::Or:
+        case IROpcode::Xor:
+        case IROpcode::Shl:
+        case IROpcode::Shr:
             return true;
-        }
+        default:
+            return false;
     }
+}
 
+// true if the memory a load at index load_index read from is written before the store
+// at store_index. Calls may write any global, but never one of our slots.
+static bool written_between(IRBlock* block, size_t load_index, size_t store_index)
+{
+    const IRInstr& store = block->instrs[store_index];
+
+    for (size_t i = load_index + 1; i < store_index; i++) {
+        const IRInstr& instr = block->instrs[i];
+        if (instr.opcode == store.opcode && instr.imm == store.imm) return true;
+        if (instr.opcode == IROpcode::Call && store.opcode == IROpcode::StoreGlobal) {
+            return true;
+        }
+    }
     return false;
 }
 
-static int stack_offsets_insert(StackOffsets* offsets, const char* name)
+// Marks the loaded and the computed vreg of every fusable update with the operation,
+// both then never get a location of their own.
+static void find_memory_updates(CodeGen* gen, IRFunction* fn)
 {
-    const size_t old_count = offsets->count;
-    assert(old_count < QXC_STACK_OFFSETS_CAPACITY);
-    offsets->variable_names[old_count] = name;
-    offsets->variable_offsets[old_count] = offsets->stack_index;
-    offsets->count++;
-    offsets->stack_index -= 8;
-    return 0;
+    array_clear(&gen->updates_in_memory);
+    for (int i = 0; i < fn->vreg_count; i++) {
+        array_append(&gen->updates_in_memory, (IRInstr*)nullptr);
+    }
+
+    // index of the instruction defining each vreg, vregs are local to their block
+    DynHeapArray<size_t> definitions = heap_array_create<size_t>((size_t)fn->vreg_count + 1);
+    defer { array_free(&definitions); };
+    for (int i = 0; i < fn->vreg_count; i++) {
+        array_append(&definitions, (size_t)0);
+    }
+
+    for (IRBlock* block : fn->blocks) {
+        for (size_t i = 0; i < block->instrs.length; i++) {
+            IRInstr* store = &block->instrs[i];
+            if (store->dst >= 0) definitions[(size_t)store->dst] = i;
+
+            const bool is_store =
+                store->opcode == IROpcode::Store || store->opcode == IROpcode::StoreGlobal;
+            if (!is_store || i == 0) continue;
+
+            IRInstr* op = &block->instrs[i - 1];
+            if (!can_update_memory(op->opcode) || op->dst != store->args[0] ||
+                gen->use_counts[(size_t)op->dst] != 1 ||
+                gen->use_counts[(size_t)op->args[0]] != 1) {
+                continue;
+            }
+
+            const size_t load_index = definitions[(size_t)op->args[0]];
+            const IRInstr& load = block->instrs[load_index];
+            const IROpcode load_opcode = store->opcode == IROpcode::Store
+                                             ? IROpcode::Load
+                                             : IROpcode::LoadGlobal;
+            if (load.opcode != load_opcode || load.imm != store->imm ||
+                written_between(block, load_index, i)) {
+                continue;
+            }
+
+            gen->updates_in_memory[(size_t)op->args[0]] = op;
+            gen->updates_in_memory[(size_t)op->dst] = op;
+        }
+    }
 }
 
-static int stack_offsets_lookup(StackOffsets* offsets, const char* name)
+static bool updated_in_memory(CodeGen* gen, int vreg)
 {
-    const size_t count = offsets->count;
-    for (size_t i = 0; i < count; i++) {
-        if (strs_are_equal(name, offsets->variable_names[i])) {
-            return offsets->variable_offsets[i];
+    return vreg >= 0 && gen->updates_in_memory[(size_t)vreg] != nullptr;
+}
+
+// --------------------------------------------------------------------------------
+// register allocation
+//
+// Since vregs never outlive their block, a single linear scan over each block with
+// exact last-use positions is all the allocation we need. Constants are ints, so they
+// always fit in an imm32 and are never materialized, they're folded into their users
+// as immediates.
+
+static void allocate_registers(CodeGen* gen, IRFunction* fn)
+{
+    array_clear(&gen->locations);
+    array_clear(&gen->use_counts);
+    for (int i = 0; i < fn->vreg_count; i++) {
+        array_append(&gen->locations, Location());
+        array_append(&gen->use_counts, 0);
+    }
+
+    DynHeapArray<int> last_use = heap_array_create<int>((size_t)fn->vreg_count + 1);
+    defer { array_free(&last_use); };
+    for (int i = 0; i < fn->vreg_count; i++) {
+        array_append(&last_use, -1);
+    }
+
+    for (IRBlock* block : fn->blocks) {
+        for (size_t i = 0; i < block->instrs.length; i++) {
+            for (int arg : block->instrs[i].args) {
+                if (arg < 0) continue;
+                last_use[(size_t)arg] = (int)i;
+                gen->use_counts[(size_t)arg]++;
+            }
+        }
+    }
+    find_memory_updates(gen, fn);
+
+    DynHeapArray<bool> spill_in_use = heap_array_create<bool>(0);
+    defer { array_free(&spill_in_use); };
+    gen->spill_count = 0;
+    gen->used_register_count = 0;
+
+    for (IRBlock* block : fn->blocks) {
+        bool reg_in_use[QXC_ALLOCATABLE_REGISTER_COUNT] = {false};
+        for (bool& in_use : spill_in_use) in_use = false;
+
+        for (size_t i = 0; i < block->instrs.length; i++) {
+            IRInstr* instr = &block->instrs[i];
+
+            // operands dying here release their location before dst is assigned, so
+            // dst may end up sharing a register with one of its operands
+            for (int arg : instr->args) {
+                if (arg < 0 || last_use[(size_t)arg] != (int)i) continue;
+                const Location& loc = gen->locations[(size_t)arg];
+                if (loc.type == LocationType::Register) {
+                    reg_in_use[loc.value] = false;
+                }
+                else if (loc.type == LocationType::Stack) {
+                    spill_in_use[(size_t)loc.value] = false;
+                }
+            }
+
+            if (instr->dst < 0 || updated_in_memory(gen, instr->dst)) continue;
+
+            Location& loc = gen->locations[(size_t)instr->dst];
+
+            if (instr->opcode == IROpcode::Const) {
+                loc.type = LocationType::Immediate;
+                loc.value = instr->imm;
+                continue;
+            }
+
+            for (long r = 0; r < QXC_ALLOCATABLE_REGISTER_COUNT; r++) {
+                if (!reg_in_use[r]) {
+                    loc.type = LocationType::Register;
+                    loc.value = r;
+                    if (r >= gen->used_register_count) gen->used_register_count = (int)r + 1;
+                    break;
+                }
+            }
+
+            if (loc.type == LocationType::None) {
+                for (size_t s = 0; s < spill_in_use.length; s++) {
+                    if (!spill_in_use[s]) {
+                        loc.type = LocationType::Stack;
+                        loc.value = (long)s;
+                        break;
+                    }
+                }
+            }
+
+            if (loc.type == LocationType::None) {
+                loc.type = LocationType::Stack;
+                loc.value = (long)spill_in_use.length;
+                array_append(&spill_in_use, false);
+            }
+
+            // a result nobody reads still needs somewhere to go, but only briefly
+            const bool used = last_use[(size_t)instr->dst] > (int)i;
+            if (loc.type == LocationType::Register) {
+                reg_in_use[loc.value] = used;
+            }
+            else {
+                spill_in_use[(size_t)loc.value] = used;
+            }
         }
     }
-    exit(EXIT_FAILURE);
+
+    gen->spill_count = (int)spill_in_use.length;
 }
 
-// static void stack_offsets_clear(StackOffsets* offsets)
-// {
-//     for (size_t i = 0; i < offsets->count; i++) {
-//         offsets->variable_names[i] = nullptr;
-//         offsets->variable_offsets[i] = 0;
-//     }
+// --------------------------------------------------------------------------------
+// operands
 //
-//     offsets->count = 0;
-// }
+// Values are 32 bit ints and computed with 32 bit instructions: eax rather than rax,
+// which also saves the REX prefix for all but r8-r15. Only the low half of a register
+// holding a value means anything: the ABI leaves the upper half of an int return value
+// or argument undefined, and code built by other compilers does leave garbage there.
+// Anything that reads a value as 64 bits extends it explicitly first. Slots and spills
+// keep their 8 byte stride, only their low dword is used.
 
-struct CodeGen {
-    FILE* asm_output;
-    size_t indent_level;
+#define QXC_INT_SIZE 4
 
-    size_t logical_or_counter;
-    size_t logical_and_counter;
-    size_t conditional_expr_counter;
-};
+static X86Operand slot_operand(long slot)
+{
+    return x86_mem(X86Reg::RBP, -8 * (slot + 1), QXC_INT_SIZE);
+}
 
-#define JUMP_LABEL_MAX_LENGTH 64
-struct JumpLabel {
-    char buffer[JUMP_LABEL_MAX_LENGTH];
-};
+static X86Operand global_operand(CodeGen* gen, long global)
+{
+    return x86_global(gen->program->globals[(size_t)global].name, QXC_INT_SIZE);
+}
+
+static X86Operand spill_operand(CodeGen* gen, long spill, int size)
+{
+    return x86_mem(X86Reg::RBP, -8 * (gen->fn->slot_count + spill + 1), size);
+}
+
+// callee-saved registers we clobber are saved below the spill area
+static X86Operand saved_register_operand(CodeGen* gen, int index)
+{
+    return x86_mem(X86Reg::RBP, -8 * (gen->fn->slot_count + gen->spill_count + index + 1));
+}
+
+static X86Operand rax(int size = QXC_INT_SIZE) { return x86_reg(X86Reg::RAX, size); }
+
+static Location vreg_location(CodeGen* gen, int vreg)
+{
+    assert(vreg >= 0);
+    return gen->locations[(size_t)vreg];
+}
 
-static void build_logical_or_jump_labels(CodeGen* gen, JumpLabel* snd_label,
-                                         JumpLabel* end_label)
+static bool in_register(CodeGen* gen, int vreg)
 {
-    size_t count = ++gen->logical_or_counter;
-    qxc_snprintf(snd_label->buffer, JUMP_LABEL_MAX_LENGTH, "_LOR_Snd_%zu", count);
-    qxc_snprintf(end_label->buffer, JUMP_LABEL_MAX_LENGTH, "_LOR_End_%zu", count);
+    return vreg_location(gen, vreg).type == LocationType::Register;
 }
 
-static void build_logical_and_jump_labels(CodeGen* gen, JumpLabel* snd_label,
-                                          JumpLabel* end_label)
+static bool is_immediate(CodeGen* gen, int vreg)
 {
-    size_t count = ++gen->logical_and_counter;
-    qxc_snprintf(snd_label->buffer, JUMP_LABEL_MAX_LENGTH, "_LAND_Snd_%zu", count);
-    qxc_snprintf(end_label->buffer, JUMP_LABEL_MAX_LENGTH, "_LAND_End_%zu", count);
+    return vreg_location(gen, vreg).type == LocationType::Immediate;
 }
 
-static void build_conditional_expr_jump_labels(CodeGen* gen, JumpLabel* else_label,
-                                               JumpLabel* post_label)
+static bool same_register(CodeGen* gen, int vreg_a, int vreg_b)
 {
-    size_t count = ++gen->conditional_expr_counter;
-    qxc_snprintf(else_label->buffer, JUMP_LABEL_MAX_LENGTH, "_CondExpr_Else_%zu", count);
-    qxc_snprintf(post_label->buffer, JUMP_LABEL_MAX_LENGTH, "_CondExpr_Post_%zu", count);
+    const Location a = vreg_location(gen, vreg_a);
+    const Location b = vreg_location(gen, vreg_b);
+    return a.type == LocationType::Register && b.type == LocationType::Register &&
+           a.value == b.value;
 }
 
-static void emit(CodeGen* gen, const char* fmt, ...)
+static X86Operand vreg_operand(CodeGen* gen, int vreg, int size = QXC_INT_SIZE)
 {
-    va_list args;
-    va_start(args, fmt);
-    for (size_t i = 0; i < gen->indent_level; i++) {
-        fprintf(gen->asm_output, "  ");
+    const Location loc = vreg_location(gen, vreg);
+
+    switch (loc.type) {
+        case LocationType::Register:
+            return x86_reg(s_allocatable_regs[loc.value], size);
+        case LocationType::Stack:
+            return spill_operand(gen, loc.value, size);
+        case LocationType::Immediate:
+            return x86_imm(loc.value);
+        default:
+            QXC_UNREACHABLE();
+            return X86Operand();
     }
-    vfprintf(gen->asm_output, fmt, args);
-    va_end(args);
-    fprintf(gen->asm_output, "\n");
 }
 
-static void generate_expression_asm(CodeGen* gen, StackOffsets* offsets,
-                                    struct ExprNode* expr);
+static X86Operand block_label(IRBlock* block) { return x86_label(block->id); }
+
+// every return jumps to the shared epilogue, which gets the label id after the last block
+static X86Operand epilogue_label(CodeGen* gen) { return x86_label((int)gen->fn->blocks.length); }
+
+// for jump targets within the code generated for a single IR instruction
+static X86Operand new_label(CodeGen* gen) { return x86_label(gen->label_count++); }
 
-static void generate_logical_OR_binop_expression_asm(CodeGen* gen, StackOffsets* offsets,
-                                                     BinopExpr* binop_node)
+// --------------------------------------------------------------------------------
+// instruction selection
+
+static X86Cond compare_cond(IROpcode opcode)
 {
-    assert(binop_node->op == Operator::LogicalOR);
+    switch (opcode) {
+        case IROpcode::Equal:
+            return X86Cond::E;
+        case IROpcode::NotEqual:
+            return X86Cond::NE;
+        case IROpcode::LessThan:
+            return X86Cond::L;
+        case IROpcode::LessEqual:
+            return X86Cond::LE;
+        case IROpcode::GreaterThan:
+            return X86Cond::G;
+        case IROpcode::GreaterEqual:
+            return X86Cond::GE;
+        case IROpcode::LogicalNot:
+            return X86Cond::E;
+        default:
+            QXC_UNREACHABLE();
+            return X86Cond::E;
+    }
+}
 
-    JumpLabel snd_label, end_label;
-    build_logical_or_jump_labels(gen, &snd_label, &end_label);
+// move the flags condition computed by the preceding cmp into dst as 0/1
+static void generate_setcc(CodeGen* gen, IROpcode opcode, int dst)
+{
+    const X86Cond cond = compare_cond(opcode);
+
+    if (in_register(gen, dst)) {
+        emit_cond(gen, X86Op::Setcc, cond, vreg_operand(gen, dst, 1));
+        emit(gen, X86Op::Movzx, vreg_operand(gen, dst, 4), vreg_operand(gen, dst, 1));
+    }
+    else {
+        emit_cond(gen, X86Op::Setcc, cond, rax(1));
+        emit(gen, X86Op::Movzx, rax(), rax(1));
+        emit(gen, X86Op::Mov, vreg_operand(gen, dst), rax());
+    }
+}
 
-    generate_expression_asm(gen, offsets, binop_node->left_expr);
+// cmp a, b. The left hand side of cmp can't be an immediate, and at most one side
+// may live in memory, so route it through rax unless it already sits in a register.
+static void generate_cmp(CodeGen* gen, int a, X86Operand b)
+{
+    if (!in_register(gen, a)) {
+        emit(gen, X86Op::Mov, rax(), vreg_operand(gen, a));
+        emit(gen, X86Op::Cmp, rax(), b);
+    }
+    else {
+        emit(gen, X86Op::Cmp, vreg_operand(gen, a), b);
+    }
+}
 
-    emit(gen, "cmp rax, 0");
-    emit(gen, "je %s", snd_label.buffer);
-    emit(gen, "mov rax, 1");
-    emit(gen, "jmp %s", end_label.buffer);
+static void generate_alu_instr(CodeGen* gen, IRInstr* instr)
+{
+    X86Op op = X86Op::Invalid;
+
+    switch (instr->opcode) {
+        case IROpcode::Add:
+            op = X86Op::Add;
+            break;
+        case IROpcode::Sub:
+            op = X86Op::Sub;
+            break;
+        case IROpcode::Mul:
+            op = X86Op::Imul;
+            break;
+        case IROpcode::And:
+            op = X86Op::And;
+            break;
+        case IROpcode::Or:
+            op = X86Op::Or;
+            break;
+        case IROpcode::Xor:
+            op = X86Op::Xor;
+            break;
+        default:
+            QXC_UNREACHABLE();
+            break;
+    }
 
-    emit(gen, "\n%s:", snd_label.buffer);
+    const X86Operand a = vreg_operand(gen, instr->args[0]);
+    const X86Operand b = vreg_operand(gen, instr->args[1]);
+    const X86Operand d = vreg_operand(gen, instr->dst);
 
-    generate_expression_asm(gen, offsets, binop_node->right_expr);
-    emit(gen, "cmp rax, 0");
-    emit(gen, "mov rax, 0");
-    emit(gen, "setne al");
+    // two-address form straight into dst, unless that would clobber b before it's read
+    const bool direct =
+        in_register(gen, instr->dst) && !same_register(gen, instr->dst, instr->args[1]);
+    const X86Operand target = direct ? d : rax();
 
-    emit(gen, "\n%s:", end_label.buffer);
+    if (!direct || !same_register(gen, instr->dst, instr->args[0])) {
+        emit(gen, X86Op::Mov, target, a);
+    }
+
+    if (op == X86Op::Imul && is_immediate(gen, instr->args[1])) {
+        emit(gen, X86Op::Imul, target, target, b);
+    }
+    else {
+        emit(gen, op, target, b);
+    }
+
+    if (!direct) {
+        emit(gen, X86Op::Mov, d, rax());
+    }
 }
 
-static void generate_logical_AND_binop_expression_asm(CodeGen* gen, StackOffsets* offsets,
-                                                      BinopExpr* binop_node)
+static void generate_unary_instr(CodeGen* gen, IRInstr* instr)
 {
-    assert(binop_node->op == Operator::LogicalAND);
+    const X86Operand a = vreg_operand(gen, instr->args[0]);
+    const X86Operand d = vreg_operand(gen, instr->dst);
+    const X86Op op = instr->opcode == IROpcode::Neg ? X86Op::Neg : X86Op::Not;
 
-    JumpLabel snd_label, end_label;
-    build_logical_and_jump_labels(gen, &snd_label, &end_label);
+    if (in_register(gen, instr->dst)) {
+        if (!same_register(gen, instr->dst, instr->args[0])) {
+            emit(gen, X86Op::Mov, d, a);
+        }
+        emit(gen, op, d);
+    }
+    else {
+        emit(gen, X86Op::Mov, rax(), a);
+        emit(gen, op, rax());
+        emit(gen, X86Op::Mov, d, rax());
+    }
+}
 
-    generate_expression_asm(gen, offsets, binop_node->left_expr);
+// shifts by a variable count take it in cl, rcx is free for that
+static X86Operand shift_count_operand(CodeGen* gen, int count)
+{
+    if (is_immediate(gen, count)) {
+        return x86_imm(vreg_location(gen, count).value & 31);
+    }
 
-    emit(gen, "cmp rax, 0");
-    emit(gen, "jne %s", snd_label.buffer);
-    emit(gen, "jmp %s", end_label.buffer);
+    emit(gen, X86Op::Mov, x86_reg(X86Reg::RCX, QXC_INT_SIZE), vreg_operand(gen, count));
+    return x86_reg(X86Reg::RCX, 1);
+}
 
-    emit(gen, "%s:", snd_label.buffer);
+static void generate_shift_instr(CodeGen* gen, IRInstr* instr)
+{
+    const X86Op op = instr->opcode == IROpcode::Shl ? X86Op::Shl : X86Op::Sar;
+    const X86Operand a = vreg_operand(gen, instr->args[0]);
+    const X86Operand d = vreg_operand(gen, instr->dst);
 
-    generate_expression_asm(gen, offsets, binop_node->right_expr);
-    emit(gen, "cmp rax, 0");
-    emit(gen, "mov rax, 0");
-    emit(gen, "setne al");
+    // read before dst is written, which may share a register with the count
+    const X86Operand count = shift_count_operand(gen, instr->args[1]);
 
-    emit(gen, "%s:", end_label.buffer);
+    if (in_register(gen, instr->dst)) {
+        if (!same_register(gen, instr->dst, instr->args[0])) {
+            emit(gen, X86Op::Mov, d, a);
+        }
+        emit(gen, op, d, count);
+    }
+    else {
+        emit(gen, X86Op::Mov, rax(), a);
+        emit(gen, op, rax(), count);
+        emit(gen, X86Op::Mov, d, rax());
+    }
 }
 
-static void generate_assignment_binop_expression_asm(CodeGen* gen, StackOffsets* offsets,
-                                                     BinopExpr* binop_node)
+// log2 of a constant divisor that is a power of two greater than 1, else 0
+static int divisor_shift(CodeGen* gen, int divisor)
 {
-    assert(binop_node->left_expr && binop_node->right_expr);
-    assert(binop_node->left_expr->type == ExprType::VariableRef);
+    if (!is_immediate(gen, divisor)) return 0;
 
-    const char* varname = binop_node->left_expr->referenced_var_name;
+    const long value = vreg_location(gen, divisor).value;
+    if (value <= 1 || (value & (value - 1)) != 0) return 0;
 
-    // generate value to be assigned to variable in left_expr
-    generate_expression_asm(gen, offsets, binop_node->right_expr);
+    int shift = 0;
+    while ((1L << shift) != value) shift++;
+    return shift;
+}
 
-    if (!stack_offsets_contains(offsets, varname)) {
-        fprintf(stderr, "attempted to assign value to un-initialized variable: %s\n",
-                varname);
-        exit(EXIT_FAILURE);
+// Signed division by 2^shift without idiv. Shifting right rounds toward negative
+// infinity rather than zero, so negative dividends are biased by 2^shift - 1 first:
+//
+//   mov ecx, eax                   mov ecx, eax
+//   sar ecx, 31                    sar ecx, 31
+//   shr ecx, 32 - shift            shr ecx, 32 - shift
+//   add eax, ecx                   add ecx, eax
+//   sar eax, shift     (a / b)     and ecx, -b
+//                                  sub eax, ecx     (a % b)
+static void generate_div_by_power_of_two(CodeGen* gen, IRInstr* instr, int shift)
+{
+    const X86Operand rcx = x86_reg(X86Reg::RCX, QXC_INT_SIZE);
+
+    emit(gen, X86Op::Mov, rax(), vreg_operand(gen, instr->args[0]));
+    emit(gen, X86Op::Mov, rcx, rax());
+    emit(gen, X86Op::Sar, rcx, x86_imm(31));
+    emit(gen, X86Op::Shr, rcx, x86_imm(32 - shift));
+
+    if (instr->opcode == IROpcode::Div) {
+        emit(gen, X86Op::Add, rax(), rcx);
+        emit(gen, X86Op::Sar, rax(), x86_imm(shift));
+    }
+    else {
+        emit(gen, X86Op::Add, rcx, rax());
+        emit(gen, X86Op::And, rcx, x86_imm(-(1L << shift)));
+        emit(gen, X86Op::Sub, rax(), rcx);
     }
 
-    emit(gen, "mov [rbp + %d], rax", stack_offsets_lookup(offsets, varname));
+    emit(gen, X86Op::Mov, vreg_operand(gen, instr->dst), rax());
 }
 
-static void generate_binop_expression_asm(CodeGen* gen, StackOffsets* offsets,
-                                          BinopExpr* binop_node)
+// a constant divisor other than 1, -1 and INT_MIN, whose magnitude doesn't fit in an int
+static bool divisor_has_reciprocal(CodeGen* gen, int divisor)
 {
-    const Operator op = binop_node->op;
+    if (!is_immediate(gen, divisor)) return false;
 
-    // separate treatment due to short circuiting
-    if (op == Operator::LogicalOR) {
-        generate_logical_OR_binop_expression_asm(gen, offsets, binop_node);
-        return;
+    const long value = vreg_location(gen, divisor).value;
+    return value != INT_MIN && (value > 1 || value < -1);
+}
+
+// Signed division by a constant d as a multiplication with its reciprocal, scaled to
+// fixed point (Granlund and Montgomery). For 2^(l-1) < |d| <= 2^l the multiplier
+// m = 2^(31 + l) / |d| + 1 is below 2^32, and n / |d| is the 64 bit product n * m
+// shifted right by 31 + l, plus one for negative n to round toward zero:
+//
+//   movsxd rax, n
+//   mov ecx, m                     ; zero extends, m takes all 32 bits
+//   imul rax, rcx
+//   mov rcx, rax
+//   sar rax, 31 + l
+//   shr rcx, 63                    ; 1 if the product, and so n, is negative
+//   add eax, ecx
+//   neg eax            (n / d, for negative d)
+//
+// The remainder takes the sign of n alone, n % d = n - (n / |d|) * |d|:
+//
+//   imul eax, eax, -|d|
+//   add eax, n         (n % d)
+static void generate_div_by_constant(CodeGen* gen, IRInstr* instr)
+{
+    const long divisor = vreg_location(gen, instr->args[1]).value;
+    const long magnitude = divisor < 0 ? -divisor : divisor;
+
+    int l = 0;
+    while ((1L << l) < magnitude) l++;
+    const long multiplier = (1L << (31 + l)) / magnitude + 1;
+
+    const X86Operand dividend = vreg_operand(gen, instr->args[0]);
+    const X86Operand rcx = x86_reg(X86Reg::RCX);
+    const X86Operand ecx = x86_reg(X86Reg::RCX, QXC_INT_SIZE);
+
+    // movsxd has no immediate form
+    if (dividend.type == X86OperandType::Imm) {
+        emit(gen, X86Op::Mov, rax(), dividend);
+        emit(gen, X86Op::Movsxd, rax(8), rax());
+    }
+    else {
+        emit(gen, X86Op::Movsxd, rax(8), dividend);
+    }
+    emit(gen, X86Op::Mov, ecx, x86_imm((int32_t)(uint32_t)multiplier));
+    emit(gen, X86Op::Imul, rax(8), rcx);
+    emit(gen, X86Op::Mov, rcx, rax(8));
+    emit(gen, X86Op::Sar, rax(8), x86_imm(31 + l));
+    emit(gen, X86Op::Shr, rcx, x86_imm(63));
+    emit(gen, X86Op::Add, rax(), ecx);
+
+    if (instr->opcode == IROpcode::Mod) {
+        emit(gen, X86Op::Imul, rax(), rax(), x86_imm(-magnitude));
+        emit(gen, X86Op::Add, rax(), dividend);
+    }
+    else if (divisor < 0) {
+        emit(gen, X86Op::Neg, rax());
     }
 
-    // separate treatment due to short circuiting
-    if (op == Operator::LogicalAND) {
-        generate_logical_AND_binop_expression_asm(gen, offsets, binop_node);
+    emit(gen, X86Op::Mov, vreg_operand(gen, instr->dst), rax());
+}
+
+// cdq; idiv leaves the quotient in eax and the remainder in edx. The 32 bit divide is
+// a good deal faster than the 64 bit one, but still slower than any of the sequences
+// for constant divisors.
+static void generate_div_instr(CodeGen* gen, IRInstr* instr)
+{
+    const int shift = divisor_shift(gen, instr->args[1]);
+    if (shift > 0) {
+        generate_div_by_power_of_two(gen, instr, shift);
         return;
     }
-
-    // separate treatment to avoid evaluating left expr
-    if (op == Operator::Assignment) {
-        generate_assignment_binop_expression_asm(gen, offsets, binop_node);
+    if (divisor_has_reciprocal(gen, instr->args[1])) {
+        generate_div_by_constant(gen, instr);
         return;
     }
 
-    // Now, all remaining binary operations behave similarly.
+    emit(gen, X86Op::Mov, rax(), vreg_operand(gen, instr->args[0]));
+    emit(gen, X86Op::Cdq);
 
-    // Put left hand operand in rax, right hand operand in rbx
-    generate_expression_asm(gen, offsets, binop_node->right_expr);
-    emit(gen, "push rax");
-    generate_expression_asm(gen, offsets, binop_node->left_expr);
-    emit(gen, "pop rbx");
+    // idiv has no immediate form
+    if (is_immediate(gen, instr->args[1])) {
+        const X86Operand ecx = x86_reg(X86Reg::RCX, QXC_INT_SIZE);
+        emit(gen, X86Op::Mov, ecx, vreg_operand(gen, instr->args[1]));
+        emit(gen, X86Op::Idiv, ecx);
+    }
+    else {
+        emit(gen, X86Op::Idiv, vreg_operand(gen, instr->args[1]));
+    }
 
-    switch (op) {
-        case Operator::Plus:
-            emit(gen, "add rax, rbx");
-            break;
-        case Operator::Minus:
-            emit(gen, "sub rax, rbx");
-            break;
-        case Operator::Divide:
-            emit(gen, "xor rdx, rdx");
-            emit(gen, "idiv rbx");
-            break;
-        case Operator::Multiply:
-            emit(gen, "imul rbx");
-            break;
-        case Operator::EqualTo:
-            emit(gen, "cmp rax, rbx");
-            emit(gen, "mov rax, 0");
-            emit(gen, "sete al");
-            break;
-        case Operator::NotEqualTo:
-            emit(gen, "cmp rax, rbx");
-            emit(gen, "mov rax, 0");
-            emit(gen, "setne al");
+    const X86Operand result =
+        instr->opcode == IROpcode::Div ? rax() : x86_reg(X86Reg::RDX, QXC_INT_SIZE);
+    emit(gen, X86Op::Mov, vreg_operand(gen, instr->dst), result);
+}
+
+// slots and globals alike, memory to memory moves go through rax
+static void generate_load(CodeGen* gen, int dst, X86Operand mem)
+{
+    if (in_register(gen, dst)) {
+        emit(gen, X86Op::Mov, vreg_operand(gen, dst), mem);
+    }
+    else {
+        emit(gen, X86Op::Mov, rax(), mem);
+        emit(gen, X86Op::Mov, vreg_operand(gen, dst), rax());
+    }
+}
+
+// the operation of an update found by find_memory_updates, applied to mem directly
+static void generate_memory_update(CodeGen* gen, IRInstr* op, X86Operand mem)
+{
+    if (op->opcode == IROpcode::Shl || op->opcode == IROpcode::Shr) {
+        const X86Operand count = shift_count_operand(gen, op->args[1]);
+        emit(gen, op->opcode == IROpcode::Shl ? X86Op::Shl : X86Op::Sar, mem, count);
+        return;
+    }
+
+    X86Op x86_op = X86Op::Invalid;
+    switch (op->opcode) {
+        case IROpcode::Add:
+            x86_op = X86Op::Add;
             break;
-        case Operator::LessThan:
-            emit(gen, "cmp rax, rbx");
-            emit(gen, "mov rax, 0");
-            emit(gen, "setl al");
+        case IROpcode::Sub:
+            x86_op = X86Op::Sub;
             break;
-        case Operator::LessThanOrEqualTo:
-            emit(gen, "cmp rax, rbx");
-            emit(gen, "mov rax, 0");
-            emit(gen, "setle al");
+        case IROpcode::And:
+            x86_op = X86Op::And;
             break;
-        case Operator::GreaterThan:
-            emit(gen, "cmp rax, rbx");
-            emit(gen, "mov rax, 0");
-            emit(gen, "setg al");
+        case IROpcode::Or:
+            x86_op = X86Op::Or;
             break;
-        case Operator::GreaterThanOrEqualTo:
-            emit(gen, "cmp rax, rbx");
-            emit(gen, "mov rax, 0");
-            emit(gen, "setge al");
+        case IROpcode::Xor:
+            x86_op = X86Op::Xor;
             break;
         default:
             QXC_UNREACHABLE();
             break;
     }
+
+    // at most one memory operand
+    X86Operand value = vreg_operand(gen, op->args[1]);
+    if (value.type == X86OperandType::Mem) {
+        emit(gen, X86Op::Mov, rax(), value);
+        value = rax();
+    }
+    emit(gen, x86_op, mem, value);
 }
 
-static void generate_expression_asm(CodeGen* gen, StackOffsets* offsets,
-                                    struct ExprNode* node)
+static void generate_store(CodeGen* gen, X86Operand mem, int value)
 {
-    switch (node->type) {
-        case ExprType::IntLiteral:
-            emit(gen, "mov rax, %d", node->literal);
-            return;
+    if (updated_in_memory(gen, value)) {
+        generate_memory_update(gen, gen->updates_in_memory[(size_t)value], mem);
+    }
+    else if (in_register(gen, value) || is_immediate(gen, value)) {
+        emit(gen, X86Op::Mov, mem, vreg_operand(gen, value));
+    }
+    else {
+        emit(gen, X86Op::Mov, rax(), vreg_operand(gen, value));
+        emit(gen, X86Op::Mov, mem, rax());
+    }
+}
 
-        case ExprType::UnaryOp:
-            generate_expression_asm(gen, offsets, node->unop_expr.child_expr);
+static void generate_param(CodeGen* gen, IRInstr* instr)
+{
+    const long index = instr->imm;
 
-            switch (node->unop_expr.op) {
-                case Operator::Minus:
-                    emit(gen, "neg rax");
-                    break;
-                case Operator::Complement:
-                    emit(gen, "not rax");
-                    break;
-                case Operator::LogicalNegation:
-                    emit(gen, "cmp rax, 0");
-                    emit(gen, "mov rax, 0");
-                    emit(gen, "sete al");
-                    break;
-                default:
-                    QXC_UNREACHABLE();
-                    break;
-            }
+    // stack parameters sit above the saved rbp and the return address
+    const X86Operand src =
+        index < QXC_ARG_REGISTER_COUNT
+            ? x86_reg(s_arg_regs[index], QXC_INT_SIZE)
+            : x86_mem(X86Reg::RBP, 16 + 8 * (index - QXC_ARG_REGISTER_COUNT), QXC_INT_SIZE);
 
-            return;
-
-        case ExprType::BinaryOp:
-            generate_binop_expression_asm(gen, offsets, &node->binop_expr);
-            return;
-
-        case ExprType::Conditional: {
-            JumpLabel else_label, post_label;
-            build_conditional_expr_jump_labels(gen, &else_label, &post_label);
-
-            generate_expression_asm(gen, offsets, node->cond_expr.conditional_expr);
-            emit(gen, "cmp rax, 0");
-            emit(gen, "je %s", else_label.buffer);
-            generate_expression_asm(gen, offsets, node->cond_expr.if_expr);
-            emit(gen, "jmp %s", post_label.buffer);
-            emit(gen, "\n%s:", else_label.buffer);
-            generate_expression_asm(gen, offsets, node->cond_expr.else_expr);
-            emit(gen, "\n%s:", post_label.buffer);
-            return;
+    if (in_register(gen, instr->dst) || src.type == X86OperandType::Reg) {
+        emit(gen, X86Op::Mov, vreg_operand(gen, instr->dst), src);
+    }
+    else {
+        emit(gen, X86Op::Mov, rax(), src);
+        emit(gen, X86Op::Mov, vreg_operand(gen, instr->dst), rax());
+    }
+}
+
+// Args come last argument first, so stack arguments get pushed right to left before
+// the register arguments are loaded. Argument registers are never allocated to vregs,
+// and nothing but other Args runs between an Arg and its Call, so they stay intact.
+// Stack arguments take a full 8 byte push, of which the callee reads the low dword.
+static void generate_arg(CodeGen* gen, IRInstr* instr)
+{
+    const long index = instr->imm;
+
+    if (index < QXC_ARG_REGISTER_COUNT) {
+        emit(gen, X86Op::Mov, x86_reg(s_arg_regs[index], QXC_INT_SIZE),
+             vreg_operand(gen, instr->args[0]));
+        return;
+    }
+
+    // the first stack argument we see is the last one, keep rsp 16 byte aligned
+    // at the call once all of them are pushed
+    if (gen->call_stack_bytes == 0) {
+        const long stack_args = index - QXC_ARG_REGISTER_COUNT + 1;
+        if (stack_args % 2 != 0) {
+            emit(gen, X86Op::Sub, x86_reg(X86Reg::RSP), x86_imm(8));
+            gen->call_stack_bytes += 8;
         }
+    }
 
-        case ExprType::VariableRef:
-            if (!stack_offsets_contains(offsets, node->referenced_var_name)) {
-                fprintf(stderr, "referenced unknown variable: %s\n",
-                        node->referenced_var_name);
-                exit(EXIT_FAILURE);
-            }
-            emit(gen, "mov rax, [rbp + %d]",
-                 stack_offsets_lookup(offsets, node->referenced_var_name));
-            return;
+    emit(gen, X86Op::Push, vreg_operand(gen, instr->args[0], 8));
+    gen->call_stack_bytes += 8;
+}
+
+static void generate_call(CodeGen* gen, IRInstr* instr)
+{
+    emit(gen, X86Op::Call, x86_symbol(instr->callee));
+
+    if (gen->call_stack_bytes > 0) {
+        emit(gen, X86Op::Add, x86_reg(X86Reg::RSP), x86_imm(gen->call_stack_bytes));
+        gen->call_stack_bytes = 0;
+    }
+
+    emit(gen, X86Op::Mov, vreg_operand(gen, instr->dst), rax());
+}
+
+// restore callee-saved registers and pop the frame, leaving rsp where it was on entry
+static void generate_frame_teardown(CodeGen* gen)
+{
+    for (int r = 0; r < gen->used_register_count; r++) {
+        emit(gen, X86Op::Mov, x86_reg(s_allocatable_regs[r]), saved_register_operand(gen, r));
+    }
+    emit(gen, X86Op::Mov, x86_reg(X86Reg::RSP), x86_reg(X86Reg::RBP));
+    emit(gen, X86Op::Pop, x86_reg(X86Reg::RBP));
+}
+
+// A call whose result is returned right away can reuse our frame: tear it down and
+// jump, the callee then returns straight to our caller. Calls passing arguments on
+// the stack are excluded, those would have to go where our own return address is.
+static bool is_tail_call(CodeGen* gen, IRInstr* instr, IRInstr* next)
+{
+    return gen->options->tail_calls && instr->opcode == IROpcode::Call &&
+           instr->imm <= QXC_ARG_REGISTER_COUNT && next &&
+           next->opcode == IROpcode::Return && next->args[0] == instr->dst;
+}
 
+static void generate_tail_call(CodeGen* gen, IRInstr* call)
+{
+    generate_frame_teardown(gen);
+    emit(gen, X86Op::Jmp, x86_symbol(call->callee));
+}
+
+static bool is_compare(IROpcode opcode)
+{
+    switch (opcode) {
+        case IROpcode::Equal:
+        case IROpcode::NotEqual:
+        case IROpcode::LessThan:
+        case IROpcode::LessEqual:
+        case IROpcode::GreaterThan:
+        case IROpcode::GreaterEqual:
+        case IROpcode::LogicalNot:
+            return true;
         default:
-            QXC_UNREACHABLE();
-            return;
+            return false;
+    }
+}
+
+// A compare whose only use is the branch right after it doesn't need its result as
+// 0/1 in a register, the branch can jump on the flags directly.
+static bool fuses_with_branch(CodeGen* gen, IRInstr* instr, IRInstr* next)
+{
+    return next && next->opcode == IROpcode::Branch && is_compare(instr->opcode) &&
+           next->args[0] == instr->dst && gen->use_counts[(size_t)instr->dst] == 1;
+}
+
+// the cmp of a compare, which leaves its outcome in the flags
+static void generate_compare_flags(CodeGen* gen, IRInstr* compare)
+{
+    if (compare->opcode == IROpcode::LogicalNot) {
+        generate_cmp(gen, compare->args[0], x86_imm(0));
+    }
+    else {
+        generate_cmp(gen, compare->args[0], vreg_operand(gen, compare->args[1]));
+    }
+}
+
+static void generate_compare_branch(CodeGen* gen, IRInstr* compare, IRInstr* branch)
+{
+    generate_compare_flags(gen, compare);
+    emit_cond(gen, X86Op::Jcc, compare_cond(compare->opcode), block_label(branch->targets[0]));
+    emit(gen, X86Op::Jmp, block_label(branch->targets[1]));
+}
+
+// --------------------------------------------------------------------------------
+// select
+//
+// dst = c ? a : b without a branch: the flags of c's compare (or of testing c), then
+// b moved into dst and a conditionally moved over it:
+//
+//       cmp ebx, r12d
+//       mov r13d, r14d            ; b
+//       cmovl r13d, r12d          ; a
+//
+// cmov can't take an immediate, those go through rcx first. Picking between two
+// constants one apart needs no cmov at all, c ? k + 1 : k is k + (c != 0):
+//
+//       setl r13b
+//       movzx r13d, r13b
+//       add r13d, k
+
+// a compare only feeding the select right after it, which then uses its flags
+static bool fuses_with_select(CodeGen* gen, IRInstr* instr, IRInstr* next)
+{
+    return next && next->opcode == IROpcode::Select && is_compare(instr->opcode) &&
+           next->args[0] == instr->dst && gen->use_counts[(size_t)instr->dst] == 1;
+}
+
+// compare is the fused compare computing the condition, nullptr if there's none
+static void generate_select(CodeGen* gen, IRInstr* select, IRInstr* compare)
+{
+    const int dst = select->dst;
+    const int a = select->args[1];
+    const int b = select->args[2];
+    const X86Operand rcx = x86_reg(X86Reg::RCX, QXC_INT_SIZE);
+
+    X86Cond cond = X86Cond::NE;
+    if (compare) {
+        generate_compare_flags(gen, compare);
+        cond = compare_cond(compare->opcode);
+    }
+    else {
+        generate_cmp(gen, select->args[0], x86_imm(0));
+    }
+
+    // computed in rax if dst doesn't live in a register
+    const X86Reg result = in_register(gen, dst) ? vreg_operand(gen, dst).reg : X86Reg::RAX;
+
+    const long difference = vreg_location(gen, a).value - vreg_location(gen, b).value;
+    if (is_immediate(gen, a) && is_immediate(gen, b) && (difference == 1 || difference == -1)) {
+        const bool a_is_larger = difference == 1;
+        emit_cond(gen, X86Op::Setcc, a_is_larger ? cond : x86_negate_cond(cond),
+                  x86_reg(result, 1));
+        emit(gen, X86Op::Movzx, x86_reg(result, QXC_INT_SIZE), x86_reg(result, 1));
+        emit(gen, X86Op::Add, x86_reg(result, QXC_INT_SIZE),
+             vreg_operand(gen, a_is_larger ? b : a));
+    }
+    else if (same_register(gen, dst, a)) {
+        // dst already holds a, b replaces it if the condition doesn't hold
+        X86Operand value = vreg_operand(gen, b);
+        if (is_immediate(gen, b)) {
+            emit(gen, X86Op::Mov, rcx, value);
+            value = rcx;
+        }
+        emit_cond(gen, X86Op::Cmov, x86_negate_cond(cond), x86_reg(result, QXC_INT_SIZE),
+                  value);
+    }
+    else {
+        X86Operand value = vreg_operand(gen, a);
+        if (is_immediate(gen, a)) {
+            emit(gen, X86Op::Mov, rcx, value);
+            value = rcx;
+        }
+        if (!same_register(gen, dst, b)) {
+            emit(gen, X86Op::Mov, x86_reg(result, QXC_INT_SIZE), vreg_operand(gen, b));
+        }
+        emit_cond(gen, X86Op::Cmov, cond, x86_reg(result, QXC_INT_SIZE), value);
+    }
+
+    if (!in_register(gen, dst)) {
+        emit(gen, X86Op::Mov, vreg_operand(gen, dst), rax());
+    }
+}
+
+// --------------------------------------------------------------------------------
+// switch dispatch
+//
+// The controlling value is kept in eax while its cases are binary searched. Runs of
+// cases dense enough for ir_switch_cases_are_dense, down to the whole switch, jump
+// through a table instead:
+//
+//       sub eax, min
+//       cmp eax, max - min
+//       ja default                ; below min wraps around to a huge unsigned value
+//       movsxd rax, eax           ; the index, as wide as the address it goes into
+//       lea rcx, [rel table]
+//       movsxd rax, dword [rcx + rax*4]
+//       add rax, rcx
+//       jmp rax
+//   table:
+//       dd case_min - table       ; and so on, values without a case go to default
+//
+// Entries are offsets from the table rather than addresses, so the table can sit in
+// .text right behind the jump and needs no relocations. No table comes near 2^31
+// entries, so once the index passed the bounds check, sign extending it is the same as
+// zero extending it.
+
+// up to this many cases are compared against one after another
+#define QXC_LINEAR_SEARCH_CASES 3
+
+static void generate_jump_table(CodeGen* gen, const IRSwitchCase* cases, size_t count,
+                                IRBlock* default_block)
+{
+    const X86Operand rcx = x86_reg(X86Reg::RCX);
+    const X86Operand table = new_label(gen);
+    const unsigned long min = (unsigned long)cases[0].value;
+    const unsigned long last_entry = (unsigned long)cases[count - 1].value - min;
+
+    emit(gen, X86Op::Sub, rax(), x86_imm(cases[0].value));
+    emit(gen, X86Op::Cmp, rax(), x86_imm((long)last_entry));
+    emit_cond(gen, X86Op::Jcc, X86Cond::A, block_label(default_block));
+    emit(gen, X86Op::Movsxd, rax(8), rax());
+    emit(gen, X86Op::Lea, rcx, x86_label_address((int)table.value));
+    emit(gen, X86Op::Movsxd, rax(8), x86_mem_indexed(X86Reg::RCX, X86Reg::RAX, 4, 4));
+    emit(gen, X86Op::Add, rax(8), rcx);
+    emit(gen, X86Op::Jmp, rax(8));
+
+    X86Instr* label = emit(gen, X86Op::Label, table);
+    label->operands[1] = x86_imm(4);
+
+    size_t next_case = 0;
+    for (unsigned long entry = 0; entry <= last_entry; entry++) {
+        IRBlock* target = default_block;
+        if ((unsigned long)cases[next_case].value - min == entry) {
+            target = cases[next_case++].target;
+        }
+        emit(gen, X86Op::JumpTableEntry, block_label(target), table);
     }
 }
 
-static void generate_statement_asm(CodeGen* gen, StackOffsets* offsets,
-                                   StatementNode* statement_node)
+// Compares against the middle case, then continues with the cases above it and
+// those below it, log2(count) compares deep. Recursing only that deep is fine.
+static void generate_case_search(CodeGen* gen, const IRSwitchCase* cases, size_t count,
+                                 IRBlock* default_block)
 {
-    assert(statement_node);
-    switch (statement_node->type) {
-        case StatementType::Return:
-            generate_expression_asm(gen, offsets, statement_node->return_expr);
-            emit(gen, "mov rdi, rax");
-            emit(gen, "mov rax, 60");  // syscall for exit
-            emit(gen, "syscall");
+    if (ir_switch_cases_are_dense(cases, count)) {
+        generate_jump_table(gen, cases, count, default_block);
+        return;
+    }
+
+    if (count <= QXC_LINEAR_SEARCH_CASES) {
+        for (size_t i = 0; i < count; i++) {
+            emit(gen, X86Op::Cmp, rax(), x86_imm(cases[i].value));
+            emit_cond(gen, X86Op::Jcc, X86Cond::E, block_label(cases[i].target));
+        }
+        emit(gen, X86Op::Jmp, block_label(default_block));
+        return;
+    }
+
+    const size_t middle = count / 2;
+    const X86Operand below = new_label(gen);
+
+    emit(gen, X86Op::Cmp, rax(), x86_imm(cases[middle].value));
+    emit_cond(gen, X86Op::Jcc, X86Cond::E, block_label(cases[middle].target));
+    emit_cond(gen, X86Op::Jcc, X86Cond::L, below);
+    generate_case_search(gen, cases + middle + 1, count - middle - 1, default_block);
+
+    emit(gen, X86Op::Label, below);
+    generate_case_search(gen, cases, middle, default_block);
+}
+
+static void generate_instr(CodeGen* gen, IRInstr* instr)
+{
+    switch (instr->opcode) {
+        case IROpcode::Const:
+            break;  // always an immediate, see allocate_registers
+
+        case IROpcode::Neg:
+        case IROpcode::Not:
+            generate_unary_instr(gen, instr);
+            break;
+
+        case IROpcode::LogicalNot:
+            generate_cmp(gen, instr->args[0], x86_imm(0));
+            generate_setcc(gen, instr->opcode, instr->dst);
             break;
 
-        case StatementType::StandAloneExpr:
-            generate_expression_asm(gen, offsets, statement_node->standalone_expr);
+        case IROpcode::Add:
+        case IROpcode::Sub:
+        case IROpcode::Mul:
+        case IROpcode::And:
+        case IROpcode::Or:
+        case IROpcode::Xor:
+            generate_alu_instr(gen, instr);
             break;
 
-        case StatementType::IfElse: {
-            JumpLabel else_label, post_label;
-            build_conditional_expr_jump_labels(gen, &else_label, &post_label);
+        case IROpcode::Div:
+        case IROpcode::Mod:
+            generate_div_instr(gen, instr);
+            break;
 
-            IfElseStatement* ifelse_stmt = statement_node->ifelse_statement;
+        case IROpcode::Shl:
+        case IROpcode::Shr:
+            generate_shift_instr(gen, instr);
+            break;
 
-            // TODO: switch all nullptr to nullptr
-            if (ifelse_stmt->else_branch_statement != nullptr) {
-                generate_expression_asm(gen, offsets, ifelse_stmt->conditional_expr);
-                emit(gen, "cmp rax, 0");
-                emit(gen, "je %s", else_label.buffer);
-                generate_statement_asm(gen, offsets, ifelse_stmt->if_branch_statement);
-                emit(gen, "jmp %s", post_label.buffer);
-                emit(gen, "\n%s:", else_label.buffer);
-                generate_statement_asm(gen, offsets, ifelse_stmt->else_branch_statement);
-                emit(gen, "\n%s:", post_label.buffer);
+        case IROpcode::Equal:
+        case IROpcode::NotEqual:
+        case IROpcode::LessThan:
+        case IROpcode::LessEqual:
+        case IROpcode::GreaterThan:
+        case IROpcode::GreaterEqual:
+            generate_cmp(gen, instr->args[0], vreg_operand(gen, instr->args[1]));
+            generate_setcc(gen, instr->opcode, instr->dst);
+            break;
+
+        case IROpcode::Select:
+            generate_select(gen, instr, nullptr);
+            break;
+
+        case IROpcode::Load:
+            generate_load(gen, instr->dst, slot_operand(instr->imm));
+            break;
+
+        case IROpcode::Store:
+            generate_store(gen, slot_operand(instr->imm), instr->args[0]);
+            break;
+
+        case IROpcode::LoadGlobal:
+            generate_load(gen, instr->dst, global_operand(gen, instr->imm));
+            break;
+
+        case IROpcode::StoreGlobal:
+            generate_store(gen, global_operand(gen, instr->imm), instr->args[0]);
+            break;
+
+        case IROpcode::Param:
+            generate_param(gen, instr);
+            break;
+
+        case IROpcode::Arg:
+            generate_arg(gen, instr);
+            break;
+
+        case IROpcode::Call:
+            generate_call(gen, instr);
+            break;
+
+        case IROpcode::Jump:
+            emit(gen, X86Op::Jmp, block_label(instr->targets[0]));
+            break;
+
+        case IROpcode::Branch:
+            if (is_immediate(gen, instr->args[0])) {
+                const bool taken = vreg_location(gen, instr->args[0]).value != 0;
+                emit(gen, X86Op::Jmp, block_label(instr->targets[taken ? 0 : 1]));
             }
             else {
-                generate_expression_asm(gen, offsets, ifelse_stmt->conditional_expr);
-                emit(gen, "cmp rax, 0");
-                emit(gen, "je %s", post_label.buffer);
-                generate_statement_asm(gen, offsets, ifelse_stmt->if_branch_statement);
-                emit(gen, "\n%s:", post_label.buffer);
+                emit(gen, X86Op::Cmp, vreg_operand(gen, instr->args[0]), x86_imm(0));
+                emit_cond(gen, X86Op::Jcc, X86Cond::NE, block_label(instr->targets[0]));
+                emit(gen, X86Op::Jmp, block_label(instr->targets[1]));
             }
             break;
-        }
+
+        case IROpcode::Switch:
+            emit(gen, X86Op::Mov, rax(), vreg_operand(gen, instr->args[0]));
+            generate_case_search(gen, instr->cases, (size_t)instr->imm, instr->targets[0]);
+            break;
+
+        case IROpcode::Return:
+            emit(gen, X86Op::Mov, rax(), vreg_operand(gen, instr->args[0]));
+            emit(gen, X86Op::Jmp, epilogue_label(gen));
+            break;
 
         default:
             QXC_UNREACHABLE();
             break;
     }
-    return;
 }
 
-static void generate_declaration_asm(CodeGen* gen, StackOffsets* offsets,
-                                     Declaration* declaration)
+// leaves the final, peephole optimized instructions of fn in gen->instrs
+static void generate_function_instrs(CodeGen* gen, IRFunction* fn)
 {
-    if (stack_offsets_contains(offsets, declaration->var_name)) {
-        fprintf(stderr, "variable declared twice: %s\n", declaration->var_name);
-        exit(EXIT_FAILURE);
+    gen->fn = fn;
+    gen->label_count = (int)fn->blocks.length + 1;
+    allocate_registers(gen, fn);
+    array_clear(&gen->instrs);
+
+    // the whole frame is known up front: variable slots, then spills, then the saved
+    // callee-saved registers. With rbp pushed, keeping it a multiple of 16 leaves rsp
+    // aligned for calls.
+    long frame_size = 8 * (fn->slot_count + gen->spill_count + gen->used_register_count);
+    frame_size = (frame_size + 15) & ~15;
+
+    emit(gen, X86Op::Push, x86_reg(X86Reg::RBP));
+    emit(gen, X86Op::Mov, x86_reg(X86Reg::RBP), x86_reg(X86Reg::RSP));
+    if (frame_size > 0) {
+        emit(gen, X86Op::Sub, x86_reg(X86Reg::RSP), x86_imm(frame_size));
     }
-
-    if (declaration->initializer_expr) {
-        // push initializer expression value onto stack
-        generate_expression_asm(gen, offsets, declaration->initializer_expr);
-        emit(gen, "push rax");
+    for (int r = 0; r < gen->used_register_count; r++) {
+        emit(gen, X86Op::Mov, saved_register_operand(gen, r), x86_reg(s_allocatable_regs[r]));
     }
-    else {
-        // push uninitialized value onto stack.
-        emit(gen, "push 0");
+
+    for (IRBlock* block : fn->blocks) {
+        X86Instr* label = emit(gen, X86Op::Label, block_label(block));
+        if (block->loop_header) {
+            label->operands[1] = x86_imm(QXC_LOOP_ALIGNMENT);
+        }
+
+        for (size_t i = 0; i < block->instrs.length; i++) {
+            IRInstr* instr = &block->instrs[i];
+            IRInstr* next = i + 1 < block->instrs.length ? &block->instrs[i + 1] : nullptr;
+
+            // the load and the operation of an update happen as part of its store
+            if (updated_in_memory(gen, instr->dst)) continue;
+
+            if (fuses_with_branch(gen, instr, next)) {
+                generate_compare_branch(gen, instr, next);
+                break;
+            }
+
+            if (fuses_with_select(gen, instr, next)) {
+                generate_select(gen, next, instr);
+                i++;
+                continue;
+            }
+
+            if (is_tail_call(gen, instr, next)) {
+                generate_tail_call(gen, instr);
+                break;
+            }
+
+            generate_instr(gen, instr);
+        }
     }
 
-    // associate newly pushed stack value with the corresponding new variable
-    stack_offsets_insert(offsets, declaration->var_name);
+    emit(gen, X86Op::Label, epilogue_label(gen));
+    generate_frame_teardown(gen);
+    emit(gen, X86Op::Ret);
+
+    peephole_optimize(&gen->instrs, gen->peephole_stats);
+}
+
+// minimal process entry point: call main and exit with its return value
+void generate_start_asm(const char* output_filepath)
+{
+    FILE* out = fopen(output_filepath, "w");
+    fprintf(out, "  global _start\n");
+    fprintf(out, "  extern main\n");
+    fprintf(out, "  section .text\n");
+    fprintf(out, "\n_start:\n");
+    fprintf(out, "  call main\n");
+    fprintf(out, "  mov rdi, rax\n");
+    fprintf(out, "  mov rax, 60\n");  // syscall for exit
+    fprintf(out, "  syscall\n");
+    fprintf(out, "\n  section .note.GNU-stack noalloc noexec nowrite progbits\n");
+    fclose(out);
 }
 
-static void generate_block_item_asm(CodeGen* gen, StackOffsets* offsets,
-                                    BlockItemNode* block_item)
+// Globals with an initial value go into .data. Zero initialized ones go into .bss,
+// which takes no space in the binary and is zero filled by the loader.
+static void generate_globals(FILE* out, IRProgram* program)
 {
-    if (block_item->type == BlockItemType::Statement) {
-        generate_statement_asm(gen, offsets, block_item->statement);
+    bool any_data = false;
+    bool any_bss = false;
+    for (const IRGlobal& global : program->globals) {
+        any_data |= global.value != 0;
+        any_bss |= global.value == 0;
     }
-    else if (block_item->type == BlockItemType::Declaration) {
-        generate_declaration_asm(gen, offsets, block_item->declaration);
+
+    if (any_data) {
+        fprintf(out, "\n  section .data\n");
+        fprintf(out, "  align 4\n");
+        for (const IRGlobal& global : program->globals) {
+            if (global.value != 0) fprintf(out, "%s:\n  dd %ld\n", global.name, global.value);
+        }
     }
-    else {
-        assert(block_item->type == BlockItemType::Invalid);
-        debug_print("invalid block item encountered in code generation");
+
+    if (any_bss) {
+        fprintf(out, "\n  section .bss\n");
+        fprintf(out, "  align 4\n");
+        for (const IRGlobal& global : program->globals) {
+            if (global.value == 0) fprintf(out, "%s:\n  resd 1\n", global.name);
+        }
     }
 }
 
-// static void generate_function_asm(struct qxc_godegen* gen) {}
-
-void generate_asm(Program* program, const char* output_filepath)
+static void codegen_init(CodeGen* gen, IRProgram* program, const CompileOptions* options,
+                         PeepholeStats* peephole_stats)
 {
-    CodeGen gen;
-    gen.indent_level = 0;
+    gen->asm_output = nullptr;
+    gen->options = options;
+    gen->program = program;
+    gen->fn = nullptr;
+    gen->locations = heap_array_create<Location>(0);
+    gen->use_counts = heap_array_create<int>(0);
+    gen->updates_in_memory = heap_array_create<IRInstr*>(0);
+    gen->spill_count = 0;
+    gen->used_register_count = 0;
+    gen->call_stack_bytes = 0;
+    gen->label_count = 0;
+    gen->instrs = heap_array_create<X86Instr>(0);
+    gen->peephole_stats = peephole_stats;
+}
 
-    gen.logical_or_counter = 0;
-    gen.logical_and_counter = 0;
-    gen.conditional_expr_counter = 0;
+static void codegen_free(CodeGen* gen)
+{
+    array_free(&gen->locations);
+    array_free(&gen->use_counts);
+    array_free(&gen->updates_in_memory);
+    array_free(&gen->instrs);
+}
 
-    gen.asm_output = fopen(output_filepath, "w");
+void generate_asm(IRProgram* program, const char* output_filepath,
+                  const CompileOptions* options, PeepholeStats* peephole_stats)
+{
+    TRACE_SPAN(TraceCategory::Codegen, "codegen");
 
-    gen.indent_level++;
-    emit(&gen, "global _start");
-    emit(&gen, "section .text");
-    gen.indent_level--;
-    emit(&gen, "\n_start:");
-    gen.indent_level++;
+    CodeGen gen;
+    codegen_init(&gen, program, options, peephole_stats);
+    defer { codegen_free(&gen); };
 
-    emit(&gen, "push rbp");
-    emit(&gen, "mov rbp, rsp");
+    gen.asm_output = fopen(output_filepath, "w");
 
-    // TODO: we'll have to revisit this once we start to compile programs with
-    // functions other than 'main'.
-    StackOffsets offsets;
+    for (IRFunction* fn : program->functions) {
+        fprintf(gen.asm_output, "  global %s\n", fn->name);
+    }
+    for (const IRGlobal& global : program->globals) {
+        fprintf(gen.asm_output, "  global %s\n", global.name);
+    }
+    for (const char* name : program->externs) {
+        fprintf(gen.asm_output, "  extern %s\n", name);
+    }
+    fprintf(gen.asm_output, "  section .text\n");
 
-    if (program->main_decl != nullptr) {
-        for (BlockItemNode* b : program->main_decl->block_items) {
-            generate_block_item_asm(&gen, &offsets, b);
-        }
+    for (IRFunction* fn : program->functions) {
+        generate_function_instrs(&gen, fn);
+        fprintf(gen.asm_output, "\n%s:\n", fn->name);
+        x86_print_instrs(gen.asm_output, &gen.instrs, fn->name);
     }
 
-    emit(&gen, "");
-    emit(&gen, "mov rsp, rbp");
-    emit(&gen, "pop rbp");
-    emit(&gen, "ret");
-    gen.indent_level--;
+    generate_globals(gen.asm_output, program);
 
-    fclose(gen.asm_output);
+    // we never need an executable stack
+    fprintf(gen.asm_output, "\n  section .note.GNU-stack noalloc noexec nowrite progbits\n");
 
-    qxc_memory_pool_release(program->pool);
+    fclose(gen.asm_output);
 }
 
+void generate_machine_code(IRProgram* program, const CompileOptions* options,
+                           PeepholeStats* peephole_stats, X86Code* code,
+                           DynHeapArray<size_t>* function_offsets)
+{
+    TRACE_SPAN(TraceCategory::Codegen, "codegen");
+
+    CodeGen gen;
+    codegen_init(&gen, program, options, peephole_stats);
+    defer { codegen_free(&gen); };
+
+    for (IRFunction* fn : program->functions) {
+        generate_function_instrs(&gen, fn);
+
+        // functions start on a fresh 16 byte fetch block, padded with int3
+        while (code->bytes.length % 16 != 0) {
+            array_append(&code->bytes, (uint8_t)0xcc);
+        }
+        array_append(function_offsets, code->bytes.length);
+        x86_encode_instrs(code, &gen.instrs);
+    }
+}
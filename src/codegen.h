@@ -2,6 +2,20 @@
 
 #include <stdbool.h>
 
-#include "ast.h"
+#include "ir.h"
+#include "options.h"
+#include "peephole.h"
+#include "x86.h"
 
-void generate_asm(Program* program, const char* output_filepath);
+// peephole_stats may be nullptr
+void generate_asm(IRProgram* program, const char* output_filepath,
+                  const CompileOptions* options, PeepholeStats* peephole_stats);
+
+// Appends the machine code of every function to code, and where each starts to
+// function_offsets (in program->functions order). For running the program in process.
+void generate_machine_code(IRProgram* program, const CompileOptions* options,
+                           PeepholeStats* peephole_stats, X86Code* code,
+                           DynHeapArray<size_t>* function_offsets);
+
+// a _start entry point calling main, for linking without libc
+void generate_start_asm(const char* output_filepath);
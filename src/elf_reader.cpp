@@ -0,0 +1,100 @@
+#include "elf_reader.h"
+
+#include <elf.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "prelude.h"
+
+#define ELF_ERROR(...)                                  \
+    do {                                                \
+        fprintf(stderr, "%s: ", object_filepath);       \
+        fprintf(stderr, __VA_ARGS__);                   \
+        fprintf(stderr, "\n");                          \
+    } while (0)
+
+// whether [offset, offset + size) lies within a file of file_size bytes
+static bool in_bounds(size_t file_size, uint64_t offset, uint64_t size)
+{
+    return offset <= file_size && size <= file_size - offset;
+}
+
+int elf_read_symbols(const char* object_filepath, ObjectCacheSymbols* symbols)
+{
+    FILE* f = fopen(object_filepath, "rb");
+    if (f == nullptr) {
+        ELF_ERROR("cannot open object file");
+        return -1;
+    }
+    defer { fclose(f); };
+
+    fseek(f, 0, SEEK_END);
+    const long file_size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    if (file_size < (long)sizeof(Elf64_Ehdr)) {
+        ELF_ERROR("not an ELF object file");
+        return -1;
+    }
+
+    uint8_t* contents = (uint8_t*)malloc((size_t)file_size);
+    defer { free(contents); };
+    if (fread(contents, 1, (size_t)file_size, f) != (size_t)file_size) {
+        ELF_ERROR("cannot read object file");
+        return -1;
+    }
+    const size_t size = (size_t)file_size;
+
+    const Elf64_Ehdr* header = (const Elf64_Ehdr*)contents;
+    if (memcmp(header->e_ident, ELFMAG, SELFMAG) != 0 ||
+        header->e_ident[EI_CLASS] != ELFCLASS64 || header->e_ident[EI_DATA] != ELFDATA2LSB ||
+        header->e_machine != EM_X86_64 || header->e_type != ET_REL ||
+        header->e_shentsize != sizeof(Elf64_Shdr) ||
+        !in_bounds(size, header->e_shoff, (uint64_t)header->e_shnum * sizeof(Elf64_Shdr))) {
+        ELF_ERROR("not an x86-64 relocatable ELF object");
+        return -1;
+    }
+
+    const Elf64_Shdr* sections = (const Elf64_Shdr*)(contents + header->e_shoff);
+
+    for (int i = 0; i < header->e_shnum; i++) {
+        const Elf64_Shdr* symtab = &sections[i];
+        if (symtab->sh_type != SHT_SYMTAB) continue;
+
+        if (symtab->sh_link >= header->e_shnum ||
+            !in_bounds(size, symtab->sh_offset, symtab->sh_size)) {
+            ELF_ERROR("malformed symbol table");
+            return -1;
+        }
+        const Elf64_Shdr* strtab = &sections[symtab->sh_link];
+        if (!in_bounds(size, strtab->sh_offset, strtab->sh_size) || strtab->sh_size == 0 ||
+            contents[strtab->sh_offset + strtab->sh_size - 1] != '\0') {
+            ELF_ERROR("malformed string table");
+            return -1;
+        }
+        const char* names = (const char*)contents + strtab->sh_offset;
+
+        const Elf64_Sym* syms = (const Elf64_Sym*)(contents + symtab->sh_offset);
+        const size_t sym_count = symtab->sh_size / sizeof(Elf64_Sym);
+
+        // the first entry is the reserved null symbol
+        for (size_t s = 1; s < sym_count; s++) {
+            const Elf64_Sym* sym = &syms[s];
+            if (ELF64_ST_BIND(sym->st_info) == STB_LOCAL) continue;
+            if (sym->st_name >= strtab->sh_size) {
+                ELF_ERROR("malformed symbol name");
+                return -1;
+            }
+
+            char* name = strdup(names + sym->st_name);
+            if (sym->st_shndx == SHN_UNDEF) {
+                array_append(&symbols->external_functions, name);
+            }
+            else {
+                array_append(&symbols->defined_functions, name);
+            }
+        }
+    }
+
+    return 0;
+}
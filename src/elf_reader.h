@@ -0,0 +1,9 @@
+#pragma once
+
+#include "object_cache.h"
+
+// Reads the global symbols of an ELF64 relocatable object, so objects compiled
+// earlier (qxc -c) can be linked alongside fresh translation units: defined symbols
+// go to defined_functions and undefined ones to external_functions.
+// Returns -1 if the file is not such an object.
+int elf_read_symbols(const char* object_filepath, ObjectCacheSymbols* symbols);
@@ -0,0 +1,1945 @@
+#include "ir.h"
+
+#include <assert.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "array.h"
+#include "prelude.h"
+#include "trace.h"
+
+const char* ir_opcode_to_str(IROpcode opcode)
+{
+    switch (opcode) {
+        case IROpcode::Const:
+            return "const";
+        case IROpcode::Neg:
+            return "neg";
+        case IROpcode::Not:
+            return "not";
+        case IROpcode::LogicalNot:
+            return "lnot";
+        case IROpcode::Add:
+            return "add";
+        case IROpcode::Sub:
+            return "sub";
+        case IROpcode::Mul:
+            return "mul";
+        case IROpcode::Div:
+            return "div";
+        case IROpcode::Mod:
+            return "mod";
+        case IROpcode::And:
+            return "and";
+        case IROpcode::Or:
+            return "or";
+        case IROpcode::Xor:
+            return "xor";
+        case IROpcode::Shl:
+            return "shl";
+        case IROpcode::Shr:
+            return "shr";
+        case IROpcode::Equal:
+            return "eq";
+        case IROpcode::NotEqual:
+            return "ne";
+        case IROpcode::LessThan:
+            return "lt";
+        case IROpcode::LessEqual:
+            return "le";
+        case IROpcode::GreaterThan:
+            return "gt";
+        case IROpcode::GreaterEqual:
+            return "ge";
+        case IROpcode::Select:
+            return "select";
+        case IROpcode::Load:
+            return "load";
+        case IROpcode::Store:
+            return "store";
+        case IROpcode::LoadGlobal:
+            return "load";
+        case IROpcode::StoreGlobal:
+            return "store";
+        case IROpcode::Param:
+            return "param";
+        case IROpcode::Arg:
+            return "arg";
+        case IROpcode::Call:
+            return "call";
+        case IROpcode::Jump:
+            return "jump";
+        case IROpcode::Branch:
+            return "branch";
+        case IROpcode::Switch:
+            return "switch";
+        case IROpcode::Return:
+            return "ret";
+        default:
+            return nullptr;
+    }
+}
+
+bool ir_opcode_is_terminator(IROpcode opcode)
+{
+    switch (opcode) {
+        case IROpcode::Jump:
+            return true;
+        case IROpcode::Branch:
+            return true;
+        case IROpcode::Switch:
+            return true;
+        case IROpcode::Return:
+            return true;
+        default:
+            return false;
+    }
+}
+
+bool ir_opcode_is_unary(IROpcode opcode)
+{
+    switch (opcode) {
+        case IROpcode::Neg:
+            return true;
+        case IROpcode::Not:
+            return true;
+        case IROpcode::LogicalNot:
+            return true;
+        default:
+            return false;
+    }
+}
+
+bool ir_opcode_is_binary(IROpcode opcode)
+{
+    switch (opcode) {
+        case IROpcode::Add:
+        case IROpcode::Sub:
+        case IROpcode::Mul:
+        case IROpcode::Div:
+        case IROpcode::Mod:
+        case IROpcode::And:
+        case IROpcode::Or:
+        case IROpcode::Xor:
+        case IROpcode::Shl:
+        case IROpcode::Shr:
+        case IROpcode::Equal:
+        case IROpcode::NotEqual:
+        case IROpcode::LessThan:
+        case IROpcode::LessEqual:
+        case IROpcode::GreaterThan:
+        case IROpcode::GreaterEqual:
+            return true;
+        default:
+            return false;
+    }
+}
+
+bool ir_evaluate_constant(IROpcode opcode, long a, long b, long* result)
+{
+    // wrap around on overflow like the generated code does, rather than invoking UB
+    const unsigned long ua = (unsigned long)a;
+    const unsigned long ub = (unsigned long)b;
+
+    switch (opcode) {
+        case IROpcode::Neg:
+            *result = ir_wrap_int(0UL - ua);
+            return true;
+        case IROpcode::Not:
+            *result = ~a;
+            return true;
+        case IROpcode::LogicalNot:
+            *result = a == 0;
+            return true;
+        case IROpcode::Add:
+            *result = ir_wrap_int(ua + ub);
+            return true;
+        case IROpcode::Sub:
+            *result = ir_wrap_int(ua - ub);
+            return true;
+        case IROpcode::Mul:
+            *result = ir_wrap_int(ua * ub);
+            return true;
+        case IROpcode::Div:
+            if (b == 0 || (a == INT_MIN && b == -1)) return false;  // traps at runtime
+            *result = a / b;
+            return true;
+        case IROpcode::Mod:
+            if (b == 0 || (a == INT_MIN && b == -1)) return false;
+            *result = a % b;
+            return true;
+        case IROpcode::And:
+            *result = a & b;
+            return true;
+        case IROpcode::Or:
+            *result = a | b;
+            return true;
+        case IROpcode::Xor:
+            *result = a ^ b;
+            return true;
+        // the shift count is masked like x86 does
+        case IROpcode::Shl:
+            *result = ir_wrap_int(ua << (b & 31));
+            return true;
+        case IROpcode::Shr:
+            *result = a >> (b & 31);
+            return true;
+        case IROpcode::Equal:
+            *result = a == b;
+            return true;
+        case IROpcode::NotEqual:
+            *result = a != b;
+            return true;
+        case IROpcode::LessThan:
+            *result = a < b;
+            return true;
+        case IROpcode::LessEqual:
+            *result = a <= b;
+            return true;
+        case IROpcode::GreaterThan:
+            *result = a > b;
+            return true;
+        case IROpcode::GreaterEqual:
+            *result = a >= b;
+            return true;
+        default:
+            return false;
+    }
+}
+
+IRInstr* ir_block_terminator(IRBlock* block)
+{
+    if (block->instrs.length == 0) return nullptr;
+
+    IRInstr* last = &block->instrs[block->instrs.length - 1];
+    return ir_opcode_is_terminator(last->opcode) ? last : nullptr;
+}
+
+int ir_successor_count(const IRInstr* terminator)
+{
+    switch (terminator->opcode) {
+        case IROpcode::Jump:
+            return 1;
+        case IROpcode::Branch:
+            return 2;
+        case IROpcode::Switch:
+            return 1 + (int)terminator->imm;
+        default:
+            return 0;
+    }
+}
+
+IRBlock* ir_successor(const IRInstr* terminator, int index)
+{
+    if (terminator->opcode == IROpcode::Switch && index > 0) {
+        return terminator->cases[index - 1].target;
+    }
+    return terminator->targets[index];
+}
+
+// A table entry costs 4 bytes where a compare and branch is around 10, so tables
+// pay off well before every value in the range is used. Too few cases are faster to
+// just compare against.
+#define QXC_MIN_JUMP_TABLE_CASES 4
+#define QXC_MAX_JUMP_TABLE_SPARSENESS 3
+
+bool ir_switch_cases_are_dense(const IRSwitchCase* cases, size_t count)
+{
+    if (count < QXC_MIN_JUMP_TABLE_CASES) return false;
+
+    const unsigned long range =
+        (unsigned long)cases[count - 1].value - (unsigned long)cases[0].value;
+    return range < count * QXC_MAX_JUMP_TABLE_SPARSENESS;
+}
+
+// --------------------------------------------------------------------------------
+// AST -> IR lowering
+
+struct ScopedVariable {
+    const char* name;
+    int slot;
+};
+
+struct FunctionSignature {
+    const char* name;
+    size_t param_count;
+    bool is_defined;
+};
+
+struct GlobalVariable {
+    const char* name;
+    long value;
+    bool is_defined;  // has an initializer, "int x;" alone is only a tentative definition
+};
+
+struct LoopTargets {
+    IRBlock* break_target;
+    IRBlock* continue_target;
+};
+
+// a switch whose body is being lowered
+struct SwitchContext {
+    IRBlock* dispatch_block;  // ends in the Switch
+    size_t first_case;        // its cases are switch_cases[first_case..]
+    IRBlock* default_block;   // nullptr until "default:" comes up
+};
+
+struct ExprTask;
+struct StatementTask;
+
+struct IRBuilder {
+    IRProgram* program;
+    IRFunction* fn;
+    IRBlock* block;  // current insertion point
+
+    // visible variables, innermost last. scope_begin marks the first variable
+    // declared in the innermost block scope.
+    DynHeapArray<ScopedVariable> scope;
+    size_t scope_begin;
+
+    DynHeapArray<LoopTargets> loops;  // enclosing loops and switches, innermost last
+
+    DynHeapArray<SwitchContext> switches;  // enclosing switches, innermost last
+    DynHeapArray<IRSwitchCase> switch_cases;  // case labels seen so far, of all of them
+
+    DynHeapArray<FunctionSignature> functions;  // declared so far
+    DynHeapArray<GlobalVariable> globals;       // declared so far, indexed like the IR's
+
+    // work stacks of lower_expression and lower_block_items, kept for their capacity
+    DynHeapArray<ExprTask> expr_tasks;
+    DynHeapArray<int> expr_values;
+    DynHeapArray<StatementTask> statement_tasks;
+};
+
+struct SavedScope {
+    size_t scope_begin;
+    size_t scope_length;
+};
+
+#define LOWER_ERROR(...)              \
+    do {                              \
+        fprintf(stderr, __VA_ARGS__); \
+        fprintf(stderr, "\n");        \
+    } while (0)
+
+static IRBlock* create_block(IRBuilder* builder)
+{
+    return qxc_malloc<IRBlock>(builder->program->pool);
+}
+
+// append block to the function layout and make it the current insertion point
+static void place_block(IRBuilder* builder, IRBlock* block)
+{
+    assert(block->id == -1);
+    block->id = (int)builder->fn->blocks.length;
+    array_append(&builder->fn->blocks, block);
+    builder->block = block;
+}
+
+static IRInstr* emit_instr(IRBuilder* builder, IROpcode opcode)
+{
+    assert(ir_block_terminator(builder->block) == nullptr);
+
+    IRInstr* instr = array_extend(&builder->block->instrs);
+    new (instr) IRInstr();
+    instr->opcode = opcode;
+    return instr;
+}
+
+static int emit_value(IRBuilder* builder, IROpcode opcode, int a = -1, int b = -1)
+{
+    IRInstr* instr = emit_instr(builder, opcode);
+    instr->dst = builder->fn->vreg_count++;
+    instr->args[0] = a;
+    instr->args[1] = b;
+    return instr->dst;
+}
+
+static int emit_const(IRBuilder* builder, long value)
+{
+    IRInstr* instr = emit_instr(builder, IROpcode::Const);
+    instr->dst = builder->fn->vreg_count++;
+    instr->imm = value;
+    return instr->dst;
+}
+
+static int emit_load(IRBuilder* builder, int slot)
+{
+    IRInstr* instr = emit_instr(builder, IROpcode::Load);
+    instr->dst = builder->fn->vreg_count++;
+    instr->imm = slot;
+    return instr->dst;
+}
+
+static void emit_store(IRBuilder* builder, int slot, int value)
+{
+    IRInstr* instr = emit_instr(builder, IROpcode::Store);
+    instr->args[0] = value;
+    instr->imm = slot;
+}
+
+// variables are either slots of the function or globals, slot is -1 for a global
+static int emit_variable_load(IRBuilder* builder, int slot, int global)
+{
+    if (slot >= 0) return emit_load(builder, slot);
+
+    IRInstr* instr = emit_instr(builder, IROpcode::LoadGlobal);
+    instr->dst = builder->fn->vreg_count++;
+    instr->imm = global;
+    return instr->dst;
+}
+
+static void emit_variable_store(IRBuilder* builder, int slot, int global, int value)
+{
+    if (slot >= 0) {
+        emit_store(builder, slot, value);
+        return;
+    }
+
+    IRInstr* instr = emit_instr(builder, IROpcode::StoreGlobal);
+    instr->args[0] = value;
+    instr->imm = global;
+}
+
+static void emit_jump(IRBuilder* builder, IRBlock* target)
+{
+    IRInstr* instr = emit_instr(builder, IROpcode::Jump);
+    instr->targets[0] = target;
+}
+
+static void emit_branch(IRBuilder* builder, int cond, IRBlock* if_true, IRBlock* if_false)
+{
+    IRInstr* instr = emit_instr(builder, IROpcode::Branch);
+    instr->args[0] = cond;
+    instr->targets[0] = if_true;
+    instr->targets[1] = if_false;
+}
+
+// jump somewhere else, anything following in this block is unreachable but still has
+// to be lowered somewhere (and checked for errors)
+static void emit_jump_away(IRBuilder* builder, IRBlock* target)
+{
+    emit_jump(builder, target);
+    place_block(builder, create_block(builder));
+}
+
+static SavedScope begin_scope(IRBuilder* builder)
+{
+    SavedScope saved;
+    saved.scope_begin = builder->scope_begin;
+    saved.scope_length = builder->scope.length;
+    builder->scope_begin = builder->scope.length;
+    return saved;
+}
+
+static void end_scope(IRBuilder* builder, SavedScope saved)
+{
+    builder->scope.length = saved.scope_length;
+    builder->scope_begin = saved.scope_begin;
+}
+
+static int new_slot(IRBuilder* builder) { return builder->fn->slot_count++; }
+
+// the AST is released after lowering, so names referenced by the IR are copied
+static const char* copy_name(IRBuilder* builder, const char* name)
+{
+    const size_t length = strlen(name) + 1;
+    char* copy = qxc_malloc_str(builder->program->pool, length);
+    memcpy(copy, name, length);
+    return copy;
+}
+
+static FunctionSignature* lookup_function(IRBuilder* builder, const char* name)
+{
+    for (FunctionSignature& signature : builder->functions) {
+        if (strs_are_equal(signature.name, name)) return &signature;
+    }
+    return nullptr;
+}
+
+static int lookup_global(IRBuilder* builder, const char* name)
+{
+    for (size_t i = 0; i < builder->globals.length; i++) {
+        if (strs_are_equal(builder->globals[i].name, name)) return (int)i;
+    }
+    return -1;
+}
+
+static int lookup_variable(IRBuilder* builder, const char* name)
+{
+    for (size_t i = builder->scope.length; i > 0; i--) {
+        if (strs_are_equal(builder->scope[i - 1].name, name)) {
+            return builder->scope[i - 1].slot;
+        }
+    }
+
+    return -1;
+}
+
+static int declare_variable(IRBuilder* builder, const char* name)
+{
+    for (size_t i = builder->scope_begin; i < builder->scope.length; i++) {
+        if (strs_are_equal(builder->scope[i].name, name)) {
+            LOWER_ERROR("variable declared twice: %s", name);
+            return -1;
+        }
+    }
+
+    ScopedVariable var;
+    var.name = name;
+    var.slot = new_slot(builder);
+    array_append(&builder->scope, var);
+    return var.slot;
+}
+
+static IROpcode binop_opcode(Operator op)
+{
+    switch (op) {
+        case Operator::Plus:
+            return IROpcode::Add;
+        case Operator::Minus:
+            return IROpcode::Sub;
+        case Operator::Multiply:
+            return IROpcode::Mul;
+        case Operator::Divide:
+            return IROpcode::Div;
+        case Operator::Percent:
+            return IROpcode::Mod;
+        case Operator::BitwiseAND:
+            return IROpcode::And;
+        case Operator::BitwiseOR:
+            return IROpcode::Or;
+        case Operator::BitwiseXOR:
+            return IROpcode::Xor;
+        case Operator::BitShiftLeft:
+            return IROpcode::Shl;
+        case Operator::BitShiftRight:
+            return IROpcode::Shr;
+        case Operator::EqualTo:
+            return IROpcode::Equal;
+        case Operator::NotEqualTo:
+            return IROpcode::NotEqual;
+        case Operator::LessThan:
+            return IROpcode::LessThan;
+        case Operator::LessThanOrEqualTo:
+            return IROpcode::LessEqual;
+        case Operator::GreaterThan:
+            return IROpcode::GreaterThan;
+        case Operator::GreaterThanOrEqualTo:
+            return IROpcode::GreaterEqual;
+        default:
+            return IROpcode::Invalid;
+    }
+}
+
+// the operation x op= y applies to x, Invalid for anything but compound assignments
+static IROpcode compound_assignment_opcode(Operator op)
+{
+    switch (op) {
+        case Operator::AddAssign:
+            return IROpcode::Add;
+        case Operator::SubtractAssign:
+            return IROpcode::Sub;
+        case Operator::MultiplyAssign:
+            return IROpcode::Mul;
+        case Operator::DivideAssign:
+            return IROpcode::Div;
+        case Operator::ModuloAssign:
+            return IROpcode::Mod;
+        case Operator::ShiftLeftAssign:
+            return IROpcode::Shl;
+        case Operator::ShiftRightAssign:
+            return IROpcode::Shr;
+        case Operator::AndAssign:
+            return IROpcode::And;
+        case Operator::OrAssign:
+            return IROpcode::Or;
+        case Operator::XorAssign:
+            return IROpcode::Xor;
+        default:
+            return IROpcode::Invalid;
+    }
+}
+
+static IROpcode unop_opcode(Operator op)
+{
+    switch (op) {
+        case Operator::Minus:
+            return IROpcode::Neg;
+        case Operator::Complement:
+            return IROpcode::Not;
+        case Operator::LogicalNegation:
+            return IROpcode::LogicalNot;
+        default:
+            return IROpcode::Invalid;
+    }
+}
+
+// Expressions and statements are lowered with explicit stacks of tasks instead of
+// recursion, since generated code can nest deeper than the native stack allows. A
+// task is suspended while one of its operands or nested statements is lowered and
+// resumed afterwards, stage counting how far along it is. Operand values are passed
+// back on a stack of vregs.
+
+// an expression waiting for its operands, see lower_expression
+struct ExprTask {
+    ExprNode* expr;
+    int stage;           // operands lowered so far
+    int slot;            // result slot, or the slot parking the left operand
+    int left;            // left operand, unless it's parked in slot
+    size_t values_base;  // where the call's arguments start on the value stack
+    FunctionSignature* callee;
+    IRBlock* next_block;  // the right hand side of && ||, else branch of ?:
+    IRBlock* end_block;
+};
+
+// a statement, or a function body, waiting for its nested statements, see
+// lower_block_items
+struct StatementTask {
+    StatementNode* statement;  // nullptr for the block items of a function body
+    BlockItemNode** items;
+    size_t item_count;
+    size_t next_item;
+    int stage;
+    SavedScope saved;
+    IRBlock* body_block;
+    IRBlock* continue_block;  // also the else branch of an if statement
+    IRBlock* exit_block;      // also the end of an if statement
+};
+
+static ExprTask expr_task(ExprNode* expr)
+{
+    ExprTask task;
+    task.expr = expr;
+    task.stage = 0;
+    task.slot = -1;
+    task.left = -1;
+    task.values_base = 0;
+    task.callee = nullptr;
+    task.next_block = nullptr;
+    task.end_block = nullptr;
+    return task;
+}
+
+static int pop_value(DynHeapArray<int>* values)
+{
+    const int value = (*values)[values->length - 1];
+    values->length--;
+    return value;
+}
+
+// Resuming a task either finishes it, pushing its value and returning 0, or returns 1
+// with the next operand to lower in *operand. Errors return -1.
+
+// a || b, a && b
+//
+// The result slot is pre-loaded with the short-circuit value, then overwritten by the
+// normalized right hand side if the left hand side didn't decide the result.
+static int resume_logical_binop(IRBuilder* builder, ExprTask* task, int stage,
+                                DynHeapArray<int>* values, ExprNode** operand)
+{
+    BinopExpr* binop = &task->expr->binop_expr;
+    const bool is_or = binop->op == Operator::LogicalOR;
+
+    if (stage == 0) {
+        task->slot = new_slot(builder);
+        *operand = binop->left_expr;
+        return 1;
+    }
+
+    if (stage == 1) {
+        const int left = pop_value(values);
+        emit_store(builder, task->slot, emit_const(builder, is_or ? 1 : 0));
+
+        task->next_block = create_block(builder);
+        task->end_block = create_block(builder);
+
+        if (is_or) {
+            emit_branch(builder, left, task->end_block, task->next_block);
+        }
+        else {
+            emit_branch(builder, left, task->next_block, task->end_block);
+        }
+
+        place_block(builder, task->next_block);
+        *operand = binop->right_expr;
+        return 1;
+    }
+
+    const int right = pop_value(values);
+    const int normalized =
+        emit_value(builder, IROpcode::NotEqual, right, emit_const(builder, 0));
+    emit_store(builder, task->slot, normalized);
+    emit_jump(builder, task->end_block);
+
+    place_block(builder, task->end_block);
+    array_append(values, emit_load(builder, task->slot));
+    return 0;
+}
+
+// the slot or global assigned to by name, or -1 after reporting an error
+static int lookup_assigned_variable(IRBuilder* builder, const char* name, int* slot,
+                                    int* global)
+{
+    *slot = lookup_variable(builder, name);
+    *global = *slot < 0 ? lookup_global(builder, name) : -1;
+    if (*slot < 0 && *global < 0) {
+        LOWER_ERROR("attempted to assign value to undeclared variable: %s", name);
+        return -1;
+    }
+    return 0;
+}
+
+// x = y, and x op= y, which reads x only once y is evaluated. The load, the operation
+// and the store back then end up next to each other, where the backend can turn them
+// into a single instruction updating x in place.
+static int resume_assignment(IRBuilder* builder, ExprTask* task, int stage,
+                             DynHeapArray<int>* values, ExprNode** operand)
+{
+    BinopExpr* binop = &task->expr->binop_expr;
+    assert(binop->left_expr->type == ExprType::VariableRef);
+
+    int slot = -1;
+    int global = -1;
+    if (lookup_assigned_variable(builder, binop->left_expr->referenced_var_name, &slot,
+                                 &global) != 0) {
+        return -1;
+    }
+
+    if (stage == 0) {
+        *operand = binop->right_expr;
+        return 1;
+    }
+
+    int* value = &(*values)[values->length - 1];  // also the assignment's value
+
+    if (binop->op != Operator::Assignment) {
+        const int current = emit_variable_load(builder, slot, global);
+        *value = emit_value(builder, compound_assignment_opcode(binop->op), current, *value);
+    }
+
+    emit_variable_store(builder, slot, global, *value);
+    return 0;
+}
+
+// ++x and x++, their value is x after and before the update respectively
+static int lower_increment(IRBuilder* builder, ExprNode* expr, DynHeapArray<int>* values)
+{
+    UnopExpr* unop = &expr->unop_expr;
+    assert(unop->child_expr->type == ExprType::VariableRef);
+
+    int slot = -1;
+    int global = -1;
+    if (lookup_assigned_variable(builder, unop->child_expr->referenced_var_name, &slot,
+                                 &global) != 0) {
+        return -1;
+    }
+
+    const IROpcode opcode = unop->op == Operator::Increment ? IROpcode::Add : IROpcode::Sub;
+    const int old_value = emit_variable_load(builder, slot, global);
+    const int new_value = emit_value(builder, opcode, old_value, emit_const(builder, 1));
+    emit_variable_store(builder, slot, global, new_value);
+
+    array_append(values, unop->postfix ? old_value : new_value);
+    return 0;
+}
+
+// Arguments are evaluated left to right, then passed last to first. If any of them
+// branches, all of them go through temporary slots, since vregs don't cross blocks.
+static int resume_call(IRBuilder* builder, ExprTask* task, int stage,
+                       DynHeapArray<int>* values, ExprNode** operand)
+{
+    CallExpr* call = task->expr->call_expr;
+    const bool spill = task->expr->branches;
+
+    if (stage == 0) {
+        task->callee = lookup_function(builder, call->function_name);
+        if (!task->callee) {
+            LOWER_ERROR("call to undeclared function: %s", call->function_name);
+            return -1;
+        }
+        if (task->callee->param_count != call->args.length) {
+            LOWER_ERROR("function %s takes %zu arguments, but %zu were given",
+                        call->function_name, task->callee->param_count, call->args.length);
+            return -1;
+        }
+        task->values_base = values->length;
+    }
+    else if (spill) {
+        const int slot = new_slot(builder);
+        emit_store(builder, slot, (*values)[values->length - 1]);
+        (*values)[values->length - 1] = slot;
+    }
+
+    if ((size_t)stage < call->args.length) {
+        *operand = call->args[(size_t)stage];
+        return 1;
+    }
+
+    if (spill) {
+        for (size_t i = task->values_base; i < values->length; i++) {
+            (*values)[i] = emit_load(builder, (*values)[i]);  // slot -> vreg
+        }
+    }
+
+    for (size_t i = call->args.length; i > 0; i--) {
+        IRInstr* instr = emit_instr(builder, IROpcode::Arg);
+        instr->args[0] = (*values)[task->values_base + i - 1];
+        instr->imm = (long)i - 1;
+    }
+
+    IRInstr* instr = emit_instr(builder, IROpcode::Call);
+    instr->dst = builder->fn->vreg_count++;
+    instr->imm = (long)call->args.length;
+    instr->callee = task->callee->name;
+
+    values->length = task->values_base;
+    array_append(values, instr->dst);
+    return 0;
+}
+
+static int resume_conditional(IRBuilder* builder, ExprTask* task, int stage,
+                              DynHeapArray<int>* values, ExprNode** operand)
+{
+    CondExpr* cond_expr = &task->expr->cond_expr;
+
+    switch (stage) {
+        case 0:
+            task->slot = new_slot(builder);
+            *operand = cond_expr->conditional_expr;
+            return 1;
+
+        case 1: {
+            const int cond = pop_value(values);
+
+            IRBlock* if_block = create_block(builder);
+            task->next_block = create_block(builder);
+            task->end_block = create_block(builder);
+
+            emit_branch(builder, cond, if_block, task->next_block);
+
+            place_block(builder, if_block);
+            *operand = cond_expr->if_expr;
+            return 1;
+        }
+
+        case 2:
+            emit_store(builder, task->slot, pop_value(values));
+            emit_jump(builder, task->end_block);
+
+            place_block(builder, task->next_block);
+            *operand = cond_expr->else_expr;
+            return 1;
+
+        default:
+            emit_store(builder, task->slot, pop_value(values));
+            emit_jump(builder, task->end_block);
+
+            place_block(builder, task->end_block);
+            array_append(values, emit_load(builder, task->slot));
+            return 0;
+    }
+}
+
+static int resume_binop(IRBuilder* builder, ExprTask* task, int stage,
+                        DynHeapArray<int>* values, ExprNode** operand)
+{
+    BinopExpr* binop = &task->expr->binop_expr;
+
+    if (binop->op == Operator::LogicalOR || binop->op == Operator::LogicalAND) {
+        return resume_logical_binop(builder, task, stage, values, operand);
+    }
+
+    if (binop->op == Operator::Assignment ||
+        compound_assignment_opcode(binop->op) != IROpcode::Invalid) {
+        return resume_assignment(builder, task, stage, values, operand);
+    }
+
+    const IROpcode opcode = binop_opcode(binop->op);
+    if (opcode == IROpcode::Invalid) {
+        LOWER_ERROR("unsupported binary operator: %s", operator_to_str(binop->op));
+        return -1;
+    }
+
+    if (stage == 0) {
+        *operand = binop->left_expr;
+        return 1;
+    }
+
+    if (stage == 1) {
+        // a left operand living across the blocks of the right one is parked in a slot
+        task->left = pop_value(values);
+        if (binop->right_expr->branches) {
+            task->slot = new_slot(builder);
+            emit_store(builder, task->slot, task->left);
+        }
+        *operand = binop->right_expr;
+        return 1;
+    }
+
+    const int right = pop_value(values);
+    const int left = task->slot >= 0 ? emit_load(builder, task->slot) : task->left;
+    array_append(values, emit_value(builder, opcode, left, right));
+    return 0;
+}
+
+static int resume_expression(IRBuilder* builder, ExprTask* task, DynHeapArray<int>* values,
+                             ExprNode** operand)
+{
+    ExprNode* expr = task->expr;
+    const int stage = task->stage++;
+
+    switch (expr->type) {
+        case ExprType::IntLiteral:
+            array_append(values, emit_const(builder, ir_wrap_int((unsigned long)expr->literal)));
+            return 0;
+
+        case ExprType::VariableRef: {
+            const char* name = expr->referenced_var_name;
+            const int slot = lookup_variable(builder, name);
+            const int global = slot < 0 ? lookup_global(builder, name) : -1;
+            if (slot < 0 && global < 0) {
+                LOWER_ERROR("referenced unknown variable: %s", name);
+                return -1;
+            }
+            array_append(values, emit_variable_load(builder, slot, global));
+            return 0;
+        }
+
+        case ExprType::UnaryOp: {
+            if (expr->unop_expr.op == Operator::Increment ||
+                expr->unop_expr.op == Operator::Decrement) {
+                return lower_increment(builder, expr, values);
+            }
+
+            const IROpcode opcode = unop_opcode(expr->unop_expr.op);
+            if (opcode == IROpcode::Invalid) {
+                LOWER_ERROR("unsupported unary operator: %s",
+                            operator_to_str(expr->unop_expr.op));
+                return -1;
+            }
+
+            if (stage == 0) {
+                *operand = expr->unop_expr.child_expr;
+                return 1;
+            }
+            array_append(values, emit_value(builder, opcode, pop_value(values)));
+            return 0;
+        }
+
+        case ExprType::BinaryOp:
+            return resume_binop(builder, task, stage, values, operand);
+
+        case ExprType::Conditional:
+            return resume_conditional(builder, task, stage, values, operand);
+
+        case ExprType::FunctionCall:
+            return resume_call(builder, task, stage, values, operand);
+
+        default:
+            QXC_UNREACHABLE();
+            return -1;
+    }
+}
+
+// returns the vreg holding the expression's value, or -1 on error
+static int lower_expression(IRBuilder* builder, ExprNode* expr)
+{
+    DynHeapArray<ExprTask>* tasks = &builder->expr_tasks;
+    DynHeapArray<int>* values = &builder->expr_values;
+    array_clear(tasks);
+    array_clear(values);
+
+    array_append(tasks, expr_task(expr));
+
+    while (tasks->length > 0) {
+        ExprNode* operand = nullptr;
+        const int status = resume_expression(builder, &(*tasks)[tasks->length - 1], values,
+                                             &operand);
+        if (status < 0) return -1;
+
+        if (status == 0) {
+            tasks->length--;
+        }
+        else {
+            array_append(tasks, expr_task(operand));
+        }
+    }
+
+    assert(values->length == 1);
+    return (*values)[0];
+}
+
+static int lower_declaration(IRBuilder* builder, Declaration* declaration);
+
+// branch to if_true if condition holds, otherwise to if_false. A missing condition
+// always holds.
+static int lower_condition_branch(IRBuilder* builder, ExprNode* condition, IRBlock* if_true,
+                                  IRBlock* if_false)
+{
+    if (!condition) {
+        emit_jump(builder, if_true);
+        return 0;
+    }
+
+    const int cond = lower_expression(builder, condition);
+    if (cond < 0) return -1;
+    emit_branch(builder, cond, if_true, if_false);
+    return 0;
+}
+
+static StatementTask statement_task(StatementNode* statement)
+{
+    StatementTask task;
+    task.statement = statement;
+    task.items = nullptr;
+    task.item_count = 0;
+    task.next_item = 0;
+    task.stage = 0;
+    task.saved = SavedScope();
+    task.body_block = nullptr;
+    task.continue_block = nullptr;
+    task.exit_block = nullptr;
+
+    if (statement->type == StatementType::Compound) {
+        task.items = statement->block_items.begin();
+        task.item_count = statement->block_items.length;
+    }
+    return task;
+}
+
+// Loops are rotated so the condition is tested at the bottom, each iteration then
+// costs a single conditional backward branch. while and for loops test the condition
+// once more in front of the loop to skip it entirely:
+//
+//       branch cond, body, exit      (do-while jumps straight to body)
+//   body:
+//       ...
+//   continue:
+//       post
+//       branch cond, body, exit
+//   exit:
+//
+// break and continue jump directly to exit and continue respectively. begin_loop
+// leads up to the body, end_loop follows it.
+static int begin_loop(IRBuilder* builder, StatementTask* task, ExprNode* condition,
+                      StatementNode* body, bool test_first, StatementNode** nested)
+{
+    task->body_block = create_block(builder);
+    task->continue_block = create_block(builder);
+    task->exit_block = create_block(builder);
+    task->body_block->loop_header = true;
+
+    if (test_first) {
+        if (lower_condition_branch(builder, condition, task->body_block, task->exit_block) !=
+            0) {
+            return -1;
+        }
+    }
+    else {
+        emit_jump(builder, task->body_block);
+    }
+
+    LoopTargets targets;
+    targets.break_target = task->exit_block;
+    targets.continue_target = task->continue_block;
+    array_append(&builder->loops, targets);
+
+    place_block(builder, task->body_block);
+    *nested = body;
+    return 1;
+}
+
+static int end_loop(IRBuilder* builder, StatementTask* task, ExprNode* condition,
+                    ExprNode* post)
+{
+    emit_jump(builder, task->continue_block);
+
+    builder->loops.length--;
+
+    place_block(builder, task->continue_block);
+    if (post && lower_expression(builder, post) < 0) return -1;
+    if (lower_condition_branch(builder, condition, task->body_block, task->exit_block) != 0) {
+        return -1;
+    }
+
+    place_block(builder, task->exit_block);
+    return 0;
+}
+
+static bool evaluate_constant_expr(ExprNode* root, long* result);
+
+static int compare_switch_cases(const void* a, const void* b)
+{
+    const long value_a = ((const IRSwitchCase*)a)->value;
+    const long value_b = ((const IRSwitchCase*)b)->value;
+    return value_a < value_b ? -1 : (value_a > value_b ? 1 : 0);
+}
+
+// The controlling value is computed up front and the block computing it ends in a
+// Switch, whose cases are only known once the whole body is lowered:
+//
+//       switch %v, default bb2, [1: bb3, 2: bb4]   (default is exit without one)
+//   bb1:                                           statements before the first case
+//       ...
+//   bb3:                                           case 1:
+//       ...                                        falls through
+//   bb4:                                           case 2:
+//       ...
+//   exit:
+//
+// break jumps to exit, continue still belongs to the enclosing loop.
+static int resume_switch(IRBuilder* builder, StatementTask* task, int stage,
+                         StatementNode** nested)
+{
+    SwitchStatement* switch_stmt = task->statement->switch_statement;
+
+    if (stage == 0) {
+        const int value = lower_expression(builder, switch_stmt->controlling_expr);
+        if (value < 0) return -1;
+
+        IRInstr* dispatch = emit_instr(builder, IROpcode::Switch);
+        dispatch->args[0] = value;
+        task->body_block = builder->block;
+        task->exit_block = create_block(builder);
+
+        LoopTargets targets;
+        targets.break_target = task->exit_block;
+        targets.continue_target =
+            builder->loops.length > 0 ? builder->loops[builder->loops.length - 1].continue_target
+                                      : nullptr;
+        array_append(&builder->loops, targets);
+
+        SwitchContext context;
+        context.dispatch_block = builder->block;
+        context.first_case = builder->switch_cases.length;
+        context.default_block = nullptr;
+        array_append(&builder->switches, context);
+
+        place_block(builder, create_block(builder));
+        *nested = switch_stmt->body_statement;
+        return 1;
+    }
+
+    emit_jump(builder, task->exit_block);
+    builder->loops.length--;
+
+    const SwitchContext context = builder->switches[builder->switches.length - 1];
+    builder->switches.length--;
+
+    IRSwitchCase* first = builder->switch_cases.begin() + context.first_case;
+    const size_t case_count = builder->switch_cases.length - context.first_case;
+    qsort(first, case_count, sizeof(IRSwitchCase), compare_switch_cases);
+    for (size_t i = 1; i < case_count; i++) {
+        if (first[i - 1].value == first[i].value) {
+            LOWER_ERROR("duplicate case value %ld", first[i].value);
+            return -1;
+        }
+    }
+
+    IRSwitchCase* cases = qxc_malloc_array<IRSwitchCase>(builder->program->pool, case_count);
+    for (size_t i = 0; i < case_count; i++) {
+        cases[i] = first[i];
+    }
+    builder->switch_cases.length = context.first_case;
+
+    IRInstr* dispatch = ir_block_terminator(context.dispatch_block);
+    dispatch->targets[0] = context.default_block ? context.default_block : task->exit_block;
+    dispatch->cases = cases;
+    dispatch->imm = (long)case_count;
+
+    place_block(builder, task->exit_block);
+    return 0;
+}
+
+// a case or default label starts a new block, which the code above falls through to
+static int begin_case(IRBuilder* builder, CaseStatement* case_stmt, StatementNode** nested)
+{
+    const char* label = case_stmt->value_expr ? "case" : "default";
+    if (builder->switches.length == 0) {
+        LOWER_ERROR("%s label not within a switch statement", label);
+        return -1;
+    }
+    SwitchContext* context = &builder->switches[builder->switches.length - 1];
+
+    IRBlock* block = create_block(builder);
+
+    if (case_stmt->value_expr) {
+        IRSwitchCase switch_case;
+        if (!evaluate_constant_expr(case_stmt->value_expr, &switch_case.value)) {
+            LOWER_ERROR("case label is not a constant expression");
+            return -1;
+        }
+        switch_case.target = block;
+        array_append(&builder->switch_cases, switch_case);
+    }
+    else {
+        if (context->default_block) {
+            LOWER_ERROR("multiple default labels in one switch");
+            return -1;
+        }
+        context->default_block = block;
+    }
+
+    emit_jump(builder, block);
+    place_block(builder, block);
+    *nested = case_stmt->statement;
+    return 1;
+}
+
+// Like resume_expression: returns 0 when the statement is done, 1 with the nested
+// statement to lower next in *nested, or -1 on error.
+static int resume_statement(IRBuilder* builder, StatementTask* task, StatementNode** nested)
+{
+    StatementNode* statement = task->statement;
+    const int stage = task->stage++;
+
+    if (statement == nullptr || statement->type == StatementType::Compound) {
+        // a function body shares the scope of the parameters
+        if (statement && stage == 0) task->saved = begin_scope(builder);
+
+        while (task->next_item < task->item_count) {
+            BlockItemNode* item = task->items[task->next_item++];
+
+            switch (item->type) {
+                case BlockItemType::Statement:
+                    *nested = item->statement;
+                    return 1;
+                case BlockItemType::Declaration:
+                    if (lower_declaration(builder, item->declaration) != 0) return -1;
+                    break;
+                default:
+                    LOWER_ERROR("invalid block item encountered in IR lowering");
+                    return -1;
+            }
+        }
+
+        if (statement) end_scope(builder, task->saved);
+        return 0;
+    }
+
+    switch (statement->type) {
+        case StatementType::Return: {
+            const int value = lower_expression(builder, statement->return_expr);
+            if (value < 0) return -1;
+
+            IRInstr* ret = emit_instr(builder, IROpcode::Return);
+            ret->args[0] = value;
+
+            // anything following the return in this block is unreachable, but still
+            // has to be lowered somewhere (and checked for errors)
+            place_block(builder, create_block(builder));
+            return 0;
+        }
+
+        case StatementType::StandAloneExpr:
+            return lower_expression(builder, statement->standalone_expr) < 0 ? -1 : 0;
+
+        case StatementType::Null:
+            return 0;
+
+        case StatementType::For: {
+            ForStatement* for_stmt = statement->for_statement;
+
+            if (stage == 0) {
+                // a variable declared in the initial clause is scoped to the loop
+                task->saved = begin_scope(builder);
+
+                if (for_stmt->init_decl) {
+                    if (lower_declaration(builder, for_stmt->init_decl) != 0) return -1;
+                }
+                else if (for_stmt->init_expr) {
+                    if (lower_expression(builder, for_stmt->init_expr) < 0) return -1;
+                }
+
+                return begin_loop(builder, task, for_stmt->condition_expr,
+                                  for_stmt->body_statement, true, nested);
+            }
+
+            if (end_loop(builder, task, for_stmt->condition_expr, for_stmt->post_expr) != 0) {
+                return -1;
+            }
+
+            end_scope(builder, task->saved);
+            return 0;
+        }
+
+        case StatementType::While:
+        case StatementType::DoWhile: {
+            WhileStatement* while_stmt = statement->while_statement;
+
+            if (stage == 0) {
+                return begin_loop(builder, task, while_stmt->condition_expr,
+                                  while_stmt->body_statement,
+                                  statement->type == StatementType::While, nested);
+            }
+            return end_loop(builder, task, while_stmt->condition_expr, nullptr);
+        }
+
+        case StatementType::Break:
+        case StatementType::Continue: {
+            const bool is_break = statement->type == StatementType::Break;
+
+            // a switch only takes break, continue goes to the loop around it if any
+            IRBlock* target = nullptr;
+            if (builder->loops.length > 0) {
+                const LoopTargets& targets = builder->loops[builder->loops.length - 1];
+                target = is_break ? targets.break_target : targets.continue_target;
+            }
+
+            if (target == nullptr) {
+                LOWER_ERROR("%s", is_break ? "break statement not within a loop or switch"
+                                           : "continue statement not within a loop");
+                return -1;
+            }
+
+            emit_jump_away(builder, target);
+            return 0;
+        }
+
+        case StatementType::Switch:
+            return resume_switch(builder, task, stage, nested);
+
+        case StatementType::Case:
+            return stage == 0 ? begin_case(builder, statement->case_statement, nested) : 0;
+
+        case StatementType::IfElse: {
+            IfElseStatement* ifelse = statement->ifelse_statement;
+
+            if (stage == 0) {
+                const int cond = lower_expression(builder, ifelse->conditional_expr);
+                if (cond < 0) return -1;
+
+                IRBlock* if_block = create_block(builder);
+                task->continue_block =
+                    ifelse->else_branch_statement ? create_block(builder) : nullptr;
+                task->exit_block = create_block(builder);
+
+                emit_branch(builder, cond, if_block,
+                            task->continue_block ? task->continue_block : task->exit_block);
+
+                place_block(builder, if_block);
+                *nested = ifelse->if_branch_statement;
+                return 1;
+            }
+
+            emit_jump(builder, task->exit_block);
+
+            if (stage == 1 && task->continue_block) {
+                place_block(builder, task->continue_block);
+                *nested = ifelse->else_branch_statement;
+                return 1;
+            }
+
+            place_block(builder, task->exit_block);
+            return 0;
+        }
+
+        default:
+            QXC_UNREACHABLE();
+            return -1;
+    }
+}
+
+static int lower_declaration(IRBuilder* builder, Declaration* declaration)
+{
+    const int slot = declare_variable(builder, declaration->var_name);
+    if (slot < 0) return -1;
+
+    if (declaration->initializer_expr) {
+        const int value = lower_expression(builder, declaration->initializer_expr);
+        if (value < 0) return -1;
+        emit_store(builder, slot, value);
+    }
+
+    return 0;
+}
+
+// the block items of a function body, and everything nested in them
+static int lower_block_items(IRBuilder* builder, BlockItemNode** items, size_t item_count)
+{
+    DynHeapArray<StatementTask>* tasks = &builder->statement_tasks;
+    array_clear(tasks);
+
+    StatementTask* body = array_extend(tasks);
+    *body = StatementTask();
+    body->items = items;
+    body->item_count = item_count;
+
+    while (tasks->length > 0) {
+        StatementNode* nested = nullptr;
+        const int status = resume_statement(builder, &(*tasks)[tasks->length - 1], &nested);
+        if (status < 0) return -1;
+
+        if (status == 0) {
+            tasks->length--;
+        }
+        else {
+            array_append(tasks, statement_task(nested));
+        }
+    }
+
+    return 0;
+}
+
+// record the declaration, checking it against earlier declarations of the same name
+static int declare_function(IRBuilder* builder, FunctionDecl* decl)
+{
+    FunctionSignature* signature = lookup_function(builder, decl->name);
+
+    if (lookup_global(builder, decl->name) >= 0) {
+        LOWER_ERROR("function %s redeclares a global variable", decl->name);
+        return -1;
+    }
+
+    if (!signature) {
+        FunctionSignature new_signature;
+        new_signature.name = copy_name(builder, decl->name);
+        new_signature.param_count = decl->param_names.length;
+        new_signature.is_defined = decl->is_definition;
+        array_append(&builder->functions, new_signature);
+        return 0;
+    }
+
+    if (signature->param_count != decl->param_names.length) {
+        LOWER_ERROR("conflicting declarations of function %s: %zu vs %zu parameters",
+                    decl->name, signature->param_count, decl->param_names.length);
+        return -1;
+    }
+
+    if (decl->is_definition) {
+        if (signature->is_defined) {
+            LOWER_ERROR("function defined twice: %s", decl->name);
+            return -1;
+        }
+        signature->is_defined = true;
+    }
+
+    return 0;
+}
+
+// Global initializers are folded at compile time, with the same arithmetic the
+// optimizer uses. Anything reading memory or calling functions is rejected. Walked
+// with an explicit stack like lower_expression, of which ?: only visits one branch.
+static bool evaluate_constant_expr(ExprNode* root, long* result)
+{
+    struct ConstTask {
+        ExprNode* expr;
+        bool operands_done;
+    };
+
+    DynHeapArray<ConstTask> tasks = heap_array_create<ConstTask>(16);
+    DynHeapArray<long> values = heap_array_create<long>(16);
+    defer {
+        array_free(&tasks);
+        array_free(&values);
+    };
+
+    array_append(&tasks, ConstTask{root, false});
+
+    while (tasks.length > 0) {
+        ConstTask* task = &tasks[tasks.length - 1];
+        ExprNode* expr = task->expr;
+        const bool operands_done = task->operands_done;
+        task->operands_done = true;
+
+        switch (expr->type) {
+            case ExprType::IntLiteral:
+                tasks.length--;
+                array_append(&values, ir_wrap_int((unsigned long)expr->literal));
+                break;
+
+            case ExprType::UnaryOp: {
+                if (!operands_done) {
+                    array_append(&tasks, ConstTask{expr->unop_expr.child_expr, false});
+                    break;
+                }
+                tasks.length--;
+                long* value = &values[values.length - 1];
+                if (!ir_evaluate_constant(unop_opcode(expr->unop_expr.op), *value, 0, value)) {
+                    return false;
+                }
+                break;
+            }
+
+            case ExprType::BinaryOp: {
+                const Operator op = expr->binop_expr.op;
+                if (op == Operator::Assignment) return false;
+
+                if (!operands_done) {
+                    // the right operand on top, so the left one is evaluated first
+                    array_append(&tasks, ConstTask{expr->binop_expr.right_expr, false});
+                    array_append(&tasks, ConstTask{expr->binop_expr.left_expr, false});
+                    break;
+                }
+                tasks.length--;
+                const long right = values[values.length - 1];
+                long* left = &values[values.length - 2];
+                values.length--;
+
+                if (op == Operator::LogicalOR || op == Operator::LogicalAND) {
+                    *left = op == Operator::LogicalOR ? (*left != 0 || right != 0)
+                                                      : (*left != 0 && right != 0);
+                }
+                else if (!ir_evaluate_constant(binop_opcode(op), *left, right, left)) {
+                    return false;
+                }
+                break;
+            }
+
+            case ExprType::Conditional:
+                if (!operands_done) {
+                    array_append(&tasks, ConstTask{expr->cond_expr.conditional_expr, false});
+                    break;
+                }
+                // replaced by the chosen branch, whose value then stands for the ?:
+                task->expr = values[values.length - 1] ? expr->cond_expr.if_expr
+                                                       : expr->cond_expr.else_expr;
+                task->operands_done = false;
+                values.length--;
+                break;
+
+            case ExprType::VariableRef:
+            case ExprType::FunctionCall:
+                return false;
+
+            default:
+                QXC_UNREACHABLE();
+                return false;
+        }
+    }
+
+    *result = values[0];
+    return true;
+}
+
+static int declare_global(IRBuilder* builder, Declaration* decl)
+{
+    if (lookup_function(builder, decl->var_name)) {
+        LOWER_ERROR("global variable %s redeclares a function", decl->var_name);
+        return -1;
+    }
+
+    long value = 0;
+    if (decl->initializer_expr && !evaluate_constant_expr(decl->initializer_expr, &value)) {
+        LOWER_ERROR("initializer of global variable %s is not a constant expression",
+                    decl->var_name);
+        return -1;
+    }
+
+    const int index = lookup_global(builder, decl->var_name);
+    if (index < 0) {
+        GlobalVariable global;
+        global.name = copy_name(builder, decl->var_name);
+        global.value = value;
+        global.is_defined = decl->initializer_expr != nullptr;
+        array_append(&builder->globals, global);
+        return 0;
+    }
+
+    GlobalVariable* global = &builder->globals[(size_t)index];
+    if (decl->initializer_expr) {
+        if (global->is_defined) {
+            LOWER_ERROR("global variable defined twice: %s", decl->var_name);
+            return -1;
+        }
+        global->value = value;
+        global->is_defined = true;
+    }
+
+    return 0;
+}
+
+static IRFunction* lower_function(IRBuilder* builder, FunctionDecl* decl)
+{
+    IRFunction* fn = qxc_malloc<IRFunction>(builder->program->pool);
+    fn->name = lookup_function(builder, decl->name)->name;
+    fn->param_count = (int)decl->param_names.length;
+
+    builder->fn = fn;
+    builder->scope_begin = 0;
+    array_clear(&builder->scope);
+
+    place_block(builder, create_block(builder));
+
+    // parameters share the scope of the function body's outermost block
+    for (size_t i = 0; i < decl->param_names.length; i++) {
+        const int slot = declare_variable(builder, decl->param_names[i]);
+        if (slot < 0) return nullptr;
+
+        IRInstr* param = emit_instr(builder, IROpcode::Param);
+        param->dst = fn->vreg_count++;
+        param->imm = (long)i;
+        emit_store(builder, slot, param->dst);
+    }
+
+    if (lower_block_items(builder, decl->block_items.begin(), decl->block_items.length) != 0) {
+        return nullptr;
+    }
+
+    // falling off the end of a function returns 0
+    const int zero = emit_const(builder, 0);
+    IRInstr* ret = emit_instr(builder, IROpcode::Return);
+    ret->args[0] = zero;
+
+    return fn;
+}
+
+IRProgram* ir_lower_program(Program* program)
+{
+    TRACE_SPAN(TraceCategory::IR, "lower");
+
+    IRProgram* ir = (IRProgram*)malloc(sizeof(IRProgram));
+    new (ir) IRProgram();
+    ir->pool = qxc_memory_pool_init(10e3);
+    ir->functions = heap_array_create<IRFunction*>(0);
+    ir->externs = heap_array_create<const char*>(0);
+    ir->globals = heap_array_create<IRGlobal>(0);
+
+    IRBuilder builder;
+    builder.program = ir;
+    builder.fn = nullptr;
+    builder.block = nullptr;
+    builder.scope = heap_array_create<ScopedVariable>(0);
+    builder.scope_begin = 0;
+    builder.loops = heap_array_create<LoopTargets>(0);
+    builder.switches = heap_array_create<SwitchContext>(0);
+    builder.switch_cases = heap_array_create<IRSwitchCase>(0);
+    builder.functions = heap_array_create<FunctionSignature>(0);
+    builder.globals = heap_array_create<GlobalVariable>(0);
+    builder.expr_tasks = heap_array_create<ExprTask>(0);
+    builder.expr_values = heap_array_create<int>(0);
+    builder.statement_tasks = heap_array_create<StatementTask>(0);
+    defer {
+        array_free(&builder.scope);
+        array_free(&builder.loops);
+        array_free(&builder.switches);
+        array_free(&builder.switch_cases);
+        array_free(&builder.functions);
+        array_free(&builder.globals);
+        array_free(&builder.expr_tasks);
+        array_free(&builder.expr_values);
+        array_free(&builder.statement_tasks);
+    };
+
+    for (TopLevelItem* item : program->items) {
+        if (item->type == TopLevelType::Variable) {
+            if (declare_global(&builder, item->var_decl) != 0) {
+                ir_program_free(ir);
+                return nullptr;
+            }
+            continue;
+        }
+
+        FunctionDecl* decl = item->function_decl;
+        if (declare_function(&builder, decl) != 0) {
+            ir_program_free(ir);
+            return nullptr;
+        }
+
+        if (!decl->is_definition) continue;
+
+        IRFunction* fn = lower_function(&builder, decl);
+        if (fn == nullptr) {
+            ir_program_free(ir);
+            return nullptr;
+        }
+        array_append(&ir->functions, fn);
+    }
+
+    for (const FunctionSignature& signature : builder.functions) {
+        if (!signature.is_defined) {
+            array_append(&ir->externs, signature.name);
+        }
+    }
+
+    // tentative definitions without an initializer anywhere start out as 0
+    for (const GlobalVariable& global : builder.globals) {
+        IRGlobal ir_global;
+        ir_global.name = global.name;
+        ir_global.value = global.value;
+        array_append(&ir->globals, ir_global);
+    }
+
+    return ir;
+}
+
+void ir_program_free(IRProgram* program)
+{
+    for (IRFunction* fn : program->functions) {
+        for (IRBlock* block : fn->blocks) {
+            array_free(&block->instrs);
+        }
+        array_free(&fn->blocks);
+    }
+    array_free(&program->functions);
+    array_free(&program->externs);
+    array_free(&program->globals);
+    qxc_memory_pool_release(program->pool);
+    free(program);
+}
+
+// --------------------------------------------------------------------------------
+// verifier
+
+#define VERIFY(EXPR, ...)                                               \
+    do {                                                                \
+        if (!(EXPR)) {                                                  \
+            fprintf(stderr, "IR verification failed in %s, bb%d: ", fn->name, \
+                    block->id);                                         \
+            fprintf(stderr, __VA_ARGS__);                               \
+            fprintf(stderr, "\n");                                      \
+            return -1;                                                  \
+        }                                                               \
+    } while (0)
+
+// constant time, so verifying functions with many blocks stays linear
+static bool block_in_function(IRFunction* fn, IRBlock* block)
+{
+    return block->id >= 0 && (size_t)block->id < fn->blocks.length &&
+           fn->blocks[(size_t)block->id] == block;
+}
+
+static int verify_function(IRProgram* program, IRFunction* fn)
+{
+    // block in which each vreg was defined, -1 if not yet seen
+    DynHeapArray<int> def_block = heap_array_create<int>((size_t)fn->vreg_count + 1);
+    defer { array_free(&def_block); };
+    for (int i = 0; i < fn->vreg_count; i++) {
+        array_append(&def_block, -1);
+    }
+
+    for (size_t bi = 0; bi < fn->blocks.length; bi++) {
+        IRBlock* block = fn->blocks[bi];
+
+        VERIFY(block->id == (int)bi, "block id doesn't match layout position %zu", bi);
+        VERIFY(ir_block_terminator(block) != nullptr, "block has no terminator");
+
+        bool in_params = bi == 0;  // still in the Param/Store prefix of the entry block
+        long pending_args = 0;     // Args still expected before the next Call
+        long call_arg_count = 0;
+
+        for (size_t ii = 0; ii < block->instrs.length; ii++) {
+            IRInstr* instr = &block->instrs[ii];
+            const IROpcode op = instr->opcode;
+
+            VERIFY(op != IROpcode::Invalid, "invalid opcode at instruction %zu", ii);
+            VERIFY(!ir_opcode_is_terminator(op) || ii + 1 == block->instrs.length,
+                   "terminator '%s' in the middle of a block", ir_opcode_to_str(op));
+
+            in_params = in_params && (op == IROpcode::Param || op == IROpcode::Store);
+            if (op == IROpcode::Param) {
+                VERIFY(in_params, "param outside of the entry block's prologue");
+                VERIFY(instr->imm >= 0 && instr->imm < fn->param_count,
+                       "invalid parameter index %ld", instr->imm);
+            }
+
+            if (op == IROpcode::Arg) {
+                if (pending_args == 0) {
+                    call_arg_count = instr->imm + 1;
+                    pending_args = call_arg_count;
+                }
+                VERIFY(instr->imm == pending_args - 1, "arguments out of order");
+                pending_args--;
+                VERIFY(pending_args > 0 || (ii + 1 < block->instrs.length &&
+                                            block->instrs[ii + 1].opcode == IROpcode::Call),
+                       "arguments not directly followed by a call");
+            }
+            else if (op == IROpcode::Call) {
+                const long passed = ii > 0 && block->instrs[ii - 1].opcode == IROpcode::Arg
+                                        ? call_arg_count
+                                        : 0;
+                VERIFY(instr->imm == passed, "call expects %ld arguments, got %ld",
+                       instr->imm, passed);
+                VERIFY(instr->callee != nullptr, "call without callee");
+            }
+            else {
+                VERIFY(pending_args == 0, "arguments not directly followed by a call");
+            }
+
+            int arg_count = 0;
+            if (op == IROpcode::Select) {
+                arg_count = 3;
+            }
+            else if (ir_opcode_is_binary(op)) {
+                arg_count = 2;
+            }
+            else if (ir_opcode_is_unary(op) || op == IROpcode::Store ||
+                     op == IROpcode::StoreGlobal || op == IROpcode::Arg || op == IROpcode::Branch ||
+                     op == IROpcode::Switch || op == IROpcode::Return) {
+                arg_count = 1;
+            }
+
+            for (int a = 0; a < 3; a++) {
+                const int vreg = instr->args[a];
+                if (a >= arg_count) {
+                    VERIFY(vreg == -1, "unexpected operand to '%s'", ir_opcode_to_str(op));
+                    continue;
+                }
+                VERIFY(vreg >= 0 && vreg < fn->vreg_count, "'%s' reads invalid vreg %d",
+                       ir_opcode_to_str(op), vreg);
+                VERIFY(def_block[(size_t)vreg] == block->id,
+                       "vreg %%%d used before definition or outside its block", vreg);
+            }
+
+            const bool defines = !ir_opcode_is_terminator(op) && op != IROpcode::Store &&
+                                 op != IROpcode::StoreGlobal && op != IROpcode::Arg;
+            if (defines) {
+                VERIFY(instr->dst >= 0 && instr->dst < fn->vreg_count,
+                       "'%s' defines invalid vreg %d", ir_opcode_to_str(op), instr->dst);
+                VERIFY(def_block[(size_t)instr->dst] == -1, "vreg %%%d defined twice",
+                       instr->dst);
+                def_block[(size_t)instr->dst] = block->id;
+            }
+            else {
+                VERIFY(instr->dst == -1, "'%s' cannot define a vreg", ir_opcode_to_str(op));
+            }
+
+            if (op == IROpcode::Load || op == IROpcode::Store) {
+                VERIFY(instr->imm >= 0 && instr->imm < fn->slot_count,
+                       "invalid stack slot %ld", instr->imm);
+            }
+            if (op == IROpcode::LoadGlobal || op == IROpcode::StoreGlobal) {
+                VERIFY(instr->imm >= 0 && instr->imm < (long)program->globals.length,
+                       "invalid global %ld", instr->imm);
+            }
+
+            const int target_count = op == IROpcode::Branch ? 2
+                                     : op == IROpcode::Jump || op == IROpcode::Switch ? 1
+                                                                                     : 0;
+            for (int t = 0; t < 2; t++) {
+                if (t < target_count) {
+                    VERIFY(instr->targets[t] && block_in_function(fn, instr->targets[t]),
+                           "'%s' jumps to a block outside of the function",
+                           ir_opcode_to_str(op));
+                }
+                else {
+                    VERIFY(instr->targets[t] == nullptr, "unexpected jump target");
+                }
+            }
+
+            if (op == IROpcode::Switch) {
+                VERIFY(instr->imm >= 0 && (instr->imm == 0 || instr->cases != nullptr),
+                       "switch without its cases");
+                for (long c = 0; c < instr->imm; c++) {
+                    VERIFY(instr->cases[c].target && block_in_function(fn, instr->cases[c].target),
+                           "'%s' jumps to a block outside of the function",
+                           ir_opcode_to_str(op));
+                    VERIFY(c == 0 || instr->cases[c - 1].value < instr->cases[c].value,
+                           "switch cases not sorted by value");
+                }
+            }
+            else {
+                VERIFY(instr->cases == nullptr, "unexpected switch cases");
+            }
+        }
+    }
+
+    return 0;
+}
+
+int ir_verify_program(IRProgram* program)
+{
+    for (IRFunction* fn : program->functions) {
+        if (verify_function(program, fn) != 0) return -1;
+    }
+    return 0;
+}
+
+// --------------------------------------------------------------------------------
+// printer
+
+static void print_instr(IRProgram* program, IRInstr* instr)
+{
+    const IROpcode op = instr->opcode;
+    const char* name = ir_opcode_to_str(op);
+
+    printf("    ");
+
+    switch (op) {
+        case IROpcode::Const:
+            printf("%%%d = %s %ld\n", instr->dst, name, instr->imm);
+            break;
+        case IROpcode::Load:
+            printf("%%%d = %s $%ld\n", instr->dst, name, instr->imm);
+            break;
+        case IROpcode::Store:
+            printf("%s $%ld, %%%d\n", name, instr->imm, instr->args[0]);
+            break;
+        case IROpcode::LoadGlobal:
+            printf("%%%d = %s @%s\n", instr->dst, name,
+                   program->globals[(size_t)instr->imm].name);
+            break;
+        case IROpcode::StoreGlobal:
+            printf("%s @%s, %%%d\n", name, program->globals[(size_t)instr->imm].name,
+                   instr->args[0]);
+            break;
+        case IROpcode::Param:
+            printf("%%%d = %s %ld\n", instr->dst, name, instr->imm);
+            break;
+        case IROpcode::Arg:
+            printf("%s %ld, %%%d\n", name, instr->imm, instr->args[0]);
+            break;
+        case IROpcode::Call:
+            printf("%%%d = %s %s, %ld\n", instr->dst, name, instr->callee, instr->imm);
+            break;
+        case IROpcode::Jump:
+            printf("%s bb%d\n", name, instr->targets[0]->id);
+            break;
+        case IROpcode::Branch:
+            printf("%s %%%d, bb%d, bb%d\n", name, instr->args[0], instr->targets[0]->id,
+                   instr->targets[1]->id);
+            break;
+        case IROpcode::Switch:
+            printf("%s %%%d, default bb%d, [", name, instr->args[0], instr->targets[0]->id);
+            for (long c = 0; c < instr->imm; c++) {
+                printf(c == 0 ? "%ld: bb%d" : ", %ld: bb%d", instr->cases[c].value,
+                       instr->cases[c].target->id);
+            }
+            printf("]\n");
+            break;
+        case IROpcode::Return:
+            printf("%s %%%d\n", name, instr->args[0]);
+            break;
+        case IROpcode::Select:
+            printf("%%%d = %s %%%d, %%%d, %%%d\n", instr->dst, name, instr->args[0],
+                   instr->args[1], instr->args[2]);
+            break;
+        default:
+            if (ir_opcode_is_binary(op)) {
+                printf("%%%d = %s %%%d, %%%d\n", instr->dst, name, instr->args[0],
+                       instr->args[1]);
+            }
+            else if (ir_opcode_is_unary(op)) {
+                printf("%%%d = %s %%%d\n", instr->dst, name, instr->args[0]);
+            }
+            else {
+                printf("<invalid>\n");
+            }
+            break;
+    }
+}
+
+void ir_print_program(IRProgram* program)
+{
+    for (const IRGlobal& global : program->globals) {
+        printf("global @%s = %ld\n", global.name, global.value);
+    }
+    if (program->globals.length > 0) printf("\n");
+
+    for (IRFunction* fn : program->functions) {
+        printf("function %s (params: %d, slots: %d, vregs: %d)\n", fn->name,
+               fn->param_count, fn->slot_count, fn->vreg_count);
+
+        for (IRBlock* block : fn->blocks) {
+            printf("  bb%d:%s\n", block->id, block->loop_header ? "  ; loop header" : "");
+            for (IRInstr& instr : block->instrs) {
+                print_instr(program, &instr);
+            }
+        }
+
+        printf("\n");
+    }
+}
@@ -0,0 +1,138 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "allocator.h"
+#include "array.h"
+#include "ast.h"
+#include "prelude.h"
+
+// Three-address intermediate representation sitting between the AST and the x86 backend.
+//
+// A function is a list of basic blocks in layout order, blocks[0] being the entry.
+// Every block ends in exactly one terminator (Jump, Branch, Switch or Return).
+//
+// Virtual registers (vregs) are block-local SSA values: each is defined exactly once
+// and only used later in the same block. Anything that has to survive a control flow
+// edge (variables, results of short-circuit/ternary expressions) lives in a stack
+// slot and is moved around with explicit Load/Store instructions.
+//
+// Calls are a run of Arg instructions, last argument first, immediately followed by
+// the Call itself. Parameters are read with Param instructions at the very start of
+// the entry block.
+//
+// File-scope variables live in the program's global table rather than in slots, and
+// are accessed with LoadGlobal/StoreGlobal. Their initial values are compile-time
+// constants.
+//
+// Every value is a 32 bit C int. Constants are carried around in longs, but always
+// sign extended from their low 32 bits, see ir_wrap_int.
+
+// --------------------------------------------------------------------------------
+
+enum class IROpcode {
+    Const,  // dst = imm
+    Neg,    // dst = -a
+    Not,    // dst = ~a
+    LogicalNot,  // dst = !a
+    Add,    // dst = a + b
+    Sub,    // dst = a - b
+    Mul,    // dst = a * b
+    Div,    // dst = a / b
+    Mod,    // dst = a % b
+    And,    // dst = a & b
+    Or,     // dst = a | b
+    Xor,    // dst = a ^ b
+    Shl,    // dst = a << b
+    Shr,    // dst = a >> b, arithmetic
+    Equal,  // dst = a == b
+    NotEqual,
+    LessThan,
+    LessEqual,
+    GreaterThan,
+    GreaterEqual,
+    Select,  // dst = a ? b : c
+    Load,    // dst = slot[imm]
+    Store,   // slot[imm] = a
+    LoadGlobal,   // dst = globals[imm]
+    StoreGlobal,  // globals[imm] = a
+    Param,   // dst = imm'th parameter
+    Arg,     // pass a as imm'th argument of the following call
+    Call,    // dst = callee(...) with imm arguments
+    Jump,    // goto targets[0]
+    Branch,  // if (a) goto targets[0] else goto targets[1]
+    Switch,  // goto the target of the case matching a, targets[0] if there's none
+    Return,  // return a
+    Invalid
+};
+
+const char* ir_opcode_to_str(IROpcode opcode);
+bool ir_opcode_is_terminator(IROpcode opcode);
+bool ir_opcode_is_binary(IROpcode opcode);
+bool ir_opcode_is_unary(IROpcode opcode);
+
+// the int a computation wraps around to, like the generated code's 32 bit arithmetic
+inline long ir_wrap_int(unsigned long value) { return (int32_t)(uint32_t)value; }
+
+// evaluate opcode on constant operands, false if that's not possible at compile time
+bool ir_evaluate_constant(IROpcode opcode, long a, long b, long* result);
+
+struct IRBlock;
+
+struct IRSwitchCase {
+    long value;
+    IRBlock* target;
+};
+
+struct IRInstr {
+    IROpcode opcode = IROpcode::Invalid;
+    int dst = -1;               // vreg written by this instruction, -1 if none
+    int args[3] = {-1, -1, -1};  // vregs read by this instruction, -1 if unused
+    long imm = 0;               // constant value or stack slot index
+    IRBlock* targets[2] = {nullptr, nullptr};  // successors of Jump/Branch
+    const char* callee = nullptr;              // Call only
+    const IRSwitchCase* cases = nullptr;  // Switch only, imm of them sorted by value
+};
+
+struct IRBlock {
+    int id = -1;
+    bool loop_header = false;  // target of a loop's backward branch
+    DynHeapArray<IRInstr> instrs;
+};
+
+struct IRFunction {
+    const char* name = nullptr;
+    int param_count = 0;
+    DynHeapArray<IRBlock*> blocks;
+    int vreg_count = 0;
+    int slot_count = 0;
+};
+
+struct IRGlobal {
+    const char* name = nullptr;
+    long value = 0;  // initial value, globals starting out as 0 go into .bss
+};
+
+struct IRProgram {
+    DynHeapArray<IRFunction*> functions;
+    DynHeapArray<IRGlobal> globals;
+    DynHeapArray<const char*> externs;  // functions declared, but not defined here
+    struct qxc_memory_pool* pool = nullptr;
+};
+
+// --------------------------------------------------------------------------------
+
+IRProgram* ir_lower_program(Program* program);
+int ir_verify_program(IRProgram* program);
+void ir_print_program(IRProgram* program);
+void ir_program_free(IRProgram* program);
+
+IRInstr* ir_block_terminator(IRBlock* block);
+
+// successor blocks of a terminator, a Switch's default first and then its cases
+int ir_successor_count(const IRInstr* terminator);
+IRBlock* ir_successor(const IRInstr* terminator, int index);
+
+// Case values packed densely enough to dispatch through a table indexed by value
+// rather than by comparing against them one at a time. cases are sorted by value.
+bool ir_switch_cases_are_dense(const IRSwitchCase* cases, size_t count);
@@ -0,0 +1,346 @@
+#include <assert.h>
+#include <stdio.h>
+
+#include "array.h"
+#include "ir.h"
+#include "ir_opt.h"
+#include "prelude.h"
+#include "trace.h"
+
+// --------------------------------------------------------------------------------
+// inlining
+//
+// A call site is replaced by a copy of the callee's body. The block containing the
+// call is split in two around it:
+//
+//   bb3:                              bb3:
+//     ...                               ...
+//     arg 0, %4                         <callee entry block, param 0 -> %4>
+//     %5 = call f, 1                    ...
+//     %6 = add %5, %5      --->         store $r, %9   (for each ret %9)
+//     ret %6                            jump bb7
+//                                     <remaining callee blocks>
+//                                     bb7:
+//                                       %5 = load $r
+//                                       %6 = add %5, %5
+//                                       ret %6
+//
+// The callee's entry block is appended directly to the calling block, which keeps the
+// argument vregs in the same block as the code reading the parameters. Callee vregs
+// and slots are renumbered past the caller's own. Value numbering and dead code
+// elimination afterwards take care of folding the result slot and merging blocks.
+
+static IRFunction* find_function(IRProgram* program, const char* name)
+{
+    for (IRFunction* fn : program->functions) {
+        if (strs_are_equal(fn->name, name)) return fn;
+    }
+    return nullptr;
+}
+
+static size_t function_size(IRFunction* fn)
+{
+    size_t size = 0;
+    for (IRBlock* block : fn->blocks) {
+        size += block->instrs.length;
+    }
+    return size;
+}
+
+static bool calls_function(IRFunction* fn, const char* name)
+{
+    for (IRBlock* block : fn->blocks) {
+        for (const IRInstr& instr : block->instrs) {
+            if (instr.opcode == IROpcode::Call && strs_are_equal(instr.callee, name)) {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+// the entry block gets merged into the caller, so nothing may jump back to it
+static bool entry_is_jump_target(IRFunction* fn)
+{
+    for (IRBlock* block : fn->blocks) {
+        const IRInstr* term = ir_block_terminator(block);
+        for (int i = 0; i < ir_successor_count(term); i++) {
+            if (ir_successor(term, i) == fn->blocks[0]) return true;
+        }
+    }
+    return false;
+}
+
+struct Inliner {
+    IRProgram* program;
+    const CompileOptions* options;
+    DynHeapArray<int> call_counts;  // call sites per function, indexed like functions
+};
+
+static bool should_inline(Inliner* inliner, IRFunction* caller, IRFunction* callee)
+{
+    // inlining recursive functions only ever unrolls them by one level
+    if (!callee || callee == caller || calls_function(callee, callee->name) ||
+        entry_is_jump_target(callee)) {
+        return false;
+    }
+
+    size_t index = 0;
+    while (inliner->program->functions[index] != callee) index++;
+    const bool called_once = inliner->call_counts[index] == 1;
+
+    return called_once || function_size(callee) <= (size_t)inliner->options->inline_threshold;
+}
+
+static IRInstr renamed_instr(const IRInstr& instr, DynHeapArray<int>* vreg_map,
+                             int slot_base, DynHeapArray<IRBlock*>* block_map,
+                             struct qxc_memory_pool* pool)
+{
+    IRInstr copy = instr;
+
+    if (copy.dst >= 0) copy.dst = (*vreg_map)[(size_t)copy.dst];
+    for (int& arg : copy.args) {
+        if (arg >= 0) arg = (*vreg_map)[(size_t)arg];
+    }
+    if (copy.opcode == IROpcode::Load || copy.opcode == IROpcode::Store) {
+        copy.imm += slot_base;
+    }
+    for (IRBlock*& target : copy.targets) {
+        if (target) target = (*block_map)[(size_t)target->id];
+    }
+    if (copy.opcode == IROpcode::Switch) {
+        IRSwitchCase* cases = qxc_malloc_array<IRSwitchCase>(pool, (size_t)copy.imm);
+        for (long c = 0; c < copy.imm; c++) {
+            cases[c].value = instr.cases[c].value;
+            cases[c].target = (*block_map)[(size_t)instr.cases[c].target->id];
+        }
+        copy.cases = cases;
+    }
+
+    return copy;
+}
+
+// inline the call at block->instrs[call_index], returns the block holding the code
+// following the call and the index in it to resume scanning at
+static IRBlock* inline_call(Inliner* inliner, IRFunction* caller, IRBlock* block,
+                            size_t call_index, IRFunction* callee, size_t* resume_index)
+{
+    struct qxc_memory_pool* pool = inliner->program->pool;
+    const IRInstr call = block->instrs[call_index];
+
+    size_t first_arg = call_index;
+    while (first_arg > 0 && block->instrs[first_arg - 1].opcode == IROpcode::Arg) {
+        first_arg--;
+    }
+
+    // callee vreg -> caller vreg, parameters map straight to the argument vregs
+    DynHeapArray<int> vreg_map = heap_array_create<int>((size_t)callee->vreg_count + 1);
+    defer { array_free(&vreg_map); };
+    for (int v = 0; v < callee->vreg_count; v++) {
+        array_append(&vreg_map, caller->vreg_count + v);
+    }
+    caller->vreg_count += callee->vreg_count;
+
+    const int slot_base = caller->slot_count;
+    const int result_slot = slot_base + callee->slot_count;
+    caller->slot_count += callee->slot_count + 1;
+
+    DynHeapArray<int> arg_vregs = heap_array_create<int>((size_t)call.imm + 1);
+    defer { array_free(&arg_vregs); };
+    for (long i = 0; i < call.imm; i++) {
+        array_append(&arg_vregs, -1);
+    }
+    for (size_t i = first_arg; i < call_index; i++) {
+        arg_vregs[(size_t)block->instrs[i].imm] = block->instrs[i].args[0];
+    }
+    for (const IRInstr& instr : callee->blocks[0]->instrs) {
+        if (instr.opcode == IROpcode::Param) {
+            vreg_map[(size_t)instr.dst] = arg_vregs[(size_t)instr.imm];
+        }
+    }
+
+    // the code after the call moves to a new block, starting with the result
+    IRBlock* continuation = qxc_malloc<IRBlock>(pool);
+    continuation->instrs = heap_array_create<IRInstr>(block->instrs.length - call_index);
+
+    IRInstr load;
+    load.opcode = IROpcode::Load;
+    load.dst = call.dst;
+    load.imm = result_slot;
+    array_append(&continuation->instrs, load);
+
+    // vregs are block-local, so values computed before the call and used after it
+    // have to go through a slot now that the call site spans several blocks
+    DynHeapArray<int> spilled = heap_array_create<int>((size_t)caller->vreg_count);
+    defer { array_free(&spilled); };
+    for (int v = 0; v < caller->vreg_count; v++) {
+        array_append(&spilled, -1);
+    }
+    DynHeapArray<bool> defined_before = heap_array_create<bool>((size_t)caller->vreg_count);
+    defer { array_free(&defined_before); };
+    for (int v = 0; v < caller->vreg_count; v++) {
+        array_append(&defined_before, false);
+    }
+    for (size_t i = 0; i < first_arg; i++) {
+        if (block->instrs[i].dst >= 0) defined_before[(size_t)block->instrs[i].dst] = true;
+    }
+    DynHeapArray<IRInstr> spill_stores = heap_array_create<IRInstr>(4);
+    defer { array_free(&spill_stores); };
+
+    // the reloads go first, a reload landing between the arguments of a later call
+    // would split them from it
+    DynHeapArray<IRInstr> rest = heap_array_create<IRInstr>(block->instrs.length - call_index);
+    defer { array_free(&rest); };
+
+    for (size_t i = call_index + 1; i < block->instrs.length; i++) {
+        IRInstr instr = block->instrs[i];
+        for (int& arg : instr.args) {
+            if (arg < 0 || !defined_before[(size_t)arg]) continue;
+
+            if (spilled[(size_t)arg] < 0) {
+                IRInstr store;
+                store.opcode = IROpcode::Store;
+                store.args[0] = arg;
+                store.imm = caller->slot_count++;
+                array_append(&spill_stores, store);
+
+                IRInstr reload;
+                reload.opcode = IROpcode::Load;
+                reload.dst = caller->vreg_count++;
+                reload.imm = store.imm;
+                array_append(&continuation->instrs, reload);
+
+                spilled[(size_t)arg] = reload.dst;
+            }
+            arg = spilled[(size_t)arg];
+        }
+        array_append(&rest, instr);
+    }
+    for (const IRInstr& instr : rest) {
+        array_append(&continuation->instrs, instr);
+    }
+
+    block->instrs.length = first_arg;
+    for (const IRInstr& store : spill_stores) {
+        array_append(&block->instrs, store);
+    }
+
+    // callee block -> the block its code ends up in
+    DynHeapArray<IRBlock*> block_map = heap_array_create<IRBlock*>(callee->blocks.length);
+    defer { array_free(&block_map); };
+    array_append(&block_map, block);
+    for (size_t i = 1; i < callee->blocks.length; i++) {
+        IRBlock* copy = qxc_malloc<IRBlock>(pool);
+        copy->loop_header = callee->blocks[i]->loop_header;
+        copy->instrs = heap_array_create<IRInstr>(callee->blocks[i]->instrs.length);
+        array_append(&block_map, copy);
+    }
+
+    for (IRBlock* callee_block : callee->blocks) {
+        IRBlock* target = block_map[(size_t)callee_block->id];
+
+        for (const IRInstr& instr : callee_block->instrs) {
+            if (instr.opcode == IROpcode::Param) continue;
+
+            if (instr.opcode == IROpcode::Return) {
+                IRInstr store;
+                store.opcode = IROpcode::Store;
+                store.args[0] = vreg_map[(size_t)instr.args[0]];
+                store.imm = result_slot;
+                array_append(&target->instrs, store);
+
+                IRInstr jump;
+                jump.opcode = IROpcode::Jump;
+                jump.targets[0] = continuation;
+                array_append(&target->instrs, jump);
+                continue;
+            }
+
+            array_append(&target->instrs,
+                         renamed_instr(instr, &vreg_map, slot_base, &block_map, pool));
+        }
+    }
+
+    // lay out the callee's blocks and the continuation right after the calling block
+    const size_t insert_at = (size_t)block->id + 1;
+    const size_t inserted = callee->blocks.length;  // callee blocks minus the entry, plus continuation
+
+    for (size_t i = 0; i < inserted; i++) {
+        array_append(&caller->blocks, (IRBlock*)nullptr);
+    }
+    for (size_t i = caller->blocks.length - 1; i >= insert_at + inserted; i--) {
+        caller->blocks[i] = caller->blocks[i - inserted];
+    }
+    for (size_t i = 1; i < callee->blocks.length; i++) {
+        caller->blocks[insert_at + i - 1] = block_map[i];
+    }
+    caller->blocks[insert_at + inserted - 1] = continuation;
+
+    for (size_t i = 0; i < caller->blocks.length; i++) {
+        caller->blocks[i]->id = (int)i;
+    }
+
+    *resume_index = 1 + spill_stores.length;
+    return continuation;
+}
+
+static void inline_calls_in_function(Inliner* inliner, IRFunction* fn)
+{
+    // only the function's own call sites are considered, not the ones in code that
+    // was just inlined, which bounds the growth to one level per pass
+    DynHeapArray<IRBlock*> original_blocks = heap_array_create<IRBlock*>(fn->blocks.length);
+    defer { array_free(&original_blocks); };
+    for (IRBlock* block : fn->blocks) {
+        array_append(&original_blocks, block);
+    }
+
+    for (IRBlock* block : original_blocks) {
+        size_t i = 0;
+        while (i < block->instrs.length) {
+            const IRInstr& instr = block->instrs[i];
+            IRFunction* callee = instr.opcode == IROpcode::Call
+                                     ? find_function(inliner->program, instr.callee)
+                                     : nullptr;
+
+            if (callee && should_inline(inliner, fn, callee)) {
+                TRACE_DEBUG(TraceCategory::Opt, "inlining %s into %s", callee->name,
+                            fn->name);
+                block = inline_call(inliner, fn, block, i, callee, &i);
+            }
+            else {
+                i++;
+            }
+        }
+    }
+}
+
+void ir_inline_calls(IRProgram* program, const CompileOptions* options)
+{
+    if (options->inline_threshold <= 0) return;
+
+    Inliner inliner;
+    inliner.program = program;
+    inliner.options = options;
+    inliner.call_counts = heap_array_create<int>(program->functions.length);
+    defer { array_free(&inliner.call_counts); };
+
+    for (size_t i = 0; i < program->functions.length; i++) {
+        array_append(&inliner.call_counts, 0);
+    }
+    for (IRFunction* fn : program->functions) {
+        for (IRBlock* block : fn->blocks) {
+            for (const IRInstr& instr : block->instrs) {
+                if (instr.opcode != IROpcode::Call) continue;
+                for (size_t i = 0; i < program->functions.length; i++) {
+                    if (strs_are_equal(program->functions[i]->name, instr.callee)) {
+                        inliner.call_counts[i]++;
+                    }
+                }
+            }
+        }
+    }
+
+    for (IRFunction* fn : program->functions) {
+        inline_calls_in_function(&inliner, fn);
+    }
+}
@@ -0,0 +1,1029 @@
+#include "ir_opt.h"
+
+#include <assert.h>
+#include <stdio.h>
+
+#include "array.h"
+#include "prelude.h"
+#include "trace.h"
+
+static bool instr_has_side_effects(const IRInstr* instr)
+{
+    switch (instr->opcode) {
+        case IROpcode::Store:
+        case IROpcode::StoreGlobal:
+        case IROpcode::Arg:
+        case IROpcode::Call:
+            return true;
+        default:
+            return ir_opcode_is_terminator(instr->opcode);
+    }
+}
+
+// remove all instructions for which keep[i] is false, preserving order
+static void compact_instrs(IRBlock* block, DynHeapArray<bool>* keep)
+{
+    assert(keep->length == block->instrs.length);
+
+    size_t kept = 0;
+    for (size_t i = 0; i < block->instrs.length; i++) {
+        if ((*keep)[i]) {
+            block->instrs[kept++] = block->instrs[i];
+        }
+    }
+    block->instrs.length = kept;
+}
+
+// --------------------------------------------------------------------------------
+// dead code elimination
+
+// where a Branch or Switch on a known value goes
+static IRBlock* constant_target(const IRInstr* term, long value)
+{
+    if (term->opcode == IROpcode::Branch) {
+        return term->targets[value != 0 ? 0 : 1];
+    }
+
+    for (long c = 0; c < term->imm; c++) {
+        if (term->cases[c].value == value) return term->cases[c].target;
+    }
+    return term->targets[0];
+}
+
+// branch or switch on a constant -> unconditional jump
+static void fold_constant_branches(IRFunction* fn)
+{
+    for (IRBlock* block : fn->blocks) {
+        IRInstr* term = ir_block_terminator(block);
+        assert(term);
+        if (term->opcode != IROpcode::Branch && term->opcode != IROpcode::Switch) continue;
+
+        for (IRInstr& instr : block->instrs) {
+            if (instr.dst == term->args[0] && instr.opcode == IROpcode::Const) {
+                IRBlock* target = constant_target(term, instr.imm);
+                term->opcode = IROpcode::Jump;
+                term->args[0] = -1;
+                term->imm = 0;
+                term->targets[0] = target;
+                term->targets[1] = nullptr;
+                term->cases = nullptr;
+                break;
+            }
+        }
+    }
+}
+
+// drop all blocks for which keep[block->id] is false and renumber the rest
+static void compact_blocks(IRFunction* fn, DynHeapArray<bool>* keep)
+{
+    size_t kept = 0;
+    for (size_t i = 0; i < fn->blocks.length; i++) {
+        IRBlock* block = fn->blocks[i];
+        if ((*keep)[i]) {
+            block->id = (int)kept;
+            fn->blocks[kept++] = block;
+        }
+        else {
+            array_free(&block->instrs);
+        }
+    }
+    fn->blocks.length = kept;
+}
+
+static void remove_unreachable_blocks(IRFunction* fn)
+{
+    DynHeapArray<bool> reachable = heap_array_create<bool>(fn->blocks.length);
+    defer { array_free(&reachable); };
+    for (size_t i = 0; i < fn->blocks.length; i++) {
+        array_append(&reachable, false);
+    }
+
+    DynHeapArray<IRBlock*> worklist = heap_array_create<IRBlock*>(fn->blocks.length);
+    defer { array_free(&worklist); };
+
+    reachable[0] = true;
+    array_append(&worklist, fn->blocks[0]);
+
+    while (worklist.length > 0) {
+        IRBlock* block = worklist[worklist.length - 1];
+        worklist.length--;
+
+        const IRInstr* term = ir_block_terminator(block);
+        for (int i = 0; i < ir_successor_count(term); i++) {
+            IRBlock* succ = ir_successor(term, i);
+            if (!reachable[(size_t)succ->id]) {
+                reachable[(size_t)succ->id] = true;
+                array_append(&worklist, succ);
+            }
+        }
+    }
+
+    compact_blocks(fn, &reachable);
+}
+
+// A block ending in a jump to a block with no other predecessors can simply absorb
+// it. This cleans up the chains left behind by lowering and branch folding.
+static void merge_straight_line_blocks(IRFunction* fn)
+{
+    DynHeapArray<int> pred_count = heap_array_create<int>(fn->blocks.length);
+    defer { array_free(&pred_count); };
+    DynHeapArray<bool> keep = heap_array_create<bool>(fn->blocks.length);
+    defer { array_free(&keep); };
+
+    for (size_t i = 0; i < fn->blocks.length; i++) {
+        array_append(&pred_count, 0);
+        array_append(&keep, true);
+    }
+
+    for (IRBlock* block : fn->blocks) {
+        const IRInstr* term = ir_block_terminator(block);
+        for (int i = 0; i < ir_successor_count(term); i++) {
+            pred_count[(size_t)ir_successor(term, i)->id]++;
+        }
+    }
+
+    for (IRBlock* block : fn->blocks) {
+        if (!keep[(size_t)block->id]) continue;
+
+        while (true) {
+            IRInstr* term = ir_block_terminator(block);
+            if (term->opcode != IROpcode::Jump) break;
+
+            IRBlock* succ = term->targets[0];
+            if (succ == block || succ->id == 0 || pred_count[(size_t)succ->id] != 1) {
+                break;
+            }
+
+            block->instrs.length--;  // drop the jump
+            for (IRInstr& instr : succ->instrs) {
+                array_append(&block->instrs, instr);
+            }
+            array_clear(&succ->instrs);
+            keep[(size_t)succ->id] = false;
+        }
+    }
+
+    compact_blocks(fn, &keep);
+}
+
+// A store is also dead when the same block stores to the same place again before
+// anything reads it. Value numbering leaves plenty of those behind, having forwarded
+// the stored values to the loads in between, e.g. for x += 1; x += 1. Walking each
+// block backwards, a place is overwritten while its latest mark is the current epoch.
+// The epoch moves on for every block, and for globals at every call, which may read
+// any of them.
+static void remove_overwritten_stores(IRFunction* fn)
+{
+    size_t global_count = 0;
+    for (IRBlock* block : fn->blocks) {
+        for (const IRInstr& instr : block->instrs) {
+            const bool is_global_access = instr.opcode == IROpcode::LoadGlobal ||
+                                          instr.opcode == IROpcode::StoreGlobal;
+            if (is_global_access && (size_t)instr.imm >= global_count) {
+                global_count = (size_t)instr.imm + 1;
+            }
+        }
+    }
+
+    DynHeapArray<long> slot_marks = heap_array_create<long>((size_t)fn->slot_count + 1);
+    defer { array_free(&slot_marks); };
+    for (int i = 0; i < fn->slot_count; i++) {
+        array_append(&slot_marks, -1L);
+    }
+
+    DynHeapArray<long> global_marks = heap_array_create<long>(global_count + 1);
+    defer { array_free(&global_marks); };
+    for (size_t i = 0; i < global_count; i++) {
+        array_append(&global_marks, -1L);
+    }
+
+    DynHeapArray<bool> keep = heap_array_create<bool>(0);
+    defer { array_free(&keep); };
+    long epoch = 0;
+
+    for (IRBlock* block : fn->blocks) {
+        array_clear(&keep);
+        for (size_t i = 0; i < block->instrs.length; i++) {
+            array_append(&keep, true);
+        }
+
+        const long block_epoch = ++epoch;
+
+        for (size_t i = block->instrs.length; i > 0; i--) {
+            const IRInstr& instr = block->instrs[i - 1];
+
+            switch (instr.opcode) {
+                case IROpcode::Store:
+                    keep[i - 1] = slot_marks[(size_t)instr.imm] != block_epoch;
+                    slot_marks[(size_t)instr.imm] = block_epoch;
+                    break;
+                case IROpcode::Load:
+                    slot_marks[(size_t)instr.imm] = -1;
+                    break;
+                case IROpcode::StoreGlobal:
+                    keep[i - 1] = global_marks[(size_t)instr.imm] != epoch;
+                    global_marks[(size_t)instr.imm] = epoch;
+                    break;
+                case IROpcode::LoadGlobal:
+                    global_marks[(size_t)instr.imm] = -1;
+                    break;
+                case IROpcode::Call:
+                    epoch++;
+                    break;
+                default:
+                    break;
+            }
+        }
+
+        compact_instrs(block, &keep);
+    }
+}
+
+// Stores to slots that are never loaded from are dead. Afterwards, renumber the
+// remaining slots so the frame only holds what is actually used.
+static void remove_dead_stores(IRFunction* fn)
+{
+    DynHeapArray<int> slot_map = heap_array_create<int>((size_t)fn->slot_count + 1);
+    defer { array_free(&slot_map); };
+    for (int i = 0; i < fn->slot_count; i++) {
+        array_append(&slot_map, -1);
+    }
+
+    int live_slots = 0;
+    for (IRBlock* block : fn->blocks) {
+        for (IRInstr& instr : block->instrs) {
+            if (instr.opcode == IROpcode::Load && slot_map[(size_t)instr.imm] == -1) {
+                slot_map[(size_t)instr.imm] = live_slots++;
+            }
+        }
+    }
+
+    DynHeapArray<bool> keep = heap_array_create<bool>(0);
+    defer { array_free(&keep); };
+
+    for (IRBlock* block : fn->blocks) {
+        array_clear(&keep);
+
+        for (IRInstr& instr : block->instrs) {
+            const bool is_slot_access =
+                instr.opcode == IROpcode::Load || instr.opcode == IROpcode::Store;
+
+            if (is_slot_access && slot_map[(size_t)instr.imm] == -1) {
+                array_append(&keep, false);
+                continue;
+            }
+
+            if (is_slot_access) {
+                instr.imm = slot_map[(size_t)instr.imm];
+            }
+            array_append(&keep, true);
+        }
+
+        compact_instrs(block, &keep);
+    }
+
+    fn->slot_count = live_slots;
+}
+
+// Since vregs are block-local, a single backwards walk over each block finds every
+// pure instruction whose result is (transitively) unused.
+static void remove_dead_instrs(IRFunction* fn)
+{
+    DynHeapArray<bool> used = heap_array_create<bool>((size_t)fn->vreg_count + 1);
+    defer { array_free(&used); };
+    for (int i = 0; i < fn->vreg_count; i++) {
+        array_append(&used, false);
+    }
+
+    DynHeapArray<bool> keep = heap_array_create<bool>(0);
+    defer { array_free(&keep); };
+
+    for (IRBlock* block : fn->blocks) {
+        array_clear(&keep);
+        for (size_t i = 0; i < block->instrs.length; i++) {
+            array_append(&keep, false);
+        }
+
+        for (size_t i = block->instrs.length; i > 0; i--) {
+            IRInstr* instr = &block->instrs[i - 1];
+
+            const bool live = instr_has_side_effects(instr) ||
+                              (instr->dst >= 0 && used[(size_t)instr->dst]);
+            if (!live) continue;
+
+            keep[i - 1] = true;
+            for (int arg : instr->args) {
+                if (arg >= 0) used[(size_t)arg] = true;
+            }
+        }
+
+        compact_instrs(block, &keep);
+    }
+}
+
+void ir_eliminate_dead_code(IRFunction* fn)
+{
+    fold_constant_branches(fn);
+    remove_unreachable_blocks(fn);
+    merge_straight_line_blocks(fn);
+    remove_overwritten_stores(fn);
+    remove_dead_stores(fn);
+    remove_dead_instrs(fn);
+}
+
+// --------------------------------------------------------------------------------
+// local value numbering
+//
+// Within a block, any pure instruction computing the same operation on the same
+// operands as an earlier one is redundant, and its uses are redirected to the first
+// result. Slot contents are tracked too: a store makes the stored vreg the known value
+// of the slot, so later loads from it reuse that vreg until the slot is written again.
+// Globals work the same, except that any call may write them. Their keys carry the
+// number of calls seen so far in the block, so nothing from before a call matches.
+//
+// vregs being block-local means there is no cross-block reuse here, that would need a
+// slot (or phi) to carry the value along dominating paths.
+//
+// Operations on constants are folded on the way, before looking them up.
+
+struct ValueKey {
+    IROpcode opcode;
+    int args[3];
+    long imm;
+};
+
+struct ValueTableEntry {
+    ValueKey key;
+    int vreg;  // -1 if the entry is empty
+};
+
+struct ValueTable {
+    DynHeapArray<ValueTableEntry> entries;  // open addressing, power of two capacity
+};
+
+static bool value_keys_are_equal(const ValueKey* a, const ValueKey* b)
+{
+    return a->opcode == b->opcode && a->args[0] == b->args[0] &&
+           a->args[1] == b->args[1] && a->args[2] == b->args[2] && a->imm == b->imm;
+}
+
+static uint64_t value_key_hash(const ValueKey* key)
+{
+    uint64_t h = (uint64_t)key->opcode;
+    h = h * 0x9E3779B97F4A7C15ull ^ (uint64_t)(uint32_t)key->args[0];
+    h = h * 0x9E3779B97F4A7C15ull ^ (uint64_t)(uint32_t)key->args[1];
+    h = h * 0x9E3779B97F4A7C15ull ^ (uint64_t)(uint32_t)key->args[2];
+    h = h * 0x9E3779B97F4A7C15ull ^ (uint64_t)key->imm;
+    return h ^ (h >> 29);
+}
+
+static void value_table_reset(ValueTable* table, size_t max_entries)
+{
+    size_t capacity = 16;
+    while (capacity < 2 * max_entries) capacity *= 2;
+
+    array_clear(&table->entries);
+    reserve(&table->entries, capacity);
+
+    ValueTableEntry empty;
+    empty.vreg = -1;
+    for (size_t i = 0; i < capacity; i++) {
+        array_append(&table->entries, empty);
+    }
+}
+
+// returns the entry matching key, or the empty entry where it belongs
+static ValueTableEntry* value_table_find(ValueTable* table, const ValueKey* key)
+{
+    const size_t mask = table->entries.length - 1;
+    size_t i = (size_t)value_key_hash(key) & mask;
+
+    while (true) {
+        ValueTableEntry* entry = &table->entries[i];
+        if (entry->vreg == -1 || value_keys_are_equal(&entry->key, key)) {
+            return entry;
+        }
+        i = (i + 1) & mask;
+    }
+}
+
+static bool opcode_is_commutative(IROpcode opcode)
+{
+    switch (opcode) {
+        case IROpcode::Add:
+        case IROpcode::Mul:
+        case IROpcode::And:
+        case IROpcode::Or:
+        case IROpcode::Xor:
+        case IROpcode::Equal:
+        case IROpcode::NotEqual:
+            return true;
+        default:
+            return false;
+    }
+}
+
+// builds the key identifying the value computed by instr, canonicalizing operand
+// order so that e.g. a + b and b + a or a < b and b > a end up with the same key
+static ValueKey value_key_for(const IRInstr* instr)
+{
+    ValueKey key;
+    key.opcode = instr->opcode;
+    key.args[0] = instr->args[0];
+    key.args[1] = instr->args[1];
+    key.args[2] = instr->args[2];
+    key.imm = instr->opcode == IROpcode::Const || instr->opcode == IROpcode::Load ||
+                      instr->opcode == IROpcode::Param
+                  ? instr->imm
+                  : 0;
+
+    if (key.opcode == IROpcode::GreaterThan) {
+        key.opcode = IROpcode::LessThan;
+        std::swap(key.args[0], key.args[1]);
+    }
+    else if (key.opcode == IROpcode::GreaterEqual) {
+        key.opcode = IROpcode::LessEqual;
+        std::swap(key.args[0], key.args[1]);
+    }
+    else if (opcode_is_commutative(key.opcode) && key.args[0] > key.args[1]) {
+        std::swap(key.args[0], key.args[1]);
+    }
+
+    return key;
+}
+
+static ValueKey global_key(long global, int calls_seen)
+{
+    ValueKey key;
+    key.opcode = IROpcode::LoadGlobal;
+    key.args[0] = calls_seen;
+    key.args[1] = -1;
+    key.args[2] = -1;
+    key.imm = global;
+    return key;
+}
+
+static ValueKey slot_key(long slot)
+{
+    ValueKey key;
+    key.opcode = IROpcode::Load;
+    key.args[0] = -1;
+    key.args[1] = -1;
+    key.args[2] = -1;
+    key.imm = slot;
+    return key;
+}
+
+// Rewrite instr into a Const if all its operands are constants. Constant operands
+// are found through the leaders value numbering already assigned, so this also folds
+// through loads of slots that were just stored a constant.
+struct ConstantValue {
+    bool known = false;
+    long value = 0;
+};
+
+static void fold_constant_instr(IRInstr* instr, DynHeapArray<ConstantValue>* constants)
+{
+    const bool unary = ir_opcode_is_unary(instr->opcode);
+    if (!unary && !ir_opcode_is_binary(instr->opcode)) return;
+
+    const ConstantValue a = (*constants)[(size_t)instr->args[0]];
+    const ConstantValue b = unary ? a : (*constants)[(size_t)instr->args[1]];
+    if (!a.known || !b.known) return;
+
+    long result = 0;
+    if (!ir_evaluate_constant(instr->opcode, a.value, b.value, &result)) return;
+
+    instr->opcode = IROpcode::Const;
+    instr->args[0] = -1;
+    instr->args[1] = -1;
+    instr->imm = result;
+}
+
+void ir_number_values(IRFunction* fn)
+{
+    // the vreg each vreg has been found equivalent to (itself if unique)
+    DynHeapArray<int> leader = heap_array_create<int>((size_t)fn->vreg_count + 1);
+    defer { array_free(&leader); };
+    for (int i = 0; i < fn->vreg_count; i++) {
+        array_append(&leader, i);
+    }
+
+    ValueTable table;
+    table.entries = heap_array_create<ValueTableEntry>(0);
+    defer { array_free(&table.entries); };
+
+    DynHeapArray<bool> keep = heap_array_create<bool>(0);
+    defer { array_free(&keep); };
+
+    DynHeapArray<ConstantValue> constants =
+        heap_array_create<ConstantValue>((size_t)fn->vreg_count + 1);
+    defer { array_free(&constants); };
+    for (int i = 0; i < fn->vreg_count; i++) {
+        array_append(&constants, ConstantValue());
+    }
+
+    for (IRBlock* block : fn->blocks) {
+        value_table_reset(&table, block->instrs.length);
+        array_clear(&keep);
+        int calls_seen = 0;
+
+        for (IRInstr& instr : block->instrs) {
+            for (int& arg : instr.args) {
+                if (arg >= 0) arg = leader[(size_t)arg];
+            }
+
+            fold_constant_instr(&instr, &constants);
+            if (instr.opcode == IROpcode::Const) {
+                constants[(size_t)instr.dst].known = true;
+                constants[(size_t)instr.dst].value = instr.imm;
+            }
+
+            // a select on a known condition, or between two equal values, is that value
+            if (instr.opcode == IROpcode::Select) {
+                const ConstantValue condition = constants[(size_t)instr.args[0]];
+                if (condition.known || instr.args[1] == instr.args[2]) {
+                    const bool holds = !condition.known || condition.value != 0;
+                    const int chosen = holds ? instr.args[1] : instr.args[2];
+                    leader[(size_t)instr.dst] = chosen;
+                    constants[(size_t)instr.dst] = constants[(size_t)chosen];
+                    array_append(&keep, false);
+                    continue;
+                }
+            }
+
+            if (instr.opcode == IROpcode::Store || instr.opcode == IROpcode::StoreGlobal) {
+                // the slot now holds the stored value, whatever it held before
+                const ValueKey key = instr.opcode == IROpcode::Store
+                                         ? slot_key(instr.imm)
+                                         : global_key(instr.imm, calls_seen);
+                ValueTableEntry* entry = value_table_find(&table, &key);
+                entry->key = key;
+                entry->vreg = instr.args[0];
+                array_append(&keep, true);
+                continue;
+            }
+
+            // a call may return something different every time
+            if (instr.opcode == IROpcode::Call) calls_seen++;
+            if (instr.dst < 0 || instr.opcode == IROpcode::Call) {
+                array_append(&keep, true);
+                continue;
+            }
+
+            const ValueKey key = instr.opcode == IROpcode::LoadGlobal
+                                     ? global_key(instr.imm, calls_seen)
+                                     : value_key_for(&instr);
+            ValueTableEntry* entry = value_table_find(&table, &key);
+
+            if (entry->vreg >= 0) {
+                leader[(size_t)instr.dst] = entry->vreg;
+                array_append(&keep, false);
+            }
+            else {
+                entry->key = key;
+                entry->vreg = instr.dst;
+                array_append(&keep, true);
+            }
+        }
+
+        compact_instrs(block, &keep);
+    }
+}
+
+// --------------------------------------------------------------------------------
+// if-conversion
+//
+// A conditional whose arms do nothing but compute a value and store it to the same
+// place, as lowering produces for ?: and for an if/else assigning one variable,
+// becomes a select between both values:
+//
+//   bb0:                           bb0:
+//     %0 = lt %a, %b                 %2 = load $1
+//     branch %0, bb1, bb2            %3 = load $2
+//   bb1:                             %0 = lt %a, %b
+//     %2 = load $1                   %4 = select %0, %2, %3
+//     store $0, %2                   store $0, %4
+//     jump bb3                       jump bb3
+//   bb2:
+//     %3 = load $2
+//     store $0, %3
+//     jump bb3
+//
+// An if without an else works the same, with the place's old value on the other side.
+// Both arms always run afterwards, so they may only hold a few instructions, none of
+// which can trap or have side effects. Anything bigger is better off behind a branch.
+// The backend selects with cmov, which can't be mispredicted: a win for conditions
+// depending on the data, like those of min, max and clamp.
+//
+// The arms go ahead of the compare feeding the branch, so it stays next to the select
+// and can fuse with it. The join is merged in right away when nothing else jumps to
+// it. Blocks are visited from last to first, which turns a conditional nested inside
+// an arm into straight-line code before the one around it is looked at.
+
+// instructions per arm doing actual work, loads, stores and constants aside
+#define QXC_MAX_SELECT_ARM_COST 3
+
+struct SelectConversion {
+    DynHeapArray<int> pred_count;     // by block id
+    DynHeapArray<int> slot_accesses;  // loads and stores of each slot in the function
+    DynHeapArray<IRInstr> instrs;     // the converted block being put together
+};
+
+static bool is_compare(IROpcode opcode)
+{
+    return (opcode >= IROpcode::Equal && opcode <= IROpcode::GreaterEqual) ||
+           opcode == IROpcode::LogicalNot;
+}
+
+static IRBlock* jump_target(IRBlock* block)
+{
+    const IRInstr* term = ir_block_terminator(block);
+    return term->opcode == IROpcode::Jump ? term->targets[0] : nullptr;
+}
+
+// slot is only ever accessed from within arm, e.g. the one of a ternary nested in it
+static bool is_private_slot(SelectConversion* conv, IRBlock* arm, long slot)
+{
+    int accesses = 0;
+    for (const IRInstr& instr : arm->instrs) {
+        const bool is_slot_access =
+            instr.opcode == IROpcode::Load || instr.opcode == IROpcode::Store;
+        if (is_slot_access && instr.imm == slot) accesses++;
+    }
+    return accesses == conv->slot_accesses[(size_t)slot];
+}
+
+// dividing by a constant other than 0 and -1 can't trap
+static bool is_safe_divisor(IRBlock* arm, int vreg)
+{
+    for (const IRInstr& instr : arm->instrs) {
+        if (instr.dst == vreg) {
+            return instr.opcode == IROpcode::Const && instr.imm != 0 && instr.imm != -1;
+        }
+    }
+    return false;
+}
+
+// The store at the end of arm, if all before it is cheap and safe to run every time,
+// and arm then jumps to join. Other stores may only go to private slots.
+static const IRInstr* convertible_arm_store(SelectConversion* conv, IRBlock* arm,
+                                            IRBlock* join)
+{
+    const size_t n = arm->instrs.length;
+    if (arm->id == 0 || conv->pred_count[(size_t)arm->id] != 1 || n < 2) return nullptr;
+
+    const IRInstr* store = &arm->instrs[n - 2];
+    if (jump_target(arm) != join ||
+        (store->opcode != IROpcode::Store && store->opcode != IROpcode::StoreGlobal)) {
+        return nullptr;
+    }
+
+    int cost = 0;
+    for (size_t i = 0; i + 2 < n; i++) {
+        const IRInstr& instr = arm->instrs[i];
+
+        switch (instr.opcode) {
+            case IROpcode::Const:
+            case IROpcode::Load:
+            case IROpcode::LoadGlobal:
+                continue;
+            case IROpcode::Store:
+                if (!is_private_slot(conv, arm, instr.imm)) return nullptr;
+                continue;
+            case IROpcode::Div:
+            case IROpcode::Mod:
+                if (!is_safe_divisor(arm, instr.args[1])) return nullptr;
+                break;
+            case IROpcode::StoreGlobal:
+            case IROpcode::Param:
+            case IROpcode::Arg:
+            case IROpcode::Call:
+                return nullptr;
+            default:
+                break;
+        }
+
+        if (++cost > QXC_MAX_SELECT_ARM_COST) return nullptr;
+    }
+
+    return store;
+}
+
+// leaves a block nothing jumps to anymore for dead code elimination to drop
+static void make_unreachable(IRBlock* block)
+{
+    IRInstr jump;
+    jump.opcode = IROpcode::Jump;
+    jump.targets[0] = block;
+
+    array_clear(&block->instrs);
+    array_append(&block->instrs, jump);
+}
+
+static void convert_to_select(SelectConversion* conv, IRFunction* fn, IRBlock* block)
+{
+    const size_t n = block->instrs.length;
+    const IRInstr branch = block->instrs[n - 1];
+    if (branch.opcode != IROpcode::Branch || branch.targets[0] == branch.targets[1]) return;
+
+    // the arm taken when the condition holds and the other one, nullptr for the side
+    // of an if without else, which goes straight to the join
+    IRBlock* arms[2] = {branch.targets[0], branch.targets[1]};
+    IRBlock* join = nullptr;
+
+    IRBlock* then_next = jump_target(arms[0]);
+    IRBlock* else_next = jump_target(arms[1]);
+    if (then_next == arms[1]) {
+        join = arms[1];
+        arms[1] = nullptr;
+    }
+    else if (else_next == arms[0]) {
+        join = arms[0];
+        arms[0] = nullptr;
+    }
+    else if (then_next && then_next == else_next) {
+        join = then_next;
+    }
+    if (!join || join == block) return;
+
+    const IRInstr* stores[2] = {nullptr, nullptr};
+    for (int i = 0; i < 2; i++) {
+        if (!arms[i]) continue;
+        stores[i] = convertible_arm_store(conv, arms[i], join);
+        if (!stores[i]) return;
+    }
+
+    const IRInstr store = stores[0] ? *stores[0] : *stores[1];
+    if (stores[0] && stores[1] &&
+        (stores[1]->opcode != store.opcode || stores[1]->imm != store.imm)) {
+        return;
+    }
+
+    size_t insert_at = n - 1;
+    if (n >= 2 && block->instrs[n - 2].dst == branch.args[0] &&
+        is_compare(block->instrs[n - 2].opcode)) {
+        insert_at = n - 2;
+    }
+
+    array_clear(&conv->instrs);
+    for (size_t i = 0; i < insert_at; i++) {
+        array_append(&conv->instrs, block->instrs[i]);
+    }
+
+    int values[2];
+    for (int i = 0; i < 2; i++) {
+        if (arms[i]) {
+            const size_t length = arms[i]->instrs.length;
+            for (size_t j = 0; j + 2 < length; j++) {
+                array_append(&conv->instrs, arms[i]->instrs[j]);
+            }
+            values[i] = arms[i]->instrs[length - 2].args[0];
+            conv->pred_count[(size_t)join->id]--;
+            continue;
+        }
+
+        IRInstr load;
+        load.opcode = store.opcode == IROpcode::Store ? IROpcode::Load : IROpcode::LoadGlobal;
+        load.dst = fn->vreg_count++;
+        load.imm = store.imm;
+        array_append(&conv->instrs, load);
+        values[i] = load.dst;
+        if (store.opcode == IROpcode::Store) conv->slot_accesses[(size_t)store.imm]++;
+    }
+
+    for (size_t i = insert_at; i + 1 < n; i++) {
+        array_append(&conv->instrs, block->instrs[i]);
+    }
+
+    IRInstr select;
+    select.opcode = IROpcode::Select;
+    select.dst = fn->vreg_count++;
+    select.args[0] = branch.args[0];
+    select.args[1] = values[0];
+    select.args[2] = values[1];
+    array_append(&conv->instrs, select);
+
+    IRInstr new_store = store;
+    new_store.args[0] = select.dst;
+    array_append(&conv->instrs, new_store);
+
+    IRInstr jump;
+    jump.opcode = IROpcode::Jump;
+    jump.targets[0] = join;
+    array_append(&conv->instrs, jump);
+
+    // both arms ran into the join, now the block does
+    if (arms[0] && arms[1]) {
+        conv->pred_count[(size_t)join->id]++;
+        if (store.opcode == IROpcode::Store) conv->slot_accesses[(size_t)store.imm]--;
+    }
+
+    for (IRBlock* arm : arms) {
+        if (arm) make_unreachable(arm);
+    }
+
+    array_clear(&block->instrs);
+    for (const IRInstr& instr : conv->instrs) {
+        array_append(&block->instrs, instr);
+    }
+
+    if (join->id != 0 && !join->loop_header && conv->pred_count[(size_t)join->id] == 1) {
+        block->instrs.length--;  // drop the jump
+        for (const IRInstr& instr : join->instrs) {
+            array_append(&block->instrs, instr);
+        }
+        make_unreachable(join);
+    }
+}
+
+void ir_convert_to_selects(IRFunction* fn)
+{
+    SelectConversion conv;
+    conv.pred_count = heap_array_create<int>(fn->blocks.length);
+    conv.slot_accesses = heap_array_create<int>((size_t)fn->slot_count + 1);
+    conv.instrs = heap_array_create<IRInstr>(16);
+    defer {
+        array_free(&conv.pred_count);
+        array_free(&conv.slot_accesses);
+        array_free(&conv.instrs);
+    };
+
+    for (size_t i = 0; i < fn->blocks.length; i++) {
+        array_append(&conv.pred_count, 0);
+    }
+    for (int i = 0; i < fn->slot_count; i++) {
+        array_append(&conv.slot_accesses, 0);
+    }
+
+    for (IRBlock* block : fn->blocks) {
+        const IRInstr* term = ir_block_terminator(block);
+        for (int i = 0; i < ir_successor_count(term); i++) {
+            conv.pred_count[(size_t)ir_successor(term, i)->id]++;
+        }
+        for (const IRInstr& instr : block->instrs) {
+            if (instr.opcode == IROpcode::Load || instr.opcode == IROpcode::Store) {
+                conv.slot_accesses[(size_t)instr.imm]++;
+            }
+        }
+    }
+
+    for (size_t i = fn->blocks.length; i > 0; i--) {
+        convert_to_select(&conv, fn, fn->blocks[i - 1]);
+    }
+}
+
+// --------------------------------------------------------------------------------
+// tail recursion elimination
+//
+// A function returning the result of calling itself can just as well jump back to
+// its start with the parameters replaced by the new arguments:
+//
+//   bb0:                           bb0:
+//     %0 = param 0                   %0 = param 0
+//     store $0, %0                   store $0, %0
+//     ...                            jump bb1
+//     arg 0, %5                    bb1:  ; loop header
+//     %6 = call f, 1                 ...
+//     ret %6                         store $0, %5
+//                                    jump bb1
+//
+// All argument vregs are computed before the first parameter slot is overwritten, so
+// arguments reading the old parameter values see the right thing. This has to run
+// before value numbering, while every parameter still has its slot.
+
+static bool is_self_tail_call(IRFunction* fn, IRBlock* block)
+{
+    const size_t n = block->instrs.length;
+    if (n < 2) return false;
+
+    const IRInstr& call = block->instrs[n - 2];
+    const IRInstr& ret = block->instrs[n - 1];
+    return call.opcode == IROpcode::Call && ret.opcode == IROpcode::Return &&
+           ret.args[0] == call.dst && strs_are_equal(call.callee, fn->name);
+}
+
+void ir_eliminate_tail_recursion(IRFunction* fn, struct qxc_memory_pool* pool)
+{
+    bool found = false;
+    for (IRBlock* block : fn->blocks) {
+        found |= is_self_tail_call(fn, block);
+    }
+    if (!found) return;
+
+    // slot holding each parameter, from the Param/Store prologue of the entry block
+    DynHeapArray<long> param_slots = heap_array_create<long>((size_t)fn->param_count + 1);
+    defer { array_free(&param_slots); };
+    for (int i = 0; i < fn->param_count; i++) {
+        array_append(&param_slots, -1L);
+    }
+
+    IRBlock* entry = fn->blocks[0];
+    size_t prologue_length = 0;
+    while (prologue_length + 1 < entry->instrs.length &&
+           entry->instrs[prologue_length].opcode == IROpcode::Param &&
+           entry->instrs[prologue_length + 1].opcode == IROpcode::Store &&
+           entry->instrs[prologue_length + 1].args[0] == entry->instrs[prologue_length].dst) {
+        param_slots[(size_t)entry->instrs[prologue_length].imm] =
+            entry->instrs[prologue_length + 1].imm;
+        prologue_length += 2;
+    }
+
+    for (long slot : param_slots) {
+        if (slot < 0) return;  // not the prologue lowering produces, leave it alone
+    }
+
+    // split everything after the prologue off into the loop header
+    IRBlock* header = qxc_malloc<IRBlock>(pool);
+    header->loop_header = true;
+    header->instrs = heap_array_create<IRInstr>(entry->instrs.length - prologue_length);
+    for (size_t i = prologue_length; i < entry->instrs.length; i++) {
+        array_append(&header->instrs, entry->instrs[i]);
+    }
+    entry->instrs.length = prologue_length;
+
+    IRInstr jump;
+    jump.opcode = IROpcode::Jump;
+    jump.targets[0] = header;
+    array_append(&entry->instrs, jump);
+
+    array_append(&fn->blocks, header);
+    for (size_t i = fn->blocks.length - 1; i > 1; i--) {
+        fn->blocks[i] = fn->blocks[i - 1];
+    }
+    fn->blocks[1] = header;
+    for (size_t i = 0; i < fn->blocks.length; i++) {
+        fn->blocks[i]->id = (int)i;
+    }
+
+    for (IRBlock* block : fn->blocks) {
+        if (!is_self_tail_call(fn, block)) continue;
+
+        // args come last to first right before the call
+        size_t first_arg = block->instrs.length - 2;
+        while (first_arg > 0 && block->instrs[first_arg - 1].opcode == IROpcode::Arg) {
+            first_arg--;
+        }
+
+        DynHeapArray<IRInstr> tail = heap_array_create<IRInstr>((size_t)fn->param_count + 1);
+        defer { array_free(&tail); };
+
+        for (size_t i = first_arg; i < block->instrs.length - 2; i++) {
+            const IRInstr& arg = block->instrs[i];
+
+            IRInstr store;
+            store.opcode = IROpcode::Store;
+            store.args[0] = arg.args[0];
+            store.imm = param_slots[(size_t)arg.imm];
+            array_append(&tail, store);
+        }
+
+        block->instrs.length = first_arg;
+        for (const IRInstr& store : tail) {
+            array_append(&block->instrs, store);
+        }
+        array_append(&block->instrs, jump);
+    }
+}
+
+// --------------------------------------------------------------------------------
+
+static void optimize_functions(IRProgram* program, const CompileOptions* options)
+{
+    for (IRFunction* fn : program->functions) {
+        if (options->tail_calls) {
+            ir_eliminate_tail_recursion(fn, program->pool);
+        }
+        if (options->branchless) {
+            ir_convert_to_selects(fn);
+        }
+        ir_number_values(fn);
+        ir_eliminate_dead_code(fn);
+    }
+}
+
+void ir_optimize_program(IRProgram* program, const CompileOptions* options)
+{
+    TRACE_SPAN(TraceCategory::Opt, "optimize");
+
+    // callees are cleaned up first so their size reflects what would get inlined, and
+    // callers again afterwards to fold the inlined code into its surroundings. Branches
+    // on constant arguments fold away there, and the blocks merged as a result give
+    // value numbering more to work with, so that repeats until the CFG stops shrinking.
+    optimize_functions(program, options);
+    if (options->inline_threshold <= 0) return;
+
+    ir_inline_calls(program, options);
+    for (IRFunction* fn : program->functions) {
+        size_t block_count;
+        do {
+            block_count = fn->blocks.length;
+            ir_eliminate_dead_code(fn);
+            if (options->branchless) {
+                ir_convert_to_selects(fn);
+            }
+            ir_number_values(fn);
+            ir_eliminate_dead_code(fn);
+        } while (fn->blocks.length < block_count);
+    }
+}
@@ -0,0 +1,12 @@
+#pragma once
+
+#include "ir.h"
+#include "options.h"
+
+void ir_eliminate_tail_recursion(IRFunction* fn, struct qxc_memory_pool* pool);
+void ir_eliminate_dead_code(IRFunction* fn);
+void ir_number_values(IRFunction* fn);
+void ir_convert_to_selects(IRFunction* fn);
+void ir_inline_calls(IRProgram* program, const CompileOptions* options);
+
+void ir_optimize_program(IRProgram* program, const CompileOptions* options);
@@ -0,0 +1,199 @@
+#include "jit.h"
+
+#include <dlfcn.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "array.h"
+#include "codegen.h"
+#include "prelude.h"
+#include "trace.h"
+#include "x86.h"
+
+// The mapping holds the code of all functions, then a stub per external function,
+// then, starting on a fresh page so it can stay writable, the globals:
+//
+//   [functions][stubs] ... [globals]
+//   r-x                    rw-
+//
+// Everything referenced with a rel32 lives in the one mapping and is within reach.
+// External functions are anywhere in the address space, so calls to them go through
+// a stub jumping to the absolute address stored right behind it.
+
+#define JIT_STUB_SIZE 14  // jmp qword [rel 0], then the 8 byte address
+
+struct JitSymbol {
+    const char* name;
+    bool is_data;   // offset is relative to the globals, else to the code
+    size_t offset;
+};
+
+struct JitExternal {
+    const char* name;
+    size_t stub_offset;
+};
+
+static int compare_symbols(const void* a, const void* b)
+{
+    return strcmp(((const JitSymbol*)a)->name, ((const JitSymbol*)b)->name);
+}
+
+static JitSymbol* find_symbol(DynHeapArray<JitSymbol>* symbols, const char* name)
+{
+    JitSymbol key;
+    key.name = name;
+    return (JitSymbol*)bsearch(&key, symbols->begin(), symbols->length, sizeof(JitSymbol),
+                               compare_symbols);
+}
+
+// the stub for an external function, resolved in this process on first use
+static long external_stub(X86Code* code, DynHeapArray<JitExternal>* externals,
+                          const char* name)
+{
+    for (const JitExternal& external : *externals) {
+        if (strs_are_equal(external.name, name)) return (long)external.stub_offset;
+    }
+
+    void* address = dlsym(RTLD_DEFAULT, name);
+    if (address == nullptr) {
+        fprintf(stderr, "undefined reference to `%s'\n", name);
+        return -1;
+    }
+
+    JitExternal external;
+    external.name = name;
+    external.stub_offset = code->bytes.length;
+    array_append(externals, external);
+
+    const uint8_t jmp[] = {0xff, 0x25, 0x00, 0x00, 0x00, 0x00};
+    for (uint8_t byte : jmp) array_append(&code->bytes, byte);
+    const uint64_t target = (uint64_t)(uintptr_t)address;
+    for (int i = 0; i < 8; i++) array_append(&code->bytes, (uint8_t)(target >> (8 * i)));
+
+    return (long)external.stub_offset;
+}
+
+int jit_run(IRProgram* const* programs, size_t program_count, const CompileOptions* options,
+            int* exit_code)
+{
+    TRACE_SPAN(TraceCategory::Driver, "jit");
+
+    X86Code code = x86_code_create();
+    DynHeapArray<JitSymbol> symbols = heap_array_create<JitSymbol>(0);
+    DynHeapArray<JitExternal> externals = heap_array_create<JitExternal>(0);
+    DynHeapArray<size_t> function_offsets = heap_array_create<size_t>(0);
+    defer {
+        x86_code_free(&code);
+        array_free(&symbols);
+        array_free(&externals);
+        array_free(&function_offsets);
+    };
+
+    size_t data_size = 0;
+    for (size_t p = 0; p < program_count; p++) {
+        IRProgram* program = programs[p];
+
+        array_clear(&function_offsets);
+        generate_machine_code(program, options, nullptr, &code, &function_offsets);
+
+        for (size_t i = 0; i < program->functions.length; i++) {
+            JitSymbol symbol;
+            symbol.name = program->functions[i]->name;
+            symbol.is_data = false;
+            symbol.offset = function_offsets[i];
+            array_append(&symbols, symbol);
+        }
+        for (const IRGlobal& global : program->globals) {
+            JitSymbol symbol;
+            symbol.name = global.name;
+            symbol.is_data = true;
+            symbol.offset = data_size;
+            array_append(&symbols, symbol);
+            data_size += 4;
+        }
+    }
+
+    qsort(symbols.begin(), symbols.length, sizeof(JitSymbol), compare_symbols);
+    for (size_t i = 1; i < symbols.length; i++) {
+        if (strs_are_equal(symbols[i - 1].name, symbols[i].name)) {
+            fprintf(stderr, "multiple definition of `%s'\n", symbols[i].name);
+            return -1;
+        }
+    }
+
+    const JitSymbol* main_symbol = find_symbol(&symbols, "main");
+    if (main_symbol == nullptr || main_symbol->is_data) {
+        fprintf(stderr, "undefined reference to `main'\n");
+        return -1;
+    }
+
+    // stubs go right behind the functions, so the code is complete after this
+    for (const X86Fixup& fixup : code.fixups) {
+        if (find_symbol(&symbols, fixup.symbol) == nullptr &&
+            external_stub(&code, &externals, fixup.symbol) < 0) {
+            return -1;
+        }
+    }
+
+    const size_t page_size = (size_t)sysconf(_SC_PAGESIZE);
+    const size_t code_size = (code.bytes.length + page_size - 1) / page_size * page_size;
+    const size_t mapping_size = code_size + (data_size + page_size - 1) / page_size * page_size;
+
+    uint8_t* base = (uint8_t*)mmap(nullptr, mapping_size, PROT_READ | PROT_WRITE,
+                                   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (base == MAP_FAILED) {
+        perror("mmap");
+        return -1;
+    }
+    defer { munmap(base, mapping_size); };
+
+    memcpy(base, code.bytes.begin(), code.bytes.length);
+
+    // the mapping comes zero filled, like .bss
+    size_t data_offset = code_size;
+    for (size_t p = 0; p < program_count; p++) {
+        for (const IRGlobal& global : programs[p]->globals) {
+            const int32_t value = (int32_t)global.value;
+            memcpy(base + data_offset, &value, 4);
+            data_offset += 4;
+        }
+    }
+
+    for (const X86Fixup& fixup : code.fixups) {
+        const JitSymbol* symbol = find_symbol(&symbols, fixup.symbol);
+        long target = 0;
+        if (symbol == nullptr) {
+            target = external_stub(&code, &externals, fixup.symbol);
+        }
+        else {
+            target = (long)(symbol->is_data ? code_size + symbol->offset : symbol->offset);
+        }
+
+        const int32_t rel = (int32_t)(target + fixup.addend - (long)fixup.offset);
+        memcpy(base + fixup.offset, &rel, 4);
+    }
+
+    if (mprotect(base, code_size, PROT_READ | PROT_EXEC) != 0) {
+        perror("mprotect");
+        return -1;
+    }
+
+    typedef int (*EntryPoint)(void);
+    const EntryPoint entry = reinterpret_cast<EntryPoint>(base + main_symbol->offset);
+
+    int result = 0;
+    {
+        TRACE_SPAN(TraceCategory::Driver, "run");
+        result = entry();
+    }
+
+    // whatever the program printed through libc is still buffered in our stdout
+    fflush(stdout);
+
+    *exit_code = (int)(result & 0xff);
+    return 0;
+}
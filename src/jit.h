@@ -0,0 +1,16 @@
+#pragma once
+
+#include <stddef.h>
+
+#include "ir.h"
+#include "options.h"
+
+// qxc --run: the whole program is encoded straight into executable memory of this
+// process and its main is called there, with no assembler, linker or binary involved.
+// Functions not defined by any of the programs are looked up in the running process,
+// which makes libc available just like when linking against it.
+//
+// Returns -1 if the program can't be run (e.g. an undefined function), else 0 with
+// main's result truncated to an exit status in *exit_code, as _start's exit would.
+int jit_run(IRProgram* const* programs, size_t program_count, const CompileOptions* options,
+            int* exit_code);
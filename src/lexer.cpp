@@ -12,6 +12,7 @@
 #include "array.h"
 #include "prelude.h"
 #include "token.h"
+#include "trace.h"
 
 #define QXC_MAXIMUM_IDENTIFIER_LENGTH 256
 
@@ -49,7 +50,8 @@ static int tokenizer_init(Tokenizer* tokenizer, const char* filepath)
     rewind(f);
 
     tokenizer->contents = (char*)malloc(fsize + 1);
-    fread(tokenizer->contents, 1, fsize, f);
+    const size_t read_size = fread(tokenizer->contents, 1, fsize, f);
+    tokenizer->contents[read_size] = '\0';  // the tokenizer stops at the terminator
     fclose(f);
 
     tokenizer->id[0] = '\0';
@@ -87,21 +89,46 @@ static inline bool is_valid_keyword_identifier_first_character(char c)
 
 static inline bool is_valid_operator_first_character(char c)
 {
-    return c != '\0' && strchr(":?-+/*!~&|=<>", c) != nullptr;
+    return c != '\0' && strchr(":?-+/*%!~&|^=<>", c) != nullptr;
 }
 
-static inline bool can_be_digraph_first_character(char c) { return strchr("&|!=<>", c); }
+static inline bool can_be_digraph_first_character(char c)
+{
+    return strchr("+-*/%&|^!=<>", c);
+}
 
 static inline Operator try_build_digraph_operator(char c1, char c2)
 {
     if (!can_be_digraph_first_character(c1)) return Operator::Invalid;
 
     switch (c1) {
+        case '+':
+            if (c2 == '+') return Operator::Increment;
+            if (c2 == '=') return Operator::AddAssign;
+            break;
+        case '-':
+            if (c2 == '-') return Operator::Decrement;
+            if (c2 == '=') return Operator::SubtractAssign;
+            break;
+        case '*':
+            if (c2 == '=') return Operator::MultiplyAssign;
+            break;
+        case '/':
+            if (c2 == '=') return Operator::DivideAssign;
+            break;
+        case '%':
+            if (c2 == '=') return Operator::ModuloAssign;
+            break;
         case '&':
             if (c2 == '&') return Operator::LogicalAND;
+            if (c2 == '=') return Operator::AndAssign;
             break;
         case '|':
             if (c2 == '|') return Operator::LogicalOR;
+            if (c2 == '=') return Operator::OrAssign;
+            break;
+        case '^':
+            if (c2 == '=') return Operator::XorAssign;
             break;
         case '!':
             if (c2 == '=') return Operator::NotEqualTo;
@@ -111,9 +138,11 @@ static inline Operator try_build_digraph_operator(char c1, char c2)
             break;
         case '<':
             if (c2 == '=') return Operator::LessThanOrEqualTo;
+            if (c2 == '<') return Operator::BitShiftLeft;
             break;
         case '>':
             if (c2 == '=') return Operator::GreaterThanOrEqualTo;
+            if (c2 == '>') return Operator::BitShiftRight;
             break;
         default:
             break;
@@ -122,6 +151,15 @@ static inline Operator try_build_digraph_operator(char c1, char c2)
     return Operator::Invalid;
 }
 
+// <<= and >>= are the only operators three characters long
+static inline Operator try_build_trigraph_operator(Operator digraph_op, char c3)
+{
+    if (c3 != '=') return Operator::Invalid;
+    if (digraph_op == Operator::BitShiftLeft) return Operator::ShiftLeftAssign;
+    if (digraph_op == Operator::BitShiftRight) return Operator::ShiftRightAssign;
+    return Operator::Invalid;
+}
+
 static inline Operator build_unigraph_operator(char c)
 {
     switch (c) {
@@ -133,6 +171,14 @@ static inline Operator build_unigraph_operator(char c)
             return Operator::Divide;
         case '*':
             return Operator::Multiply;
+        case '%':
+            return Operator::Percent;
+        case '&':
+            return Operator::BitwiseAND;
+        case '|':
+            return Operator::BitwiseOR;
+        case '^':
+            return Operator::BitwiseXOR;
         case '!':
             return Operator::LogicalNegation;
         case '>':
@@ -179,7 +225,7 @@ static void tokenizer_consume_id(Tokenizer* tokenizer)
 
 static inline bool is_valid_symbol(char c)
 {
-    return c != '\0' && strchr("{}();", c) != nullptr;
+    return c != '\0' && strchr("{}();,", c) != nullptr;
 }
 
 static void build_symbol_token(Tokenizer* tokenizer, DynHeapArray<Token>* token_buffer,
@@ -205,6 +251,9 @@ static void build_symbol_token(Tokenizer* tokenizer, DynHeapArray<Token>* token_
         case ';':
             new_token->type = TokenType::SemiColon;
             break;
+        case ',':
+            new_token->type = TokenType::Comma;
+            break;
         default:
             new_token->type = TokenType::Invalid;
             break;
@@ -238,12 +287,14 @@ static void consume_operator_token(Tokenizer* tokenizer,
 
 int tokenize(DynHeapArray<Token>* token_buffer, const char* filepath)
 {
+    TRACE_SPAN(TraceCategory::Lexer, "tokenize");
+
     array_clear(token_buffer);
 
     Tokenizer tokenizer;
 
     if (tokenizer_init(&tokenizer, filepath) != 0) {
-        debug_print("failed to initializer tokenizer");
+        fprintf(stderr, "cannot read %s\n", filepath);
         return -1;
     }
 
@@ -283,7 +334,16 @@ int tokenize(DynHeapArray<Token>* token_buffer, const char* filepath)
             Operator digraph_op = try_build_digraph_operator(c1, c2);
 
             if (digraph_op != Operator::Invalid) {
-                consume_operator_token(&tokenizer, token_buffer, digraph_op);
+                tokenizer_advance(&tokenizer);
+
+                Operator trigraph_op =
+                    try_build_trigraph_operator(digraph_op, tokenizer.next_char);
+                if (trigraph_op != Operator::Invalid) {
+                    consume_operator_token(&tokenizer, token_buffer, trigraph_op);
+                }
+                else {
+                    build_operator_token(&tokenizer, token_buffer, digraph_op);
+                }
             }
             else {
                 Operator maybe_unigraph_op = build_unigraph_operator(c1);
@@ -339,8 +399,9 @@ int tokenize(DynHeapArray<Token>* token_buffer, const char* filepath)
         }
 
         else {
-            debug_print("encountered unexpected character: %c %d\n", tokenizer.next_char,
-                        (int)tokenizer.next_char);
+            fprintf(stderr, "%s:%d:%d: unexpected character '%c' (%d)\n", filepath,
+                    tokenizer.current_line, tokenizer.current_column, tokenizer.next_char,
+                    (int)tokenizer.next_char);
             // TODO: free buffer and return nullptr here
             break;
         }
@@ -5,40 +5,161 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
 #include <unistd.h>
 
 #include "allocator.h"
 #include "ast.h"
+#include "bytecode.h"
 #include "codegen.h"
+#include "elf_reader.h"
+#include "ir.h"
+#include "ir_opt.h"
+#include "jit.h"
 #include "lexer.h"
+#include "object_cache.h"
+#include "options.h"
 #include "prelude.h"
 #include "pretty_print_ast.h"
+#include "server.h"
 #include "strbuf.h"
+#include "thread_pool.h"
+#include "trace.h"
+
+// COMPILE_MODE links an executable, OBJECT_MODE (-c) stops at one object per source,
+// RUN_MODE (--run) runs the program in process without writing any files, and so does
+// INTERPRET_MODE (--interpret), only executing bytecode instead of machine code
+enum qxc_mode {
+    TOKENIZE_MODE,
+    PARSE_MODE,
+    IR_MODE,
+    OBJECT_MODE,
+    COMPILE_MODE,
+    RUN_MODE,
+    INTERPRET_MODE
+};
 
-enum qxc_mode { TOKENIZE_MODE, PARSE_MODE, COMPILE_MODE };
-
-struct qxc_context {
+// one input file, compiled to an object file independently of all others. Objects
+// given on the command line are units too, they only take part in linking.
+struct translation_unit {
     char canonical_input_filepath[PATH_MAX];
-    char work_dir[PATH_MAX];
+    bool is_object_input = false;
     char output_assembly_path[2 * PATH_MAX];
     char output_object_path[2 * PATH_MAX];
+    int assembly_fd = -1;  // in-memory files backing the paths above, unless saved
+    int object_fd = -1;
+
+    struct qxc_context* ctx = nullptr;
+    IRProgram* ir = nullptr;
+    ObjectCacheSymbols symbols;  // what linking needs to know, from the IR or the cache
+    PeepholeStats peephole_stats;
+    int result = 0;
+};
+
+struct qxc_context {
+    DynHeapArray<translation_unit> units;
     char output_exe_path[2 * PATH_MAX];
 
     enum qxc_mode mode;
     bool verbose;
+    bool save_temps;  // intermediates go to the current directory instead of memory
+    int jobs;  // worker threads compiling translation units
+    CompileOptions options;
+
+    bool use_cache;
+    bool print_cache_stats;
+    long cache_max_bytes;
+    ObjectCache cache;
+
+    bool tracing;  // trace_init succeeded, shut it down with the context
 };
 
+// parses the number following option argv[*i], advancing *i past it
+static int parse_count_argument(int argc, char* argv[], int* i, long max_value, long* value)
+{
+    char* end = nullptr;
+    *value = *i + 1 < argc ? strtol(argv[*i + 1], &end, 10) : -1;
+    if (end == nullptr || *end != '\0' || *value < 0 || *value > max_value) {
+        fprintf(stderr, "%s expects a non-negative number\n", argv[*i]);
+        return -1;
+    }
+
+    (*i)++;
+    return 0;
+}
+
+static int add_translation_unit(struct qxc_context* ctx, const char* input_filepath)
+{
+    translation_unit* unit = array_extend(&ctx->units);
+    new (unit) translation_unit();
+    unit->ctx = ctx;
+    unit->symbols = object_cache_symbols_create();
+
+    if (realpath(input_filepath, unit->canonical_input_filepath) == nullptr) {
+        fprintf(stderr, "Specified file doesn't exist or could not be opened.\n");
+        fprintf(stderr, "--> %s\n", input_filepath);
+        return -1;
+    }
+
+    const size_t length = strlen(unit->canonical_input_filepath);
+    unit->is_object_input =
+        length > 2 && strs_are_equal(unit->canonical_input_filepath + length - 2, ".o");
+
+    return 0;
+}
+
+// Intermediate files live in anonymous memory and are handed to nasm and the linker
+// as /proc/self/fd/N, which child processes inherit. Only --save-temps writes them
+// out, as name in the current directory. *fd is -1 for a real file.
+static int create_intermediate_file(struct qxc_context* ctx, const char* name, char* path,
+                                    int* fd)
+{
+    if (ctx->save_temps) {
+        sprintf(path, "%s", name);
+        *fd = -1;
+        return 0;
+    }
+
+    *fd = memfd_create(name, 0);
+    if (*fd < 0) {
+        perror("memfd_create");
+        return -1;
+    }
+
+    sprintf(path, "/proc/self/fd/%d", *fd);
+    return 0;
+}
+
+static void close_intermediate_file(int fd)
+{
+    if (fd >= 0) close(fd);
+}
+
+static bool mode_emits_objects(enum qxc_mode mode)
+{
+    return mode == OBJECT_MODE || mode == COMPILE_MODE;
+}
+
+static bool mode_runs_program(enum qxc_mode mode)
+{
+    return mode == RUN_MODE || mode == INTERPRET_MODE;
+}
+
 // parse command line arguments, determine paths of output files and working directory
 static int qxc_context_init(struct qxc_context* ctx, int argc, char* argv[])
 {
-    ctx->canonical_input_filepath[0] = '\0';
-    ctx->work_dir[0] = '\0';
-    ctx->output_assembly_path[0] = '\0';
-    ctx->output_object_path[0] = '\0';
+    ctx->units = heap_array_create<translation_unit>(1);
     ctx->output_exe_path[0] = '\0';
 
     ctx->mode = COMPILE_MODE;
     ctx->verbose = false;
+    ctx->save_temps = false;
+    ctx->jobs = thread_pool_default_thread_count();
+    ctx->options = CompileOptions();
+    ctx->use_cache = true;
+    ctx->print_cache_stats = false;
+    ctx->tracing = false;
+    ctx->cache_max_bytes = 512L << 20;
 
     if (argc < 2) {
         // TODO error print macro
@@ -47,113 +168,444 @@ static int qxc_context_init(struct qxc_context* ctx, int argc, char* argv[])
         return -1;
     }
 
-    const char* user_specified_input_filepath = nullptr;
+    const char* user_specified_output_path = nullptr;
+    const char* trace_categories = nullptr;
+    const char* trace_json_path = nullptr;
 
     for (int i = 1; i < argc; i++) {
         const char* ith_arg = argv[i];
 
-        if (access(ith_arg, R_OK) == -1) {
+        if (strs_are_equal("-o", ith_arg)) {
+            if (i + 1 == argc) {
+                fprintf(stderr, "-o expects an output file name\n");
+                return EXIT_FAILURE;
+            }
+            user_specified_output_path = argv[++i];
+        }
+        else if (access(ith_arg, R_OK) == -1) {
+            long value = 0;
+
             if (strs_are_equal("-t", ith_arg)) {
                 ctx->mode = TOKENIZE_MODE;
             }
             else if (strs_are_equal("-p", ith_arg)) {
                 ctx->mode = PARSE_MODE;
             }
+            else if (strs_are_equal("-i", ith_arg)) {
+                ctx->mode = IR_MODE;
+            }
+            else if (strs_are_equal("-c", ith_arg)) {
+                ctx->mode = OBJECT_MODE;
+            }
+            else if (strs_are_equal("--run", ith_arg)) {
+                ctx->mode = RUN_MODE;
+            }
+            else if (strs_are_equal("--interpret", ith_arg)) {
+                ctx->mode = INTERPRET_MODE;
+            }
             else if (strs_are_equal("-v", ith_arg)) {
                 ctx->verbose = true;
             }
+            else if (strs_are_equal("-j", ith_arg)) {
+                if (parse_count_argument(argc, argv, &i, INT_MAX, &value) != 0) {
+                    return EXIT_FAILURE;
+                }
+                ctx->jobs = value > 0 ? (int)value : thread_pool_default_thread_count();
+            }
+            else if (strs_are_equal("--save-temps", ith_arg)) {
+                ctx->save_temps = true;
+            }
+            else if (strs_are_equal("--no-cache", ith_arg)) {
+                ctx->use_cache = false;
+            }
+            else if (strs_are_equal("--cache-size", ith_arg)) {
+                if (parse_count_argument(argc, argv, &i, LONG_MAX >> 20, &value) != 0) {
+                    return EXIT_FAILURE;
+                }
+                ctx->cache_max_bytes = value << 20;  // given in MiB
+            }
+            else if (strs_are_equal("--trace", ith_arg)) {
+                if (i + 1 == argc) {
+                    fprintf(stderr, "--trace expects a list of categories\n");
+                    return EXIT_FAILURE;
+                }
+                trace_categories = argv[++i];
+            }
+            else if (strs_are_equal("--trace-json", ith_arg)) {
+                if (i + 1 == argc) {
+                    fprintf(stderr, "--trace-json expects an output file name\n");
+                    return EXIT_FAILURE;
+                }
+                trace_json_path = argv[++i];
+            }
+            else if (strs_are_equal("--cache-stats", ith_arg)) {
+                ctx->print_cache_stats = true;
+            }
+            else if (strs_are_equal("--no-tail-calls", ith_arg)) {
+                ctx->options.tail_calls = false;
+            }
+            else if (strs_are_equal("--no-branchless", ith_arg)) {
+                ctx->options.branchless = false;
+            }
+            else if (strs_are_equal("--inline-threshold", ith_arg)) {
+                if (parse_count_argument(argc, argv, &i, INT_MAX, &value) != 0) {
+                    return EXIT_FAILURE;
+                }
+                ctx->options.inline_threshold = (int)value;
+            }
+            else if (strs_are_equal("--max-nesting-depth", ith_arg)) {
+                if (parse_count_argument(argc, argv, &i, INT_MAX, &value) != 0) {
+                    return EXIT_FAILURE;
+                }
+                ctx->options.max_nesting_depth = (int)value;
+            }
         }
-        else {
-            user_specified_input_filepath = ith_arg;
+        else if (add_translation_unit(ctx, ith_arg) != 0) {
+            return EXIT_FAILURE;
         }
     }
 
-    if (user_specified_input_filepath == nullptr) {
+    if (trace_init(trace_categories, trace_json_path) != 0) {
+        return EXIT_FAILURE;
+    }
+    ctx->tracing = true;
+
+    ctx->use_cache = ctx->use_cache && mode_emits_objects(ctx->mode);
+    if ((ctx->use_cache || ctx->print_cache_stats) &&
+        object_cache_init(&ctx->cache, ctx->cache_max_bytes) != 0) {
+        fprintf(stderr, "cannot use object cache directory, compiling without it\n");
+        ctx->use_cache = false;
+        ctx->print_cache_stats = false;
+    }
+
+    // qxc --cache-stats on its own just reports
+    if (ctx->units.length == 0 && ctx->print_cache_stats) {
+        return 0;
+    }
+
+    if (ctx->units.length == 0) {
         fprintf(stderr, "No input file specified in command line arguments.\n");
         return EXIT_FAILURE;
     }
 
-    if (realpath(user_specified_input_filepath, ctx->canonical_input_filepath) ==
-        nullptr) {
-        fprintf(stderr, "Specified file doesn't exist or could not be opened.\n");
-        fprintf(stderr, "--> %s\n", user_specified_input_filepath);
+    size_t source_count = 0;
+    for (const translation_unit& unit : ctx->units) {
+        source_count += !unit.is_object_input;
+    }
+    if (ctx->mode == OBJECT_MODE && user_specified_output_path && source_count > 1) {
+        fprintf(stderr, "-o with -c names a single object, but there are %zu sources\n",
+                source_count);
         return EXIT_FAILURE;
     }
 
-    const size_t canonical_path_len = strlen(ctx->canonical_input_filepath);
+    // anything printed along the way would get interleaved between units
+    if (ctx->verbose || !mode_emits_objects(ctx->mode)) {
+        ctx->jobs = 1;
+    }
 
-    char input_dir[PATH_MAX];
-    char input_base[PATH_MAX];
-    strncpy(input_dir, ctx->canonical_input_filepath, canonical_path_len);
-    strncpy(input_base, ctx->canonical_input_filepath, canonical_path_len);
+    // nothing to write, the program only ever exists in memory
+    if (mode_runs_program(ctx->mode)) {
+        return 0;
+    }
 
-    char* dname = dirname(input_dir);
-    char* bname = basename(input_base);
-    strip_ext(bname);
+    for (size_t i = 0; i < ctx->units.length; i++) {
+        translation_unit* unit = &ctx->units[i];
 
-    const char* new_tmp_dir = mk_tmp_dir();
-    if (new_tmp_dir == nullptr) {
-        fprintf(stderr, "failed to create working dir for qxc\n");
-        return -1;
-    }
+        if (unit->is_object_input) {
+            sprintf(unit->output_object_path, "%s", unit->canonical_input_filepath);
+            continue;
+        }
+
+        char input_base[PATH_MAX];
+        strcpy(input_base, unit->canonical_input_filepath);
+        char* bname = basename(input_base);
+        strip_ext(bname);
+
+        char name[PATH_MAX + 8];
+        sprintf(name, "%s.asm", bname);
+        if (create_intermediate_file(ctx, name, unit->output_assembly_path,
+                                     &unit->assembly_fd) != 0) {
+            return -1;
+        }
+
+        // -c objects are outputs: named by -o, else after the source in the current
+        // directory, like other compilers do
+        if (ctx->mode == OBJECT_MODE) {
+            if (user_specified_output_path) {
+                sprintf(unit->output_object_path, "%s", user_specified_output_path);
+            }
+            else {
+                sprintf(unit->output_object_path, "%s.o", bname);
+            }
+            continue;
+        }
 
-    sprintf(ctx->work_dir, "%s", new_tmp_dir);
+        sprintf(name, "%s.o", bname);
+        if (create_intermediate_file(ctx, name, unit->output_object_path,
+                                     &unit->object_fd) != 0) {
+            return -1;
+        }
+    }
 
-    sprintf(ctx->output_assembly_path, "%s/%s.asm", ctx->work_dir, bname);
-    sprintf(ctx->output_object_path, "%s/%s.o", ctx->work_dir, bname);
-    sprintf(ctx->output_exe_path, "%s/%s", dname, bname);
+    // without -o, the executable is named after the first input file, next to it
+    if (user_specified_output_path) {
+        sprintf(ctx->output_exe_path, "%s", user_specified_output_path);
+    }
+    else {
+        char input_dir[PATH_MAX];
+        char input_base[PATH_MAX];
+        strcpy(input_dir, ctx->units[0].canonical_input_filepath);
+        strcpy(input_base, ctx->units[0].canonical_input_filepath);
+
+        char* dname = dirname(input_dir);
+        char* bname = basename(input_base);
+        strip_ext(bname);
+        sprintf(ctx->output_exe_path, "%s/%s", dname, bname);
+    }
 
     return 0;
 }
 
-static void qxc_context_deinit(struct qxc_context* ctx) { rm_tmp_dir(ctx->work_dir); }
+static void qxc_context_deinit(struct qxc_context* ctx)
+{
+    for (translation_unit& unit : ctx->units) {
+        if (unit.ir) ir_program_free(unit.ir);
+        object_cache_symbols_free(&unit.symbols);
+        close_intermediate_file(unit.assembly_fd);
+        close_intermediate_file(unit.object_fd);
+    }
+    array_free(&ctx->units);
 
-static int qxc_context_run(const struct qxc_context* ctx)
+    if (ctx->tracing) {
+        trace_shutdown();
+    }
+}
+
+static int tokenize_translation_unit(const translation_unit* unit)
 {
-    if (ctx->mode == TOKENIZE_MODE) {
-        DynHeapArray<Token> tokens = heap_array_create<Token>(256);
-        defer { array_free(&tokens); };
+    DynHeapArray<Token> tokens = heap_array_create<Token>(256);
+    defer { array_free(&tokens); };
+
+    if (tokenize(&tokens, unit->canonical_input_filepath) != 0) {
+        fprintf(stderr, "lexure failure\n");
+        return -1;
+    }
+
+    printf("=== TOKENS ===\n");
+    for (const Token& t : tokens) {
+        token_print(t);
+    }
+
+    return 0;
+}
 
-        if (tokenize(&tokens, ctx->canonical_input_filepath) != 0) {
-            fprintf(stderr, "lexure failure\n");
+// Everything from source to object file. Each unit gets its own parser, arenas and
+// IR, so units can be compiled on any thread.
+static int compile_translation_unit(translation_unit* unit)
+{
+    struct qxc_context* ctx = unit->ctx;
+    TRACE_SPAN(TraceCategory::Driver, "compile", unit->canonical_input_filepath);
+
+    if (unit->is_object_input) {
+        if (mode_runs_program(ctx->mode)) {
+            fprintf(stderr, "%s: object files can't be run in process, only linked\n",
+                    unit->canonical_input_filepath);
             return -1;
         }
+        if (ctx->mode != COMPILE_MODE) {
+            fprintf(stderr, "%s: object file unused because nothing is linked\n",
+                    unit->canonical_input_filepath);
+            return 0;
+        }
+        return elf_read_symbols(unit->canonical_input_filepath, &unit->symbols);
+    }
+
+    if (ctx->mode == TOKENIZE_MODE) {
+        return tokenize_translation_unit(unit);
+    }
 
-        printf("=== TOKENS ===\n");
-        for (const Token& t : tokens) {
-            token_print(t);
+    // a verbose run is after the dumps along the way, so it always compiles
+    uint64_t cache_key = 0;
+    int cached_object_fd = -1;
+    const bool cacheable =
+        ctx->use_cache &&
+        object_cache_key(&ctx->cache, unit->canonical_input_filepath, &ctx->options, &cache_key);
+    if (cacheable && !ctx->verbose &&
+        object_cache_lookup(&ctx->cache, cache_key, &cached_object_fd, &unit->symbols)) {
+        char cached_object_path[PATH_MAX];
+        sprintf(cached_object_path, "/proc/self/fd/%d", cached_object_fd);
+
+        // -c hands out a copy the user may change
+        if (ctx->mode == OBJECT_MODE) {
+            defer { close(cached_object_fd); };
+            return copy_file(cached_object_path, unit->output_object_path);
         }
 
+        // linking reads the entry through our own descriptor, which keeps it alive
+        // even if eviction, ours or another compiler's, removes it before the link
+        close_intermediate_file(unit->object_fd);
+        unit->object_fd = cached_object_fd;
+        sprintf(unit->output_object_path, "%s", cached_object_path);
         return 0;
     }
 
-    Program* program = parse_program(ctx->canonical_input_filepath);
+    Program* program = parse_program(unit->canonical_input_filepath, &ctx->options);
     if (program == nullptr) {
         return -1;
     }
 
     if (ctx->verbose) {
-        print_file(ctx->canonical_input_filepath);
+        print_file(unit->canonical_input_filepath);
         print_program(program);
     }
 
-    generate_asm(program, ctx->output_assembly_path);
-    if (ctx->verbose) {
-        print_file(ctx->output_assembly_path);
+    unit->ir = ir_lower_program(program);
+    qxc_memory_pool_release(program->pool);
+    if (unit->ir == nullptr) {
+        return -1;
     }
+    IRProgram* ir = unit->ir;
 
-    char nasm_cmd[PATH_MAX * 5];
-    sprintf(nasm_cmd, "nasm -felf64 %s -o %s", ctx->output_assembly_path,
-            ctx->output_object_path);
-    if (system(nasm_cmd) != 0) {
-        fprintf(stderr, "NASM ASSEMBLER FAILED\n");
+    if (ir_verify_program(ir) != 0) {
         return -1;
     }
 
-    char ld_cmd[PATH_MAX * 5];
-    sprintf(ld_cmd, "ld %s -o %s", ctx->output_object_path, ctx->output_exe_path);
+    ir_optimize_program(ir, &ctx->options);
+    if (ir_verify_program(ir) != 0) {
+        return -1;
+    }
+
+    if (ctx->verbose || ctx->mode == IR_MODE) {
+        printf("=== IR ===\n");
+        ir_print_program(ir);
+        if (ctx->mode == IR_MODE) {
+            return 0;
+        }
+    }
+
+    // jit_run or the interpreter take it from here, with every unit's IR
+    if (mode_runs_program(ctx->mode)) {
+        return 0;
+    }
+
+    generate_asm(ir, unit->output_assembly_path, &ctx->options, &unit->peephole_stats);
+    if (ctx->verbose) {
+        peephole_print_stats(&unit->peephole_stats);
+    }
+    if (ctx->verbose) {
+        print_file(unit->output_assembly_path);
+    }
+
+    {
+        TRACE_SPAN(TraceCategory::Driver, "assemble");
+
+        char nasm_cmd[PATH_MAX * 5];
+        sprintf(nasm_cmd, "nasm -felf64 %s -o %s", unit->output_assembly_path,
+                unit->output_object_path);
+        if (system(nasm_cmd) != 0) {
+            fprintf(stderr, "NASM ASSEMBLER FAILED\n");
+            return -1;
+        }
+    }
+
+    for (IRFunction* fn : ir->functions) {
+        array_append(&unit->symbols.defined_functions, strdup(fn->name));
+    }
+    for (const char* name : ir->externs) {
+        array_append(&unit->symbols.external_functions, strdup(name));
+    }
+
+    if (cacheable) {
+        object_cache_store(&ctx->cache, cache_key, unit->output_object_path, &unit->symbols);
+    }
+
+    return 0;
+}
+
+static void compile_translation_unit_task(void* arg)
+{
+    translation_unit* unit = (translation_unit*)arg;
+    unit->result = compile_translation_unit(unit);
+}
+
+static bool is_defined_in_program(struct qxc_context* ctx, const char* name)
+{
+    for (translation_unit& unit : ctx->units) {
+        for (const char* defined : unit.symbols.defined_functions) {
+            if (strs_are_equal(defined, name)) return true;
+        }
+    }
+    return false;
+}
+
+// programs calling functions defined outside of all units (e.g. putchar) are linked
+// against libc, which brings its own entry point. Everything else stays freestanding.
+static bool is_freestanding(struct qxc_context* ctx)
+{
+    for (translation_unit& unit : ctx->units) {
+        for (const char* name : unit.symbols.external_functions) {
+            if (!is_defined_in_program(ctx, name)) return false;
+        }
+    }
+    return true;
+}
+
+static int link_translation_units(struct qxc_context* ctx)
+{
+    TRACE_SPAN(TraceCategory::Driver, "link");
+
+    const bool freestanding = is_freestanding(ctx);
+
+    char start_assembly_path[2 * PATH_MAX];
+    char start_object_path[2 * PATH_MAX];
+    int start_assembly_fd = -1;
+    int start_object_fd = -1;
+    defer {
+        close_intermediate_file(start_assembly_fd);
+        close_intermediate_file(start_object_fd);
+    };
+
+    if (freestanding) {
+        if (create_intermediate_file(ctx, "_start.asm", start_assembly_path,
+                                     &start_assembly_fd) != 0 ||
+            create_intermediate_file(ctx, "_start.o", start_object_path,
+                                     &start_object_fd) != 0) {
+            return -1;
+        }
+
+        generate_start_asm(start_assembly_path);
+
+        char nasm_cmd[PATH_MAX * 5];
+        sprintf(nasm_cmd, "nasm -felf64 %s -o %s", start_assembly_path, start_object_path);
+        if (system(nasm_cmd) != 0) {
+            fprintf(stderr, "NASM ASSEMBLER FAILED\n");
+            return -1;
+        }
+    }
+
+    DynHeapArray<char> ld_cmd = heap_array_create<char>(PATH_MAX * 4);
+    defer { array_free(&ld_cmd); };
+
+    const auto append = [&ld_cmd](const char* str) {
+        for (const char* c = str; *c; c++) {
+            array_append(&ld_cmd, *c);
+        }
+    };
+
+    append(freestanding ? "ld" : "cc -no-pie");
+    for (const translation_unit& unit : ctx->units) {
+        append(" ");
+        append(unit.output_object_path);
+    }
+    if (freestanding) {
+        append(" ");
+        append(start_object_path);
+    }
+    append(" -o ");
+    append(ctx->output_exe_path);
+    array_append(&ld_cmd, '\0');
 
-    if (system(ld_cmd) != 0) {
+    if (system(&ld_cmd[0]) != 0) {
         fprintf(stderr, "LD LINKER FAILED\n");
         return -1;
     }
@@ -161,7 +613,89 @@ static int qxc_context_run(const struct qxc_context* ctx)
     return 0;
 }
 
-int main(int argc, char* argv[])
+static int interpret_programs(struct qxc_context* ctx, IRProgram* const* programs,
+                              size_t program_count, int* exit_code)
+{
+    BytecodeProgram* bytecode = bytecode_compile(programs, program_count);
+    if (bytecode == nullptr) {
+        return -1;
+    }
+    defer { bytecode_program_free(bytecode); };
+
+    if (ctx->verbose) {
+        printf("=== BYTECODE ===\n");
+        bytecode_print_program(bytecode);
+    }
+
+    return bytecode_run(bytecode, exit_code);
+}
+
+// --run and --interpret: the exit status is the program's, or failure if it couldn't
+// be run at all
+static int run_translation_units(struct qxc_context* ctx)
+{
+    DynHeapArray<IRProgram*> programs = heap_array_create<IRProgram*>(ctx->units.length);
+    defer { array_free(&programs); };
+
+    for (translation_unit& unit : ctx->units) {
+        array_append(&programs, unit.ir);
+    }
+
+    int exit_code = 0;
+    const int result =
+        ctx->mode == INTERPRET_MODE
+            ? interpret_programs(ctx, &programs[0], programs.length, &exit_code)
+            : jit_run(&programs[0], programs.length, &ctx->options, &exit_code);
+    if (result != 0) {
+        return EXIT_FAILURE;
+    }
+    return exit_code;
+}
+
+static int qxc_context_run(struct qxc_context* ctx)
+{
+    if (ctx->units.length == 0) {
+        object_cache_print_stats(&ctx->cache);
+        return 0;
+    }
+
+    DynHeapArray<ThreadPoolTask> tasks = heap_array_create<ThreadPoolTask>(ctx->units.length);
+    defer { array_free(&tasks); };
+
+    for (translation_unit& unit : ctx->units) {
+        ThreadPoolTask task;
+        task.fn = compile_translation_unit_task;
+        task.arg = &unit;
+        array_append(&tasks, task);
+    }
+
+    thread_pool_run(&tasks[0], tasks.length, ctx->jobs);
+
+    if (ctx->use_cache) {
+        object_cache_record_stats(&ctx->cache);
+        object_cache_evict(&ctx->cache);
+    }
+    if (ctx->print_cache_stats || (ctx->verbose && ctx->use_cache)) {
+        object_cache_print_stats(&ctx->cache);
+    }
+
+    for (const translation_unit& unit : ctx->units) {
+        if (unit.result != 0) return unit.result;
+    }
+
+    if (mode_runs_program(ctx->mode)) {
+        return run_translation_units(ctx);
+    }
+
+    if (ctx->mode != COMPILE_MODE) {
+        return 0;
+    }
+
+    return link_translation_units(ctx);
+}
+
+// one compiler invocation, either from main or as a job run by a compile server
+static int qxc_main(int argc, char* argv[])
 {
     struct qxc_context ctx;
 
@@ -179,3 +713,42 @@ int main(int argc, char* argv[])
 
     return EXIT_SUCCESS;
 }
+
+int main(int argc, char* argv[])
+{
+    char socket_path[PATH_MAX];
+
+    // qxc --server [socket path]
+    if (argc >= 2 && strs_are_equal("--server", argv[1])) {
+        if (argc > 3) {
+            fprintf(stderr, "--server takes at most a socket path\n");
+            return EXIT_FAILURE;
+        }
+        if (argc == 3) {
+            sprintf(socket_path, "%s", argv[2]);
+        }
+        else {
+            server_default_socket_path(socket_path, sizeof(socket_path));
+        }
+        return server_run(socket_path, qxc_main) == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
+    // hand the job to a warm server if one is configured and listening. Programs run
+    // with --run or --interpret stay in this process though, a crashing one mustn't
+    // take the server down with it.
+    bool runs_program = false;
+    for (int i = 1; i < argc; i++) {
+        runs_program |= strs_are_equal("--run", argv[i]) || strs_are_equal("--interpret", argv[i]);
+    }
+
+    const char* server_env = getenv("QXC_SERVER");
+    if (server_env && *server_env && !runs_program) {
+        int exit_code = 0;
+        server_default_socket_path(socket_path, sizeof(socket_path));
+        if (client_forward(socket_path, argc, argv, &exit_code)) {
+            return exit_code;
+        }
+    }
+
+    return qxc_main(argc, argv);
+}
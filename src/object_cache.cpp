@@ -0,0 +1,494 @@
+#include "object_cache.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+
+#include "prelude.h"
+#include "trace.h"
+
+// bump whenever the entry layout or key derivation changes
+#define QXC_CACHE_FORMAT_VERSION 1
+
+// --------------------------------------------------------------------------------
+// xxHash64, see https://github.com/Cyan4973/xxHash/blob/dev/doc/xxhash_spec.md
+
+static const uint64_t XXH_PRIME64_1 = 0x9E3779B185EBCA87ull;
+static const uint64_t XXH_PRIME64_2 = 0xC2B2AE3D27D4EB4Full;
+static const uint64_t XXH_PRIME64_3 = 0x165667B19E3779F9ull;
+static const uint64_t XXH_PRIME64_4 = 0x85EBCA77C2B2AE63ull;
+static const uint64_t XXH_PRIME64_5 = 0x27D4EB2F165667C5ull;
+
+static uint64_t rotl64(uint64_t x, int r) { return (x << r) | (x >> (64 - r)); }
+
+static uint64_t read64(const uint8_t* p)
+{
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static uint32_t read32(const uint8_t* p)
+{
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static uint64_t xxh64_round(uint64_t acc, uint64_t input)
+{
+    acc += input * XXH_PRIME64_2;
+    acc = rotl64(acc, 31);
+    return acc * XXH_PRIME64_1;
+}
+
+static uint64_t xxh64_merge_round(uint64_t acc, uint64_t value)
+{
+    acc ^= xxh64_round(0, value);
+    return acc * XXH_PRIME64_1 + XXH_PRIME64_4;
+}
+
+static uint64_t xxh64(const void* data, size_t length, uint64_t seed)
+{
+    const uint8_t* p = (const uint8_t*)data;
+    const uint8_t* const end = p + length;
+    uint64_t h;
+
+    if (length >= 32) {
+        uint64_t v1 = seed + XXH_PRIME64_1 + XXH_PRIME64_2;
+        uint64_t v2 = seed + XXH_PRIME64_2;
+        uint64_t v3 = seed;
+        uint64_t v4 = seed - XXH_PRIME64_1;
+
+        do {
+            v1 = xxh64_round(v1, read64(p));
+            v2 = xxh64_round(v2, read64(p + 8));
+            v3 = xxh64_round(v3, read64(p + 16));
+            v4 = xxh64_round(v4, read64(p + 24));
+            p += 32;
+        } while (end - p >= 32);
+
+        h = rotl64(v1, 1) + rotl64(v2, 7) + rotl64(v3, 12) + rotl64(v4, 18);
+        h = xxh64_merge_round(h, v1);
+        h = xxh64_merge_round(h, v2);
+        h = xxh64_merge_round(h, v3);
+        h = xxh64_merge_round(h, v4);
+    }
+    else {
+        h = seed + XXH_PRIME64_5;
+    }
+
+    h += (uint64_t)length;
+
+    while (end - p >= 8) {
+        h ^= xxh64_round(0, read64(p));
+        h = rotl64(h, 27) * XXH_PRIME64_1 + XXH_PRIME64_4;
+        p += 8;
+    }
+    if (end - p >= 4) {
+        h ^= (uint64_t)read32(p) * XXH_PRIME64_1;
+        h = rotl64(h, 23) * XXH_PRIME64_2 + XXH_PRIME64_3;
+        p += 4;
+    }
+    while (p < end) {
+        h ^= (uint64_t)*p * XXH_PRIME64_5;
+        h = rotl64(h, 11) * XXH_PRIME64_1;
+        p++;
+    }
+
+    h ^= h >> 33;
+    h *= XXH_PRIME64_2;
+    h ^= h >> 29;
+    h *= XXH_PRIME64_3;
+    h ^= h >> 32;
+    return h;
+}
+
+// --------------------------------------------------------------------------------
+// files
+
+// whole file contents, malloc'ed, nullptr on failure
+static uint8_t* read_file(const char* filepath, size_t* size)
+{
+    FILE* f = fopen(filepath, "rb");
+    if (f == nullptr) return nullptr;
+    defer { fclose(f); };
+
+    size_t capacity = 1 << 16;
+    size_t length = 0;
+    uint8_t* contents = (uint8_t*)malloc(capacity);
+
+    while (true) {
+        length += fread(contents + length, 1, capacity - length, f);
+        if (length < capacity) break;
+        capacity *= 2;
+        contents = (uint8_t*)realloc(contents, capacity);
+    }
+
+    if (ferror(f)) {
+        free(contents);
+        return nullptr;
+    }
+
+    *size = length;
+    return contents;
+}
+
+static int make_dirs(const char* path)
+{
+    char partial[PATH_MAX];
+    snprintf(partial, sizeof(partial), "%s", path);
+
+    for (char* c = partial + 1; *c; c++) {
+        if (*c != '/') continue;
+        *c = '\0';
+        if (mkdir(partial, 0755) != 0 && errno != EEXIST) return -1;
+        *c = '/';
+    }
+
+    return mkdir(partial, 0755) != 0 && errno != EEXIST ? -1 : 0;
+}
+
+static void entry_path(ObjectCache* cache, uint64_t key, const char* ext, char* path)
+{
+    snprintf(path, PATH_MAX, "%s/%016lx.%s", cache->dir, (unsigned long)key, ext);
+}
+
+// write to a fresh temporary file next to the destination, then rename it into
+// place, so readers see either nothing or the complete file
+static bool write_file_atomically(ObjectCache* cache, const char* path,
+                                  const uint8_t* contents, size_t size)
+{
+    char tmp_path[PATH_MAX];
+    snprintf(tmp_path, sizeof(tmp_path), "%s/tmp.XXXXXX", cache->dir);
+
+    const int fd = mkstemp(tmp_path);
+    if (fd < 0) return false;
+
+    size_t written = 0;
+    while (written < size) {
+        const ssize_t n = write(fd, contents + written, size - written);
+        if (n <= 0) break;
+        written += (size_t)n;
+    }
+    close(fd);
+
+    if (written != size || rename(tmp_path, path) != 0) {
+        unlink(tmp_path);
+        return false;
+    }
+    return true;
+}
+
+// --------------------------------------------------------------------------------
+// symbols
+
+ObjectCacheSymbols object_cache_symbols_create(void)
+{
+    ObjectCacheSymbols symbols;
+    symbols.defined_functions = heap_array_create<char*>(0);
+    symbols.external_functions = heap_array_create<char*>(0);
+    return symbols;
+}
+
+void object_cache_symbols_free(ObjectCacheSymbols* symbols)
+{
+    for (char* name : symbols->defined_functions) free(name);
+    for (char* name : symbols->external_functions) free(name);
+    array_free(&symbols->defined_functions);
+    array_free(&symbols->external_functions);
+}
+
+// one symbol per line, "D name" for defined and "U name" for external functions
+static bool read_symbols(const char* path, ObjectCacheSymbols* symbols)
+{
+    size_t size = 0;
+    uint8_t* contents = read_file(path, &size);
+    if (contents == nullptr) return false;
+    defer { free(contents); };
+
+    const char* line = (const char*)contents;
+    const char* const end = line + size;
+
+    while (line < end) {
+        const char* newline = (const char*)memchr(line, '\n', (size_t)(end - line));
+        if (newline == nullptr || newline - line < 3 || line[1] != ' ') return false;
+
+        char* name = strndup(line + 2, (size_t)(newline - line - 2));
+        if (line[0] == 'D') {
+            array_append(&symbols->defined_functions, name);
+        }
+        else if (line[0] == 'U') {
+            array_append(&symbols->external_functions, name);
+        }
+        else {
+            free(name);
+            return false;
+        }
+
+        line = newline + 1;
+    }
+
+    return true;
+}
+
+// --------------------------------------------------------------------------------
+
+struct CompilerHash {
+    bool valid;
+    uint64_t hash;
+};
+
+static CompilerHash hash_compiler(void)
+{
+    TRACE_SPAN(TraceCategory::Cache, "hash compiler");
+
+    CompilerHash compiler = {false, 0};
+    size_t exe_size = 0;
+    uint8_t* exe = read_file("/proc/self/exe", &exe_size);
+    if (exe == nullptr) return compiler;
+
+    compiler.valid = true;
+    compiler.hash = xxh64(exe, exe_size, QXC_CACHE_FORMAT_VERSION);
+    free(exe);
+    return compiler;
+}
+
+int object_cache_init(ObjectCache* cache, long max_bytes)
+{
+    cache->max_bytes = max_bytes;
+    cache->hits = 0;
+    cache->misses = 0;
+
+    const char* env_dir = getenv("QXC_CACHE_DIR");
+    const char* xdg_dir = getenv("XDG_CACHE_HOME");
+    const char* home_dir = getenv("HOME");
+
+    if (env_dir && *env_dir) {
+        snprintf(cache->dir, sizeof(cache->dir), "%s", env_dir);
+    }
+    else if (xdg_dir && *xdg_dir) {
+        snprintf(cache->dir, sizeof(cache->dir), "%s/qxc", xdg_dir);
+    }
+    else if (home_dir && *home_dir) {
+        snprintf(cache->dir, sizeof(cache->dir), "%s/.cache/qxc", home_dir);
+    }
+    else {
+        return -1;
+    }
+
+    if (make_dirs(cache->dir) != 0) return -1;
+
+    // a rebuilt compiler may generate different code for the same source, but the
+    // binary can't change under a running process, so it's only hashed once. That
+    // matters for the compile server, which runs every job through here.
+    static const CompilerHash compiler = hash_compiler();
+    if (!compiler.valid) return -1;
+    cache->compiler_hash = compiler.hash;
+
+    return 0;
+}
+
+bool object_cache_key(ObjectCache* cache, const char* source_filepath,
+                      const CompileOptions* options, uint64_t* key)
+{
+    size_t source_size = 0;
+    uint8_t* source = read_file(source_filepath, &source_size);
+    if (source == nullptr) return false;
+    defer { free(source); };
+
+    // every CompileOptions field goes in here
+    char flags[128];
+    const int flags_length =
+        snprintf(flags, sizeof(flags),
+                 "tail_calls=%d branchless=%d inline_threshold=%d max_nesting_depth=%d",
+                 options->tail_calls, options->branchless, options->inline_threshold,
+                 options->max_nesting_depth);
+
+    const uint64_t seed = xxh64(flags, (size_t)flags_length, cache->compiler_hash);
+    *key = xxh64(source, source_size, seed);
+    return true;
+}
+
+bool object_cache_lookup(ObjectCache* cache, uint64_t key, int* object_fd,
+                         ObjectCacheSymbols* symbols)
+{
+    TRACE_SPAN(TraceCategory::Cache, "cache lookup");
+
+    char object_path[PATH_MAX];
+    char symbols_path[PATH_MAX];
+    entry_path(cache, key, "o", object_path);
+    entry_path(cache, key, "sym", symbols_path);
+
+    // opened first, an entry evicted after this still reads fine through the fd
+    const int fd = open(object_path, O_RDONLY);
+    if (fd < 0) {
+        cache->misses++;
+        return false;
+    }
+
+    if (!read_symbols(symbols_path, symbols)) {
+        close(fd);
+        object_cache_symbols_free(symbols);
+        *symbols = object_cache_symbols_create();
+        cache->misses++;
+        return false;
+    }
+
+    // the modification time doubles as the last use for eviction
+    futimens(fd, nullptr);
+
+    *object_fd = fd;
+    cache->hits++;
+    return true;
+}
+
+void object_cache_store(ObjectCache* cache, uint64_t key, const char* object_filepath,
+                        ObjectCacheSymbols* symbols)
+{
+    TRACE_SPAN(TraceCategory::Cache, "cache store");
+
+    size_t object_size = 0;
+    uint8_t* object = read_file(object_filepath, &object_size);
+    if (object == nullptr) return;
+    defer { free(object); };
+
+    DynHeapArray<uint8_t> listing = heap_array_create<uint8_t>(256);
+    defer { array_free(&listing); };
+
+    const auto append_symbol = [&listing](char kind, const char* name) {
+        array_append(&listing, (uint8_t)kind);
+        array_append(&listing, (uint8_t)' ');
+        for (const char* c = name; *c; c++) array_append(&listing, (uint8_t)*c);
+        array_append(&listing, (uint8_t)'\n');
+    };
+    for (const char* name : symbols->defined_functions) append_symbol('D', name);
+    for (const char* name : symbols->external_functions) append_symbol('U', name);
+
+    char object_path[PATH_MAX];
+    char symbols_path[PATH_MAX];
+    entry_path(cache, key, "o", object_path);
+    entry_path(cache, key, "sym", symbols_path);
+
+    // the object goes last, an entry counts as present once it exists
+    if (write_file_atomically(cache, symbols_path, listing.data, listing.length)) {
+        write_file_atomically(cache, object_path, object, object_size);
+    }
+}
+
+struct CacheEntry {
+    uint64_t key;
+    long bytes;
+    struct timespec last_use;
+};
+
+void object_cache_evict(ObjectCache* cache)
+{
+    DIR* dir = opendir(cache->dir);
+    if (dir == nullptr) return;
+
+    DynHeapArray<CacheEntry> entries = heap_array_create<CacheEntry>(0);
+    defer { array_free(&entries); };
+    long total_bytes = 0;
+
+    while (struct dirent* dirent = readdir(dir)) {
+        unsigned long key = 0;
+        char ext[4] = {0};
+        if (sscanf(dirent->d_name, "%16lx.%3s", &key, ext) != 2 || strcmp(ext, "o") != 0) {
+            continue;
+        }
+
+        char object_path[PATH_MAX];
+        char symbols_path[PATH_MAX];
+        entry_path(cache, key, "o", object_path);
+        entry_path(cache, key, "sym", symbols_path);
+
+        struct stat object_stat;
+        struct stat symbols_stat;
+        if (stat(object_path, &object_stat) != 0) continue;
+
+        CacheEntry entry;
+        entry.key = key;
+        entry.bytes = object_stat.st_size;
+        entry.last_use = object_stat.st_mtim;
+        if (stat(symbols_path, &symbols_stat) == 0) entry.bytes += symbols_stat.st_size;
+
+        total_bytes += entry.bytes;
+        array_append(&entries, entry);
+    }
+    closedir(dir);
+
+    if (total_bytes <= cache->max_bytes) return;
+
+    std::sort(entries.begin(), entries.end(), [](const CacheEntry& a, const CacheEntry& b) {
+        return a.last_use.tv_sec != b.last_use.tv_sec ? a.last_use.tv_sec < b.last_use.tv_sec
+                                                      : a.last_use.tv_nsec < b.last_use.tv_nsec;
+    });
+
+    for (const CacheEntry& entry : entries) {
+        if (total_bytes <= cache->max_bytes) break;
+
+        char path[PATH_MAX];
+        entry_path(cache, entry.key, "o", path);
+        unlink(path);
+        entry_path(cache, entry.key, "sym", path);
+        unlink(path);
+        total_bytes -= entry.bytes;
+    }
+}
+
+// "hits N misses N", updated under an exclusive lock as other compilers share it
+void object_cache_record_stats(ObjectCache* cache)
+{
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/stats", cache->dir);
+
+    const int fd = open(path, O_RDWR | O_CREAT, 0644);
+    if (fd < 0) return;
+    defer { close(fd); };
+    if (flock(fd, LOCK_EX) != 0) return;
+
+    char contents[128] = {0};
+    long hits = 0;
+    long misses = 0;
+    if (read(fd, contents, sizeof(contents) - 1) > 0) {
+        sscanf(contents, "hits %ld misses %ld", &hits, &misses);
+    }
+
+    hits += cache->hits;
+    misses += cache->misses;
+
+    const int length = snprintf(contents, sizeof(contents), "hits %ld misses %ld\n", hits, misses);
+    if (ftruncate(fd, 0) == 0 && pwrite(fd, contents, (size_t)length, 0) != length) {
+        fprintf(stderr, "failed to update cache statistics in %s\n", path);
+    }
+}
+
+void object_cache_print_stats(ObjectCache* cache)
+{
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/stats", cache->dir);
+
+    long hits = 0;
+    long misses = 0;
+    size_t size = 0;
+    uint8_t* contents = read_file(path, &size);
+    if (contents) {
+        contents = (uint8_t*)realloc(contents, size + 1);
+        contents[size] = '\0';
+        sscanf((const char*)contents, "hits %ld misses %ld", &hits, &misses);
+        free(contents);
+    }
+
+    printf("=== CACHE (%s) ===\n", cache->dir);
+    printf("this run: %ld hits, %ld misses\n", cache->hits.load(), cache->misses.load());
+    printf("all runs: %ld hits, %ld misses\n", hits, misses);
+}
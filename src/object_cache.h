@@ -0,0 +1,60 @@
+#pragma once
+
+#include <linux/limits.h>
+#include <stdint.h>
+
+#include <atomic>
+
+#include "array.h"
+#include "options.h"
+
+// On-disk cache of object files, keyed by a hash of the source bytes, the compiler
+// binary itself and every option affecting code generation. A hit skips the whole
+// pipeline from lexing to assembling.
+//
+// Each entry is <key>.o plus <key>.sym, which lists the functions the object defines
+// and the ones it calls from elsewhere, since linking needs those without the IR.
+// Entries are written to a temporary name and renamed into place, so concurrent
+// compilers (and threads) never see half-written files. The least recently used
+// entries are evicted once the cache grows past its size limit.
+//
+// The directory is $QXC_CACHE_DIR, else $XDG_CACHE_HOME/qxc, else ~/.cache/qxc.
+
+struct ObjectCache {
+    char dir[PATH_MAX / 2];  // leaves room for entry names in PATH_MAX buffers
+    long max_bytes;
+    uint64_t compiler_hash;  // of the running qxc executable, hashed once per process
+
+    std::atomic<long> hits;
+    std::atomic<long> misses;
+};
+
+struct ObjectCacheSymbols {
+    DynHeapArray<char*> defined_functions;
+    DynHeapArray<char*> external_functions;
+};
+
+ObjectCacheSymbols object_cache_symbols_create(void);
+void object_cache_symbols_free(ObjectCacheSymbols* symbols);
+
+// returns -1 if there is no usable cache directory, the cache is unusable then
+int object_cache_init(ObjectCache* cache, long max_bytes);
+
+// false if the source can't be read
+bool object_cache_key(ObjectCache* cache, const char* source_filepath,
+                      const CompileOptions* options, uint64_t* key);
+
+// On a hit, object_fd receives a descriptor of the cached object and symbols the
+// names it was stored with. Read the object through the descriptor, it stays valid
+// when the entry gets evicted by this or any other compiler in the meantime.
+bool object_cache_lookup(ObjectCache* cache, uint64_t key, int* object_fd,
+                         ObjectCacheSymbols* symbols);
+void object_cache_store(ObjectCache* cache, uint64_t key, const char* object_filepath,
+                        ObjectCacheSymbols* symbols);
+
+// drop least recently used entries until the cache fits in max_bytes again
+void object_cache_evict(ObjectCache* cache);
+
+// adds this run's hits and misses to the totals kept in the cache directory
+void object_cache_record_stats(ObjectCache* cache);
+void object_cache_print_stats(ObjectCache* cache);
@@ -0,0 +1,11 @@
+#pragma once
+
+// Optimization knobs set from the command line and threaded through the pipeline.
+struct CompileOptions {
+    bool tail_calls = true;  // --no-tail-calls: keep every call a call, for debugging
+    bool branchless = true;  // --no-branchless: keep every conditional a branch
+    int inline_threshold = 32;  // --inline-threshold N: max IR instructions of an inlined
+                                // function (single call sites always inline), 0 disables
+    int max_nesting_depth = 1000000;  // --max-nesting-depth N: deepest nesting of
+                                      // expressions and of statements the parser accepts
+};
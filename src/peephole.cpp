@@ -0,0 +1,455 @@
+#include "peephole.h"
+
+#include <assert.h>
+#include <stdio.h>
+
+#include "prelude.h"
+
+// Every rule looks at a short window of instructions starting at some index, and
+// returns true if it rewrote anything. Deleted instructions are turned into Nops,
+// which no rule matches, and are compacted away between sweeps over the function.
+
+struct PeepholeContext {
+    X86Instr* instrs;
+    size_t count;
+    DynHeapArray<int> label_refs;   // label id -> number of references to it
+    DynHeapArray<long> label_index;  // label id -> instruction index, -1 if unknown
+    DynHeapArray<size_t> code_after;  // instruction index -> first non-label at or after it
+};
+
+typedef bool (*PeepholeRuleFn)(PeepholeContext* ctx, size_t i);
+
+static bool is_reg(const X86Operand& operand)
+{
+    return operand.type == X86OperandType::Reg;
+}
+
+static bool is_mem(const X86Operand& operand)
+{
+    return operand.type == X86OperandType::Mem;
+}
+
+static bool is_imm(const X86Operand& operand, long value)
+{
+    return operand.type == X86OperandType::Imm && operand.value == value;
+}
+
+static bool is_label(const X86Instr& instr, long label)
+{
+    return instr.op == X86Op::Label && instr.operands[0].value == label;
+}
+
+// a jump to one of the function's own blocks, rather than a tail call to a symbol
+static bool is_local_jump(const X86Instr& instr)
+{
+    return (instr.op == X86Op::Jmp || instr.op == X86Op::Jcc) &&
+           instr.operands[0].type == X86OperandType::Label;
+}
+
+// label id an operand refers to: a jump target, a jump table entry or the address
+// of a jump table. -1 for anything else.
+static long referenced_label(const X86Operand& operand)
+{
+    if (operand.type == X86OperandType::Label) return operand.value;
+    if (is_mem(operand) && operand.reg == X86Reg::None && operand.symbol == nullptr) {
+        return operand.value;
+    }
+    return -1;
+}
+
+static X86Instr* instr_at(PeepholeContext* ctx, size_t i)
+{
+    return i < ctx->count ? &ctx->instrs[i] : nullptr;
+}
+
+static void delete_instr(X86Instr* instr) { instr->op = X86Op::Nop; }
+
+// The flags are dead after instruction i if they are overwritten before being read.
+// Code coming out of the backend never carries flags across a label or jump (every
+// conditional jump directly follows its compare), so those end the search too.
+static bool flags_dead_after(PeepholeContext* ctx, size_t i)
+{
+    for (size_t j = i + 1; j < ctx->count; j++) {
+        switch (ctx->instrs[j].op) {
+            case X86Op::Jcc:
+            case X86Op::Setcc:
+            case X86Op::Cmov:
+                return false;
+            case X86Op::Cmp:
+            case X86Op::Test:
+            case X86Op::Add:
+            case X86Op::Sub:
+            case X86Op::Imul:
+            case X86Op::Idiv:
+            case X86Op::Neg:
+            case X86Op::And:
+            case X86Op::Or:
+            case X86Op::Xor:
+            case X86Op::Label:
+            case X86Op::JumpTableEntry:
+            case X86Op::Jmp:
+            case X86Op::Call:
+            case X86Op::Ret:
+            case X86Op::Syscall:
+                return true;
+            default:
+                break;
+        }
+    }
+
+    return true;
+}
+
+// mov r, r
+static bool rule_self_move(PeepholeContext* ctx, size_t i)
+{
+    X86Instr* mov = instr_at(ctx, i);
+
+    // a 32 bit self move clears the upper half of the register, so only the 64 bit
+    // one is a no-op
+    if (mov->op != X86Op::Mov || !is_reg(mov->operands[0]) || mov->operands[0].size != 8 ||
+        !x86_operands_are_equal(mov->operands[0], mov->operands[1])) {
+        return false;
+    }
+
+    delete_instr(mov);
+    return true;
+}
+
+// push a; pop b -> mov b, a
+static bool rule_push_pop(PeepholeContext* ctx, size_t i)
+{
+    X86Instr* push = instr_at(ctx, i);
+    X86Instr* pop = instr_at(ctx, i + 1);
+
+    if (!pop || push->op != X86Op::Push || pop->op != X86Op::Pop ||
+        !is_reg(push->operands[0])) {
+        return false;
+    }
+
+    const X86Operand src = push->operands[0];
+    const X86Operand dst = pop->operands[0];
+
+    delete_instr(push);
+    if (x86_operands_are_equal(src, dst)) {
+        delete_instr(pop);
+    }
+    else {
+        pop->op = X86Op::Mov;
+        pop->operands[0] = dst;
+        pop->operands[1] = src;
+    }
+    return true;
+}
+
+// mov [m], r1; mov r2, [m] -> mov [m], r1; mov r2, r1
+static bool rule_store_reload(PeepholeContext* ctx, size_t i)
+{
+    X86Instr* store = instr_at(ctx, i);
+    X86Instr* load = instr_at(ctx, i + 1);
+
+    if (!load || store->op != X86Op::Mov || load->op != X86Op::Mov ||
+        !is_mem(store->operands[0]) || !is_reg(store->operands[1]) ||
+        !is_reg(load->operands[0]) ||
+        !x86_operands_are_equal(store->operands[0], load->operands[1]) ||
+        load->operands[0].size != store->operands[1].size) {
+        return false;
+    }
+
+    if (x86_operands_are_equal(load->operands[0], store->operands[1])) {
+        delete_instr(load);
+    }
+    else {
+        load->operands[1] = store->operands[1];
+    }
+    return true;
+}
+
+// mov r, [m]; mov [m], r -> mov r, [m]
+static bool rule_redundant_store(PeepholeContext* ctx, size_t i)
+{
+    X86Instr* load = instr_at(ctx, i);
+    X86Instr* store = instr_at(ctx, i + 1);
+
+    if (!store || load->op != X86Op::Mov || store->op != X86Op::Mov ||
+        !is_reg(load->operands[0]) || !is_mem(load->operands[1]) ||
+        !x86_operands_are_equal(load->operands[0], store->operands[1]) ||
+        !x86_operands_are_equal(load->operands[1], store->operands[0])) {
+        return false;
+    }
+
+    delete_instr(store);
+    return true;
+}
+
+// mov r1, r2; mov r2, r1 -> mov r1, r2
+//
+// mov leaves the flags alone, and r2 already holds what the second move copies back.
+// Only for 64 bit moves though: in mov r1d, r2d; mov r2d, r1d the second move is the
+// one that clears the upper half of r2.
+static bool rule_move_round_trip(PeepholeContext* ctx, size_t i)
+{
+    X86Instr* first = instr_at(ctx, i);
+    X86Instr* second = instr_at(ctx, i + 1);
+
+    if (!second || first->op != X86Op::Mov || second->op != X86Op::Mov ||
+        !is_reg(first->operands[0]) || !is_reg(first->operands[1]) ||
+        first->operands[0].size != 8 ||
+        !x86_operands_are_equal(first->operands[0], second->operands[1]) ||
+        !x86_operands_are_equal(first->operands[1], second->operands[0])) {
+        return false;
+    }
+
+    delete_instr(second);
+    return true;
+}
+
+// jmp L; L: -> L:
+static bool rule_jump_to_next(PeepholeContext* ctx, size_t i)
+{
+    X86Instr* jump = instr_at(ctx, i);
+    if (!is_local_jump(*jump)) return false;
+
+    // there may be several labels in a row
+    for (size_t j = i + 1; j < ctx->count && ctx->instrs[j].op == X86Op::Label; j++) {
+        if (is_label(ctx->instrs[j], jump->operands[0].value)) {
+            delete_instr(jump);
+            return true;
+        }
+    }
+
+    return false;
+}
+
+// jcc L1; jmp L2; L1: -> jncc L2; L1:
+static bool rule_invert_branch(PeepholeContext* ctx, size_t i)
+{
+    X86Instr* jcc = instr_at(ctx, i);
+    X86Instr* jmp = instr_at(ctx, i + 1);
+    X86Instr* label = instr_at(ctx, i + 2);
+
+    if (!label || !is_local_jump(*jcc) || jcc->op != X86Op::Jcc ||
+        !is_local_jump(*jmp) || jmp->op != X86Op::Jmp ||
+        !is_label(*label, jcc->operands[0].value)) {
+        return false;
+    }
+
+    jcc->cond = x86_negate_cond(jcc->cond);
+    jcc->operands[0] = jmp->operands[0];
+    delete_instr(jmp);
+    return true;
+}
+
+// jmp L1; ... L1: jmp L2 -> jmp L2
+static bool rule_jump_to_jump(PeepholeContext* ctx, size_t i)
+{
+    X86Instr* jump = instr_at(ctx, i);
+    if (!is_local_jump(*jump)) return false;
+
+    const long index = ctx->label_index[(size_t)jump->operands[0].value];
+    if (index < 0) return false;
+
+    // an indirect jmp depends on what ran before it, so it can't be jumped to directly
+    X86Instr* target = instr_at(ctx, ctx->code_after[(size_t)index]);
+    if (!target || target->op != X86Op::Jmp || is_reg(target->operands[0]) ||
+        x86_operands_are_equal(target->operands[0], jump->operands[0])) {
+        return false;
+    }
+
+    jump->operands[0] = target->operands[0];
+    return true;
+}
+
+static bool rule_dead_label(PeepholeContext* ctx, size_t i)
+{
+    X86Instr* label = instr_at(ctx, i);
+
+    if (label->op != X86Op::Label || ctx->label_refs[(size_t)label->operands[0].value] > 0) {
+        return false;
+    }
+
+    delete_instr(label);
+    return true;
+}
+
+// mov r, 0 -> xor r32, r32 (shorter, and breaks the dependency on r)
+static bool rule_zero_via_xor(PeepholeContext* ctx, size_t i)
+{
+    X86Instr* mov = instr_at(ctx, i);
+
+    if (mov->op != X86Op::Mov || !is_reg(mov->operands[0]) || !is_imm(mov->operands[1], 0) ||
+        !flags_dead_after(ctx, i)) {
+        return false;
+    }
+
+    const X86Reg reg = mov->operands[0].reg;
+    mov->op = X86Op::Xor;
+    mov->operands[0] = x86_reg(reg, 4);
+    mov->operands[1] = x86_reg(reg, 4);
+    return true;
+}
+
+// cmp r, 0 -> test r, r (identical flags for all conditions we use)
+static bool rule_compare_zero_to_test(PeepholeContext* ctx, size_t i)
+{
+    X86Instr* cmp = instr_at(ctx, i);
+
+    if (cmp->op != X86Op::Cmp || !is_reg(cmp->operands[0]) || !is_imm(cmp->operands[1], 0)) {
+        return false;
+    }
+
+    cmp->op = X86Op::Test;
+    cmp->operands[1] = cmp->operands[0];
+    return true;
+}
+
+// add x, 0 / sub x, 0 / or x, 0 / xor x, 0 / shifts by 0 / imul r, r, 1
+//
+// Not for 32 bit registers: writing one clears its upper half, so add eax, 0 isn't
+// quite a no-op.
+static bool rule_arithmetic_identity(PeepholeContext* ctx, size_t i)
+{
+    X86Instr* instr = instr_at(ctx, i);
+    if (is_reg(instr->operands[0]) && instr->operands[0].size != 8) return false;
+
+    const bool add_sub_zero =
+        (instr->op == X86Op::Add || instr->op == X86Op::Sub || instr->op == X86Op::Or ||
+         instr->op == X86Op::Xor || instr->op == X86Op::Shl || instr->op == X86Op::Shr ||
+         instr->op == X86Op::Sar) &&
+        is_imm(instr->operands[1], 0);
+    const bool mul_one = instr->op == X86Op::Imul && is_imm(instr->operands[2], 1) &&
+                         x86_operands_are_equal(instr->operands[0], instr->operands[1]);
+
+    if ((!add_sub_zero && !mul_one) || !flags_dead_after(ctx, i)) {
+        return false;
+    }
+
+    delete_instr(instr);
+    return true;
+}
+
+struct PeepholeRuleEntry {
+    PeepholeRule rule;
+    const char* name;
+    PeepholeRuleFn apply;
+};
+
+static const PeepholeRuleEntry s_rules[] = {
+    {PeepholeRule::SelfMove, "self-move", rule_self_move},
+    {PeepholeRule::PushPop, "push-pop", rule_push_pop},
+    {PeepholeRule::StoreReload, "store-reload", rule_store_reload},
+    {PeepholeRule::RedundantStore, "redundant-store", rule_redundant_store},
+    {PeepholeRule::MoveRoundTrip, "move-round-trip", rule_move_round_trip},
+    {PeepholeRule::JumpToNext, "jump-to-next", rule_jump_to_next},
+    {PeepholeRule::InvertBranch, "invert-branch", rule_invert_branch},
+    {PeepholeRule::JumpToJump, "jump-to-jump", rule_jump_to_jump},
+    {PeepholeRule::DeadLabel, "dead-label", rule_dead_label},
+    {PeepholeRule::ZeroViaXor, "zero-via-xor", rule_zero_via_xor},
+    {PeepholeRule::CompareZeroToTest, "cmp-zero-to-test", rule_compare_zero_to_test},
+    {PeepholeRule::ArithmeticIdentity, "arithmetic-identity", rule_arithmetic_identity},
+};
+
+static_assert(sizeof(s_rules) / sizeof(s_rules[0]) == (size_t)PeepholeRule::Count,
+              "every peephole rule needs an entry in s_rules");
+
+static void index_labels(PeepholeContext* ctx)
+{
+    long max_label = -1;
+    for (size_t i = 0; i < ctx->count; i++) {
+        const X86Instr& instr = ctx->instrs[i];
+        for (const X86Operand& operand : instr.operands) {
+            if (referenced_label(operand) > max_label) max_label = referenced_label(operand);
+        }
+    }
+
+    array_clear(&ctx->label_refs);
+    array_clear(&ctx->label_index);
+    for (long l = 0; l <= max_label; l++) {
+        array_append(&ctx->label_refs, 0);
+        array_append(&ctx->label_index, -1L);
+    }
+
+    for (size_t i = 0; i < ctx->count; i++) {
+        const X86Instr& instr = ctx->instrs[i];
+        if (instr.op == X86Op::Label) {
+            ctx->label_index[(size_t)instr.operands[0].value] = (long)i;
+            continue;
+        }
+        for (const X86Operand& operand : instr.operands) {
+            const long label = referenced_label(operand);
+            if (label >= 0) ctx->label_refs[(size_t)label]++;
+        }
+    }
+
+    // nested control flow ends in long runs of labels, looking past them once here
+    // keeps jump threading linear
+    array_clear(&ctx->code_after);
+    for (size_t i = 0; i < ctx->count; i++) {
+        array_append(&ctx->code_after, ctx->count);
+    }
+    for (size_t i = ctx->count; i > 0; i--) {
+        if (ctx->instrs[i - 1].op != X86Op::Label) {
+            ctx->code_after[i - 1] = i - 1;
+        }
+        else if (i < ctx->count) {
+            ctx->code_after[i - 1] = ctx->code_after[i];
+        }
+    }
+}
+
+static void remove_nops(DynHeapArray<X86Instr>* instrs)
+{
+    size_t kept = 0;
+    for (size_t i = 0; i < instrs->length; i++) {
+        if ((*instrs)[i].op != X86Op::Nop) {
+            (*instrs)[kept++] = (*instrs)[i];
+        }
+    }
+    instrs->length = kept;
+}
+
+void peephole_optimize(DynHeapArray<X86Instr>* instrs, PeepholeStats* stats)
+{
+    PeepholeContext ctx;
+    ctx.label_refs = heap_array_create<int>(0);
+    ctx.label_index = heap_array_create<long>(0);
+    ctx.code_after = heap_array_create<size_t>(0);
+    defer {
+        array_free(&ctx.label_refs);
+        array_free(&ctx.label_index);
+        array_free(&ctx.code_after);
+    };
+
+    bool changed = true;
+
+    while (changed) {
+        changed = false;
+
+        ctx.instrs = instrs->begin();
+        ctx.count = instrs->length;
+        index_labels(&ctx);
+
+        for (size_t i = 0; i < ctx.count; i++) {
+            for (const PeepholeRuleEntry& entry : s_rules) {
+                if (ctx.instrs[i].op == X86Op::Nop) break;
+
+                if (entry.apply(&ctx, i)) {
+                    changed = true;
+                    if (stats) stats->hits[(size_t)entry.rule]++;
+                }
+            }
+        }
+
+        remove_nops(instrs);
+        if (stats) stats->sweeps++;
+    }
+}
+
+void peephole_print_stats(const PeepholeStats* stats)
+{
+    printf("=== PEEPHOLE ===\n");
+    for (const PeepholeRuleEntry& entry : s_rules) {
+        printf("%-24s %zu\n", entry.name, stats->hits[(size_t)entry.rule]);
+    }
+    printf("%-24s %zu\n", "(sweeps)", stats->sweeps);
+}
@@ -0,0 +1,32 @@
+#pragma once
+
+#include <stddef.h>
+
+#include "array.h"
+#include "x86.h"
+
+enum class PeepholeRule {
+    SelfMove,
+    PushPop,
+    StoreReload,
+    RedundantStore,
+    MoveRoundTrip,
+    JumpToNext,
+    InvertBranch,
+    JumpToJump,
+    DeadLabel,
+    ZeroViaXor,
+    CompareZeroToTest,
+    ArithmeticIdentity,
+    Count
+};
+
+struct PeepholeStats {
+    size_t hits[(size_t)PeepholeRule::Count] = {0};
+    size_t sweeps = 0;
+};
+
+// rewrite instrs in place until no rule applies anymore. stats may be nullptr.
+void peephole_optimize(DynHeapArray<X86Instr>* instrs, PeepholeStats* stats);
+
+void peephole_print_stats(const PeepholeStats* stats);
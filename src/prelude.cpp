@@ -1,7 +1,6 @@
 #include "prelude.h"
 
 #include <errno.h>
-#include <ftw.h>
 #include <linux/limits.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -22,38 +21,6 @@ void strip_ext(char* fname)
     }
 }
 
-// for make_tmp_dir below
-static int remove_callback(const char* pathname,
-                           __attribute__((unused)) const struct stat* sbuf,
-                           __attribute__((unused)) int type,
-                           __attribute__((unused)) struct FTW* ftwb)
-{
-    return remove(pathname);
-}
-
-const char* mk_tmp_dir(void)
-{
-    /* Create the temporary directory */
-    char _template[] = "/tmp/qxc.XXXXXX";
-
-    const char* tmp_dirname = mkdtemp(_template);
-
-    if (tmp_dirname == nullptr) {
-        perror("mkdtemp failed: ");
-        return nullptr;
-    }
-
-    return tmp_dirname;
-}
-
-void rm_tmp_dir(const char* tmp_path)
-{
-    if (nftw(tmp_path, remove_callback, FOPEN_MAX, FTW_DEPTH | FTW_MOUNT | FTW_PHYS) ==
-        -1) {
-        perror("tempdir: error: ");
-    }
-}
-
 size_t max(size_t a, size_t b) { return a > b ? a : b; }
 
 void print_file(const char* filepath)
@@ -77,3 +44,32 @@ void print_file(const char* filepath)
     fclose(fptr);
 }
 
+int copy_file(const char* src_filepath, const char* dst_filepath)
+{
+    FILE* src = fopen(src_filepath, "rb");
+    if (src == nullptr) {
+        fprintf(stderr, "Cannot open file %s\n", src_filepath);
+        return -1;
+    }
+    defer { fclose(src); };
+
+    FILE* dst = fopen(dst_filepath, "wb");
+    if (dst == nullptr) {
+        fprintf(stderr, "Cannot create file %s\n", dst_filepath);
+        return -1;
+    }
+
+    char buffer[1 << 16];
+    size_t n = 0;
+    bool failed = false;
+    while (!failed && (n = fread(buffer, 1, sizeof(buffer), src)) > 0) {
+        failed = fwrite(buffer, 1, n, dst) != n;
+    }
+    failed = failed || ferror(src);
+
+    if (fclose(dst) != 0 || failed) {
+        fprintf(stderr, "Failed to copy %s to %s\n", src_filepath, dst_filepath);
+        return -1;
+    }
+    return 0;
+}
@@ -3,21 +3,6 @@
 #include <stdbool.h>
 #include <stdlib.h>
 
-#define DEBUG
-
-#ifdef DEBUG
-#define debug_print(...)                                               \
-    do {                                                               \
-        fprintf(stderr, "%s:%d:%s(): ", __FILE__, __LINE__, __func__); \
-        fprintf(stderr, __VA_ARGS__);                                  \
-        fprintf(stderr, "\n");                                         \
-    } while (0)
-#else
-#define debug_print(...) \
-    do {                 \
-    } while (0)
-#endif
-
 #define QXC_FATAL_ERROR(msg)                                       \
     fprintf(stderr, "%s:%d:%s(): ", __FILE__, __LINE__, __func__); \
     fprintf(stderr, "fatal compiler error:\n%s\n", msg);           \
@@ -34,12 +19,10 @@ bool strs_are_equal(const char* strA, const char* strB);
 
 void strip_ext(char* fname);
 
-const char* mk_tmp_dir(void);
-void rm_tmp_dir(const char* tmp_path);
-
 size_t max(size_t a, size_t b);
 
 void print_file(const char* filepath);
+int copy_file(const char* src_filepath, const char* dst_filepath);
 
 void qxc_compiler_error_halt(const char* msg);
 
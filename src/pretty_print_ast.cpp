@@ -14,7 +14,68 @@ static size_t indent_level;
         printf(__VA_ARGS__);                        \
     } while (0)
 
-void print_expression(struct ExprNode* node)
+// The tree is walked with an explicit stack rather than recursion, generated code can
+// nest far deeper than the native stack allows. Each item prints its own line and
+// lists its children, which are printed next in order.
+
+enum class PrintItemType { Label, Expression, Statement, BlockItem, Declaration };
+
+struct PrintItem {
+    PrintItemType type;
+    size_t indent;
+
+    union {
+        const char* label;
+        ExprNode* expr;
+        StatementNode* statement;
+        BlockItemNode* block_item;
+        Declaration* declaration;
+    };
+};
+
+typedef DynArray<PrintItem, 8> PrintChildren;
+
+static void add_label(PrintChildren* children, size_t indent, const char* label)
+{
+    PrintItem* item = array_extend(children);
+    item->type = PrintItemType::Label;
+    item->indent = indent;
+    item->label = label;
+}
+
+static void add_expression(PrintChildren* children, size_t indent, ExprNode* expr)
+{
+    PrintItem* item = array_extend(children);
+    item->type = PrintItemType::Expression;
+    item->indent = indent;
+    item->expr = expr;
+}
+
+static void add_statement(PrintChildren* children, size_t indent, StatementNode* statement)
+{
+    PrintItem* item = array_extend(children);
+    item->type = PrintItemType::Statement;
+    item->indent = indent;
+    item->statement = statement;
+}
+
+static void add_block_item(PrintChildren* children, size_t indent, BlockItemNode* block_item)
+{
+    PrintItem* item = array_extend(children);
+    item->type = PrintItemType::BlockItem;
+    item->indent = indent;
+    item->block_item = block_item;
+}
+
+static void add_declaration(PrintChildren* children, size_t indent, Declaration* declaration)
+{
+    PrintItem* item = array_extend(children);
+    item->type = PrintItemType::Declaration;
+    item->indent = indent;
+    item->declaration = declaration;
+}
+
+static void print_expression_node(ExprNode* node, PrintChildren* children)
 {
     switch (node->type) {
         case ExprType::IntLiteral:
@@ -22,40 +83,36 @@ void print_expression(struct ExprNode* node)
             break;
 
         case ExprType::UnaryOp:
-            PPRINT("UnaryOp<%s>:\n", operator_to_str(node->unop_expr.op));
-            indent_level++;
-            print_expression(node->unop_expr.child_expr);
-            indent_level--;
+            PPRINT(node->unop_expr.postfix ? "PostfixUnaryOp<%s>:\n" : "UnaryOp<%s>:\n",
+                   operator_to_str(node->unop_expr.op));
+            add_expression(children, indent_level + 1, node->unop_expr.child_expr);
             break;
 
         case ExprType::BinaryOp:
             PPRINT("BinaryOp<%s>:\n", operator_to_str(node->binop_expr.op));
-            indent_level++;
-            print_expression(node->binop_expr.left_expr);
-            print_expression(node->binop_expr.right_expr);
-            indent_level--;
+            add_expression(children, indent_level + 1, node->binop_expr.left_expr);
+            add_expression(children, indent_level + 1, node->binop_expr.right_expr);
             break;
 
         case ExprType::VariableRef:
             PPRINT("VariableRef<%s>\n", node->referenced_var_name);
             break;
 
+        case ExprType::FunctionCall:
+            PPRINT("FunctionCall<%s>:\n", node->call_expr->function_name);
+            for (ExprNode* arg : node->call_expr->args) {
+                add_expression(children, indent_level + 1, arg);
+            }
+            break;
+
         case ExprType::Conditional:
             PPRINT("TernaryConditional\n");
-            indent_level++;
-            PPRINT("Condition:\n");
-            indent_level++;
-            print_expression(node->cond_expr.conditional_expr);
-            indent_level--;
-            PPRINT("IfExpr:\n");
-            indent_level++;
-            print_expression(node->cond_expr.if_expr);
-            indent_level--;
-            PPRINT("ElseExpr:\n");
-            indent_level++;
-            print_expression(node->cond_expr.else_expr);
-            indent_level--;
-            indent_level--;
+            add_label(children, indent_level + 1, "Condition:\n");
+            add_expression(children, indent_level + 2, node->cond_expr.conditional_expr);
+            add_label(children, indent_level + 1, "IfExpr:\n");
+            add_expression(children, indent_level + 2, node->cond_expr.if_expr);
+            add_label(children, indent_level + 1, "ElseExpr:\n");
+            add_expression(children, indent_level + 2, node->cond_expr.else_expr);
             break;
 
         case ExprType::Invalid:
@@ -68,27 +125,102 @@ void print_expression(struct ExprNode* node)
     }
 }
 
-static void print_block_item(BlockItemNode* block_item);
-
-static void print_statement(StatementNode* statement)
+static void print_statement_node(StatementNode* statement, PrintChildren* children)
 {
     switch (statement->type) {
         case StatementType::Return:
             PPRINT("Return:\n");
-            indent_level++;
-            print_expression(statement->return_expr);
-            indent_level--;
+            add_expression(children, indent_level + 1, statement->return_expr);
             return;
 
         case StatementType::StandAloneExpr:
             PPRINT("StandaloneExpr:\n");
-            indent_level++;
-            print_expression(statement->standalone_expr);
-            indent_level--;
+            add_expression(children, indent_level + 1, statement->standalone_expr);
+            return;
+
+        case StatementType::Null:
+            PPRINT("NullStatement\n");
+            return;
+
+        case StatementType::Break:
+            PPRINT("Break\n");
+            return;
+
+        case StatementType::Continue:
+            PPRINT("Continue\n");
+            return;
+
+        case StatementType::For: {
+            ForStatement* for_stmt = statement->for_statement;
+            const size_t indent = indent_level + 1;
+
+            PPRINT("ForStatement:\n");
+
+            if (for_stmt->init_decl) {
+                add_declaration(children, indent, for_stmt->init_decl);
+            }
+            else if (for_stmt->init_expr) {
+                add_label(children, indent, "Init:\n");
+                add_expression(children, indent + 1, for_stmt->init_expr);
+            }
+            if (for_stmt->condition_expr) {
+                add_label(children, indent, "Condition:\n");
+                add_expression(children, indent + 1, for_stmt->condition_expr);
+            }
+            if (for_stmt->post_expr) {
+                add_label(children, indent, "Post:\n");
+                add_expression(children, indent + 1, for_stmt->post_expr);
+            }
+            add_label(children, indent, "Body:\n");
+            add_statement(children, indent + 1, for_stmt->body_statement);
+            return;
+        }
+
+        case StatementType::While:
+        case StatementType::DoWhile: {
+            WhileStatement* while_stmt = statement->while_statement;
+            const size_t indent = indent_level + 1;
+
+            PPRINT("%s:\n", statement->type == StatementType::While ? "WhileStatement"
+                                                                  : "DoWhileStatement");
+
+            add_label(children, indent, "Condition:\n");
+            add_expression(children, indent + 1, while_stmt->condition_expr);
+            add_label(children, indent, "Body:\n");
+            add_statement(children, indent + 1, while_stmt->body_statement);
+            return;
+        }
+
+        case StatementType::Switch: {
+            SwitchStatement* switch_stmt = statement->switch_statement;
+            const size_t indent = indent_level + 1;
+
+            PPRINT("SwitchStatement:\n");
+
+            add_label(children, indent, "Controlling:\n");
+            add_expression(children, indent + 1, switch_stmt->controlling_expr);
+            add_label(children, indent, "Body:\n");
+            add_statement(children, indent + 1, switch_stmt->body_statement);
             return;
+        }
+
+        case StatementType::Case: {
+            CaseStatement* case_stmt = statement->case_statement;
+
+            if (case_stmt->value_expr != nullptr) {
+                PPRINT("Case:\n");
+                add_expression(children, indent_level + 1, case_stmt->value_expr);
+            }
+            else {
+                PPRINT("Default:\n");
+            }
+            add_statement(children, indent_level + 1, case_stmt->statement);
+            return;
+        }
 
         case StatementType::IfElse: {
             IfElseStatement* ifelse_stmt = statement->ifelse_statement;
+            const size_t indent = indent_level + 1;
 
             if (ifelse_stmt->else_branch_statement != nullptr) {
                 PPRINT("IfElseStatement:\n");
@@ -96,37 +228,25 @@ static void print_statement(StatementNode* statement)
             else {
                 PPRINT("IfStatement:\n");
             }
-            indent_level++;
 
-            PPRINT("Condition:\n");
-            indent_level++;
-            print_expression(ifelse_stmt->conditional_expr);
-            indent_level--;
-            PPRINT("IfBranch:\n");
-            indent_level++;
-            print_statement(ifelse_stmt->if_branch_statement);
-            indent_level--;
+            add_label(children, indent, "Condition:\n");
+            add_expression(children, indent + 1, ifelse_stmt->conditional_expr);
+            add_label(children, indent, "IfBranch:\n");
+            add_statement(children, indent + 1, ifelse_stmt->if_branch_statement);
 
             if (ifelse_stmt->else_branch_statement != nullptr) {
-                PPRINT("ElseBranch:\n");
-                indent_level++;
-                print_statement(ifelse_stmt->else_branch_statement);
-                indent_level--;
+                add_label(children, indent, "ElseBranch:\n");
+                add_statement(children, indent + 1, ifelse_stmt->else_branch_statement);
             }
-
-            indent_level--;
             return;
         }
 
         case StatementType::Compound: {
             PPRINT("CompoundStatement:\n");
-            indent_level++;
 
             for (BlockItemNode* b : statement->block_items) {
-                print_block_item(b);
+                add_block_item(children, indent_level + 1, b);
             }
-
-            indent_level--;
             return;
         }
 
@@ -136,49 +256,136 @@ static void print_statement(StatementNode* statement)
     }
 }
 
-static void print_declaration(Declaration* declaration)
+static void print_item(const PrintItem& item, PrintChildren* children)
 {
-    PPRINT("Declaration<%s>:\n", declaration->var_name);
-    if (declaration->initializer_expr) {
-        indent_level++;
-        print_expression(declaration->initializer_expr);
-        indent_level--;
+    indent_level = item.indent;
+
+    switch (item.type) {
+        case PrintItemType::Label:
+            PPRINT("%s", item.label);
+            break;
+
+        case PrintItemType::Expression:
+            print_expression_node(item.expr, children);
+            break;
+
+        case PrintItemType::Statement:
+            print_statement_node(item.statement, children);
+            break;
+
+        case PrintItemType::BlockItem:
+            if (item.block_item->type == BlockItemType::Statement) {
+                add_statement(children, item.indent, item.block_item->statement);
+            }
+            else if (item.block_item->type == BlockItemType::Declaration) {
+                add_declaration(children, item.indent, item.block_item->declaration);
+            }
+            else {
+                assert(item.block_item->type == BlockItemType::Invalid);
+                fprintf(stderr, "invalid block item encountered");
+            }
+            break;
+
+        case PrintItemType::Declaration:
+            PPRINT("Declaration<%s>:\n", item.declaration->var_name);
+            if (item.declaration->initializer_expr) {
+                add_expression(children, item.indent + 1, item.declaration->initializer_expr);
+            }
+            break;
+
+        default:
+            QXC_UNREACHABLE();
     }
 }
 
-static void print_block_item(BlockItemNode* block_item)
+// prints the given items and everything below them, at the indentation they carry
+static void print_items(PrintChildren* roots)
 {
-    if (block_item->type == BlockItemType::Statement) {
-        print_statement(block_item->statement);
-    }
-    else if (block_item->type == BlockItemType::Declaration) {
-        print_declaration(block_item->declaration);
+    DynHeapArray<PrintItem> stack = heap_array_create<PrintItem>(64);
+    PrintChildren children;
+    array_init(&children);
+    defer {
+        array_free(&stack);
+        array_free(&children);
+    };
+
+    for (size_t i = roots->length; i > 0; i--) {
+        array_append(&stack, (*roots)[i - 1]);
     }
-    else {
-        assert(block_item->type == BlockItemType::Invalid);
-        fprintf(stderr, "invalid block item encountered");
+
+    while (stack.length > 0) {
+        const PrintItem item = stack[stack.length - 1];
+        stack.length--;
+
+        array_clear(&children);
+        print_item(item, &children);
+
+        for (size_t i = children.length; i > 0; i--) {
+            array_append(&stack, children[i - 1]);
+        }
     }
 }
 
+void print_expression(struct ExprNode* node)
+{
+    PrintChildren roots;
+    array_init(&roots);
+    defer { array_free(&roots); };
+
+    add_expression(&roots, indent_level, node);
+    print_items(&roots);
+}
+
 static void print_function_decl(FunctionDecl* decl)
 {
     PPRINT("FUNC NAME: %s\n", decl->name);
     indent_level++;
     PPRINT("FUNC RETURN TYPE: Int\n");
-    PPRINT("PARAMS: ()\n");
+    PPRINT("PARAMS: (");
+    for (size_t i = 0; i < decl->param_names.length; i++) {
+        printf(i == 0 ? "%s" : ", %s", decl->param_names[i]);
+    }
+    printf(")\n");
+    if (!decl->is_definition) {
+        indent_level--;
+        return;
+    }
     PPRINT("BODY:\n");
-    indent_level++;
+
+    PrintChildren body;
+    array_init(&body);
+    defer { array_free(&body); };
 
     for (BlockItemNode* b : decl->block_items) {
-        print_block_item(b);
+        add_block_item(&body, indent_level + 1, b);
     }
+    print_items(&body);
 
-    indent_level -= 2;
+    indent_level = 0;
 }
 
 void print_program(Program* program)
 {
     indent_level = 0;
-    print_function_decl(program->main_decl);
-    printf("\n");
+    for (TopLevelItem* item : program->items) {
+        switch (item->type) {
+            case TopLevelType::Function:
+                print_function_decl(item->function_decl);
+                break;
+            case TopLevelType::Variable: {
+                PrintChildren roots;
+                array_init(&roots);
+                defer { array_free(&roots); };
+
+                add_declaration(&roots, 0, item->var_decl);
+                print_items(&roots);
+                indent_level = 0;
+                break;
+            }
+            default:
+                QXC_UNREACHABLE();
+                break;
+        }
+        printf("\n");
+    }
 }
@@ -0,0 +1,261 @@
+#include "server.h"
+
+#include <errno.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <linux/limits.h>
+
+#include "array.h"
+#include "prelude.h"
+
+#define QXC_SERVER_MAGIC 0x51584331u  // "QXC1"
+
+// followed by argc + 1 NUL terminated strings, the working directory first
+struct JobHeader {
+    uint32_t magic;
+    uint32_t argc;
+    uint32_t payload_bytes;
+};
+
+void server_default_socket_path(char* path, size_t size)
+{
+    const char* env_path = getenv("QXC_SERVER");
+    const char* runtime_dir = getenv("XDG_RUNTIME_DIR");
+
+    if (env_path && *env_path) {
+        snprintf(path, size, "%s", env_path);
+    }
+    else if (runtime_dir && *runtime_dir) {
+        snprintf(path, size, "%s/qxc.sock", runtime_dir);
+    }
+    else {
+        snprintf(path, size, "/tmp/qxc-%u.sock", (unsigned)getuid());
+    }
+}
+
+static bool socket_address(const char* socket_path, struct sockaddr_un* addr)
+{
+    if (strlen(socket_path) >= sizeof(addr->sun_path)) {
+        fprintf(stderr, "socket path too long: %s\n", socket_path);
+        return false;
+    }
+
+    memset(addr, 0, sizeof(*addr));
+    addr->sun_family = AF_UNIX;
+    strcpy(addr->sun_path, socket_path);
+    return true;
+}
+
+static bool read_all(int fd, void* buffer, size_t size)
+{
+    uint8_t* p = (uint8_t*)buffer;
+    while (size > 0) {
+        const ssize_t n = read(fd, p, size);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        p += n;
+        size -= (size_t)n;
+    }
+    return true;
+}
+
+static bool write_all(int fd, const void* buffer, size_t size)
+{
+    const uint8_t* p = (const uint8_t*)buffer;
+    while (size > 0) {
+        const ssize_t n = write(fd, p, size);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        p += n;
+        size -= (size_t)n;
+    }
+    return true;
+}
+
+// --------------------------------------------------------------------------------
+// server
+
+// receives the header along with the client's stdout and stderr
+static bool receive_header(int connection, JobHeader* header, int* fds)
+{
+    char control[CMSG_SPACE(2 * sizeof(int))];
+    struct iovec iov = {header, sizeof(*header)};
+
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+
+    if (recvmsg(connection, &msg, MSG_WAITALL) != (ssize_t)sizeof(*header)) return false;
+
+    struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+    if (!cmsg || cmsg->cmsg_type != SCM_RIGHTS || cmsg->cmsg_len != CMSG_LEN(2 * sizeof(int))) {
+        return false;
+    }
+    memcpy(fds, CMSG_DATA(cmsg), 2 * sizeof(int));
+
+    return header->magic == QXC_SERVER_MAGIC;
+}
+
+static int run_job(int connection, ServerJobFn job)
+{
+    JobHeader header;
+    int client_fds[2] = {-1, -1};
+    if (!receive_header(connection, &header, client_fds)) return -1;
+    defer {
+        close(client_fds[0]);
+        close(client_fds[1]);
+    };
+
+    DynHeapArray<char> payload = heap_array_create<char>(header.payload_bytes + 1);
+    defer { array_free(&payload); };
+    payload.length = header.payload_bytes;
+    if (!read_all(connection, payload.data, payload.length)) return -1;
+    array_append(&payload, '\0');
+
+    // cwd, then argv, all NUL terminated
+    DynHeapArray<char*> args = heap_array_create<char*>(header.argc + 1);
+    defer { array_free(&args); };
+    char* cwd = &payload[0];
+    for (char* p = cwd + strlen(cwd) + 1; args.length < header.argc; p += strlen(p) + 1) {
+        if (p >= &payload[0] + header.payload_bytes) return -1;
+        array_append(&args, p);
+    }
+    array_append(&args, (char*)nullptr);
+
+    char server_cwd[PATH_MAX];
+    if (getcwd(server_cwd, sizeof(server_cwd)) == nullptr || chdir(cwd) != 0) return -1;
+
+    // the job prints straight to the client's terminal
+    fflush(stdout);
+    fflush(stderr);
+    const int saved_stdout = dup(STDOUT_FILENO);
+    const int saved_stderr = dup(STDERR_FILENO);
+    dup2(client_fds[0], STDOUT_FILENO);
+    dup2(client_fds[1], STDERR_FILENO);
+
+    const int32_t exit_code = job((int)header.argc, &args[0]);
+
+    fflush(stdout);
+    fflush(stderr);
+    dup2(saved_stdout, STDOUT_FILENO);
+    dup2(saved_stderr, STDERR_FILENO);
+    close(saved_stdout);
+    close(saved_stderr);
+
+    if (chdir(server_cwd) != 0) {
+        perror("qxc server: cannot return to its working directory");
+    }
+
+    write_all(connection, &exit_code, sizeof(exit_code));
+    return 0;
+}
+
+int server_run(const char* socket_path, ServerJobFn job)
+{
+    struct sockaddr_un addr;
+    if (!socket_address(socket_path, &addr)) return -1;
+
+    const int listener = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (listener < 0) {
+        perror("qxc server: socket");
+        return -1;
+    }
+    defer { close(listener); };
+
+    unlink(socket_path);  // left behind by a previous server
+    if (bind(listener, (struct sockaddr*)&addr, sizeof(addr)) != 0 ||
+        listen(listener, 64) != 0) {
+        perror("qxc server: cannot listen on socket");
+        return -1;
+    }
+
+    // a client going away mid-job must not take the server with it
+    signal(SIGPIPE, SIG_IGN);
+
+    fprintf(stderr, "qxc server listening on %s\n", socket_path);
+
+    while (true) {
+        const int connection = accept4(listener, nullptr, nullptr, SOCK_CLOEXEC);
+        if (connection < 0) {
+            if (errno == EINTR) continue;
+            perror("qxc server: accept");
+            return -1;
+        }
+
+        if (run_job(connection, job) != 0) {
+            fprintf(stderr, "qxc server: dropped malformed job\n");
+        }
+        close(connection);
+    }
+}
+
+// --------------------------------------------------------------------------------
+// client
+
+bool client_forward(const char* socket_path, int argc, char* argv[], int* exit_code)
+{
+    struct sockaddr_un addr;
+    if (!socket_address(socket_path, &addr)) return false;
+
+    const int connection = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (connection < 0) return false;
+    defer { close(connection); };
+
+    if (connect(connection, (struct sockaddr*)&addr, sizeof(addr)) != 0) return false;
+
+    char cwd[PATH_MAX];
+    if (getcwd(cwd, sizeof(cwd)) == nullptr) return false;
+
+    DynHeapArray<char> payload = heap_array_create<char>(PATH_MAX);
+    defer { array_free(&payload); };
+    const auto append = [&payload](const char* str) {
+        for (const char* c = str; *c; c++) array_append(&payload, *c);
+        array_append(&payload, '\0');
+    };
+    append(cwd);
+    for (int i = 0; i < argc; i++) append(argv[i]);
+
+    JobHeader header;
+    header.magic = QXC_SERVER_MAGIC;
+    header.argc = (uint32_t)argc;
+    header.payload_bytes = (uint32_t)payload.length;
+
+    const int fds[2] = {STDOUT_FILENO, STDERR_FILENO};
+    char control[CMSG_SPACE(sizeof(fds))];
+    memset(control, 0, sizeof(control));
+    struct iovec iov = {&header, sizeof(header)};
+
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+
+    struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(fds));
+    memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+
+    if (sendmsg(connection, &msg, 0) != (ssize_t)sizeof(header) ||
+        !write_all(connection, payload.data, payload.length)) {
+        return false;
+    }
+
+    int32_t code = 0;
+    if (!read_all(connection, &code, sizeof(code))) return false;
+
+    *exit_code = code;
+    return true;
+}
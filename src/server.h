@@ -0,0 +1,26 @@
+#pragma once
+
+#include <stddef.h>
+
+// Compile server: `qxc --server [socket]` stays resident and runs compile jobs sent
+// by thin clients over a Unix socket, so process startup is paid for once and the
+// allocator arenas stay warm from one job to the next.
+//
+// A client sends its working directory and argv together with its stdout and stderr
+// file descriptors, the server runs the job with those in place and answers with
+// the exit code. Jobs run one at a time, each can still use the thread pool.
+//
+// Plain qxc invocations act as clients when $QXC_SERVER names the socket, and fall
+// back to compiling in-process if no server is listening there.
+
+typedef int (*ServerJobFn)(int argc, char* argv[]);
+
+// socket path to use if none is given: $QXC_SERVER, else $XDG_RUNTIME_DIR/qxc.sock,
+// else /tmp/qxc-<uid>.sock
+void server_default_socket_path(char* path, size_t size);
+
+// only returns on failure to set up the socket
+int server_run(const char* socket_path, ServerJobFn job);
+
+// false if no server could be reached, *exit_code is the job's otherwise
+bool client_forward(const char* socket_path, int argc, char* argv[], int* exit_code);
@@ -0,0 +1,109 @@
+#include "thread_pool.h"
+
+#include <unistd.h>
+
+#include <mutex>
+#include <thread>
+
+#include "array.h"
+#include "prelude.h"
+
+struct WorkerQueue {
+    std::mutex lock;
+    DynHeapArray<ThreadPoolTask> tasks;
+    size_t head = 0;  // tasks before head have been stolen already
+};
+
+struct ThreadPool {
+    WorkerQueue* queues;
+    int worker_count;
+};
+
+int thread_pool_default_thread_count(void)
+{
+    const long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    return cpus > 0 ? (int)cpus : 1;
+}
+
+// the owner works LIFO on its own deque
+static bool pop_task(WorkerQueue* queue, ThreadPoolTask* task)
+{
+    std::lock_guard<std::mutex> guard(queue->lock);
+    if (queue->head == queue->tasks.length) return false;
+
+    *task = queue->tasks[queue->tasks.length - 1];
+    queue->tasks.length--;
+    return true;
+}
+
+// thieves take the oldest task, the one the owner would get to last
+static bool steal_task(WorkerQueue* queue, ThreadPoolTask* task)
+{
+    std::lock_guard<std::mutex> guard(queue->lock);
+    if (queue->head == queue->tasks.length) return false;
+
+    *task = queue->tasks[queue->head++];
+    return true;
+}
+
+static void worker_loop(ThreadPool* pool, int self)
+{
+    ThreadPoolTask task;
+
+    while (true) {
+        bool found = pop_task(&pool->queues[self], &task);
+
+        for (int i = 1; i < pool->worker_count && !found; i++) {
+            found = steal_task(&pool->queues[(self + i) % pool->worker_count], &task);
+        }
+
+        // tasks never spawn new ones, so once every deque is empty the remaining work
+        // is already running on other workers
+        if (!found) return;
+
+        task.fn(task.arg);
+    }
+}
+
+void thread_pool_run(ThreadPoolTask* tasks, size_t task_count, int thread_count)
+{
+    if (thread_count > (int)task_count) thread_count = (int)task_count;
+
+    if (thread_count <= 1) {
+        for (size_t i = 0; i < task_count; i++) {
+            tasks[i].fn(tasks[i].arg);
+        }
+        return;
+    }
+
+    ThreadPool pool;
+    pool.worker_count = thread_count;
+    pool.queues = new WorkerQueue[(size_t)thread_count];
+    defer {
+        for (int i = 0; i < thread_count; i++) {
+            array_free(&pool.queues[i].tasks);
+        }
+        delete[] pool.queues;
+    };
+
+    for (int i = 0; i < thread_count; i++) {
+        pool.queues[i].tasks =
+            heap_array_create<ThreadPoolTask>(task_count / (size_t)thread_count + 1);
+    }
+    // pushed in reverse, so each worker starts on its share in the given order
+    for (size_t i = task_count; i > 0; i--) {
+        array_append(&pool.queues[(i - 1) % (size_t)thread_count].tasks, tasks[i - 1]);
+    }
+
+    std::thread* threads = new std::thread[(size_t)thread_count - 1];
+    for (int i = 1; i < thread_count; i++) {
+        threads[i - 1] = std::thread(worker_loop, &pool, i);
+    }
+
+    worker_loop(&pool, 0);
+
+    for (int i = 1; i < thread_count; i++) {
+        threads[i - 1].join();
+    }
+    delete[] threads;
+}
@@ -0,0 +1,25 @@
+#pragma once
+
+#include <stddef.h>
+
+// Runs a fixed set of independent tasks on a pool of worker threads, returning once
+// all of them have finished.
+//
+// Every worker owns a deque of tasks, seeded round-robin. It takes work from the back
+// of its own deque and, once that runs dry, steals from the front of the others. That
+// keeps all threads busy when a few tasks (large translation units) take far longer
+// than the rest, without any central queue every worker contends on.
+
+typedef void (*ThreadPoolTaskFn)(void* arg);
+
+struct ThreadPoolTask {
+    ThreadPoolTaskFn fn = nullptr;
+    void* arg = nullptr;
+};
+
+// number of online CPUs, at least 1
+int thread_pool_default_thread_count(void);
+
+// the calling thread works as one of the thread_count workers, so 1 runs every task
+// in order on the calling thread
+void thread_pool_run(ThreadPoolTask* tasks, size_t task_count, int thread_count);
@@ -18,6 +18,22 @@ const char* keyword_to_str(Keyword keyword)
             return "if";
         case Keyword::Else:
             return "else";
+        case Keyword::For:
+            return "for";
+        case Keyword::While:
+            return "while";
+        case Keyword::Do:
+            return "do";
+        case Keyword::Break:
+            return "break";
+        case Keyword::Continue:
+            return "continue";
+        case Keyword::Switch:
+            return "switch";
+        case Keyword::Case:
+            return "case";
+        case Keyword::Default:
+            return "default";
         default:
             return nullptr;
     }
@@ -37,6 +53,30 @@ Keyword str_to_keyword(const char* kstr)
     else if (strs_are_equal("else", kstr)) {
         return Keyword::Else;
     }
+    else if (strs_are_equal("for", kstr)) {
+        return Keyword::For;
+    }
+    else if (strs_are_equal("while", kstr)) {
+        return Keyword::While;
+    }
+    else if (strs_are_equal("do", kstr)) {
+        return Keyword::Do;
+    }
+    else if (strs_are_equal("break", kstr)) {
+        return Keyword::Break;
+    }
+    else if (strs_are_equal("continue", kstr)) {
+        return Keyword::Continue;
+    }
+    else if (strs_are_equal("switch", kstr)) {
+        return Keyword::Switch;
+    }
+    else if (strs_are_equal("case", kstr)) {
+        return Keyword::Case;
+    }
+    else if (strs_are_equal("default", kstr)) {
+        return Keyword::Default;
+    }
     else {
         return Keyword::Invalid;
     }
@@ -79,6 +119,42 @@ const char* operator_to_str(Operator op)
             return "?";
         case Operator::Assignment:
             return "=";
+        case Operator::BitwiseOR:
+            return "|";
+        case Operator::BitwiseAND:
+            return "&";
+        case Operator::BitwiseXOR:
+            return "^";
+        case Operator::BitShiftLeft:
+            return "<<";
+        case Operator::BitShiftRight:
+            return ">>";
+        case Operator::Percent:
+            return "%";
+        case Operator::AddAssign:
+            return "+=";
+        case Operator::SubtractAssign:
+            return "-=";
+        case Operator::MultiplyAssign:
+            return "*=";
+        case Operator::DivideAssign:
+            return "/=";
+        case Operator::ModuloAssign:
+            return "%=";
+        case Operator::ShiftLeftAssign:
+            return "<<=";
+        case Operator::ShiftRightAssign:
+            return ">>=";
+        case Operator::AndAssign:
+            return "&=";
+        case Operator::OrAssign:
+            return "|=";
+        case Operator::XorAssign:
+            return "^=";
+        case Operator::Increment:
+            return "++";
+        case Operator::Decrement:
+            return "--";
         default:
             return nullptr;
     }
@@ -132,6 +208,9 @@ void token_print(const Token& token)
         case TokenType::SemiColon:
             printf(";");
             break;
+        case TokenType::Comma:
+            printf(",");
+            break;
         case TokenType::KeyWord:
             printf("keyword: %s", keyword_to_str(token.keyword));
             break;
@@ -3,7 +3,21 @@
 #include <stdbool.h>
 #include <stddef.h>
 
-enum class Keyword { Return, Int, If, Else, Invalid };
+enum class Keyword {
+    Return,
+    Int,
+    If,
+    Else,
+    For,
+    While,
+    Do,
+    Break,
+    Continue,
+    Switch,
+    Case,
+    Default,
+    Invalid
+};
 
 const char* keyword_to_str(Keyword keyword);
 Keyword str_to_keyword(const char* kstr);
@@ -33,6 +47,18 @@ enum class Operator {
     BitShiftLeft,
     BitShiftRight,
     Percent,
+    AddAssign,
+    SubtractAssign,
+    MultiplyAssign,
+    DivideAssign,
+    ModuloAssign,
+    ShiftLeftAssign,
+    ShiftRightAssign,
+    AndAssign,
+    OrAssign,
+    XorAssign,
+    Increment,
+    Decrement,
     Invalid
 };
 
@@ -43,6 +69,7 @@ bool operator_is_always_unary(Operator op);
 enum class TokenType {
     CloseBrace,
     CloseParen,
+    Comma,
     Identifier,
     IntLiteral,
     KeyWord,
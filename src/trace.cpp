@@ -0,0 +1,260 @@
+#include "trace.h"
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include <linux/limits.h>
+
+#include <atomic>
+#include <mutex>
+
+#include "array.h"
+#include "prelude.h"
+
+// a thread's buffered messages are written out once they grow past this
+#define QXC_TRACE_FLUSH_BYTES (64 << 10)
+
+uint32_t g_trace_categories = 0;
+bool g_trace_spans = false;
+
+struct TraceEvent {
+    const char* name;
+    TraceCategory category;
+    char* detail;
+    uint64_t start_us;
+    uint64_t duration_us;
+    int tid;
+};
+
+static const struct {
+    const char* name;
+    TraceCategory category;
+} s_category_names[] = {
+    {"driver", TraceCategory::Driver}, {"lexer", TraceCategory::Lexer},
+    {"parser", TraceCategory::Parser}, {"ir", TraceCategory::IR},
+    {"opt", TraceCategory::Opt},       {"codegen", TraceCategory::Codegen},
+    {"cache", TraceCategory::Cache},
+};
+
+static char s_json_path[PATH_MAX];
+static uint64_t s_start_us = 0;
+static std::atomic<int> s_next_tid(0);
+
+// events of threads that have flushed, guarded by the lock
+static std::mutex s_lock;
+static DynHeapArray<TraceEvent> s_events;
+
+static void flush_thread_buffer(struct ThreadTraceBuffer* buffer);
+
+struct ThreadTraceBuffer {
+    DynHeapArray<char> text;
+    DynHeapArray<TraceEvent> events;
+    int tid = -1;
+
+    ~ThreadTraceBuffer()
+    {
+        if (tid < 0) return;
+        flush_thread_buffer(this);
+        array_free(&text);
+        array_free(&events);
+    }
+};
+
+static thread_local ThreadTraceBuffer s_thread_buffer;
+
+static ThreadTraceBuffer* thread_buffer(void)
+{
+    ThreadTraceBuffer* buffer = &s_thread_buffer;
+    if (buffer->tid < 0) {
+        buffer->text = heap_array_create<char>(QXC_TRACE_FLUSH_BYTES);
+        buffer->events = heap_array_create<TraceEvent>(64);
+        buffer->tid = s_next_tid++;
+    }
+    return buffer;
+}
+
+static void flush_thread_buffer(ThreadTraceBuffer* buffer)
+{
+    std::lock_guard<std::mutex> guard(s_lock);
+
+    if (buffer->text.length > 0) {
+        fwrite(buffer->text.data, 1, buffer->text.length, stderr);
+        array_clear(&buffer->text);
+    }
+
+    if (g_trace_spans) {
+        for (TraceEvent& event : buffer->events) {
+            array_append(&s_events, event);
+        }
+    }
+    array_clear(&buffer->events);
+}
+
+static uint64_t now_us(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + (uint64_t)ts.tv_nsec / 1000;
+}
+
+static const char* category_name(TraceCategory category)
+{
+    for (const auto& entry : s_category_names) {
+        if (entry.category == category) return entry.name;
+    }
+    return "unknown";
+}
+
+int trace_init(const char* categories, const char* json_path)
+{
+    g_trace_categories = 0;
+
+    if (categories) {
+        char list[256];
+        snprintf(list, sizeof(list), "%s", categories);
+
+        char* save = nullptr;
+        for (char* name = strtok_r(list, ",", &save); name;
+             name = strtok_r(nullptr, ",", &save)) {
+            bool known = strs_are_equal(name, "all");
+            if (known) g_trace_categories = QXC_TRACE_ALL_CATEGORIES;
+
+            for (const auto& entry : s_category_names) {
+                if (strs_are_equal(name, entry.name)) {
+                    g_trace_categories |= (uint32_t)entry.category;
+                    known = true;
+                }
+            }
+
+            if (!known) {
+                fprintf(stderr, "unknown trace category: %s\n", name);
+                return -1;
+            }
+        }
+    }
+
+#if QXC_TRACE_LEVEL < QXC_TRACE_LEVEL_DEBUG
+    if (g_trace_categories != 0) {
+        fprintf(stderr, "trace messages are compiled out, rebuild with TRACE_LEVEL=2\n");
+    }
+#endif
+
+    g_trace_spans = json_path != nullptr;
+    if (g_trace_spans) {
+        snprintf(s_json_path, sizeof(s_json_path), "%s", json_path);
+        s_events = heap_array_create<TraceEvent>(256);
+        s_start_us = now_us();
+    }
+
+    return 0;
+}
+
+static void write_json_string(FILE* out, const char* str)
+{
+    fputc('"', out);
+    for (const char* c = str; *c; c++) {
+        if (*c == '"' || *c == '\\') {
+            fputc('\\', out);
+        }
+        if ((unsigned char)*c < 0x20) {
+            fprintf(out, "\\u%04x", (unsigned)*c);
+            continue;
+        }
+        fputc(*c, out);
+    }
+    fputc('"', out);
+}
+
+static void write_json(void)
+{
+    FILE* out = fopen(s_json_path, "w");
+    if (out == nullptr) {
+        fprintf(stderr, "cannot write trace to %s\n", s_json_path);
+        return;
+    }
+
+    fprintf(out, "{\"traceEvents\":[\n");
+    for (size_t i = 0; i < s_events.length; i++) {
+        const TraceEvent& event = s_events[i];
+        fprintf(out, "{\"name\":");
+        write_json_string(out, event.name);
+        fprintf(out, ",\"cat\":\"%s\",\"ph\":\"X\",\"ts\":%lu,\"dur\":%lu,\"pid\":1,\"tid\":%d",
+                category_name(event.category), event.start_us - s_start_us,
+                event.duration_us, event.tid);
+        if (event.detail) {
+            fprintf(out, ",\"args\":{\"detail\":");
+            write_json_string(out, event.detail);
+            fprintf(out, "}");
+        }
+        fprintf(out, "}%s\n", i + 1 < s_events.length ? "," : "");
+    }
+    fprintf(out, "],\"displayTimeUnit\":\"ms\"}\n");
+
+    fclose(out);
+}
+
+void trace_shutdown(void)
+{
+    flush_thread_buffer(thread_buffer());
+
+    if (g_trace_spans) {
+        write_json();
+        for (TraceEvent& event : s_events) {
+            free(event.detail);
+        }
+        array_free(&s_events);
+    }
+
+    g_trace_categories = 0;
+    g_trace_spans = false;
+}
+
+void trace_message(TraceCategory category, const char* file, int line, const char* func,
+                   const char* fmt, ...)
+{
+    char message[1024];
+    const int prefix_length = snprintf(message, sizeof(message), "%s:%d:%s(): [%s] ", file,
+                                       line, func, category_name(category));
+
+    va_list args;
+    va_start(args, fmt);
+    vsnprintf(message + prefix_length, sizeof(message) - (size_t)prefix_length, fmt, args);
+    va_end(args);
+
+    ThreadTraceBuffer* buffer = thread_buffer();
+    for (const char* c = message; *c; c++) {
+        array_append(&buffer->text, *c);
+    }
+    array_append(&buffer->text, '\n');
+
+    if (buffer->text.length >= QXC_TRACE_FLUSH_BYTES) {
+        flush_thread_buffer(buffer);
+    }
+}
+
+TraceSpan::TraceSpan(TraceCategory category_, const char* name_, const char* detail_)
+    : active(g_trace_spans), category(category_), name(name_), detail(nullptr), start_us(0)
+{
+    if (!active) return;
+
+    detail = detail_ ? strdup(detail_) : nullptr;
+    start_us = now_us();
+}
+
+TraceSpan::~TraceSpan()
+{
+    if (!active) return;
+
+    TraceEvent event;
+    event.name = name;
+    event.category = category;
+    event.detail = detail;
+    event.start_us = start_us;
+    event.duration_us = now_us() - start_us;
+
+    ThreadTraceBuffer* buffer = thread_buffer();
+    event.tid = buffer->tid;
+    array_append(&buffer->events, event);
+}
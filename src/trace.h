@@ -0,0 +1,95 @@
+#pragma once
+
+#include <stdint.h>
+
+// Tracing, in two flavours:
+//
+// - TRACE_DEBUG(category, fmt, ...) messages about individual decisions. Printed to
+//   stderr for the categories enabled with --trace, buffered per thread.
+// - TRACE_SPAN(category, name) scopes timing a phase. Recorded when --trace-json is
+//   given and written out as Chrome trace events (chrome://tracing, Perfetto).
+//
+// QXC_TRACE_LEVEL decides at compile time what exists at all: 0 compiles everything
+// away, 1 (the default) keeps spans, 2 adds debug messages. Build with
+// `make TRACE_LEVEL=2` for the chatty version.
+
+#define QXC_TRACE_LEVEL_OFF 0
+#define QXC_TRACE_LEVEL_SPANS 1
+#define QXC_TRACE_LEVEL_DEBUG 2
+
+#ifndef QXC_TRACE_LEVEL
+#define QXC_TRACE_LEVEL QXC_TRACE_LEVEL_SPANS
+#endif
+
+enum class TraceCategory : uint32_t {
+    Driver = 1 << 0,
+    Lexer = 1 << 1,
+    Parser = 1 << 2,
+    IR = 1 << 3,
+    Opt = 1 << 4,
+    Codegen = 1 << 5,
+    Cache = 1 << 6,
+};
+
+#define QXC_TRACE_ALL_CATEGORIES 0x7fu
+
+// categories printing debug messages, and whether spans are being recorded. Only
+// changed by trace_init, before any worker threads exist.
+extern uint32_t g_trace_categories;
+extern bool g_trace_spans;
+
+// categories is a comma separated list of category names or "all", json_path may be
+// null. Returns -1 on an unknown category.
+int trace_init(const char* categories, const char* json_path);
+
+// flushes everything, writes the JSON file if any and turns tracing off again
+void trace_shutdown(void);
+
+void trace_message(TraceCategory category, const char* file, int line, const char* func,
+                   const char* fmt, ...) __attribute__((format(printf, 5, 6)));
+
+// a complete event from construction to destruction. detail, if any, is copied and
+// shown as the event's argument.
+struct TraceSpan {
+    TraceSpan(TraceCategory category, const char* name, const char* detail = nullptr);
+    ~TraceSpan();
+
+    TraceSpan(const TraceSpan&) = delete;
+    TraceSpan& operator=(const TraceSpan&) = delete;
+
+    bool active;  // spans started while recording was off stay inactive
+    TraceCategory category;
+    const char* name;
+    char* detail;
+    uint64_t start_us;
+};
+
+inline bool trace_category_enabled(TraceCategory category)
+{
+    return (g_trace_categories & (uint32_t)category) != 0;
+}
+
+#define QXC_TRACE_CONCAT_(a, b) a##b
+#define QXC_TRACE_CONCAT(a, b) QXC_TRACE_CONCAT_(a, b)
+
+#if QXC_TRACE_LEVEL >= QXC_TRACE_LEVEL_SPANS
+#define TRACE_SPAN(category, ...) \
+    TraceSpan QXC_TRACE_CONCAT(trace_span_, __LINE__)(category, __VA_ARGS__)
+#else
+#define TRACE_SPAN(category, ...) \
+    do {                          \
+    } while (0)
+#endif
+
+#if QXC_TRACE_LEVEL >= QXC_TRACE_LEVEL_DEBUG
+#define TRACE_DEBUG(category, ...)                                              \
+    do {                                                                        \
+        if (trace_category_enabled(category)) {                                 \
+            trace_message(category, __FILE__, __LINE__, __func__, __VA_ARGS__); \
+        }                                                                       \
+    } while (0)
+#else
+#define TRACE_DEBUG(category, ...) \
+    do {                           \
+    } while (0)
+#endif
@@ -0,0 +1,821 @@
+#include "x86.h"
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "prelude.h"
+
+static const char* const s_reg_names_64[] = {"rax", "rcx", "rdx", "rbx", "rsp", "rbp",
+                                             "rsi", "rdi", "r8",  "r9",  "r10", "r11",
+                                             "r12", "r13", "r14", "r15"};
+static const char* const s_reg_names_32[] = {"eax",  "ecx",  "edx",  "ebx",
+                                             "esp",  "ebp",  "esi",  "edi",
+                                             "r8d",  "r9d",  "r10d", "r11d",
+                                             "r12d", "r13d", "r14d", "r15d"};
+static const char* const s_reg_names_8[] = {"al",   "cl",   "dl",   "bl",
+                                            "spl",  "bpl",  "sil",  "dil",
+                                            "r8b",  "r9b",  "r10b", "r11b",
+                                            "r12b", "r13b", "r14b", "r15b"};
+
+X86Cond x86_negate_cond(X86Cond cond)
+{
+    switch (cond) {
+        case X86Cond::E:
+            return X86Cond::NE;
+        case X86Cond::NE:
+            return X86Cond::E;
+        case X86Cond::L:
+            return X86Cond::GE;
+        case X86Cond::LE:
+            return X86Cond::G;
+        case X86Cond::G:
+            return X86Cond::LE;
+        case X86Cond::GE:
+            return X86Cond::L;
+        case X86Cond::A:
+            return X86Cond::BE;
+        case X86Cond::BE:
+            return X86Cond::A;
+        default:
+            QXC_UNREACHABLE();
+            return cond;
+    }
+}
+
+X86Operand x86_reg(X86Reg reg, int size)
+{
+    X86Operand operand;
+    operand.type = X86OperandType::Reg;
+    operand.reg = reg;
+    operand.size = size;
+    return operand;
+}
+
+X86Operand x86_imm(long value)
+{
+    X86Operand operand;
+    operand.type = X86OperandType::Imm;
+    operand.value = value;
+    return operand;
+}
+
+X86Operand x86_mem(X86Reg base, long displacement, int size)
+{
+    X86Operand operand;
+    operand.type = X86OperandType::Mem;
+    operand.reg = base;
+    operand.value = displacement;
+    operand.size = size;
+    return operand;
+}
+
+X86Operand x86_mem_indexed(X86Reg base, X86Reg index, int scale, int size)
+{
+    X86Operand operand = x86_mem(base, 0, size);
+    operand.index = index;
+    operand.scale = scale;
+    return operand;
+}
+
+X86Operand x86_global(const char* symbol, int size)
+{
+    X86Operand operand;
+    operand.type = X86OperandType::Mem;
+    operand.symbol = symbol;
+    operand.size = size;
+    return operand;
+}
+
+X86Operand x86_label_address(int label)
+{
+    X86Operand operand;
+    operand.type = X86OperandType::Mem;
+    operand.value = label;
+    return operand;
+}
+
+X86Operand x86_label(int label)
+{
+    X86Operand operand;
+    operand.type = X86OperandType::Label;
+    operand.value = label;
+    return operand;
+}
+
+X86Operand x86_symbol(const char* symbol)
+{
+    X86Operand operand;
+    operand.type = X86OperandType::Symbol;
+    operand.symbol = symbol;
+    return operand;
+}
+
+bool x86_operands_are_equal(const X86Operand& a, const X86Operand& b)
+{
+    return a.type == b.type && a.reg == b.reg && a.index == b.index && a.scale == b.scale &&
+           a.size == b.size && a.value == b.value && a.symbol == b.symbol;
+}
+
+static const char* cond_suffix(X86Cond cond)
+{
+    switch (cond) {
+        case X86Cond::E:
+            return "e";
+        case X86Cond::NE:
+            return "ne";
+        case X86Cond::L:
+            return "l";
+        case X86Cond::LE:
+            return "le";
+        case X86Cond::G:
+            return "g";
+        case X86Cond::GE:
+            return "ge";
+        case X86Cond::A:
+            return "a";
+        case X86Cond::BE:
+            return "be";
+        default:
+            QXC_UNREACHABLE();
+            return nullptr;
+    }
+}
+
+static const char* op_mnemonic(X86Op op)
+{
+    switch (op) {
+        case X86Op::Mov:
+            return "mov";
+        case X86Op::Movzx:
+            return "movzx";
+        case X86Op::Movsxd:
+            return "movsxd";
+        case X86Op::Lea:
+            return "lea";
+        case X86Op::Add:
+            return "add";
+        case X86Op::Sub:
+            return "sub";
+        case X86Op::Imul:
+            return "imul";
+        case X86Op::Idiv:
+            return "idiv";
+        case X86Op::Cdq:
+            return "cdq";
+        case X86Op::Neg:
+            return "neg";
+        case X86Op::Not:
+            return "not";
+        case X86Op::And:
+            return "and";
+        case X86Op::Or:
+            return "or";
+        case X86Op::Xor:
+            return "xor";
+        case X86Op::Shl:
+            return "shl";
+        case X86Op::Shr:
+            return "shr";
+        case X86Op::Sar:
+            return "sar";
+        case X86Op::Cmp:
+            return "cmp";
+        case X86Op::Test:
+            return "test";
+        case X86Op::Jmp:
+            return "jmp";
+        case X86Op::Push:
+            return "push";
+        case X86Op::Pop:
+            return "pop";
+        case X86Op::Call:
+            return "call";
+        case X86Op::Ret:
+            return "ret";
+        case X86Op::Syscall:
+            return "syscall";
+        default:
+            QXC_UNREACHABLE();
+            return nullptr;
+    }
+}
+
+static const char* reg_name(X86Reg reg, int size)
+{
+    const int index = (int)reg;
+    assert(reg != X86Reg::None);
+
+    switch (size) {
+        case 8:
+            return s_reg_names_64[index];
+        case 4:
+            return s_reg_names_32[index];
+        case 1:
+            return s_reg_names_8[index];
+        default:
+            QXC_UNREACHABLE();
+            return nullptr;
+    }
+}
+
+static const char* size_keyword(int size)
+{
+    switch (size) {
+        case 8:
+            return "qword";
+        case 4:
+            return "dword";
+        case 1:
+            return "byte";
+        default:
+            QXC_UNREACHABLE();
+            return nullptr;
+    }
+}
+
+static void print_operand(FILE* out, const X86Operand& operand, const char* label_prefix)
+{
+    switch (operand.type) {
+        case X86OperandType::Reg:
+            fprintf(out, "%s", reg_name(operand.reg, operand.size));
+            break;
+        case X86OperandType::Imm:
+            fprintf(out, "%ld", operand.value);
+            break;
+        case X86OperandType::Mem:
+            if (operand.reg == X86Reg::None && operand.symbol == nullptr) {
+                fprintf(out, "[rel %s.bb%ld]", label_prefix, operand.value);  // lea only
+                break;
+            }
+            if (operand.reg == X86Reg::None) {
+                fprintf(out, "%s [rel %s]", size_keyword(operand.size), operand.symbol);
+                break;
+            }
+            fprintf(out, "%s [%s", size_keyword(operand.size), reg_name(operand.reg, 8));
+            if (operand.index != X86Reg::None) {
+                fprintf(out, " + %s*%d", reg_name(operand.index, 8), operand.scale);
+            }
+            fprintf(out, " %c %ld]", operand.value < 0 ? '-' : '+',
+                    operand.value < 0 ? -operand.value : operand.value);
+            break;
+        case X86OperandType::Label:
+            fprintf(out, "%s.bb%ld", label_prefix, operand.value);
+            break;
+        case X86OperandType::Symbol:
+            fprintf(out, "%s", operand.symbol);
+            break;
+        default:
+            QXC_UNREACHABLE();
+            break;
+    }
+}
+
+void x86_print_instrs(FILE* out, DynHeapArray<X86Instr>* instrs, const char* label_prefix)
+{
+    for (const X86Instr& instr : *instrs) {
+        switch (instr.op) {
+            case X86Op::Nop:
+                continue;
+            case X86Op::Label:
+                if (instr.operands[1].type == X86OperandType::Imm) {
+                    fprintf(out, "  align %ld\n", instr.operands[1].value);
+                }
+                print_operand(out, instr.operands[0], label_prefix);
+                fprintf(out, ":\n");
+                continue;
+            case X86Op::Setcc:
+                fprintf(out, "  set%s", cond_suffix(instr.cond));
+                break;
+            case X86Op::Cmov:
+                fprintf(out, "  cmov%s", cond_suffix(instr.cond));
+                break;
+            case X86Op::Jcc:
+                fprintf(out, "  j%s", cond_suffix(instr.cond));
+                break;
+            case X86Op::JumpTableEntry:
+                fprintf(out, "  dd ");
+                print_operand(out, instr.operands[0], label_prefix);
+                fprintf(out, " - ");
+                print_operand(out, instr.operands[1], label_prefix);
+                fprintf(out, "\n");
+                continue;
+            default:
+                fprintf(out, "  %s", op_mnemonic(instr.op));
+                break;
+        }
+
+        for (int i = 0; i < X86_MAX_OPERANDS; i++) {
+            const X86Operand& operand = instr.operands[i];
+            if (operand.type == X86OperandType::None) break;
+            fprintf(out, i == 0 ? " " : ", ");
+            print_operand(out, operand, label_prefix);
+        }
+
+        fprintf(out, "\n");
+    }
+}
+
+// --------------------------------------------------------------------------------
+// machine code encoding
+//
+// Covers exactly the forms the backend emits. Jumps always take the rel32 form, which
+// saves a relaxation pass over the function at the cost of a few bytes.
+
+struct X86LabelRef {
+    size_t offset;  // of the 32 bit field
+    long label;
+    long base_label;  // the field holds label - base_label, or is rel32 if this is -1
+};
+
+struct X86Encoder {
+    X86Code* code;
+    DynHeapArray<long> label_offsets;  // indexed by label id, -1 until placed
+    DynHeapArray<X86LabelRef> label_refs;
+    long pending_fixup;  // index of a fixup waiting for the end of its instruction, or -1
+};
+
+X86Code x86_code_create(void)
+{
+    X86Code code;
+    code.bytes = heap_array_create<uint8_t>(0);
+    code.fixups = heap_array_create<X86Fixup>(0);
+    return code;
+}
+
+void x86_code_free(X86Code* code)
+{
+    array_free(&code->bytes);
+    array_free(&code->fixups);
+}
+
+static void put_byte(X86Encoder* enc, long byte) { array_append(&enc->code->bytes, (uint8_t)byte); }
+
+static void put_u32(X86Encoder* enc, long value)
+{
+    for (int i = 0; i < 4; i++) put_byte(enc, (value >> (8 * i)) & 0xff);
+}
+
+static void put_u64(X86Encoder* enc, long value)
+{
+    for (int i = 0; i < 8; i++) put_byte(enc, (value >> (8 * i)) & 0xff);
+}
+
+static size_t code_offset(X86Encoder* enc) { return enc->code->bytes.length; }
+
+static bool fits_in_imm8(long value) { return value >= -128 && value <= 127; }
+
+static bool fits_in_imm32(long value) { return value >= INT32_MIN && value <= INT32_MAX; }
+
+static int reg_number(X86Reg reg)
+{
+    assert(reg != X86Reg::None);
+    return (int)reg;
+}
+
+static int cond_code(X86Cond cond)
+{
+    switch (cond) {
+        case X86Cond::E:
+            return 0x4;
+        case X86Cond::NE:
+            return 0x5;
+        case X86Cond::L:
+            return 0xc;
+        case X86Cond::GE:
+            return 0xd;
+        case X86Cond::LE:
+            return 0xe;
+        case X86Cond::G:
+            return 0xf;
+        case X86Cond::A:
+            return 0x7;
+        case X86Cond::BE:
+            return 0x6;
+        default:
+            QXC_UNREACHABLE();
+            return 0;
+    }
+}
+
+// spl, bpl, sil and dil only exist with a REX prefix, without one they'd be ah..bh
+static bool needs_rex_for_byte(const X86Operand& operand)
+{
+    return operand.type == X86OperandType::Reg && operand.size == 1 &&
+           reg_number(operand.reg) >= 4 && reg_number(operand.reg) < 8;
+}
+
+// [REX] opcode ModRM [SIB] [disp] for an instruction with a ModRM byte, reg being either
+// a register number or an opcode extension. The immediate, if any, follows.
+static void put_rel32_to_label(X86Encoder* enc, long label);
+
+static int scale_bits(int scale)
+{
+    switch (scale) {
+        case 1:
+            return 0;
+        case 2:
+            return 1;
+        case 4:
+            return 2;
+        case 8:
+            return 3;
+        default:
+            QXC_UNREACHABLE();
+            return 0;
+    }
+}
+
+static void put_modrm_instr(X86Encoder* enc, const uint8_t* opcode, int opcode_length,
+                            int reg, const X86Operand& rm, bool wide, bool force_rex)
+{
+    int rex = (wide ? 0x08 : 0) | ((reg & 8) ? 0x04 : 0);
+    if (rm.type != X86OperandType::Mem || rm.reg != X86Reg::None) {
+        rex |= (reg_number(rm.reg) & 8) ? 0x01 : 0;
+    }
+    if (rm.type == X86OperandType::Mem && rm.index != X86Reg::None) {
+        rex |= (reg_number(rm.index) & 8) ? 0x02 : 0;
+    }
+    if (rex != 0 || force_rex) put_byte(enc, 0x40 | rex);
+
+    for (int i = 0; i < opcode_length; i++) put_byte(enc, opcode[i]);
+
+    if (rm.type == X86OperandType::Reg) {
+        put_byte(enc, 0xc0 | ((reg & 7) << 3) | (reg_number(rm.reg) & 7));
+        return;
+    }
+
+    assert(rm.type == X86OperandType::Mem);
+
+    // RIP-relative to one of our own labels, only lea takes those so nothing follows
+    if (rm.reg == X86Reg::None && rm.symbol == nullptr) {
+        put_byte(enc, 0x05 | ((reg & 7) << 3));
+        put_rel32_to_label(enc, rm.value);
+        return;
+    }
+
+    // RIP-relative, the displacement is filled in once the symbol has an address
+    if (rm.reg == X86Reg::None) {
+        put_byte(enc, 0x05 | ((reg & 7) << 3));
+        X86Fixup fixup;
+        fixup.offset = code_offset(enc);
+        fixup.symbol = rm.symbol;
+        fixup.addend = -4;
+        enc->pending_fixup = (long)enc->code->fixups.length;
+        array_append(&enc->code->fixups, fixup);
+        put_u32(enc, 0);
+        return;
+    }
+
+    // rbp/r13 as a base always need a displacement, rsp/r12 always need a SIB byte
+    const int base = reg_number(rm.reg) & 7;
+    const int mod = rm.value == 0 && base != 5 ? 0x00 : fits_in_imm8(rm.value) ? 0x40 : 0x80;
+    const bool has_sib = base == 4 || rm.index != X86Reg::None;
+    put_byte(enc, mod | ((reg & 7) << 3) | (has_sib ? 4 : base));
+    if (has_sib) {
+        // an index of 4 (rsp) means no index at all
+        const int index = rm.index != X86Reg::None ? reg_number(rm.index) & 7 : 4;
+        assert(rm.index != X86Reg::RSP);
+        put_byte(enc, (scale_bits(rm.scale) << 6) | (index << 3) | base);
+    }
+
+    if (mod == 0x40) {
+        put_byte(enc, rm.value & 0xff);
+    }
+    else if (mod == 0x80) {
+        assert(fits_in_imm32(rm.value));
+        put_u32(enc, rm.value);
+    }
+}
+
+static void put_modrm_instr(X86Encoder* enc, int opcode, int reg, const X86Operand& rm,
+                            bool wide, bool force_rex = false)
+{
+    const uint8_t byte = (uint8_t)opcode;
+    put_modrm_instr(enc, &byte, 1, reg, rm, wide, force_rex);
+}
+
+static void put_imm(X86Encoder* enc, long value, int size)
+{
+    if (size == 1) {
+        put_byte(enc, value & 0xff);
+    }
+    else {
+        assert(fits_in_imm32(value));
+        put_u32(enc, value);
+    }
+
+    // a RIP-relative displacement counts from the end of the whole instruction
+    if (enc->pending_fixup >= 0) {
+        enc->code->fixups[(size_t)enc->pending_fixup].addend -= size;
+    }
+}
+
+static void put_label_difference(X86Encoder* enc, long label, long base_label)
+{
+    X86LabelRef ref;
+    ref.offset = code_offset(enc);
+    ref.label = label;
+    ref.base_label = base_label;
+    array_append(&enc->label_refs, ref);
+    put_u32(enc, 0);
+}
+
+static void put_rel32_to_label(X86Encoder* enc, long label)
+{
+    put_label_difference(enc, label, -1);
+}
+
+static void put_rel32_to_symbol(X86Encoder* enc, const char* symbol)
+{
+    X86Fixup fixup;
+    fixup.offset = code_offset(enc);
+    fixup.symbol = symbol;
+    fixup.addend = -4;
+    array_append(&enc->code->fixups, fixup);
+    put_u32(enc, 0);
+}
+
+static void put_jump_target(X86Encoder* enc, const X86Operand& target)
+{
+    if (target.type == X86OperandType::Label) {
+        put_rel32_to_label(enc, target.value);
+    }
+    else {
+        assert(target.type == X86OperandType::Symbol);
+        put_rel32_to_symbol(enc, target.symbol);
+    }
+}
+
+// the recommended multi-byte nops, for padding up to an alignment boundary
+static void put_padding(X86Encoder* enc, long alignment)
+{
+    static const uint8_t nops[9][9] = {
+        {0x90},
+        {0x66, 0x90},
+        {0x0f, 0x1f, 0x00},
+        {0x0f, 0x1f, 0x40, 0x00},
+        {0x0f, 0x1f, 0x44, 0x00, 0x00},
+        {0x66, 0x0f, 0x1f, 0x44, 0x00, 0x00},
+        {0x0f, 0x1f, 0x80, 0x00, 0x00, 0x00, 0x00},
+        {0x0f, 0x1f, 0x84, 0x00, 0x00, 0x00, 0x00, 0x00},
+        {0x66, 0x0f, 0x1f, 0x84, 0x00, 0x00, 0x00, 0x00, 0x00},
+    };
+
+    long remaining = (alignment - (long)code_offset(enc) % alignment) % alignment;
+    while (remaining > 0) {
+        const long length = remaining < 9 ? remaining : 9;
+        for (long i = 0; i < length; i++) put_byte(enc, nops[length - 1][i]);
+        remaining -= length;
+    }
+}
+
+// add, or, and, sub, xor and cmp share their encodings, told apart by ext
+static void encode_alu(X86Encoder* enc, int ext, const X86Operand& dst, const X86Operand& src)
+{
+    const bool wide = dst.size == 8;
+
+    if (src.type == X86OperandType::Imm) {
+        const bool short_imm = fits_in_imm8(src.value);
+        put_modrm_instr(enc, short_imm ? 0x83 : 0x81, ext, dst, wide);
+        put_imm(enc, src.value, short_imm ? 1 : 4);
+    }
+    else if (src.type == X86OperandType::Reg) {
+        put_modrm_instr(enc, (ext << 3) | 0x01, reg_number(src.reg), dst, wide);
+    }
+    else {
+        assert(dst.type == X86OperandType::Reg);
+        put_modrm_instr(enc, (ext << 3) | 0x03, reg_number(dst.reg), src, wide);
+    }
+}
+
+// shl, shr and sar by an immediate or by cl, told apart by ext
+static void encode_shift(X86Encoder* enc, int ext, const X86Operand& dst,
+                         const X86Operand& count)
+{
+    const bool wide = dst.size == 8;
+
+    if (count.type == X86OperandType::Imm) {
+        put_modrm_instr(enc, 0xc1, ext, dst, wide);
+        put_imm(enc, count.value, 1);
+    }
+    else {
+        assert(count.type == X86OperandType::Reg && count.reg == X86Reg::RCX);
+        put_modrm_instr(enc, 0xd3, ext, dst, wide);
+    }
+}
+
+static void encode_mov(X86Encoder* enc, const X86Operand& dst, const X86Operand& src)
+{
+    const bool wide = dst.size == 8;
+
+    if (src.type == X86OperandType::Imm) {
+        if (!fits_in_imm32(src.value)) {
+            // movabs, the only form taking a full 64 bit immediate
+            assert(dst.type == X86OperandType::Reg && wide);
+            const int reg = reg_number(dst.reg);
+            put_byte(enc, 0x48 | ((reg & 8) ? 0x01 : 0));
+            put_byte(enc, 0xb8 | (reg & 7));
+            put_u64(enc, src.value);
+            return;
+        }
+        if (dst.type == X86OperandType::Reg && dst.size == 4) {
+            // B8+r, a byte shorter than C7 /0, and zero extends like any 32 bit write
+            const int reg = reg_number(dst.reg);
+            if (reg & 8) put_byte(enc, 0x41);
+            put_byte(enc, 0xb8 | (reg & 7));
+            put_imm(enc, src.value, 4);
+            return;
+        }
+        put_modrm_instr(enc, 0xc7, 0, dst, wide);
+        put_imm(enc, src.value, 4);
+    }
+    else if (src.type == X86OperandType::Reg) {
+        put_modrm_instr(enc, 0x89, reg_number(src.reg), dst, wide);
+    }
+    else {
+        assert(dst.type == X86OperandType::Reg);
+        put_modrm_instr(enc, 0x8b, reg_number(dst.reg), src, wide);
+    }
+}
+
+static void encode_instr(X86Encoder* enc, const X86Instr& instr)
+{
+    const X86Operand& a = instr.operands[0];
+    const X86Operand& b = instr.operands[1];
+    const X86Operand& c = instr.operands[2];
+    enc->pending_fixup = -1;
+
+    switch (instr.op) {
+        case X86Op::Nop:
+            break;
+        case X86Op::Label:
+            if (b.type == X86OperandType::Imm) {
+                put_padding(enc, b.value);
+            }
+            while (enc->label_offsets.length <= (size_t)a.value) {
+                array_append(&enc->label_offsets, -1L);
+            }
+            enc->label_offsets[(size_t)a.value] = (long)code_offset(enc);
+            break;
+        case X86Op::Mov:
+            encode_mov(enc, a, b);
+            break;
+        case X86Op::Movzx: {
+            const uint8_t opcode[] = {0x0f, 0xb6};
+            put_modrm_instr(enc, opcode, 2, reg_number(a.reg), b, a.size == 8,
+                            needs_rex_for_byte(b));
+            break;
+        }
+        case X86Op::Movsxd:
+            put_modrm_instr(enc, 0x63, reg_number(a.reg), b, true);
+            break;
+        case X86Op::Lea:
+            put_modrm_instr(enc, 0x8d, reg_number(a.reg), b, true);
+            break;
+        case X86Op::Add:
+            encode_alu(enc, 0, a, b);
+            break;
+        case X86Op::Sub:
+            encode_alu(enc, 5, a, b);
+            break;
+        case X86Op::Or:
+            encode_alu(enc, 1, a, b);
+            break;
+        case X86Op::And:
+            encode_alu(enc, 4, a, b);
+            break;
+        case X86Op::Xor:
+            encode_alu(enc, 6, a, b);
+            break;
+        case X86Op::Shl:
+            encode_shift(enc, 4, a, b);
+            break;
+        case X86Op::Shr:
+            encode_shift(enc, 5, a, b);
+            break;
+        case X86Op::Sar:
+            encode_shift(enc, 7, a, b);
+            break;
+        case X86Op::Cmp:
+            encode_alu(enc, 7, a, b);
+            break;
+        case X86Op::Test:
+            assert(b.type == X86OperandType::Reg);
+            put_modrm_instr(enc, 0x85, reg_number(b.reg), a, a.size == 8);
+            break;
+        case X86Op::Imul:
+            // imul r, r/m, imm or imul r, r/m
+            if (c.type == X86OperandType::Imm) {
+                const bool short_imm = fits_in_imm8(c.value);
+                put_modrm_instr(enc, short_imm ? 0x6b : 0x69, reg_number(a.reg), b,
+                                a.size == 8);
+                put_imm(enc, c.value, short_imm ? 1 : 4);
+            }
+            else {
+                const uint8_t opcode[] = {0x0f, 0xaf};
+                put_modrm_instr(enc, opcode, 2, reg_number(a.reg), b, a.size == 8, false);
+            }
+            break;
+        case X86Op::Idiv:
+            put_modrm_instr(enc, 0xf7, 7, a, a.size == 8);
+            break;
+        case X86Op::Neg:
+            put_modrm_instr(enc, 0xf7, 3, a, a.size == 8);
+            break;
+        case X86Op::Not:
+            put_modrm_instr(enc, 0xf7, 2, a, a.size == 8);
+            break;
+        case X86Op::Cdq:
+            put_byte(enc, 0x99);
+            break;
+        case X86Op::Setcc: {
+            const uint8_t opcode[] = {0x0f, (uint8_t)(0x90 | cond_code(instr.cond))};
+            put_modrm_instr(enc, opcode, 2, 0, a, false, needs_rex_for_byte(a));
+            break;
+        }
+        case X86Op::Cmov: {
+            const uint8_t opcode[] = {0x0f, (uint8_t)(0x40 | cond_code(instr.cond))};
+            put_modrm_instr(enc, opcode, 2, reg_number(a.reg), b, a.size == 8, false);
+            break;
+        }
+        case X86Op::Jmp:
+            if (a.type == X86OperandType::Reg) {
+                put_modrm_instr(enc, 0xff, 4, a, false);
+                break;
+            }
+            put_byte(enc, 0xe9);
+            put_jump_target(enc, a);
+            break;
+        case X86Op::JumpTableEntry:
+            put_label_difference(enc, a.value, b.value);
+            break;
+        case X86Op::Jcc:
+            put_byte(enc, 0x0f);
+            put_byte(enc, 0x80 | cond_code(instr.cond));
+            put_jump_target(enc, a);
+            break;
+        case X86Op::Call:
+            put_byte(enc, 0xe8);
+            put_jump_target(enc, a);
+            break;
+        case X86Op::Push:
+            if (a.type == X86OperandType::Reg) {
+                if (reg_number(a.reg) & 8) put_byte(enc, 0x41);
+                put_byte(enc, 0x50 | (reg_number(a.reg) & 7));
+            }
+            else if (a.type == X86OperandType::Imm) {
+                const bool short_imm = fits_in_imm8(a.value);
+                put_byte(enc, short_imm ? 0x6a : 0x68);
+                put_imm(enc, a.value, short_imm ? 1 : 4);
+            }
+            else {
+                put_modrm_instr(enc, 0xff, 6, a, false);
+            }
+            break;
+        case X86Op::Pop:
+            assert(a.type == X86OperandType::Reg);
+            if (reg_number(a.reg) & 8) put_byte(enc, 0x41);
+            put_byte(enc, 0x58 | (reg_number(a.reg) & 7));
+            break;
+        case X86Op::Ret:
+            put_byte(enc, 0xc3);
+            break;
+        case X86Op::Syscall:
+            put_byte(enc, 0x0f);
+            put_byte(enc, 0x05);
+            break;
+        default:
+            QXC_UNREACHABLE();
+            break;
+    }
+}
+
+void x86_encode_instrs(X86Code* code, DynHeapArray<X86Instr>* instrs)
+{
+    X86Encoder enc;
+    enc.code = code;
+    enc.label_offsets = heap_array_create<long>(0);
+    enc.label_refs = heap_array_create<X86LabelRef>(0);
+    enc.pending_fixup = -1;
+    defer {
+        array_free(&enc.label_offsets);
+        array_free(&enc.label_refs);
+    };
+
+    for (const X86Instr& instr : *instrs) {
+        encode_instr(&enc, instr);
+    }
+
+    // every jump's rel32 counts from the end of its own field
+    for (const X86LabelRef& ref : enc.label_refs) {
+        const long target = enc.label_offsets[(size_t)ref.label];
+        const long base = ref.base_label >= 0 ? enc.label_offsets[(size_t)ref.base_label]
+                                              : (long)(ref.offset + 4);
+        assert(target >= 0 && base >= 0);
+        const long rel = target - base;
+        for (size_t i = 0; i < 4; i++) {
+            code->bytes[ref.offset + i] = (uint8_t)((rel >> (8 * i)) & 0xff);
+        }
+    }
+}
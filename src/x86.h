@@ -0,0 +1,126 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "array.h"
+
+// Structured x86-64 instructions, as produced by the backend before they are written
+// out as NASM source. Keeping them structured lets the peephole optimizer pattern
+// match on opcodes and operands rather than on text.
+
+// in hardware encoding order
+enum class X86Reg {
+    RAX,
+    RCX,
+    RDX,
+    RBX,
+    RSP,
+    RBP,
+    RSI,
+    RDI,
+    R8,
+    R9,
+    R10,
+    R11,
+    R12,
+    R13,
+    R14,
+    R15,
+    None
+};
+
+enum class X86Op {
+    Mov,
+    Movzx,
+    Movsxd,
+    Lea,
+    Add,
+    Sub,
+    Imul,
+    Idiv,
+    Cdq,
+    Neg,
+    Not,
+    And,
+    Or,
+    Xor,
+    Shl,
+    Shr,
+    Sar,  // shifts take an immediate count or cl
+    Cmp,
+    Test,
+    Setcc,
+    Cmov,
+    Jmp,
+    Jcc,
+    Push,
+    Pop,
+    Call,
+    Ret,
+    Syscall,
+    Label,  // pseudo instruction marking a jump target, optional alignment as 2nd operand
+    JumpTableEntry,  // 32 bit offset of the 1st operand's label from the 2nd operand's
+    Nop,    // deleted instruction, skipped when printing
+    Invalid
+};
+
+enum class X86Cond { E, NE, L, LE, G, GE, A, BE };  // A and BE compare unsigned
+
+X86Cond x86_negate_cond(X86Cond cond);
+
+enum class X86OperandType { None, Reg, Imm, Mem, Label, Symbol };
+
+struct X86Operand {
+    X86OperandType type = X86OperandType::None;
+    X86Reg reg = X86Reg::None;  // register, or base register of a memory operand (None
+                                // for a RIP-relative reference to symbol, or to the
+                                // label in value if there's no symbol)
+    X86Reg index = X86Reg::None;  // memory operands only, scaled by scale
+    int scale = 1;
+    int size = 8;               // width in bytes
+    long value = 0;             // immediate, memory displacement or label id
+    const char* symbol = nullptr;
+};
+
+X86Operand x86_reg(X86Reg reg, int size = 8);
+X86Operand x86_imm(long value);
+X86Operand x86_mem(X86Reg base, long displacement, int size = 8);
+X86Operand x86_mem_indexed(X86Reg base, X86Reg index, int scale, int size = 8);
+X86Operand x86_global(const char* symbol, int size = 8);
+X86Operand x86_label_address(int label);
+X86Operand x86_label(int label);
+X86Operand x86_symbol(const char* symbol);
+
+bool x86_operands_are_equal(const X86Operand& a, const X86Operand& b);
+
+#define X86_MAX_OPERANDS 3
+struct X86Instr {
+    X86Op op = X86Op::Invalid;
+    X86Cond cond = X86Cond::E;  // Setcc/Cmov/Jcc only
+    X86Operand operands[X86_MAX_OPERANDS];
+};
+
+// labels are printed as <label_prefix>.bb<id>
+void x86_print_instrs(FILE* out, DynHeapArray<X86Instr>* instrs, const char* label_prefix);
+
+// Machine code, for running a program without assembling and linking it. Jumps to
+// labels are resolved while encoding. References to symbols (calls, tail calls and
+// globals) are left as fixups, to be patched once it's known where everything ends up.
+struct X86Fixup {
+    size_t offset;  // of the 32 bit field to patch
+    const char* symbol;
+    long addend;  // the field becomes symbol + addend - field address, like R_X86_64_PC32
+};
+
+struct X86Code {
+    DynHeapArray<uint8_t> bytes;
+    DynHeapArray<X86Fixup> fixups;
+};
+
+X86Code x86_code_create(void);
+void x86_code_free(X86Code* code);
+
+// appends the encoding of instrs to code, their labels are local to this call
+void x86_encode_instrs(X86Code* code, DynHeapArray<X86Instr>* instrs);
@@ -0,0 +1,11 @@
+int sum;
+int base = 100;
+
+int add(int amount) {
+    sum = sum + amount;
+    return sum;
+}
+
+int total() {
+    return sum + base - 100;
+}
@@ -0,0 +1,16 @@
+int add(int amount);
+int total();
+
+int calls = 0;
+
+int record(int amount) {
+    calls = calls + 1;
+    return add(amount);
+}
+
+int main() {
+    record(5);
+    record(7);
+    record(30);
+    return total() + calls;
+}
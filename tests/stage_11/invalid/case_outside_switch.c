@@ -0,0 +1,3 @@
+int main() {
+    case 1: return 1;
+}
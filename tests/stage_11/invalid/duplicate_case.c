@@ -0,0 +1,7 @@
+int main() {
+    switch (1) {
+        case 1: return 1;
+        case 1: return 2;
+    }
+    return 0;
+}
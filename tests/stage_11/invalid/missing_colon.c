@@ -0,0 +1,6 @@
+int main() {
+    switch (1) {
+        case 1 return 1;
+    }
+    return 0;
+}
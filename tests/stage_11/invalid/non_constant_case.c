@@ -0,0 +1,7 @@
+int main() {
+    int a = 1;
+    switch (1) {
+        case a: return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,6 @@
+int main() {
+    switch (1) {
+        default: return 1;
+        default: return 2;
+    }
+}
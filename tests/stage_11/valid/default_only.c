@@ -0,0 +1,10 @@
+int main() {
+    int a = 5;
+    switch (a) {
+        default:
+            a = a * 2;
+    }
+    switch (a) {
+    }
+    return a;
+}
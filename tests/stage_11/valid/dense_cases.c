@@ -0,0 +1,14 @@
+int pick(int a) {
+    switch (a) {
+        case 0: return 3;
+        case 1: return 5;
+        case 2: return 7;
+        case 4: return 11;
+        case 5: return 13;
+        default: return 1;
+    }
+}
+
+int main() {
+    return pick(-1) + pick(0) + pick(2) + pick(3) + pick(5) + pick(6);
+}
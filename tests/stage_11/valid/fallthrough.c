@@ -0,0 +1,16 @@
+int main() {
+    int a = 2;
+    int b = 0;
+    switch (a) {
+        case 1:
+            b = b + 1;
+        case 2:
+            b = b + 2;
+        case 3:
+            b = b + 4;
+            break;
+        case 4:
+            b = b + 8;
+    }
+    return b;
+}
@@ -0,0 +1,20 @@
+int classify(int a, int b) {
+    switch (a) {
+        case 1:
+            switch (b) {
+                case 1: return 11;
+                case 2: return 12;
+            }
+            return 10;
+        case 2:
+            return 20;
+        default:
+            switch (b) {
+                default: return 30;
+            }
+    }
+}
+
+int main() {
+    return classify(1, 1) + classify(1, 2) + classify(1, 3) + classify(2, 1) + classify(3, 3);
+}
@@ -0,0 +1,16 @@
+int pick(int a) {
+    switch (a) {
+        case -100000: return 1;
+        case 3: return 2;
+        case 250: return 4;
+        case 4096: return 8;
+        case 70000: return 16;
+        case 1000000: return 32;
+    }
+    return 64;
+}
+
+int main() {
+    return pick(-100000) + pick(3) + pick(250) + pick(4096) + pick(70000) + pick(1000000) +
+           pick(4);
+}
@@ -0,0 +1,19 @@
+int main() {
+    int sum = 0;
+    for (int i = 0; i < 10; i = i + 1) {
+        switch (i) {
+            case 2:
+                continue;
+            case 5:
+                break;
+            case 7:
+            case 8:
+                sum = sum + 100;
+                break;
+            default:
+                sum = sum + i;
+        }
+        sum = sum + 1;
+    }
+    return sum;
+}
@@ -0,0 +1,33 @@
+int wide_index(int i);
+
+int from_zero(int i) {
+    switch (wide_index(i)) {
+        case 0: return 3;
+        case 1: return 5;
+        case 2: return 7;
+        case 3: return 11;
+        case 4: return 13;
+        default: return 1;
+    }
+}
+
+int from_ten(int i) {
+    switch (wide_index(i)) {
+        case 10: return 17;
+        case 11: return 19;
+        case 12: return 23;
+        case 13: return 29;
+        case 14: return 31;
+        default: return 2;
+    }
+}
+
+int main() {
+    int total = 0;
+    int i = 0;
+    while (i < 16) {
+        total = total + from_zero(i) + from_ten(i);
+        i = i + 1;
+    }
+    return total;
+}
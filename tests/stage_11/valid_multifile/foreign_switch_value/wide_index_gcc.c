@@ -0,0 +1,3 @@
+// Returns i in the low half of rax with garbage above it, which the ABI allows for an
+// int. main.c declares it as returning one.
+long wide_index(int i) { return 0x1234567800000000L + i; }
@@ -0,0 +1,5 @@
+int main() {
+    int a = 108;
+    int b = 58;
+    return (a & b) + (a | b) - (a ^ b);
+}
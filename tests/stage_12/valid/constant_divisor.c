@@ -0,0 +1,12 @@
+int main() {
+    int total = 0;
+    int i = -40;
+    while (i <= 40) {
+        total = total + i / 3 + i % 3 + i / 7 + i % -7 + i / -10 + i % 25;
+        i = i + 1;
+    }
+    int big = 2147483647;
+    int low = -2147483647 - 1;
+    total = total + big / 1000 % 256 + low / 641 % 256 + low % 2147483647 + big % -3;
+    return total + 100;
+}
@@ -0,0 +1,6 @@
+int mask = (1 << 5) - 1;
+int mixed = 7 % 3 | 12 >> 2 ^ 16;
+
+int main() {
+    return mask & mixed;
+}
@@ -0,0 +1,6 @@
+int main() {
+    int a = -17;
+    int b = 5;
+    int sum = a % b + 17 % b + a % 4 + a % -4 + 29 % 8;
+    return sum + 20;
+}
@@ -0,0 +1,9 @@
+int main() {
+    int total = 0;
+    int i = -20;
+    while (i <= 20) {
+        total = total + i / 8 + i % 8 + i / 2 + i % 16;
+        i = i + 1;
+    }
+    return total + 100;
+}
@@ -0,0 +1,4 @@
+int main() {
+    int a = 6;
+    return (a | 1 ^ 3 & 2 << 1 == 0) + (a + 2 << 1) + (a % 4 * 3) + (1 | 2 < 3);
+}
@@ -0,0 +1,5 @@
+int main() {
+    int a = -100;
+    int n = 3;
+    return (a >> n) + (a >> 1) + (1 << n) + (5 << 4);
+}
@@ -0,0 +1,4 @@
+int main() {
+    b++;
+    return 0;
+}
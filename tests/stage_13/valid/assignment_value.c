@@ -0,0 +1,7 @@
+int main() {
+    int a = 2;
+    int b = 3;
+    int c = (a += 4) * (b -= 1);
+    a = b += c;
+    return a + b + c;
+}
@@ -0,0 +1,14 @@
+int main() {
+    int a = 10;
+    a += 5;
+    a -= 3;
+    a *= 4;
+    a /= 3;
+    a %= 9;
+    a <<= 4;
+    a >>= 2;
+    a |= 3;
+    a &= 27;
+    a ^= 6;
+    return a;
+}
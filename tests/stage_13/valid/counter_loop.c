@@ -0,0 +1,10 @@
+int main() {
+    int sum = 0;
+    for (int i = 0; i < 20; i++) {
+        sum += i;
+        sum ^= i << 1;
+    }
+    int j = 10;
+    while (j--) sum -= 2;
+    return sum;
+}
@@ -0,0 +1,17 @@
+int counter;
+int total = 3;
+
+int bump(int amount) {
+    counter++;
+    total += amount;
+    return counter;
+}
+
+int main() {
+    for (int i = 0; i < 5; i++) {
+        total *= 2;
+        bump(i);
+    }
+    --total;
+    return total + counter;
+}
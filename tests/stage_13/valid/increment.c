@@ -0,0 +1,8 @@
+int main() {
+    int a = 5;
+    int b = a++;
+    int c = ++a;
+    int d = a--;
+    int e = --a;
+    return a * 1000 + b * 100 + c * 10 + d - e;
+}
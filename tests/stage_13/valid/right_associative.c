@@ -0,0 +1,7 @@
+int main() {
+    int a = 1;
+    int b = 2;
+    int c = 3;
+    a += b *= c -= 1;
+    return a * 100 + b * 10 + c;
+}
@@ -0,0 +1,6 @@
+int main() {
+    int a = 1;
+    int b = 2;
+    (a < b ? a : b) += 3;
+    return a;
+}
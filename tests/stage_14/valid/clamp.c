@@ -0,0 +1,17 @@
+int clamp(int x, int lo, int hi) {
+    if (x < lo) x = lo;
+    if (x > hi) x = hi;
+    return x;
+}
+
+int clamp_nested(int x, int lo, int hi) {
+    return x < lo ? lo : x > hi ? hi : x;
+}
+
+int main() {
+    int sum = 0;
+    for (int x = -20; x <= 20; x += 3) {
+        sum += clamp(x, -5, 7) * 2 + clamp_nested(x, 0, 10);
+    }
+    return sum;
+}
@@ -0,0 +1,19 @@
+int limit = 6;
+
+int main() {
+    int evens = 0;
+    int odds = 0;
+    int sign;
+    for (int i = -4; i < 12; i++) {
+        if (i % 2 == 0) evens = evens + i;
+        else odds = odds + i;
+
+        if (i < 0) sign = -1;
+        else if (i == 0) sign = 0;
+        else sign = 1;
+
+        if (i > limit) limit = i;
+        evens += sign;
+    }
+    return evens * 4 + odds + limit;
+}
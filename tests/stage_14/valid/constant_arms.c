@@ -0,0 +1,10 @@
+int main() {
+    int count = 0;
+    int flags = 0;
+    for (int i = 0; i < 20; i++) {
+        count += i % 3 == 0 ? 1 : 0;
+        flags += i > 9 ? 5 : 4;
+        flags += !i ? 100 : 10;
+    }
+    return count + flags;
+}
@@ -0,0 +1,18 @@
+int min(int a, int b) {
+    return a < b ? a : b;
+}
+
+int max(int a, int b) {
+    return a > b ? a : b;
+}
+
+int main() {
+    int lowest = 100;
+    int highest = -100;
+    for (int i = 0; i < 10; i++) {
+        int value = (i * 37) % 23 - 11;
+        lowest = min(lowest, value);
+        highest = max(highest, value);
+    }
+    return highest - lowest;
+}
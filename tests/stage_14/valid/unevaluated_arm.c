@@ -0,0 +1,17 @@
+int calls = 0;
+int divisor;
+
+int count(int x) {
+    calls++;
+    return x;
+}
+
+int main() {
+    int a = divisor != 0 ? 10 / divisor : 3;
+    int b = divisor == 0 ? 4 : 10 % divisor;
+    int c = a > b ? count(a) : b;
+    int d = a < b ? count(1) + count(2) : -1;
+    if (c > 0) c = count(c);
+    int e = b > 0 ? a / 2 : a % 5;
+    return a + b + c + d + e + calls * 10;
+}
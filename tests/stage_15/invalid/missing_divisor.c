@@ -0,0 +1,4 @@
+int main() {
+    int min = -2147483647 - 1;
+    return min / ;
+}
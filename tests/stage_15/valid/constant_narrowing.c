@@ -0,0 +1,6 @@
+int main() {
+    int min = 2147483648;
+    int max = 4294967295 - 2147483648;
+    int low = 4294967296 * 3 + 7;
+    return (min < 0) + (max == 2147483647) * 2 + (low == 7) * 4 + (min + max == -1) * 8;
+}
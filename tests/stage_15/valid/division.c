@@ -0,0 +1,11 @@
+int dividend = -7;
+int min = -2147483647 - 1;
+
+int main() {
+    int quotient = dividend / 2;
+    int remainder = dividend % 4;
+    int large = min / 3;
+    int modulo = min % 1000;
+    return (quotient == -3) + (remainder == -3) * 2 + (large == -715827882) * 4 +
+           (modulo == -648) * 8 + (min / 65536 == -32768) * 16;
+}
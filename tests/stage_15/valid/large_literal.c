@@ -0,0 +1,6 @@
+int truncated = 4294967301;
+
+int main() {
+    int local = 4294967298;
+    return truncated + local;
+}
@@ -0,0 +1,7 @@
+int pick(int a, int b, int c, int d, int e, int f, int g, int h) {
+    return g * 10 + h;
+}
+
+int main() {
+    return pick(1, 2, 3, 4, 5, 6, -5, -7) + 100;
+}
@@ -0,0 +1,9 @@
+int max = 2147483647;
+int count = 3;
+
+int main() {
+    int wrapped = max + 2147483649;
+    int scaled = count * 4294967298;
+    int sum = max + 4294967295;
+    return (wrapped == 0) + (scaled == 6) * 2 + (sum == max - 1) * 4;
+}
@@ -0,0 +1,10 @@
+int sign = 2147483648;
+int count = 31;
+
+int main() {
+    int smeared = sign >> count;
+    int halved = sign >> 1;
+    int high = 1 << 30;
+    return (sign < 0) + (smeared == -1) * 2 + (halved == -1073741824) * 4 +
+           (high >> (count - 2) == 2) * 8;
+}
@@ -0,0 +1,10 @@
+int is_odd(int n);
+
+int is_even(int n) {
+    if (n == 0) return 1;
+    return is_odd(n - 1);
+}
+
+int main() {
+    return is_even(10) + is_odd(7) * 2 + is_even(3) * 4;
+}
@@ -0,0 +1,125 @@
+#!/bin/bash
+
+# Compiles machine-generated programs nesting expressions and statements DEPTH levels
+# deep, and times each compile. Every program has a known exit code.
+#
+# usage: ./stress_nesting.sh /path/to/compiler [DEPTH]    (DEPTH defaults to 100000)
+
+cmp=$1
+depth=${2:-100000}
+padlength=40
+success=0
+fail=0
+workdir=$(mktemp -d)
+trap 'rm -rf $workdir' EXIT
+
+# repeat STRING COUNT
+repeat () {
+    local out=$1 count=$2 result=""
+    while [ $count -gt 0 ]; do
+        if (( count & 1 )); then result+=$out; fi
+        out+=$out
+        count=$((count >> 1))
+    done
+    printf '%s' "$result"
+}
+
+# run_case NAME EXPECTED_EXIT_CODE, the program is in $workdir/NAME.c
+run_case () {
+    local name=$1 expected=$2
+    printf '%-*s' $padlength "$name"
+
+    local start=$(date +%s%N)
+    $cmp --no-cache "$workdir/$name.c" -o "$workdir/$name" 2>"$workdir/$name.err"
+    local status=$?
+    local elapsed=$(( ($(date +%s%N) - start) / 1000000 ))
+
+    if [ $status -ne 0 ] || [ ! -x "$workdir/$name" ]; then
+        echo "FAIL (compile, $(head -c 200 "$workdir/$name.err"))"
+        ((fail++))
+        return
+    fi
+
+    "$workdir/$name"
+    local actual=$?
+    if [ $actual -ne $expected ]; then
+        echo "FAIL (exit code $actual, expected $expected)"
+        ((fail++))
+        return
+    fi
+
+    printf '%6d ms\n' $elapsed
+    ((success++))
+}
+
+echo "nesting depth $depth"
+
+# ((((...1...))))
+{
+    echo "int main() { return $(repeat '(' $depth)1$(repeat ')' $depth); }"
+} > "$workdir/parens.c"
+run_case parens 1
+
+# - - - ... 3, an even count cancels out
+{
+    echo "int main() { return $(repeat '- ' $((depth / 2 * 2)))3; }"
+} > "$workdir/unary.c"
+run_case unary 3
+
+# 1+(1+(1+...)), every left operand waits for the whole right hand side
+{
+    echo "int main() { return $(repeat '1+(' $depth)0$(repeat ')' $depth); }"
+} > "$workdir/right_nested_sum.c"
+run_case right_nested_sum $((depth % 256))
+
+# The decision trees below test a global, which like real input isn't known at
+# compile time. A constant key would instead have the optimizer fold the tree one
+# level per pass.
+
+# a == 0 ? 0 : a == 1 ? 1 : ..., a decision tree flattened into a ternary chain
+{
+    echo "int a = $((depth - 1)); int main() { return"
+    for ((i = 0; i < depth; i++)); do printf 'a == %d ? %d : ' $i $((i % 100)); done
+    echo "255; }"
+} > "$workdir/ternary_chain.c"
+run_case ternary_chain $(((depth - 1) % 100))
+
+# if (a == 0) return 0; else if (a == 1) return 1; else ...
+{
+    echo "int a = $((depth - 1)); int main() {"
+    for ((i = 0; i < depth; i++)); do printf 'if (a == %d) return %d; else ' $i $((i % 100)); done
+    echo "return 255; }"
+} > "$workdir/else_if_chain.c"
+run_case else_if_chain $(((depth - 1) % 100))
+
+# if (a) if (a) ... a = 7; return a;
+{
+    echo "int a = 1; int main() { $(repeat 'if (a) ' $depth)a = 7; return a; }"
+} > "$workdir/nested_if.c"
+run_case nested_if 7
+
+# {{{...}}} with a declaration at the bottom
+{
+    echo "int main() { int a = 5; $(repeat '{ ' $depth)int b = a; a = b + 1;$(repeat ' }' $depth) return a; }"
+} > "$workdir/nested_blocks.c"
+run_case nested_blocks 6
+
+# while (1) while (1) ... return 9;
+{
+    echo "int main() { $(repeat 'while (1) ' $depth)return 9; }"
+} > "$workdir/nested_loops.c"
+run_case nested_loops 9
+
+# the nesting limit turns runaway input into a diagnostic
+printf '%-*s' $padlength "limit_diagnostic"
+if $cmp --no-cache --max-nesting-depth $((depth / 2)) "$workdir/parens.c" -o "$workdir/limit" \
+        2>&1 | grep -q "nesting deeper than"; then
+    echo "OK"
+    ((success++))
+else
+    echo "FAIL (no nesting limit diagnostic)"
+    ((fail++))
+fi
+
+echo "$success successes, $fail failures"
+[ $fail -eq 0 ]
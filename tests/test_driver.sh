@@ -0,0 +1,243 @@
+#!/bin/bash
+
+# Tests the driver rather than the language: the object cache and the other ways of
+# invoking the compiler. Every case runs in a scratch directory with its own cache.
+#
+# usage: ./test_driver.sh /path/to/compiler
+
+cmp=$(realpath "$1")
+padlength=40
+success=0
+fail=0
+workdir=$(mktemp -d)
+server_pid=
+trap '[ -n "$server_pid" ] && kill $server_pid; rm -rf $workdir' EXIT
+
+export QXC_CACHE_DIR=$workdir/cache
+unset QXC_SERVER
+cd "$workdir" || exit 1
+
+# check NAME COMMAND..., passes if COMMAND succeeds
+check () {
+    local name=$1
+    shift
+    printf '%-*s' $padlength "$name"
+
+    if "$@" >"$workdir/check.log" 2>&1; then
+        echo "OK"
+        ((success++))
+    else
+        echo "FAIL ($(head -c 200 "$workdir/check.log"))"
+        ((fail++))
+    fi
+}
+
+# exit_code_is EXPECTED PROGRAM
+exit_code_is () {
+    "$2"
+    local actual=$?
+    [ $actual -eq $1 ] || { echo "exit code $actual, expected $1"; return 1; }
+}
+
+# only_files DIR FILES..., passes if DIR holds exactly FILES
+only_files () {
+    local dir=$1
+    shift
+    [ "$(ls "$dir" | sort | tr '\n' ' ')" == "$(printf '%s\n' "$@" | sort | tr '\n' ' ')" ]
+}
+
+# a program split over two sources, exiting with 42
+write_sources () {
+    echo 'int twice(int x); int main() { return twice(21); }' > main.c
+    echo 'int twice(int x) { return x * 2; }' > twice.c
+}
+
+write_sources
+
+# ---------------------------------------------------------------------------------
+# object cache
+
+cache_hit () {
+    rm -rf "$QXC_CACHE_DIR"
+    $cmp --cache-stats main.c twice.c -o cold | grep -q "this run: 0 hits, 2 misses" &&
+        $cmp --cache-stats main.c twice.c -o warm | grep -q "this run: 2 hits, 0 misses" &&
+        exit_code_is 42 ./warm
+}
+check cache_hit cache_hit
+
+cache_miss_on_change () {
+    echo 'int twice(int x) { return x + x; }' > twice.c
+    $cmp --cache-stats main.c twice.c -o changed | grep -q "this run: 1 hits, 1 misses"
+    local status=$?
+    write_sources
+    [ $status -eq 0 ] && exit_code_is 42 ./changed
+}
+check cache_miss_on_change cache_miss_on_change
+
+cache_stats_totals () {
+    $cmp --cache-stats | grep -q "all runs: 3 hits, 3 misses"
+}
+check cache_stats_totals cache_stats_totals
+
+# a size bound of 0 evicts every entry, including the ones this run links
+cache_eviction () {
+    $cmp --cache-size 0 main.c twice.c -o evicted &&
+        exit_code_is 42 ./evicted &&
+        [ -z "$(ls "$QXC_CACHE_DIR" | grep '\.o$')" ]
+}
+check cache_eviction cache_eviction
+
+no_cache () {
+    rm -rf "$QXC_CACHE_DIR"
+    $cmp --no-cache main.c twice.c -o uncached &&
+        exit_code_is 42 ./uncached &&
+        [ -z "$(ls "$QXC_CACHE_DIR" 2>/dev/null | grep '\.o$')" ]
+}
+check no_cache no_cache
+
+# ---------------------------------------------------------------------------------
+# multiple translation units, whose symbols only meet in the linker
+
+# no_executable NAME SOURCES..., passes if compiling fails without leaving NAME behind
+no_executable () {
+    local name=$1
+    shift
+    ! $cmp --no-cache "$@" -o "$name" && [ ! -e "$name" ]
+}
+
+echo 'int twice(int x) { return x; } int main() { return 1; }' > duplicate.c
+check duplicate_definition no_executable duplicate main.c twice.c duplicate.c
+
+echo 'int thrice(int x); int main() { return thrice(1); }' > undefined.c
+check undefined_function no_executable undefined undefined.c
+
+# ---------------------------------------------------------------------------------
+# -c and object inputs
+
+# -c writes main.o next to where it runs, which then links like a source would
+compile_then_link () {
+    mkdir -p objects && cd objects &&
+        $cmp --no-cache -c ../main.c &&
+        only_files . main.o &&
+        $cmp --no-cache main.o ../twice.c -o program &&
+        exit_code_is 42 ./program
+    local status=$?
+    cd .. && rm -rf objects
+    return $status
+}
+check compile_then_link compile_then_link
+
+# the second -c is a cache hit, and still has to hand out a complete object
+cached_object_output () {
+    rm -rf "$QXC_CACHE_DIR"
+    $cmp -c twice.c -o first.o &&
+        $cmp --cache-stats -c twice.c -o second.o | grep -q "this run: 1 hits" &&
+        cmp -s first.o second.o &&
+        $cmp main.c second.o -o from_cache &&
+        exit_code_is 42 ./from_cache
+}
+check cached_object_output cached_object_output
+
+# -o names one object, there'd be two
+check object_output_conflict no_executable both.o -c main.c twice.c
+
+# an int returned by code from another compiler may come with garbage in the upper half
+# of rax, which must not end up in the index of a jump table
+foreign_return_in_switch () {
+    echo 'long wide_index(void) { return 0x1234567800000002L; }' > wide.c
+    cat > switch.c <<'EOF'
+int wide_index();
+int main() {
+    switch (wide_index()) {
+        case 0: return 10;
+        case 1: return 11;
+        case 2: return 12;
+        case 3: return 13;
+    }
+    return 1;
+}
+EOF
+    gcc -c wide.c -o wide.o &&
+        $cmp --no-cache switch.c wide.o -o switch &&
+        exit_code_is 12 ./switch
+}
+check foreign_return_in_switch foreign_return_in_switch
+
+# an object for another machine, here aarch64 (e_machine at offset 18 set to 0xb7), is
+# turned down when it's read rather than by the linker
+wrong_machine_object () {
+    cp wide.o arm.o &&
+        printf '\xb7\x00' | dd of=arm.o bs=1 seek=18 conv=notrunc 2>/dev/null &&
+        ! $cmp --no-cache switch.c arm.o -o arm 2>arm.err &&
+        [ ! -e arm ] &&
+        grep -q "arm.o: not an x86-64 relocatable ELF object" arm.err
+}
+check wrong_machine_object wrong_machine_object
+
+# ---------------------------------------------------------------------------------
+# intermediate files
+
+# assembly and objects stay in memory unless asked for
+in_memory_temps () {
+    mkdir -p temps && cd temps &&
+        $cmp --no-cache ../main.c ../twice.c -o program &&
+        only_files . program &&
+        exit_code_is 42 ./program
+    local status=$?
+    cd .. && rm -rf temps
+    return $status
+}
+check in_memory_temps in_memory_temps
+
+# --save-temps writes them to the current directory, the _start stub included
+save_temps () {
+    mkdir -p temps && cd temps &&
+        $cmp --no-cache --save-temps ../main.c ../twice.c -o program &&
+        only_files . program main.asm main.o twice.asm twice.o _start.asm _start.o &&
+        grep -q "global twice" twice.asm &&
+        exit_code_is 42 ./program
+    local status=$?
+    cd .. && rm -rf temps
+    return $status
+}
+check save_temps save_temps
+
+# ---------------------------------------------------------------------------------
+# compile server
+
+# The server keeps a cache directory of its own, so --cache-stats shows whether a job
+# really ran there rather than in a client that fell back to compiling itself.
+QXC_CACHE_DIR=$workdir/server_cache $cmp --server "$workdir/qxc.sock" 2>server.log &
+server_pid=$!
+for _ in $(seq 50); do
+    [ -S "$workdir/qxc.sock" ] && break
+    sleep 0.1
+done
+
+# runs the compiler as a client of the server above
+served () {
+    QXC_SERVER=$workdir/qxc.sock $cmp "$@"
+}
+
+server_round_trip () {
+    served --cache-stats main.c twice.c -o served > served.out &&
+        grep -q "CACHE ($workdir/server_cache)" served.out &&
+        exit_code_is 42 ./served
+}
+check server_round_trip server_round_trip
+
+# a failed job reports its exit code and diagnostics to the client, like it would
+# compiling in process
+server_failure () {
+    echo 'int main() { return 1 }' > broken.c
+    $cmp --no-cache broken.c -o local 2>local.err
+    local local_code=$?
+    served --no-cache broken.c -o remote 2>remote.err
+    local remote_code=$?
+    [ $local_code -ne 0 ] && [ $remote_code -eq $local_code ] && [ ! -e remote ] &&
+        cmp -s local.err remote.err
+}
+check server_failure server_failure
+
+echo "$success successes, $fail failures"
+[ $fail -eq 0 ]